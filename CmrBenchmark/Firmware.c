@@ -0,0 +1,59 @@
+/**
+vim:	ts=4
+vim:	shiftwidth=4
+*/
+
+#include <stdint.h>
+#include "sysdefs.h"        // TRUE, FALSE
+#include "cmrpcktctrl.h"
+#include "Firmware.h"
+
+static CMR_RXPACKET rxpacket;
+static uint8_t      rxbuffer[256];
+
+/****************************************************************************/
+void
+firmware_decode_init(void)
+{
+    CMR_Init(&rxpacket, rxbuffer);
+}
+
+/****************************************************************************/
+unsigned int
+firmware_decode(
+    const uint8_t*      data,
+    const unsigned int  size,
+    unsigned long*      pings,
+    unsigned long*      payload
+    )
+{
+    unsigned int    npackets = 0;
+    unsigned int    i;
+    for (i=0; i<size; ++i) {
+        if (CMR_DecodePacket(&rxpacket, data[i]) == CMRDECODE_COMPLETE) {
+            if (rxpacket.Type == CMR_TYPE_PING) {
+                ++*pings;
+            } else {
+                *payload += rxpacket.Length;
+            }
+            ++npackets;
+        }
+    }
+    return npackets;
+}
+
+/****************************************************************************/
+unsigned int
+firmware_encode(
+    const uint8_t*      data_block,
+    const uint8_t       length,
+    const uint16_t      type,
+    uint8_t*            buffer
+    )
+{
+    uint8_t cmr_length = 0;
+    if (CMR_EncodePacket((uint8_t*)data_block, length, type, buffer, &cmr_length) == TRUE) {
+        return cmr_length;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+/**
+vim:	ts=4
+vim:	shiftwidth=4
+*/
+#ifndef Firmware_h_
+#define Firmware_h_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--------------------------------------------------------------------------*/
+/** ModemBox firmware CMR codec, ModemBox/SwitchFirmware/cmrpcktctrl.c.
+It can't share a translation unit with cmr.h, the type names clash.
+*/
+
+/** Reset the firmware decoder. */
+void
+firmware_decode_init(void);
+
+/** Feed a block to \c CMR_DecodePacket, one byte at a time.
+\param[out] pings Incremented for every ping.
+\param[out] payload Incremented by the data block length of every other decoded packet.
+\return Number of packets decoded.
+*/
+unsigned int
+firmware_decode(
+    const uint8_t*      data,
+    const unsigned int  size,
+    unsigned long*      pings,
+    unsigned long*      payload
+    );
+
+/** Encode a packet with \c CMR_EncodePacket.
+\param  buffer  Room for at least 255 bytes.
+\return Length of the packet, 0 on failure.
+*/
+unsigned int
+firmware_encode(
+    const uint8_t*      data_block,
+    const uint8_t       length,
+    const uint16_t      type,
+    uint8_t*            buffer
+    );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* Firmware_h_ */
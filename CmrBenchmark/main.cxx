@@ -0,0 +1,664 @@
+/**
+vim:	ts=4
+vim:	shiftwidth=4
+
+Throughput of the CMR codecs over typical DigNet traffic:
+- cmr_encode, cmr_encode_once, cmr_decode and cmr_decode_block in cmr/,
+- CMR_EncodePacket and CMR_DecodePacket of the ModemBox firmware,
+- utils::CMR::encode and utils::CMRDecoder used by GpsServer and GpsViewer.
+
+Every codec runs over every traffic mix for a fixed time. Reported are CMR stream
+bytes per second, frames per second and heap allocations per frame.
+
+Before timing, every codec is checked, a fast codec is of no use if it is wrong: encoders have to
+produce as many bytes as cmr_encode_once, and decoders have to give back exactly the frames and
+payload the stream was made of. Decoders lose different frames while resynchronizing after line
+noise, so from the corrupted stream they only must not decode more than was sent. Mismatches are
+reported and the exit status is 2.
+*/
+
+#include <string>
+#include <vector>
+#include <new>              // std::bad_alloc
+
+#include <stdio.h>          // printf, fprintf
+#include <stdlib.h>         // malloc, atoi
+#include <string.h>         // strcmp
+#include <time.h>           // clock_gettime
+
+#include <utils/CMR.h>
+
+#include "DigNetMessages.h" // PACKET_FORWARD, PACKET_SHIP_POSITION
+#include "cmr.h"
+#include "Firmware.h"
+
+/** Frame to be encoded. */
+typedef struct {
+    uint16_t                    type;
+    std::vector<unsigned char>  data;
+} FRAME;
+
+/** Traffic to run the codecs on. */
+typedef struct {
+    std::string                 name;
+    std::vector<FRAME>          frames;     ///< Frames for encoding
+    std::vector<unsigned char>  stream;     ///< Encoded \c frames, possibly damaged, for decoding
+} MIX;
+
+/** What a decoder got out of a stream. */
+typedef struct {
+    unsigned long   frames;         ///< Frames including pings
+    unsigned long   pings;
+    unsigned long   payload;        ///< Data block bytes of the other frames
+} DECODED;
+
+/** Result of a run. */
+typedef struct {
+    double          seconds;
+    unsigned long   bytes;          ///< Bytes of CMR stream encoded or decoded
+    unsigned long   frames;
+    unsigned long   allocations;
+} RESULT;
+
+/** Encode all frames, return number of bytes produced. */
+typedef unsigned long (*ENCODE_FUNCTION)(const std::vector<FRAME>& frames);
+
+/** Decode the stream in reads of \c read_size bytes, add the frames to \c decoded. */
+typedef void (*DECODE_FUNCTION)(const std::vector<unsigned char>& stream, const unsigned int read_size, DECODED& decoded);
+
+/// Heap allocations since start, counted by operator new.
+static unsigned long    allocations = 0;
+/// Consumes the codec output, so that the compiler can't skip the work.
+static volatile unsigned long   sink = 0;
+
+/****************************************************************************/
+void*
+operator new(
+    size_t  size)
+{
+    ++allocations;
+    void*   r = malloc(size > 0 ? size : 1);
+    if (r == 0) {
+        throw std::bad_alloc();
+    }
+    return r;
+}
+
+/****************************************************************************/
+void*
+operator new[](
+    size_t  size)
+{
+    return operator new(size);
+}
+
+/****************************************************************************/
+void
+operator delete(
+    void*   p) throw ()
+{
+    free(p);
+}
+
+/****************************************************************************/
+void
+operator delete[](
+    void*   p) throw ()
+{
+    free(p);
+}
+
+#if __cplusplus >= 201402L
+/****************************************************************************/
+void
+operator delete(
+    void*   p,
+    size_t  size) throw ()
+{
+    free(p);
+}
+
+/****************************************************************************/
+void
+operator delete[](
+    void*   p,
+    size_t  size) throw ()
+{
+    free(p);
+}
+#endif
+
+/****************************************************************************/
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/****************************************************************************/
+static void
+add_frame(
+    std::vector<FRAME>&     frames,
+    const uint16_t          type,
+    const void*             data,
+    const unsigned int      size)
+{
+    FRAME   frame;
+    frame.type = type;
+    frame.data.assign(reinterpret_cast<const unsigned char*>(data), reinterpret_cast<const unsigned char*>(data) + size);
+    frames.push_back(frame);
+}
+
+/****************************************************************************/
+static void
+add_ping(
+    std::vector<FRAME>&     frames)
+{
+    add_frame(frames, CMR_TYPE_PING, "", 0);
+}
+
+/****************************************************************************/
+static void
+add_rtcm(
+    std::vector<FRAME>&     frames)
+{
+    // RTCM is forwarded in chunks of 120 bytes.
+    unsigned char   chunk[120];
+    for (unsigned int i=0; i<sizeof(chunk); ++i) {
+        chunk[i] = rand();
+    }
+    add_frame(frames, utils::CMR::RTCM, chunk, sizeof(chunk));
+}
+
+/****************************************************************************/
+static void
+add_gga(
+    std::vector<FRAME>&     frames)
+{
+    char            line[100];
+    const int       second = rand() % 60;
+    snprintf(line, sizeof(line), "$GPGGA,1023%02d.00,5924.%04d,N,02445.%04d,E,4,08,0.9,12.3,M,18.0,M,1.0,0000*",
+        second, rand() % 10000, rand() % 10000);
+    unsigned char   checksum = 0;
+    for (const char* p=line+1; *p!='*'; ++p) {
+        checksum ^= *p;
+    }
+    const size_t    n = strlen(line);
+    snprintf(line + n, sizeof(line) - n, "%02X\r\n", checksum);
+    add_frame(frames, utils::CMR::SERIAL, line, strlen(line));
+}
+
+/****************************************************************************/
+static void
+add_position(
+    std::vector<FRAME>&     frames)
+{
+    // Ship position as forwarded by GpsServer to other ships.
+    unsigned char           buffer[sizeof(PACKET_FORWARD) - 1 + sizeof(PACKET_SHIP_POSITION)];
+    PACKET_FORWARD*         forward = reinterpret_cast<PACKET_FORWARD*>(buffer);
+    PACKET_SHIP_POSITION    position;
+    position.ship_number = 1 + rand() % 20;
+    position.has_barge = 0;
+    position.gps1_x = 6580000.0 + rand() % 1000;
+    position.gps1_y = 1540000.0 + rand() % 1000;
+    position.heading = rand() % 360;
+    position.flags = 0;
+    forward->ship_id = position.ship_number;
+    forward->original_type = CMRTYPE_SHIP_POSITION;
+    memcpy(forward->original_data_block, &position, sizeof(position));
+    add_frame(frames, PACKET_FORWARD::CMRTYPE, buffer, sizeof(buffer));
+}
+
+/****************************************************************************/
+static void
+encode_stream(
+    MIX&                    mix)
+{
+    mix.stream.clear();
+    for (unsigned int i=0; i<mix.frames.size(); ++i) {
+        const FRAME&    frame = mix.frames[i];
+        uint8_t         buffer[CMR_MAX_PACKET_LENGTH + 1];
+        uint8_t         length = 0;
+        cmr_encode_once(const_cast<uint8_t*>(frame.data.empty() ? buffer : &frame.data[0]), frame.data.size(), frame.type, buffer, &length);
+        mix.stream.insert(mix.stream.end(), buffer, buffer + length);
+    }
+}
+
+/****************************************************************************/
+static void
+damage_stream(
+    std::vector<unsigned char>& stream)
+{
+    // Every 1000 bytes on average: flip a byte, drop a byte or insert line noise.
+    std::vector<unsigned char>  r;
+    r.reserve(stream.size() + stream.size() / 100);
+    for (unsigned int i=0; i<stream.size(); ++i) {
+        switch (rand() % 3000) {
+            case 0:
+                r.push_back(stream[i] ^ (1 << (rand() % 8)));
+                break;
+            case 1:
+                break;
+            case 2:
+                for (int n=rand()%32; n>0; --n) {
+                    r.push_back(rand());
+                }
+                r.push_back(stream[i]);
+                break;
+            default:
+                r.push_back(stream[i]);
+                break;
+        }
+    }
+    stream.swap(r);
+}
+
+/****************************************************************************/
+static std::vector<MIX>
+make_mixes(
+    const unsigned int  nframes)
+{
+    std::vector<MIX>    mixes;
+    MIX                 mix;
+
+    mix.name = "ping";
+    mix.frames.clear();
+    for (unsigned int i=0; i<nframes; ++i) {
+        add_ping(mix.frames);
+    }
+    mixes.push_back(mix);
+
+    mix.name = "rtcm";
+    mix.frames.clear();
+    for (unsigned int i=0; i<nframes; ++i) {
+        add_rtcm(mix.frames);
+    }
+    mixes.push_back(mix);
+
+    mix.name = "gga";
+    mix.frames.clear();
+    for (unsigned int i=0; i<nframes; ++i) {
+        add_gga(mix.frames);
+    }
+    mixes.push_back(mix);
+
+    mix.name = "position";
+    mix.frames.clear();
+    for (unsigned int i=0; i<nframes; ++i) {
+        add_position(mix.frames);
+    }
+    mixes.push_back(mix);
+
+    // Server traffic: per second a GGA line from every ship, positions forwarded to
+    // every ship, a couple of RTCM chunks and pings.
+    mix.name = "mixed";
+    mix.frames.clear();
+    while (mix.frames.size() < nframes) {
+        add_rtcm(mix.frames);
+        add_rtcm(mix.frames);
+        for (unsigned int i=0; i<5; ++i) {
+            add_gga(mix.frames);
+            add_position(mix.frames);
+            add_position(mix.frames);
+        }
+        add_ping(mix.frames);
+    }
+    mixes.push_back(mix);
+
+    for (unsigned int i=0; i<mixes.size(); ++i) {
+        encode_stream(mixes[i]);
+    }
+
+    // Same as mixed, but with line noise to exercise resynchronization.
+    mix.name = "corrupted";
+    encode_stream(mix);
+    damage_stream(mix.stream);
+    mixes.push_back(mix);
+
+    return mixes;
+}
+
+/****************************************************************************/
+static unsigned long
+encode_cmr_encode(
+    const std::vector<FRAME>&   frames)
+{
+    unsigned long   bytes = 0;
+    for (unsigned int i=0; i<frames.size(); ++i) {
+        const FRAME&    frame = frames[i];
+        CMR_TXPACKET    packet;
+        cmr_txpacket_init(&packet, frame.type, frame.data.empty() ? 0 : &frame.data[0], frame.data.size());
+        for (;;) {
+            const int16_t   c = cmr_encode(&packet);
+            if (c < 0) {
+                break;
+            }
+            sink += c;
+            ++bytes;
+        }
+    }
+    return bytes;
+}
+
+/****************************************************************************/
+static unsigned long
+encode_cmr_encode_once(
+    const std::vector<FRAME>&   frames)
+{
+    unsigned long   bytes = 0;
+    uint8_t         buffer[CMR_MAX_PACKET_LENGTH + 1];
+    for (unsigned int i=0; i<frames.size(); ++i) {
+        const FRAME&    frame = frames[i];
+        uint8_t         length = 0;
+        cmr_encode_once(const_cast<uint8_t*>(frame.data.empty() ? buffer : &frame.data[0]), frame.data.size(), frame.type, buffer, &length);
+        sink += buffer[length - 1];
+        bytes += length;
+    }
+    return bytes;
+}
+
+/****************************************************************************/
+static unsigned long
+encode_firmware(
+    const std::vector<FRAME>&   frames)
+{
+    unsigned long   bytes = 0;
+    uint8_t         buffer[CMR_MAX_PACKET_LENGTH + 1];
+    for (unsigned int i=0; i<frames.size(); ++i) {
+        const FRAME&    frame = frames[i];
+        const unsigned int length = firmware_encode(frame.data.empty() ? buffer : &frame.data[0], frame.data.size(), frame.type, buffer);
+        sink += buffer[0];
+        bytes += length;
+    }
+    return bytes;
+}
+
+/****************************************************************************/
+static unsigned long
+encode_utils(
+    const std::vector<FRAME>&   frames)
+{
+    unsigned long   bytes = 0;
+    for (unsigned int i=0; i<frames.size(); ++i) {
+        const FRAME&    frame = frames[i];
+        // Fresh buffer for every frame, like GpsServer::send_packet.
+        std::vector<unsigned char>  buffer;
+        utils::CMR::encode(buffer, frame.type, frame.data.empty() ? 0 : &frame.data[0], frame.data.size());
+        bytes += buffer.size();
+    }
+    return bytes;
+}
+
+/****************************************************************************/
+static void
+count_frame(
+    DECODED&            decoded,
+    const uint16_t      type,
+    const unsigned int  length)
+{
+    ++decoded.frames;
+    // Decoders differ in the length of a ping, it carries no data anyway.
+    if (type == CMR_TYPE_PING) {
+        ++decoded.pings;
+    } else {
+        decoded.payload += length;
+    }
+}
+
+/****************************************************************************/
+static void
+decode_cmr_decode(
+    const std::vector<unsigned char>&   stream,
+    const unsigned int                  read_size,
+    DECODED&                            decoded)
+{
+    CMR_RXPACKET    rxpacket;
+    uint8_t         rxbuffer[CMR_MAX_PACKET_LENGTH + 1];
+    cmr_rxpacket_init(&rxpacket, rxbuffer);
+    for (unsigned int i=0; i<stream.size(); ++i) {
+        if (cmr_decode(&rxpacket, stream[i]) == CMRDECODE_COMPLETE) {
+            count_frame(decoded, rxpacket.Type, rxpacket.Length);
+        }
+    }
+}
+
+/****************************************************************************/
+static void
+count_packet(
+    void*               context,
+    const uint16_t      type,
+    const uint8_t*      data_block,
+    const uint8_t       length)
+{
+    count_frame(*reinterpret_cast<DECODED*>(context), type, length);
+}
+
+/****************************************************************************/
+static void
+decode_cmr_decode_block(
+    const std::vector<unsigned char>&   stream,
+    const unsigned int                  read_size,
+    DECODED&                            decoded)
+{
+    CMR_RXPACKET    rxpacket;
+    uint8_t         rxbuffer[CMR_MAX_PACKET_LENGTH + 1];
+    cmr_rxpacket_init(&rxpacket, rxbuffer);
+    for (unsigned int pos=0; pos<stream.size(); pos+=read_size) {
+        const unsigned int  size = stream.size() - pos < read_size ? stream.size() - pos : read_size;
+        cmr_decode_block(&rxpacket, &stream[pos], size, count_packet, &decoded);
+    }
+}
+
+/****************************************************************************/
+static void
+decode_firmware(
+    const std::vector<unsigned char>&   stream,
+    const unsigned int                  read_size,
+    DECODED&                            decoded)
+{
+    firmware_decode_init();
+    decoded.frames += firmware_decode(&stream[0], stream.size(), &decoded.pings, &decoded.payload);
+}
+
+/****************************************************************************/
+static void
+decode_utils(
+    const std::vector<unsigned char>&   stream,
+    const unsigned int                  read_size,
+    DECODED&                            decoded)
+{
+    utils::CMRDecoder   decoder;
+    utils::CMR          cmr;
+    for (unsigned int pos=0; pos<stream.size(); pos+=read_size) {
+        const unsigned int  size = stream.size() - pos < read_size ? stream.size() - pos : read_size;
+        // Every read is copied into a vector, like GpsViewer does.
+        std::vector<unsigned char>  data(&stream[pos], &stream[pos] + size);
+        decoder.feed(data);
+        while (decoder.pop(cmr)) {
+            count_frame(decoded, cmr.type, cmr.data.size());
+        }
+    }
+}
+
+/****************************************************************************/
+static RESULT
+run_encode(
+    ENCODE_FUNCTION     encode,
+    const MIX&          mix,
+    const double        seconds)
+{
+    RESULT  r = { 0 };
+    const unsigned long allocations_start = allocations;
+    const double        start = now();
+    do {
+        r.bytes += encode(mix.frames);
+        r.frames += mix.frames.size();
+        r.seconds = now() - start;
+    } while (r.seconds < seconds);
+    r.allocations = allocations - allocations_start;
+    return r;
+}
+
+/****************************************************************************/
+static RESULT
+run_decode(
+    DECODE_FUNCTION     decode,
+    const MIX&          mix,
+    const unsigned int  read_size,
+    const double        seconds)
+{
+    RESULT  r = { 0 };
+    const unsigned long allocations_start = allocations;
+    const double        start = now();
+    DECODED             decoded = { 0 };
+    do {
+        decode(mix.stream, read_size, decoded);
+        r.bytes += mix.stream.size();
+        r.seconds = now() - start;
+    } while (r.seconds < seconds);
+    r.frames = decoded.frames;
+    r.allocations = allocations - allocations_start;
+    sink += decoded.payload;
+    return r;
+}
+
+/****************************************************************************/
+/** Encodes the frames once, returns false and complains if the stream isn't \c expected_bytes long. */
+static bool
+check_encode(
+    const char*         codec,
+    ENCODE_FUNCTION     encode,
+    const MIX&          mix,
+    const unsigned long expected_bytes)
+{
+    const unsigned long bytes = encode(mix.frames);
+    if (bytes != expected_bytes) {
+        fprintf(stderr, "%s %s: encoded %lu bytes instead of %lu\n", codec, mix.name.c_str(), bytes, expected_bytes);
+        return false;
+    }
+    return true;
+}
+
+/****************************************************************************/
+/** Decodes the stream once, returns false and complains unless the decoder gets the frames \c sent.
+    From a \c damaged stream it may get fewer, pings are not counted as line noise has zeros too.
+*/
+static bool
+check_decode(
+    const char*         codec,
+    DECODE_FUNCTION     decode,
+    const MIX&          mix,
+    const unsigned int  read_size,
+    const DECODED&      sent,
+    const bool          damaged)
+{
+    DECODED     decoded = { 0 };
+    decode(mix.stream, read_size, decoded);
+    const bool  ok = damaged
+        ? decoded.frames - decoded.pings <= sent.frames - sent.pings && decoded.payload <= sent.payload
+        : decoded.frames == sent.frames && decoded.pings == sent.pings && decoded.payload == sent.payload;
+    if (!ok) {
+        fprintf(stderr, "%s %s: decoded %lu frames, %lu pings, %lu payload bytes; sent %lu frames, %lu pings, %lu payload bytes\n",
+            codec, mix.name.c_str(), decoded.frames, decoded.pings, decoded.payload, sent.frames, sent.pings, sent.payload);
+    }
+    return ok;
+}
+
+/****************************************************************************/
+static void
+print_result(
+    const char*         codec,
+    const MIX&          mix,
+    const RESULT&       r)
+{
+    printf("%-18s %-10s %10.2f %12.0f %10.3f\n",
+        codec, mix.name.c_str(),
+        r.bytes / r.seconds / 1e6,
+        r.frames / r.seconds,
+        r.frames > 0 ? double(r.allocations) / r.frames : 0.0);
+}
+
+/****************************************************************************/
+static int
+print_usage()
+{
+    printf("Usage:\n");
+    printf("\tCmrBenchmark [-t seconds] [-r read-size] [-n frames] [mix ...]\n");
+    printf("where:\n");
+    printf("\t-t seconds\tTime to run every codec on every mix, default 1.\n");
+    printf("\t-r read-size\tBytes per read when decoding, default 1460.\n");
+    printf("\t-n frames\tFrames per mix, default 10000.\n");
+    printf("\tmix\t\tping, rtcm, gga, position, mixed or corrupted; all by default.\n");
+    return 1;
+}
+
+/****************************************************************************/
+int
+main(
+    int     argc,
+    char**  argv)
+{
+    double                      seconds = 1.0;
+    unsigned int                read_size = 1460;
+    unsigned int                nframes = 10000;
+    std::vector<std::string>    selected;
+
+    for (int i=1; i<argc; ++i) {
+        if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i+1 < argc) {
+            read_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i+1 < argc) {
+            nframes = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            return print_usage();
+        } else {
+            selected.push_back(argv[i]);
+        }
+    }
+    if (read_size == 0 || nframes == 0) {
+        return print_usage();
+    }
+
+    srand(1);
+    const std::vector<MIX>  mixes = make_mixes(nframes);
+
+    bool    ok = true;
+    printf("%-18s %-10s %10s %12s %10s\n", "codec", "mix", "MB/s", "frames/s", "allocs");
+    for (unsigned int i=0; i<mixes.size(); ++i) {
+        const MIX&  mix = mixes[i];
+        bool        run = selected.empty();
+        for (unsigned int j=0; j<selected.size(); ++j) {
+            run = run || selected[j] == mix.name;
+        }
+        if (!run) {
+            continue;
+        }
+
+        DECODED     sent = { 0 };
+        for (unsigned int j=0; j<mix.frames.size(); ++j) {
+            count_frame(sent, mix.frames[j].type, mix.frames[j].data.size());
+        }
+        const unsigned long encoded_bytes = encode_cmr_encode_once(mix.frames);
+        const bool          damaged = mix.name == "corrupted";
+        ok = check_encode("cmr_encode", encode_cmr_encode, mix, encoded_bytes) && ok;
+        ok = check_encode("CMR_EncodePacket", encode_firmware, mix, encoded_bytes) && ok;
+        ok = check_encode("CMR::encode", encode_utils, mix, encoded_bytes) && ok;
+        ok = check_decode("cmr_decode", decode_cmr_decode, mix, read_size, sent, damaged) && ok;
+        ok = check_decode("cmr_decode_block", decode_cmr_decode_block, mix, read_size, sent, damaged) && ok;
+        ok = check_decode("CMR_DecodePacket", decode_firmware, mix, read_size, sent, damaged) && ok;
+        ok = check_decode("CMRDecoder", decode_utils, mix, read_size, sent, damaged) && ok;
+
+        print_result("cmr_encode", mix, run_encode(encode_cmr_encode, mix, seconds));
+        print_result("cmr_encode_once", mix, run_encode(encode_cmr_encode_once, mix, seconds));
+        print_result("CMR_EncodePacket", mix, run_encode(encode_firmware, mix, seconds));
+        print_result("CMR::encode", mix, run_encode(encode_utils, mix, seconds));
+        print_result("cmr_decode", mix, run_decode(decode_cmr_decode, mix, read_size, seconds));
+        print_result("cmr_decode_block", mix, run_decode(decode_cmr_decode_block, mix, read_size, seconds));
+        print_result("CMR_DecodePacket", mix, run_decode(decode_firmware, mix, read_size, seconds));
+        print_result("CMRDecoder", mix, run_decode(decode_utils, mix, read_size, seconds));
+    }
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,88 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdexcept>
+
+#include <string.h>         // memcmp, memcpy
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <utils/util.h>     // ssprintf
+
+#include "CaptureReader.h"
+
+using namespace std;
+using namespace utils;
+
+/// Records are padded to this many bytes, see PacketCapture.cxx.
+static const unsigned int CAPTURE_ALIGN = 4;
+
+/*****************************************************************************/
+CaptureReader::CaptureReader(
+    const std::string&  path) :
+        path_(path),
+        fd_(-1),
+        data_(0),
+        size_(0),
+        end_(0),
+        offset_(0)
+{
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        throw runtime_error(ssprintf("Can't open capture file %s, errno %d", path.c_str(), errno));
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(CAPTURE_FILE_HEADER))) {
+        close(fd_);
+        throw runtime_error(ssprintf("%s is not a capture file", path.c_str()));
+    }
+    size_ = st.st_size;
+    void* data = mmap(0, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) {
+        close(fd_);
+        throw runtime_error(ssprintf("Can't map capture file %s, errno %d", path.c_str(), errno));
+    }
+    data_ = reinterpret_cast<const unsigned char*>(data);
+
+    CAPTURE_FILE_HEADER header;
+    memcpy(&header, data_, sizeof(header));
+    if (memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 || header.version != CAPTURE_VERSION
+        || header.header_size < sizeof(CAPTURE_FILE_HEADER) || header.header_size > size_) {
+        munmap(const_cast<unsigned char*>(data_), size_);
+        close(fd_);
+        throw runtime_error(ssprintf("%s is not a capture file of version %d", path.c_str(), CAPTURE_VERSION));
+    }
+    offset_ = header.header_size;
+    end_ = header.used < size_ ? header.used : size_;
+}
+
+/*****************************************************************************/
+CaptureReader::~CaptureReader()
+{
+    munmap(const_cast<unsigned char*>(data_), size_);
+    close(fd_);
+}
+
+/*****************************************************************************/
+bool
+CaptureReader::next(
+    CAPTURE_RECORD&         record,
+    const unsigned char*&   data)
+{
+    if (offset_ + sizeof(CAPTURE_RECORD) > end_) {
+        return false;
+    }
+    memcpy(&record, data_ + offset_, sizeof(record));
+    const unsigned int  start = offset_ + sizeof(CAPTURE_RECORD);
+    // Truncated record, the server died while writing it.
+    if (record.size > end_ - start) {
+        offset_ = end_;
+        return false;
+    }
+    data = data_ + start;
+    offset_ = start + ((record.size + CAPTURE_ALIGN - 1) & ~(CAPTURE_ALIGN - 1));
+    return true;
+}
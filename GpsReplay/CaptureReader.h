@@ -0,0 +1,41 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef CaptureReader_h_
+#define CaptureReader_h_
+
+#include <string>
+
+#include "PacketCapture.h"  // CAPTURE_FILE_HEADER, CAPTURE_RECORD
+
+/**
+Reads the records of a capture file written by \c PacketCapture.
+
+The file is mapped read-only; a file of a crashed or still running server is read up to
+the last complete record.
+*/
+class CaptureReader {
+    private:
+        std::string             path_;
+        int                     fd_;
+        const unsigned char*    data_;      ///< Mapping of the whole file
+        unsigned int            size_;      ///< Size of mapping
+        unsigned int            end_;       ///< Records end here
+        unsigned int            offset_;    ///< Next record starts here
+    public:
+        /** Opens and maps the file. Throws \c std::runtime_error on errors. */
+        CaptureReader(
+            const std::string&      path);
+
+        ~CaptureReader();
+
+        /** Returns the next record and its data, or false at the end of the file. */
+        bool
+        next(
+            CAPTURE_RECORD&         record,
+            const unsigned char*&   data);
+
+        const std::string&
+        path() const { return path_; }
+}; // class CaptureReader
+
+#endif /* CaptureReader_h_ */
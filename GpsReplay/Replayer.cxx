@@ -0,0 +1,565 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <algorithm>        // std::sort
+#include <set>
+#include <stdexcept>
+
+#include <stdio.h>          // printf
+#include <string.h>         // memset
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>          // gethostbyname
+#include <sys/time.h>       // gettimeofday
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <utils/util.h>     // ssprintf
+
+#include "Replayer.h"
+
+using namespace utils;
+
+/// Give up connecting after this many seconds.
+static const int            CONNECT_TIMEOUT = 10;
+/// Records sent in one step, so that the sockets get their turn.
+static const unsigned int   STEP_RECORDS = 1000;
+/// At speed 0, wait for the server while this many bytes are not sent.
+static const unsigned int   MAX_PENDING = 4 * 1024 * 1024;
+/// At speed 0, waiting time when the server is behind, seconds.
+static const double         BACKOFF = 0.01;
+/// After the last record, wait this long for the data to be sent, seconds.
+static const double         LINGER = 5.0;
+
+/*****************************************************************************/
+static double
+time_of_record(
+    const CAPTURE_RECORD&   record)
+{
+    return record.sec + record.usec * 1e-6;
+}
+
+/*****************************************************************************/
+static void
+set_timer(
+    struct event*       ev,
+    const double        seconds)
+{
+    struct timeval  tv;
+    tv.tv_sec = static_cast<long>(seconds);
+    tv.tv_usec = static_cast<long>((seconds - tv.tv_sec) * 1e6);
+    evtimer_add(ev, &tv);
+}
+
+/*****************************************************************************/
+ReplaySession::ReplaySession(
+    Replayer*           replayer) :
+        replayer_(replayer),
+        fd_(-1),
+        bev_(0),
+        connect_time_(0),
+        closing_(false),
+        closed_(false)
+{
+}
+
+/*****************************************************************************/
+ReplaySession::~ReplaySession()
+{
+    close();
+}
+
+/*****************************************************************************/
+void
+ReplaySession::connect(
+    const double        now)
+{
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0) {
+        ++replayer_->interval_.failed;
+        ++replayer_->total_.failed;
+        closed_ = true;
+        return;
+    }
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+    // Set before connecting, close() deletes it.
+    event_set(&connect_event_, fd_, EV_WRITE, connect_handler, this);
+    event_base_set(replayer_->base_, &connect_event_);
+    const struct sockaddr_in&   address = replayer_->address_;
+    if (::connect(fd_, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0 && errno != EINPROGRESS) {
+        ++replayer_->interval_.failed;
+        ++replayer_->total_.failed;
+        close();
+        return;
+    }
+    connect_time_ = now;
+    struct timeval  timeout;
+    timeout.tv_sec = CONNECT_TIMEOUT;
+    timeout.tv_usec = 0;
+    event_add(&connect_event_, &timeout);
+}
+
+/*****************************************************************************/
+void
+ReplaySession::send(
+    const unsigned char*    data,
+    const unsigned int      size)
+{
+    if (closed_) {
+        replayer_->interval_.bytes_dropped += size;
+        replayer_->total_.bytes_dropped += size;
+    } else if (bev_ != 0) {
+        bufferevent_write(bev_, const_cast<unsigned char*>(data), size);
+        replayer_->interval_.bytes_sent += size;
+        replayer_->total_.bytes_sent += size;
+    } else {
+        pending_.append(reinterpret_cast<const char*>(data), size);
+    }
+}
+
+/*****************************************************************************/
+void
+ReplaySession::finish()
+{
+    closing_ = true;
+    if (bev_ != 0 && output_size() == 0) {
+        close();
+    }
+}
+
+/*****************************************************************************/
+void
+ReplaySession::close()
+{
+    if (fd_ >= 0) {
+        if (bev_ != 0) {
+            bufferevent_free(bev_);
+            bev_ = 0;
+        } else {
+            event_del(&connect_event_);
+        }
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (!pending_.empty()) {
+        replayer_->interval_.bytes_dropped += pending_.size();
+        replayer_->total_.bytes_dropped += pending_.size();
+        pending_.clear();
+    }
+    closed_ = true;
+}
+
+/*****************************************************************************/
+unsigned int
+ReplaySession::output_size() const
+{
+    return bev_ != 0 ? EVBUFFER_LENGTH(EVBUFFER_OUTPUT(bev_)) : pending_.size();
+}
+
+/*****************************************************************************/
+void
+ReplaySession::connect_handler(
+    int                 fd,
+    short               event,
+    void*               _self)
+{
+    ReplaySession*  self = reinterpret_cast<ReplaySession*>(_self);
+    Replayer*       replayer = self->replayer_;
+    int             error = 0;
+    socklen_t       len = sizeof(error);
+    if ((event & EV_TIMEOUT) != 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+        ++replayer->interval_.failed;
+        ++replayer->total_.failed;
+        self->close();
+        return;
+    }
+    const double    latency = (Replayer::now() - self->connect_time_) * 1000.0;
+    replayer->connect_latency_.push_back(latency);
+    ++replayer->interval_.connects;
+    ++replayer->total_.connects;
+
+    self->bev_ = bufferevent_new(fd, read_handler, write_handler, error_handler, self);
+    bufferevent_base_set(replayer->base_, self->bev_);
+    bufferevent_enable(self->bev_, EV_READ | EV_WRITE);
+    if (!self->pending_.empty()) {
+        std::string pending;
+        pending.swap(self->pending_);
+        self->send(reinterpret_cast<const unsigned char*>(pending.data()), pending.size());
+    } else if (self->closing_) {
+        self->close();
+    }
+}
+
+/*****************************************************************************/
+void
+ReplaySession::read_handler(
+    struct bufferevent* event,
+    void*               _self)
+{
+    ReplaySession*      self = reinterpret_cast<ReplaySession*>(_self);
+    struct evbuffer*    input = EVBUFFER_INPUT(event);
+    const unsigned int  size = EVBUFFER_LENGTH(input);
+    evbuffer_drain(input, size);
+    self->replayer_->interval_.bytes_received += size;
+    self->replayer_->total_.bytes_received += size;
+}
+
+/*****************************************************************************/
+void
+ReplaySession::write_handler(
+    struct bufferevent* event,
+    void*               _self)
+{
+    ReplaySession*  self = reinterpret_cast<ReplaySession*>(_self);
+    // Everything sent.
+    if (self->closing_) {
+        self->close();
+    }
+}
+
+/*****************************************************************************/
+void
+ReplaySession::error_handler(
+    struct bufferevent* event,
+    short               what,
+    void*               _self)
+{
+    ReplaySession*  self = reinterpret_cast<ReplaySession*>(_self);
+    if (!self->closing_) {
+        // Server closed the connection, the recorded client wasn't.
+        ++self->replayer_->interval_.lost;
+        ++self->replayer_->total_.lost;
+    }
+    const unsigned int  unsent = self->output_size();
+    self->replayer_->interval_.bytes_dropped += unsent;
+    self->replayer_->total_.bytes_dropped += unsent;
+    self->close();
+}
+
+/*****************************************************************************/
+Replayer::Replayer(
+    const REPLAY_CONFIG&    config) :
+        config_(config),
+        base_(reinterpret_cast<struct event_base*>(event_init())),  // bufferevent_new needs the current base.
+        reader_(0),
+        have_record_(false),
+        record_data_(0),
+        capture_start_(0),
+        capture_time_(0),
+        start_(0),
+        last_report_(0),
+        end_time_(0)
+{
+    memset(&address_, 0, sizeof(address_));
+    address_.sin_family = AF_INET;
+    address_.sin_port = htons(config.port);
+    if (inet_aton(config.host.c_str(), &address_.sin_addr) == 0) {
+        struct hostent* host = gethostbyname(config.host.c_str());
+        if (host == 0 || host->h_addrtype != AF_INET) {
+            throw std::runtime_error(ssprintf("Can't resolve host %s", config.host.c_str()));
+        }
+        memcpy(&address_.sin_addr, host->h_addr_list[0], sizeof(address_.sin_addr));
+    }
+    memset(&interval_, 0, sizeof(interval_));
+    memset(&total_, 0, sizeof(total_));
+
+    try {
+        for (unsigned int i=0; i<config.files.size(); ++i) {
+            readers_.push_back(new CaptureReader(config.files[i]));
+        }
+    } catch (...) {
+        for (unsigned int i=0; i<readers_.size(); ++i) {
+            delete readers_[i];
+        }
+        throw;
+    }
+    have_record_ = next_record();
+    if (!have_record_) {
+        for (unsigned int i=0; i<readers_.size(); ++i) {
+            delete readers_[i];
+        }
+        throw std::runtime_error("Nothing to replay, the capture files are empty");
+    }
+    capture_start_ = capture_time_ = time_of_record(record_);
+}
+
+/*****************************************************************************/
+Replayer::~Replayer()
+{
+    for (unsigned int i=0; i<sessions_.size(); ++i) {
+        delete sessions_[i];
+    }
+    for (unsigned int i=0; i<readers_.size(); ++i) {
+        delete readers_[i];
+    }
+    event_base_free(base_);
+}
+
+/*****************************************************************************/
+double
+Replayer::now()
+{
+    struct timeval  tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/*****************************************************************************/
+bool
+Replayer::next_record()
+{
+    for (; reader_ < readers_.size(); ++reader_) {
+        if (readers_[reader_]->next(record_, record_data_)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*****************************************************************************/
+ReplaySession*
+Replayer::open_session(
+    const int           client,
+    const double        now)
+{
+    ReplaySession*  session = new ReplaySession(this);
+    sessions_.push_back(session);
+    active_[client] = session;
+    session->connect(now);
+    return session;
+}
+
+/*****************************************************************************/
+void
+Replayer::dispatch(
+    const CAPTURE_RECORD&   record,
+    const unsigned char*    data,
+    const double            now)
+{
+    std::map<int, ReplaySession*>::iterator it = active_.find(record.client);
+    switch (record.kind) {
+    case CAPTURE_CONNECT:
+        // Close record was dropped, the socket is reused by the new client.
+        if (it != active_.end()) {
+            it->second->finish();
+        }
+        open_session(record.client, now);
+        break;
+    case CAPTURE_DATA:
+        // Client connected before the capture started.
+        if (it == active_.end()) {
+            open_session(record.client, now)->send(data, record.size);
+        } else {
+            it->second->send(data, record.size);
+        }
+        break;
+    case CAPTURE_CLOSE:
+        if (it != active_.end()) {
+            it->second->finish();
+            active_.erase(it);
+        }
+        break;
+    }
+}
+
+/*****************************************************************************/
+double
+Replayer::step()
+{
+    const double    now = Replayer::now();
+
+    if (end_time_ != 0) {
+        sweep();
+        if (sessions_.empty() || now >= end_time_ + LINGER) {
+            event_base_loopbreak(base_);
+            return -1;
+        }
+        return 0.1;
+    }
+
+    if (config_.speed <= 0) {
+        unsigned int    pending = 0;
+        for (std::map<int, ReplaySession*>::const_iterator it=active_.begin(); it!=active_.end(); ++it) {
+            pending += it->second->output_size();
+        }
+        if (pending > MAX_PENDING) {
+            return BACKOFF;
+        }
+    }
+
+    for (unsigned int n=0; n<STEP_RECORDS; ++n) {
+        if (!have_record_) {
+            have_record_ = next_record();
+            if (!have_record_) {
+                // Clients still connected at the end of the capture.
+                for (std::map<int, ReplaySession*>::iterator it=active_.begin(); it!=active_.end(); ++it) {
+                    it->second->finish();
+                }
+                active_.clear();
+                end_time_ = now;
+                return 0;
+            }
+        }
+        const double    t = time_of_record(record_);
+        if (config_.speed > 0) {
+            const double    due = start_ + (t - capture_start_) / config_.speed;
+            if (due > now) {
+                return due - now;
+            }
+            const double    lag = now - due;
+            interval_.lag_sum += lag;
+            total_.lag_sum += lag;
+            if (lag > interval_.lag_max) {
+                interval_.lag_max = lag;
+            }
+            if (lag > total_.lag_max) {
+                total_.lag_max = lag;
+            }
+        }
+        dispatch(record_, record_data_, now);
+        ++interval_.records;
+        ++total_.records;
+        capture_time_ = t;
+        have_record_ = false;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+void
+Replayer::sweep()
+{
+    // Session closed by a failed connect or by the server stays in active_ until the close
+    // record of its client, records up to that are dropped by it.
+    std::set<ReplaySession*>    active;
+    for (std::map<int, ReplaySession*>::const_iterator it=active_.begin(); it!=active_.end(); ++it) {
+        active.insert(it->second);
+    }
+    unsigned int    j = 0;
+    for (unsigned int i=0; i<sessions_.size(); ++i) {
+        if (sessions_[i]->is_closed() && active.find(sessions_[i]) == active.end()) {
+            delete sessions_[i];
+        } else {
+            sessions_[j++] = sessions_[i];
+        }
+    }
+    sessions_.resize(j);
+}
+
+/*****************************************************************************/
+static void
+percentiles(
+    std::vector<double>&    samples,
+    char*                   buf,
+    const unsigned int      size)
+{
+    if (samples.empty()) {
+        snprintf(buf, size, "%7s %7s %7s %7s", "-", "-", "-", "-");
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    const unsigned int  n = samples.size();
+    snprintf(buf, size, "%7.1f %7.1f %7.1f %7.1f",
+        samples[n * 50 / 100], samples[n * 90 / 100], samples[n * 99 / 100], samples[n - 1]);
+}
+
+/*****************************************************************************/
+void
+Replayer::report(
+    const double            now,
+    const double            seconds,
+    const REPLAY_COUNTERS&  counters,
+    std::vector<double>&    connect_latency)
+{
+    unsigned int    connected = 0;
+    for (unsigned int i=0; i<sessions_.size(); ++i) {
+        if (sessions_[i]->is_connected()) {
+            ++connected;
+        }
+    }
+    char            lag[32];
+    if (config_.speed > 0 && counters.records > 0) {
+        snprintf(lag, sizeof(lag), "%7.1f %7.1f", counters.lag_sum / counters.records * 1000.0, counters.lag_max * 1000.0);
+    } else {
+        snprintf(lag, sizeof(lag), "%7s %7s", "-", "-");
+    }
+    char            connect[64];
+    percentiles(connect_latency, connect, sizeof(connect));
+    printf("%6.0f %8.0f %5u %5lu %5lu %5lu %8.0f %9.0f %9.0f | %s | %s\n",
+        now - start_, capture_time_ - capture_start_, connected,
+        counters.connects, counters.failed, counters.lost,
+        counters.records / seconds, counters.bytes_sent / seconds, counters.bytes_received / seconds,
+        lag, connect);
+    fflush(stdout);
+}
+
+/*****************************************************************************/
+void
+Replayer::step_handler(
+    int                 fd,
+    short               event,
+    void*               _self)
+{
+    Replayer*       self = reinterpret_cast<Replayer*>(_self);
+    const double    wait = self->step();
+    if (wait >= 0) {
+        set_timer(&self->step_event_, wait);
+    }
+}
+
+/*****************************************************************************/
+void
+Replayer::report_handler(
+    int                 fd,
+    short               event,
+    void*               _self)
+{
+    Replayer*       self = reinterpret_cast<Replayer*>(_self);
+    const double    now = Replayer::now();
+    self->sweep();
+    self->report(now, now - self->last_report_, self->interval_, self->connect_latency_);
+    self->total_connect_latency_.insert(self->total_connect_latency_.end(),
+        self->connect_latency_.begin(), self->connect_latency_.end());
+    self->connect_latency_.clear();
+    memset(&self->interval_, 0, sizeof(self->interval_));
+    self->last_report_ = now;
+    set_timer(&self->report_event_, self->config_.report_interval);
+}
+
+/*****************************************************************************/
+void
+Replayer::run()
+{
+    start_ = last_report_ = now();
+    if (config_.speed > 0) {
+        printf("Replaying %d files at %gx into %s:%d\n",
+            static_cast<int>(readers_.size()), config_.speed, config_.host.c_str(), config_.port);
+    } else {
+        printf("Replaying %d files as fast as possible into %s:%d\n",
+            static_cast<int>(readers_.size()), config_.host.c_str(), config_.port);
+    }
+    printf("%6s %8s %5s %5s %5s %5s %8s %9s %9s | %-15s | %-31s\n",
+        "time", "capture", "conn", "new", "fail", "lost", "rec/s", "out B/s", "in B/s",
+        "lag ms avg max", "connect ms p50 p90 p99 max");
+
+    evtimer_set(&step_event_, step_handler, this);
+    event_base_set(base_, &step_event_);
+    set_timer(&step_event_, 0);
+    evtimer_set(&report_event_, report_handler, this);
+    event_base_set(base_, &report_event_);
+    set_timer(&report_event_, config_.report_interval);
+    event_base_dispatch(base_);
+    evtimer_del(&step_event_);
+    evtimer_del(&report_event_);
+
+    const double    end = now();
+    total_connect_latency_.insert(total_connect_latency_.end(), connect_latency_.begin(), connect_latency_.end());
+    printf("Total:\n");
+    report(end, end - start_, total_, total_connect_latency_);
+    const double    captured = capture_time_ - capture_start_;
+    const double    elapsed = (end_time_ != 0 ? end_time_ : end) - start_;
+    printf("%lu records, %.1f s of capture replayed in %.1f s (%.1fx), %lu bytes sent, %lu bytes dropped\n",
+        total_.records, captured, elapsed, elapsed > 0 ? captured / elapsed : 0.0,
+        total_.bytes_sent, total_.bytes_dropped);
+}
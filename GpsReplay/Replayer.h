@@ -0,0 +1,202 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef Replayer_h_
+#define Replayer_h_
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <netinet/in.h>     // sockaddr_in
+#include <event.h>
+
+#include "CaptureReader.h"
+
+/** Settings of the replay. */
+typedef struct {
+    std::string                 host;               ///< GpsServer address
+    int                         port;               ///< GpsServer ListeningPort
+    double                      speed;              ///< 1 for real time, 0 for as fast as possible
+    std::vector<std::string>    files;              ///< Capture files, oldest first
+    unsigned int                report_interval;    ///< Seconds between reports
+} REPLAY_CONFIG;
+
+/** Traffic counters. */
+typedef struct {
+    unsigned long   records;            ///< Capture records replayed
+    unsigned long   connects;
+    unsigned long   failed;             ///< Connections that couldn't be made
+    unsigned long   lost;               ///< Connections closed by the server
+    unsigned long   bytes_sent;
+    unsigned long   bytes_received;
+    unsigned long   bytes_dropped;      ///< Data of connections that failed or were lost
+    double          lag_sum;            ///< Sum of the delays of the records behind schedule, seconds
+    double          lag_max;
+} REPLAY_COUNTERS;
+
+class Replayer;
+
+/**
+One recorded client connection, replayed as a connection to GpsServer.
+
+Data is sent as it was received by the server; what the server sends back is counted and
+discarded.
+*/
+class ReplaySession {
+    private:
+        Replayer*               replayer_;
+        int                     fd_;                ///< -1 if not connected
+        struct event            connect_event_;
+        struct bufferevent*     bev_;               ///< 0 until connected
+        std::string             pending_;           ///< Data to send once connected
+        double                  connect_time_;
+        bool                    closing_;           ///< Close once the data is sent
+        bool                    closed_;
+
+        static void
+        connect_handler(
+            int                     fd,
+            short                   event,
+            void*                   _self);
+
+        static void
+        read_handler(
+            struct bufferevent*     event,
+            void*                   _self);
+
+        static void
+        write_handler(
+            struct bufferevent*     event,
+            void*                   _self);
+
+        static void
+        error_handler(
+            struct bufferevent*     event,
+            short                   what,
+            void*                   _self);
+    public:
+        ReplaySession(
+            Replayer*               replayer);
+
+        ~ReplaySession();
+
+        /** Starts connecting. */
+        void
+        connect(
+            const double            now);
+
+        /** Sends data, queued until connected. */
+        void
+        send(
+            const unsigned char*    data,
+            const unsigned int      size);
+
+        /** Closes the connection once the data is sent. */
+        void
+        finish();
+
+        /** Closes the connection now. */
+        void
+        close();
+
+        /** Bytes not yet sent. */
+        unsigned int
+        output_size() const;
+
+        bool
+        is_connected() const { return bev_ != 0; }
+
+        bool
+        is_closed() const { return closed_; }
+}; // class ReplaySession
+
+/**
+Replays capture files of \c PacketCapture into GpsServer.
+
+Every recorded client connection is made again and its data sent at the recorded times,
+scaled by \c speed. At speed 0 the records are sent as fast as the server takes them.
+*/
+class Replayer {
+    private:
+        friend class ReplaySession;
+
+        REPLAY_CONFIG                   config_;
+        struct sockaddr_in              address_;
+        struct event_base*              base_;
+        struct event                    step_event_;
+        struct event                    report_event_;
+        std::vector<CaptureReader*>     readers_;
+        unsigned int                    reader_;            ///< Index of the reader in use
+        bool                            have_record_;       ///< \c record_ is waiting for its time
+        CAPTURE_RECORD                  record_;
+        const unsigned char*            record_data_;
+        double                          capture_start_;     ///< Time of the first record
+        double                          capture_time_;      ///< Time of the last replayed record
+        double                          start_;
+        double                          last_report_;
+        double                          end_time_;          ///< All records sent, 0 before
+        std::map<int, ReplaySession*>   active_;            ///< By the client socket of the capture
+        std::vector<ReplaySession*>     sessions_;          ///< All sessions not yet deleted
+        REPLAY_COUNTERS                 interval_;          ///< Since last report
+        REPLAY_COUNTERS                 total_;
+        std::vector<double>             connect_latency_;   ///< Since last report, milliseconds
+        std::vector<double>             total_connect_latency_;
+
+        /** Returns the next record of the capture files, false at the end of the last one. */
+        bool
+        next_record();
+
+        void
+        dispatch(
+            const CAPTURE_RECORD&   record,
+            const unsigned char*    data,
+            const double            now);
+
+        ReplaySession*
+        open_session(
+            const int               client,
+            const double            now);
+
+        /** Sends the records that are due, returns seconds until the next step. */
+        double
+        step();
+
+        /** Deletes the closed sessions that are not in \c active_. */
+        void
+        sweep();
+
+        void
+        report(
+            const double            now,
+            const double            seconds,
+            const REPLAY_COUNTERS&  counters,
+            std::vector<double>&    connect_latency);
+
+        static void
+        step_handler(
+            int                     fd,
+            short                   event,
+            void*                   _self);
+
+        static void
+        report_handler(
+            int                     fd,
+            short                   event,
+            void*                   _self);
+    public:
+        /** Opens the capture files. Throws \c std::runtime_error on errors. */
+        Replayer(
+            const REPLAY_CONFIG&    config);
+
+        ~Replayer();
+
+        /** Replays all the files, then prints the summary. */
+        void
+        run();
+
+        /** Current time, seconds. */
+        static double
+        now();
+}; // class Replayer
+
+#endif /* Replayer_h_ */
@@ -0,0 +1,91 @@
+// vim: shiftwidth=4
+// vim: ts=4
+/**
+Replays the client data captured by GpsServer ([Capture] section of GpsServer.ini) into a
+GpsServer, for reproducible throughput and latency runs with real traffic.
+
+Give the rotated files oldest first:
+    GpsReplay -p 5002 -s 10 packets.cap.2 packets.cap.1 packets.cap
+*/
+
+#include <stdexcept>
+
+#include <stdio.h>          // printf
+#include <stdlib.h>         // atoi, atof
+#include <string.h>         // strcmp
+#include <signal.h>         // signal
+#include <sys/resource.h>   // setrlimit
+
+#include "Replayer.h"
+
+/*****************************************************************************/
+static int
+print_usage()
+{
+    printf("Usage:\n");
+    printf("\tGpsReplay [options] capturefile...\n");
+    printf("where options are:\n");
+    printf("\t-h host\t\tGpsServer host, default localhost.\n");
+    printf("\t-p port\t\tGpsServer ListeningPort, default 5002.\n");
+    printf("\t-s speed\tReplay speed, 1 for real time, 0 for as fast as possible, default 1.\n");
+    printf("\t-report seconds\tReport period, default 5.\n");
+    printf("Capture files are replayed in the given order, give the oldest first.\n");
+    return 1;
+}
+
+/*****************************************************************************/
+int
+main(
+    int     argc,
+    char**  argv)
+{
+    REPLAY_CONFIG   config;
+    config.host = "localhost";
+    config.port = 5002;
+    config.speed = 1;
+    config.report_interval = 5;
+
+    for (int i=1; i<argc; ++i) {
+        const char* arg = argv[i];
+        if (arg[0] != '-') {
+            config.files.push_back(arg);
+            continue;
+        }
+        const char* value = i+1 < argc ? argv[i+1] : 0;
+        if (value == 0) {
+            return print_usage();
+        }
+        ++i;
+        if (strcmp(arg, "-h") == 0) {
+            config.host = value;
+        } else if (strcmp(arg, "-p") == 0) {
+            config.port = atoi(value);
+        } else if (strcmp(arg, "-s") == 0) {
+            config.speed = atof(value);
+        } else if (strcmp(arg, "-report") == 0) {
+            config.report_interval = atoi(value);
+        } else {
+            return print_usage();
+        }
+    }
+    if (config.files.empty() || config.speed < 0 || config.report_interval == 0) {
+        return print_usage();
+    }
+
+    // One socket per recorded client.
+    struct rlimit   limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    try {
+        Replayer    replayer(config);
+        replayer.run();
+    } catch (const std::exception& e) {
+        printf("Error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
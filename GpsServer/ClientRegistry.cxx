@@ -0,0 +1,149 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include "GpsServer.h"
+#include "ClientRegistry.h"
+
+const ClientSet ClientRegistry::empty_;
+
+/*****************************************************************************/
+ClientRegistry::ClientRegistry() :
+    added_(0)
+{
+}
+
+/*****************************************************************************/
+void
+ClientRegistry::index(
+    TCP_CLIENT*     client,
+    ENTRY&          entry)
+{
+    entry.group_id = client->group_id;
+    entry.ship_number = client->ship_id.get() == 0 ? -1 : client->ship_id->ship_number;
+    entry.mode = client->mode;
+
+    groups_[entry.group_id].insert(client);
+    modes_[entry.mode].insert(client);
+    // GpsViewers share the ship number of the viewer account, and a ship reconnecting may still
+    // have its old connection. Newest one wins, like the search from the newest client did.
+    if (entry.ship_number >= 0) {
+        std::map<int, TCP_CLIENT*>::iterator sit = ships_.find(entry.ship_number);
+        if (sit == ships_.end()) {
+            ships_[entry.ship_number] = client;
+        } else if (entries_[sit->second].serial < entry.serial) {
+            sit->second = client;
+        }
+    }
+}
+
+/*****************************************************************************/
+void
+ClientRegistry::unindex(
+    TCP_CLIENT*     client,
+    const ENTRY&    entry)
+{
+    std::map<int, ClientSet>::iterator git = groups_.find(entry.group_id);
+    if (git != groups_.end()) {
+        git->second.erase(client);
+        if (git->second.empty()) {
+            groups_.erase(git);
+        }
+    }
+    std::map<unsigned int, ClientSet>::iterator mit = modes_.find(entry.mode);
+    if (mit != modes_.end()) {
+        mit->second.erase(client);
+        if (mit->second.empty()) {
+            modes_.erase(mit);
+        }
+    }
+    std::map<int, TCP_CLIENT*>::iterator sit = ships_.find(entry.ship_number);
+    if (sit != ships_.end() && sit->second == client) {
+        ships_.erase(sit);
+        // Hand the ship number over to the newest other client having it, if any.
+        const ClientSet& others = group(entry.group_id);
+        for (ClientSet::const_iterator it = others.begin(); it != others.end(); ++it) {
+            const ENTRY& other = entries_[*it];
+            if (other.ship_number == entry.ship_number) {
+                std::map<int, TCP_CLIENT*>::iterator newest = ships_.find(entry.ship_number);
+                if (newest == ships_.end() || entries_[newest->second].serial < other.serial) {
+                    ships_[entry.ship_number] = *it;
+                }
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+void
+ClientRegistry::add(
+    TCP_CLIENT*     client)
+{
+    if (entries_.find(client) != entries_.end()) {
+        update(client);
+        return;
+    }
+    clients_.push_front(client);
+    ENTRY& entry = entries_[client];
+    entry.position = clients_.begin();
+    entry.serial = ++added_;
+    index(client, entry);
+}
+
+/*****************************************************************************/
+void
+ClientRegistry::update(
+    TCP_CLIENT*     client)
+{
+    std::map<TCP_CLIENT*, ENTRY>::iterator it = entries_.find(client);
+    if (it == entries_.end()) {
+        add(client);
+        return;
+    }
+    ENTRY& entry = it->second;
+    const int ship_number = client->ship_id.get() == 0 ? -1 : client->ship_id->ship_number;
+    if (entry.group_id != client->group_id || entry.ship_number != ship_number || entry.mode != (unsigned int)client->mode) {
+        unindex(client, entry);
+        index(client, entry);
+    }
+}
+
+/*****************************************************************************/
+void
+ClientRegistry::remove(
+    TCP_CLIENT*     client)
+{
+    std::map<TCP_CLIENT*, ENTRY>::iterator it = entries_.find(client);
+    if (it != entries_.end()) {
+        const ENTRY entry = it->second;
+        clients_.erase(entry.position);
+        entries_.erase(it);
+        unindex(client, entry);
+    }
+}
+
+/*****************************************************************************/
+TCP_CLIENT*
+ClientRegistry::findShip(
+    const int       ship_number) const
+{
+    std::map<int, TCP_CLIENT*>::const_iterator it = ships_.find(ship_number);
+    return it == ships_.end() ? 0 : it->second;
+}
+
+/*****************************************************************************/
+const ClientSet&
+ClientRegistry::group(
+    const int       group_id) const
+{
+    std::map<int, ClientSet>::const_iterator it = groups_.find(group_id);
+    return it == groups_.end() ? empty_ : it->second;
+}
+
+/*****************************************************************************/
+const ClientSet&
+ClientRegistry::mode(
+    const unsigned int  mode) const
+{
+    std::map<unsigned int, ClientSet>::const_iterator it = modes_.find(mode);
+    return it == modes_.end() ? empty_ : it->second;
+}
@@ -0,0 +1,99 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef ClientRegistry_h_
+#define ClientRegistry_h_
+
+#include <list>
+#include <map>
+#include <set>
+
+class TCP_CLIENT;
+
+/** Set of clients. */
+typedef std::set<TCP_CLIENT*>   ClientSet;
+
+/**
+All connected TCP clients, indexed by ship number, group ID and client mode.
+
+Clients are added unidentified and have to be re-indexed with \c update whenever
+their mode, ship ID or group ID changes. Lookups and group/mode sets cost logarithmic
+time in the number of groups or ships, never a pass over all clients.
+*/
+class ClientRegistry {
+    public:
+        typedef std::list<TCP_CLIENT*>::const_iterator  const_iterator;
+    private:
+        /** Keys under which the client is currently indexed. */
+        typedef struct {
+            std::list<TCP_CLIENT*>::iterator    position;       ///< Position in \c clients_
+            unsigned long                       serial;         ///< Order of adding, newer clients have greater ones
+            int                                 group_id;       ///< Key in \c groups_
+            int                                 ship_number;    ///< Key in \c ships_, -1 if none
+            unsigned int                        mode;           ///< Key in \c modes_
+        } ENTRY;
+
+        std::list<TCP_CLIENT*>              clients_;   ///< All clients, newest first
+        std::map<TCP_CLIENT*, ENTRY>        entries_;   ///< Index keys of every client
+        std::map<int, TCP_CLIENT*>          ships_;     ///< Newest client of every ship number
+        std::map<int, ClientSet>            groups_;    ///< Clients by group ID
+        std::map<unsigned int, ClientSet>   modes_;     ///< Clients by \c CLIENTMODE
+        static const ClientSet              empty_;     ///< Returned for unknown groups and modes
+        unsigned long                       added_;     ///< Clients added so far, gives \c ENTRY::serial
+
+        void
+        index(
+            TCP_CLIENT*     client,
+            ENTRY&          entry);
+
+        void
+        unindex(
+            TCP_CLIENT*     client,
+            const ENTRY&    entry);
+    public:
+        ClientRegistry();
+
+        /** Adds new client. */
+        void
+        add(
+            TCP_CLIENT*     client);
+
+        /** Re-indexes client after its mode, ship ID or group ID has changed. */
+        void
+        update(
+            TCP_CLIENT*     client);
+
+        /** Removes client, does nothing if not registered. */
+        void
+        remove(
+            TCP_CLIENT*     client);
+
+        /** Finds the newest client with given ship number. Returns 0 if not found. */
+        TCP_CLIENT*
+        findShip(
+            const int       ship_number) const;
+
+        /** Clients belonging to given group. */
+        const ClientSet&
+        group(
+            const int       group_id) const;
+
+        /** Clients in given mode, \c CLIENTMODE. */
+        const ClientSet&
+        mode(
+            const unsigned int  mode) const;
+
+        /** All clients. */
+        const std::list<TCP_CLIENT*>&
+        all() const { return clients_; }
+
+        const_iterator
+        begin() const { return clients_.begin(); }
+
+        const_iterator
+        end() const { return clients_.end(); }
+
+        unsigned int
+        size() const { return clients_.size(); }
+}; // class ClientRegistry
+
+#endif /* ClientRegistry_h_ */
@@ -0,0 +1,68 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdio.h>      // snprintf
+
+#include "CmrStream.h"
+
+/*****************************************************************************/
+CmrStream::CmrStream() :
+    input_(0),
+    input_size_(0),
+    pos_(0)
+{
+    cmr_rxpacket_init(&rx_, buffer_);
+}
+
+/*****************************************************************************/
+void
+CmrStream::feed(
+    const unsigned char*    data,
+    const unsigned int      size)
+{
+    input_ = data;
+    input_size_ = size;
+    pos_ = 0;
+}
+
+/*****************************************************************************/
+bool
+CmrStream::pop(
+    CMR_VIEW&               view)
+{
+    while (pos_ < input_size_) {
+        unsigned int    used;
+        const uint8_t*  data_block;
+        const CMRDECODE r = cmr_decode_next(&rx_, input_ + pos_, input_size_ - pos_, &used, &data_block);
+        pos_ += used;
+        if (r == CMRDECODE_COMPLETE) {
+            view.type = rx_.Type;
+            if (rx_.Type == CMR_TYPE_PING) {
+                view.data = 0;
+                view.size = 0;
+            } else {
+                view.data = data_block;
+                view.size = rx_.Length;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*****************************************************************************/
+std::string
+CmrStream::toString(
+    const CMR_VIEW&         view)
+{
+    std::string r;
+    char        buf[32];
+    snprintf(buf, sizeof(buf), "CMR 0x%04x [%u] = {", view.type, view.size);
+    r += buf;
+    for (unsigned int i = 0; i < view.size; ++i) {
+        snprintf(buf, sizeof(buf), " %02x", view.data[i]);
+        r += buf;
+    }
+    r += " }";
+    return r;
+}
@@ -0,0 +1,58 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef CmrStream_h_
+#define CmrStream_h_
+
+#include <string>
+
+#include "cmr.h"        // cmr_decode_next
+
+/** Decoded CMR packet: type and data block, not copied. */
+typedef struct {
+    uint16_t                type;       ///< Packet type, \c CMR_TYPE_PING for pings
+    const unsigned char*    data;       ///< Data block, 0 for pings
+    unsigned int            size;       ///< Length of \c data
+} CMR_VIEW;
+
+/**
+Streaming CMR decoder on top of \c cmr_decode_next.
+
+The caller feeds whatever the socket gave, without copying it, and pops packets. A packet
+lying entirely in the fed block is found by scanning and returned as a view into that block;
+only a packet split between two reads is decoded byte by byte into the 255-byte packet buffer
+of the decoder. No heap allocation is done.
+
+Views are valid until the fed block is released or the next \c feed.
+*/
+class CmrStream {
+    private:
+        uint8_t                 buffer_[CMR_MAX_PACKET_LENGTH + 1];    ///< Packet under decoding
+        CMR_RXPACKET            rx_;
+        const unsigned char*    input_;     ///< Block being decoded
+        unsigned int            input_size_;
+        unsigned int            pos_;       ///< Next byte in \c input_
+
+        /** Not copyable, \c rx_ points into \c buffer_. */
+        CmrStream(const CmrStream&);
+        CmrStream& operator=(const CmrStream&);
+    public:
+        CmrStream();
+
+        /** Starts decoding next block of the stream. Rest of the previous block is dropped. */
+        void
+        feed(
+            const unsigned char*    data,
+            const unsigned int      size);
+
+        /** Decodes next packet from the fed block. Returns false when the block is exhausted. */
+        bool
+        pop(
+            CMR_VIEW&               view);
+
+        /** Hex dump of the packet, for logging. */
+        static std::string
+        toString(
+            const CMR_VIEW&         view);
+}; // class CmrStream
+
+#endif /* CmrStream_h_ */
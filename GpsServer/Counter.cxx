@@ -20,8 +20,9 @@ Counter::countAtInterval(
     if (intervals.find(num) == intervals.end()) {
         intervals[num] = 0;
     }
-    const uint64_t count = total-intervals[num];
-    intervals[num] = total;
+    const uint64_t now = getTotal();
+    const uint64_t count = now-intervals[num];
+    intervals[num] = now;
     return count;
 }
 
@@ -30,14 +31,15 @@ Counter::countAtInterval(
 uint64_t
 Counter::getTotal() const
 {
-    return total;
+    // Atomic read, also where 64-bit loads are not.
+    return __sync_add_and_fetch(const_cast<volatile uint64_t*>(&total), 0);
 }
 
 /*****************************************************************************/
 void 
 Counter::operator++()
 {
-    total++;
+    __sync_add_and_fetch(&total, 1);
 }
 
 /*****************************************************************************/
@@ -45,5 +47,5 @@ void
 Counter::operator+=(
         const int amount)
 {
-    total+=amount;
+    __sync_add_and_fetch(&total, amount);
 }
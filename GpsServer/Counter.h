@@ -7,12 +7,13 @@
 \c Counter class Counts stuff like packets/bytes sent/received and holds information about time intervals
     (e.g how much stuff was counted during last 10s/60s/3600s)
     Intervals are identified by integer keys. Easiest would be to simply use corresponding timer values (10, 60 etc)
+    Any thread may count, \c total is updated atomically. Intervals must be read by one thread only.
 
  @author Kalle Last <kalle@errapartengineering.com>
 */
 class Counter
 {
-    uint64_t total;                             ///< Holds total count
+    volatile uint64_t total;                    ///< Holds total count
     std::map<int, uint64_t> intervals;          ///< Holds count for each interval, gets set when reading it
 public:
     Counter();
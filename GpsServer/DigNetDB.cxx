@@ -5,16 +5,13 @@
 #include <vector>
 #include <string>
 
-#include <iostream> // cout, ofstream
+#include <iostream> // cout
 
 #include <utils/util.h>
-#include <utils/hxio.h>
 #include <utils/math.h>
 
-#include <mysql.h>
-
-#include <unistd.h>
-#include <assert.h>
+#include <string.h> // memset
+#include <time.h>
 
 #include "DigNetDB.h"
 
@@ -22,246 +19,170 @@ using namespace std;
 using namespace utils;
 
 /*****************************************************************************/
-static int
-do_query(
-        void*           mysql,
-        const string&   query)
+/** Number of worklog rows and columns in the work area. */
+static void
+worklog_size(
+        const WorkArea& wa,
+        int&            nrows,
+        int&            ncols)
 {
-    //cout<<"Executing query: \""<<query<<"\""<<endl;
-    const int   r = mysql_real_query(reinterpret_cast<MYSQL*>(mysql), query.c_str(), query.size());
-    // cout << "MySQL result:" << r << endl << flush;
-    return r;
+    const double    length = sqrt(sqr(wa.Start_X - wa.End_X) + sqr(wa.Start_Y - wa.End_Y));
+    nrows = utils::round(length / wa.Step_Forward);
+    ncols = static_cast<int>(wa.Pos_Sideways.size()) - 1;
 }
 
 /*****************************************************************************/
-/**
-Query just 1 row from the database. FIXME: error handling.
-*/
-static bool
-query1row(
-        void*           mysql,
-        const string&   query,
-        vector<string>& row)
+void
+DigNetDB::setArea(
+        const WorkArea& area)
 {
-    //cout<<"Executing query: \""<<query<<"\""<<endl;
-    bool    r = false;
-    MYSQL*  sql = reinterpret_cast<MYSQL*>(mysql);
-    if (do_query(mysql, query) == 0) {
-        MYSQL_RES*  result = mysql_store_result(sql);
-        if (result == 0) {
-            throw runtime_error(ssprintf("query1row: Mysql misbehaved on query %s", query.c_str()));
-        } else {
-            MYSQL_ROW   mysql_row = mysql_fetch_row(result);
-            if (mysql_row != 0) {
-                const int   ncols = mysql_num_fields(result);
-                row.resize(ncols);
-                for (unsigned int i = 0; i < row.size(); ++i) {
-                    row[i] = mysql_row[i];
-                }
-                r = true;
-            }
-            mysql_free_result(result);
-        }
-    } else {
-        // bad error.
-        throw runtime_error(ssprintf("query1row: Invalid query \"%s\" or smth.", query.c_str()));
+    const bool changed = !Area.IsValid() || float_of_time(Area().Change_Time) != float_of_time(area.Change_Time);
+    Area = area;
+    if (changed || !worklog_valid_) {
+        loadWorklog();
     }
-    // unsuccessful.
-    return r;
 }
 
 /*****************************************************************************/
-/** Query a table from the MySQL.
-
-Throws exceptions on errors.
-*/
-static int
-querytable(
-        void*                                   mysql,
-        const std::string&                      query,
-        std::vector<std::vector<std::string> >& results)
+bool
+DigNetDB::loadWorklog()
 {
-    MYSQL*  sql = reinterpret_cast<MYSQL*>(mysql);
-    // Execute the query.
-    if (do_query(mysql, query) == 0) {
-        results.resize(0);
-        MYSQL_RES*  result = mysql_store_result(sql);
-        if (result == 0) {
-            // There were no results.
-            return mysql_affected_rows(sql);
-        } else {
-            // Fetch the results.
-            const int   ncols = mysql_num_fields(result);
-            MYSQL_ROW   mysql_row;
-            while ((mysql_row = mysql_fetch_row(result)) != 0) {
-                results.resize(results.size() + 1);
-                vector<string>& row = results[results.size()-1];
-                row.resize(ncols);
-                for (unsigned int i = 0; i < row.size(); ++i) {
-                    const char* cell = mysql_row[i];
-                    row[i] = cell == 0 ? "" : cell;
-                }
+    worklog_valid_ = false;
+    if (!Area.IsValid()) {
+        return false;
+    }
+    int nrows = 0;
+    int ncols = 0;
+    worklog_size(Area(), nrows, ncols);
+    if (nrows <= 0 || ncols <= 0) {
+        return false;
+    }
+
+    try {
+        TNT::Array2D<unsigned int>  ids(nrows, ncols);
+        TNT::Array2D<WORKMARK>      worklog(nrows, ncols);
+        for (int i = 0; i < nrows; ++i) {
+            for (int j = 0; j < ncols; ++j) {
+                ids[i][j] = 0;
+                worklog[i][j] = WORKMARK_EMPTY;
             }
-            mysql_free_result(result);
-            return 0;
         }
-    } else {
-        // bad error.
-        throw runtime_error(ssprintf("query1table: Invalid query \"%s\" or smth.", query.c_str()));
+        std::vector<WORKLOG_ROW> results;
+        readWorklog(results);
+        for (unsigned int i = 0; i < results.size(); ++i) {
+            const WORKLOG_ROW& row = results[i];
+            if (row.row_index >= 0 && row.row_index < nrows && row.col_index >= 0 && row.col_index < ncols && row.mark >= 0 && row.mark < WORKMARK_SIZE) {
+                worklog[row.row_index][row.col_index] = static_cast<WORKMARK>(row.mark);
+                ids[row.row_index][row.col_index] = row.id;
+            }
+        }
+        worklog_ = worklog;
+        worklog_ids_ = ids;
+        worklog_valid_ = true;
+        cout << "DigNetDB: loaded worklog " << nrows << "x" << ncols << " from " << results.size() << " rows." << endl;
+    } catch (const std::exception& e) {
+        cout << "DigNetDB::loadWorklog: error: " << e.what() << endl;
     }
-    assert(0);
-    return -1;
+    return worklog_valid_;
 }
-/*****************************************************************************/
-/** Execute an insert query.
 
-  \return ID of the inserted row.
-
-  Throws exceptions on errors.
-*/
-static int
-execute_insert(
-        void*           mysql,
-        const string&   query)
-{
-    MYSQL*  sql = reinterpret_cast<MYSQL*>(mysql);
-
-    // Execute the query.
-    if (do_query(mysql, query) == 0) {
-        // Get the ID.
-        return mysql_insert_id(sql);
-    } else {
-        // bad error.
-        throw runtime_error(ssprintf("execute_insert: Invalid query \"%s\" or smth.", query.c_str()));
-    }
-}
+/// Cached Ships row is read again this many seconds after it was read, other programs may change it.
+static const time_t SHIP_STATE_EXPIRY = 60;
+/// Cached Ships row is kept at least this many seconds after its last update was handed to the writer,
+/// so that it isn't read again before the update has been written.
+static const time_t SHIP_STATE_WRITE_DELAY = 10;
+/// Ship not found in DB is looked for again after this many seconds.
+static const time_t SHIP_MISSING_EXPIRY = 10;
 
 /*****************************************************************************/
-typedef enum {
-    UPDATE_NULL_THROW,
-    UPDATE_NULL_OK
-} UPDATE_FLAGS;
-
-/**
-Update just 1 row.
-*/
-static bool
-update1row(
-        void*               mysql,
-        const string&       query,
-        const UPDATE_FLAGS  flags = UPDATE_NULL_THROW)
+DigNetDB::DigNetDB() :
+        worklog_valid_(false)
 {
-    //cout<<"update1row query: \""<<query<<"\""<<endl;
-    MYSQL*  sql = reinterpret_cast<MYSQL*>(mysql);
-    if (do_query(mysql, query) == 0) {
-        const int   nrows = mysql_affected_rows(sql);
-        if (flags == UPDATE_NULL_THROW ? (nrows != 1) : (nrows != 1 && nrows != 0)) {
-            throw runtime_error(ssprintf("update1row: Updated %d rows instead of just 1, query: %s", nrows, query.c_str()));
-        }
-        return true;
-    } else {
-        throw runtime_error(ssprintf("update1row: Invalid query \"%s\"or smth.", query.c_str()));
-    }
-    return false;
 }
 
 /*****************************************************************************/
-static string
-escape_string(
-        void*           mysql,
-        const string&   s)
+DigNetDB::~DigNetDB()
 {
-    MYSQL*  sql = reinterpret_cast<MYSQL*>(mysql);
-    string  buffer;
-
-    buffer.resize(2*s.size() + 1);
-    const unsigned long l = mysql_real_escape_string(sql, &buffer[0], &s[0], s.size());
-    buffer.resize(l);
-
-    return buffer;
 }
 
 /*****************************************************************************/
-bool
-DigNetDB::refreshArea()
+SHIP_STATE*
+DigNetDB::shipState(
+        const int shipId)
 {
-    WorkArea tmp;
-    bool  r = false;
-
-    string query("SELECT "
-                 "Change_Time, "
-                 "Start_X, "
-                 "Start_Y, "
-                 "End_X, "
-                 "End_Y, "
-                 "Step_Forward, "
-                 "Pos_Sideways "
-                 "FROM WorkArea "
-                 "LIMIT 1");
+    std::map<int, CACHED_SHIP>::iterator it = ships_.find(shipId);
+    if (it != ships_.end()) {
+        return &it->second.state;
+    }
+    // Every packet of an unknown ship would query DB again.
+    const time_t now = time(0);
+    std::map<int, time_t>::iterator mit = missing_ships_.find(shipId);
+    if (mit != missing_ships_.end() && now - mit->second < SHIP_MISSING_EXPIRY) {
+        return 0;
+    }
 
-    try {
-        vector<string> result;
-        vector<string> vsideways;
-        if (query1row(mysql_, query, result)) {
-            tmp.Change_Time = my_time_of_mysql(result[0]);
-            r =
-                double_of(result[1], tmp.Start_X) &&
-                double_of(result[2], tmp.Start_Y) &&
-                double_of(result[3], tmp.End_X) &&
-                double_of(result[4], tmp.End_Y) &&
-                double_of(result[5], tmp.Step_Forward);
-            split(result[6], ";",  vsideways);
-            for (unsigned int i = 0; i < vsideways.size(); ++i) {
-                double f = 0;
-                r = r && double_of(vsideways[i], f);
-                tmp.Pos_Sideways.push_back(f);
-            }
-            if (r) {
-                Area = tmp;
-            }
+    CACHED_SHIP ship;
+    memset(&ship, 0, sizeof(ship));
+    if (readShipState(shipId, ship.state)) {
+        if (mit != missing_ships_.end()) {
+            missing_ships_.erase(mit);
         }
-    } catch (const exception& e) {
-        cout << "Error querying WorkArea : %s" << e.what() << endl;
+        ship.loaded_time = now;
+        return &(ships_[shipId] = ship).state;
     }
-
-    return r;
+    missing_ships_[shipId] = now;
+    return 0;
 }
 
 /*****************************************************************************/
-DigNetDB::DigNetDB(
-        const std::string&  database,
-        const std::string&  username,
-        const std::string&  password
-) :
-        mysql_(0)
+void
+DigNetDB::setPositionStore(
+        PositionStore*  store)
 {
-    mysql_ = mysql_init(0);
-    MYSQL* h = reinterpret_cast<MYSQL*>(mysql_);
-
-    if (mysql_ == 0) {
-        // mysql_library_end();
-        throw runtime_error("MySQL library error.");
-    }
+    position_store_.reset(store);
+}
 
-    if (mysql_real_connect(h, "localhost", username.c_str(), password.c_str(), database.c_str(), 0, 0, 0) == 0) {
-        string s(ssprintf(
-                     "Unable to connect MySQL server, tried %s:%s@%s. Error was: %s",
-                     username.c_str(), password.c_str(), database.c_str(), mysql_error(h)
-                 ));
-        mysql_close(h);
-        mysql_ = 0;
-        // mysql_library_end();
-        throw runtime_error(s.c_str());
+/*****************************************************************************/
+void
+DigNetDB::storePosition(
+        const SHIP_POSITION_ROW& row)
+{
+    // Position store can't take it when the disk is full, the table may still.
+    if (position_store_.get() == 0 || !position_store_->append(row)) {
+        writePosition(row);
     }
 }
 
 /*****************************************************************************/
-DigNetDB::~DigNetDB()
+void
+DigNetDB::flushShips()
 {
-    if (mysql_ != 0) {
-        mysql_close(reinterpret_cast<MYSQL*>(mysql_));
-        mysql_ = 0;
-        // mysql_library_end();
+    if (position_store_.get() != 0) {
+        position_store_->flush();
+    }
+    const time_t now = time(0);
+    for (std::map<int, CACHED_SHIP>::iterator it = ships_.begin(); it != ships_.end(); ) {
+        CACHED_SHIP& ship = it->second;
+        if (ship.state.dirty != 0) {
+            SHIP_UPDATE update;
+            update.ship_id = it->first;
+            update.state = ship.state;
+            writeShipUpdate(update);
+            ship.state.dirty = 0;
+            ship.written_time = now;
+        }
+        if (now - ship.loaded_time >= SHIP_STATE_EXPIRY && now - ship.written_time >= SHIP_STATE_WRITE_DELAY) {
+            ships_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    for (std::map<int, time_t>::iterator it = missing_ships_.begin(); it != missing_ships_.end(); ) {
+        if (now - it->second >= SHIP_MISSING_EXPIRY) {
+            missing_ships_.erase(it++);
+        } else {
+            ++it;
+        }
     }
 }
 
@@ -270,9 +191,11 @@ void
 DigNetDB::updateContactTime(
         const int shipId)
 {
-    std::string query;
-    query = ssprintf("update Ships set Contact_Time = now() where id = %d", shipId);
-    update1row(mysql_, query, UPDATE_NULL_OK);
+    SHIP_STATE* state = shipState(shipId);
+    if (state != 0) {
+        state->contact_time = time(0);
+        state->dirty |= SHIP_DIRTY_CONTACT;
+    }
 }
 
 /*****************************************************************************/
@@ -283,10 +206,14 @@ DigNetDB::updateGps(
         const double x,
         const double y)
 {
-    std::string query;
-    query = ssprintf("update Ships set GPS%d_Time = now(), GPS%d_X = %f, GPS%d_Y = %f where id = %d", gpsNum, gpsNum, x, gpsNum, y, shipId);
-    //cout<<"Updating GPS: \""<<query<<"\""<<endl;
-    update1row(mysql_, query, UPDATE_NULL_OK);
+    SHIP_STATE* state = shipState(shipId);
+    if (state != 0 && (gpsNum == 1 || gpsNum == 2)) {
+        const int i = gpsNum - 1;
+        state->gps_time[i] = time(0);
+        state->gps_x[i] = x;
+        state->gps_y[i] = y;
+        state->dirty |= i == 0 ? SHIP_DIRTY_GPS1 : SHIP_DIRTY_GPS2;
+    }
 }
 
 
@@ -296,8 +223,12 @@ DigNetDB::updateShipHeading(
         const int shipId,
         const double heading)
 {
-    std::string query = ssprintf("update Ships set Heading_Time = now(), Heading = %f where id = %d", heading, shipId);
-    update1row(mysql_, query, UPDATE_NULL_OK);
+    SHIP_STATE* state = shipState(shipId);
+    if (state != 0) {
+        state->heading_time = time(0);
+        state->heading = heading;
+        state->dirty |= SHIP_DIRTY_HEADING;
+    }
 }
 
 /*****************************************************************************/
@@ -311,21 +242,24 @@ DigNetDB::addShipPosition(
         const double        heading,
         const utils::Option<double>    speed)
 {
-    std::string insertQuery(ssprintf("insert into ShipPosition set Create_Time = now(), ShipId = %d, type = '%c', x = %f, y = %f, heading = %f", shipId, type, x, y, heading));
+    SHIP_POSITION_ROW row;
+    memset(&row, 0, sizeof(row));
+    row.create_time = time(0);
+    row.ship_id = shipId;
+    row.type = type;
+    row.x = x;
+    row.y = y;
+    row.heading = heading;
+    row.has_heading = true;
     if (speed.IsValid()){
-        std::string speedStr(ssprintf(", speed = %f", speed()));
-        insertQuery.append(speedStr);
+        row.speed = speed();
+        row.has_speed = true;
     }
     if (type != POSITION_TYPE_VIEWER){
-        std::string zStr(ssprintf(", z = %f", z));
-        insertQuery.append(zStr);
-    }
-    try {
-        execute_insert(mysql_, insertQuery);
-    } catch (const runtime_error& e){
-        cout<<"Error adding ship position: "<<e.what()<<endl;
+        row.z = z;
+        row.has_z = true;
     }
-
+    storePosition(row);
 }
 
 /*****************************************************************************/
@@ -338,13 +272,18 @@ DigNetDB::addGpsPosition(
         const double    z,
         const int       status)
 {
-    std::string insertQuery = ssprintf("insert into ShipPosition set Create_Time = now(), ShipId = %d, type = '%c', x = %f, y = %f, z = %f, GpsStatus = %d",
-                                        shipId, '1'+type, x, y, z, status);
-    try {
-        execute_insert(mysql_, insertQuery);
-    } catch (const runtime_error& e){
-        cout<<"Error adding GPS position: "<<e.what()<<endl;
-    }
+    SHIP_POSITION_ROW row;
+    memset(&row, 0, sizeof(row));
+    row.create_time = time(0);
+    row.ship_id = shipId;
+    row.type = '1' + type;
+    row.x = x;
+    row.y = y;
+    row.z = z;
+    row.has_z = true;
+    row.gps_status = status;
+    row.has_gps_status = true;
+    storePosition(row);
 }
 
 /*****************************************************************************/
@@ -356,8 +295,13 @@ DigNetDB::saveShadow(
         const double    y,
         const double    dir)
 {
-    std::string query(ssprintf("update Ships set Shadow_X = %f, Shadow_Y= %f, Shadow_Dir = %f where id = %d", x, y, dir, shipId));
-    update1row(mysql_, query, UPDATE_NULL_OK);
+    SHIP_STATE* state = shipState(shipId);
+    if (state != 0) {
+        state->shadow_x = x;
+        state->shadow_y = y;
+        state->shadow_dir = dir;
+        state->dirty |= SHIP_DIRTY_SHADOW;
+    }
 }
 
 bool
@@ -367,18 +311,13 @@ DigNetDB::getShadow(
         double&     y,
         double&     dir)
 {
-    std::string query(ssprintf("select Shadow_X, Shadow_Y, Shadow_Dir from Ships where id = %d", shipId));
-    vector<string> result;
-    if (!query1row(mysql_, query, result)) {
+    const SHIP_STATE* state = shipState(shipId);
+    if (state == 0 || state->shadow_x < 0) {
         return false;
     }
-    const double sx = double_of(result[0]);
-    if (sx < 0){
-        return false;
-    }
-    x = sx;
-    y = double_of(result[1]);
-    dir = double_of(result[0]);
+    x = state->shadow_x;
+    y = state->shadow_y;
+    dir = state->shadow_dir;
     return true;
 }
 
@@ -391,164 +330,16 @@ DigNetDB::getShipPosition(
         double&             y,
         double&             heading)
 {
-    string query = ssprintf("select Gps1_X, Gps1_y, Heading from Ships where ID = %d", shipId);
-    vector<string> result;
-    if (!query1row(mysql_, query, result)) {
+    const SHIP_STATE* state = shipState(shipId);
+    if (state == 0) {
         return false;
     }
-    x = double_of(result[0]);
-    y = double_of(result[1]);
-    heading = double_of(result[2]);
+    x = state->gps_x[0];
+    y = state->gps_y[0];
+    heading = state->heading;
     return true;
 }
 
-/*****************************************************************************/
-bool
-DigNetDB::getShipVoltageInfo(
-        const int           shipId,
-        double&             lastReading,
-        double&             minimum,
-        int&                secondsFromLastRead,
-        my_time&        timeLastRead)
-{
-    bool r = false;
-    string query = ssprintf(
-		"SELECT "
-			"now() - v.Reading_Time, "
-			"v.Reading_Time, "
-			"v.SupplyVoltage, "
-			"s.SupplyVoltageLimit "
-		"FROM "
-			"SupplyVoltages AS v, Ships AS s "
-		"WHERE "
-			"s.id = %d AND v.ShipId = s.id "
-		"ORDER BY v.Reading_Time DESC LIMIT 1", shipId);
-    try {
-        vector<string> result;
-        if (query1row(mysql_, query, result)) {
-            secondsFromLastRead = int_of(result[0]);
-            timeLastRead = my_time_of_mysql(result[1]);
-            lastReading = double_of(result[2]);
-            minimum = double_of(result[3]);
-            r = true;
-        }
-    } catch (const exception& e) {
-        cout << "Error reading last voltage: %s" << e.what() << endl;
-    }
-    return r;
-}
-        
-/*****************************************************************************/
-bool
-DigNetDB::registerShip(
-        int&            shipId,
-        int&            groupId,
-        string&         name,
-        double&         gps1_dx,
-        double&         gps1_dy,
-        double&         gps2_dx,
-        double&         gps2_dy,
-        double&         supplyVoltageLimit,
-        const string&   imei,
-        const string&   firmwareName,
-        const string&   firmwareVersion,
-        const string&   firmwareBuildDate,
-        const string&   phone
-)
-{
-    try {
-        string firmwareNameBuf(escape_string(mysql_, firmwareName));
-        string imeiBuf(escape_string(mysql_, imei));
-        string firmwareVersionBuf(escape_string(mysql_, firmwareVersion));
-        string firmwareDateBuf(escape_string(mysql_, firmwareBuildDate));
-        // FIXME: Get this from somewhere
-        string phoneNumberBuf(escape_string(mysql_, "12345678"));
-        string nameBuf(escape_string(mysql_, name));
-        string query = ssprintf("select id, GroupId, name, IMEI, Firmware_Name, Firmware_Version, Firmware_Build_date, Gps1_dx, Gps1_dy, Gps2_dx, Gps2_dy, SupplyVoltageLimit  from Ships where IMEI = '%s'", imeiBuf.c_str());
-        vector<string> result;
-        if (!query1row(mysql_, query, result)) {
-            // Ship doesn't exist, abort
-            return false;
-#if (0)
-            string insertQuery = ssprintf("insert into Ships SET SimNumber='', ShipType = '', IMEI = '%s', Firmware_Name = '%s', Firmware_Version = '%s', Firmware_Build_date = '%s', Phone_no = '%s', Name = '%s', Contact_Time = now()",
-                                          imeiBuf.c_str(),
-                                          firmwareNameBuf.c_str(),
-                                          firmwareVersionBuf.c_str(),
-                                          firmwareDateBuf.c_str(),
-                                          phoneNumberBuf.c_str(),
-                                          nameBuf.c_str());
-            execute_insert(mysql_, insertQuery);
-            // Re-fetch to get ID
-            query1row(mysql_, query, result);
-#endif
-        }
-        shipId = int_of(result[0]);
-        groupId = int_of(result[1]);
-        name = result[2];
-        gps1_dx = double_of(result[7]);
-        gps1_dy = double_of(result[8]);
-        gps2_dx = double_of(result[9]);
-        gps2_dy = double_of(result[10]);
-        supplyVoltageLimit = double_of(result[11]);
-        // If firmwarersion differs then update
-        if (result[5].compare(firmwareVersion) != 0) {
-            query = ssprintf("update Ships set Firmware_Name = '%s', Firmware_Version = '%s', Firmware_Build_date = '%s' where id = %d",
-                             firmwareNameBuf.c_str(), firmwareVersionBuf.c_str(), firmwareDateBuf.c_str(), shipId);
-            update1row(mysql_, query);
-        }
-        // Ship exists in DB
-    } catch (const exception& e) {
-        cout << "Can't register ship: " << e.what() << endl;
-        return false;
-    }
-    return true;
-}
-
-/*****************************************************************************/
-bool
-DigNetDB::getShipGpsOffsets(
-        const int   shipId,
-        double&     gps1_dx,
-        double&     gps1_dy,
-        double&     gps2_dx,
-        double&     gps2_dy
-)
-{
-    bool r = false;
-    string query = ssprintf("select Gps1_dx, Gps1_dy, Gps2_dx, Gps2_dy from Ships where id = %d", shipId);
-    try {
-        vector<string> result;
-        if (query1row(mysql_, query, result)) {
-            gps1_dx = double_of(result[0]);
-            gps1_dy = double_of(result[1]);
-            gps2_dx = double_of(result[2]);
-            gps2_dy = double_of(result[3]);
-            r = true;
-        }
-    } catch (const exception& e) {
-        cout << "Error reading offsets: %s" << e.what() << endl;
-    }
-    return r;
-}
-
-/*****************************************************************************/
-bool
-DigNetDB::shipExists(
-        const int shipId)
-{
-    bool r = false;
-    string query(ssprintf("select id from Ships where id = %d", shipId));
-    try {
-        vector<string> result;
-        if (query1row(mysql_, query, result)) {
-            r = true;
-        }
-    } catch (const exception& e) {
-        cout << "Error checking for ship existance: %s" << e.what() << endl;
-    }
-    return r;
-}
-
 /*****************************************************************************/
 bool
 DigNetDB::queryWorkArea(
@@ -567,17 +358,85 @@ DigNetDB::queryWorkArea(
     }
 }
 
+/*****************************************************************************/
+/** Number of bits per mark in PACKET_WORKLOG_ROWS. */
+static const unsigned int BITS_IN_MARK = 2;
+
+/** Maximum size of the marks in one PACKET_WORKLOG_ROWS, keeps the packet within a CMR frame. */
+static const unsigned int MAX_WORKLOG_MARK_BYTES = 240;
+
 /*****************************************************************************/
 void
-DigNetDB::logSupplyVoltage(
-        const int    shipId,
-        const double voltage)
+DigNetDB::encodeWorklogRows(
+        const unsigned int              start_row_index,
+        const unsigned int              nrows,
+        std::vector<unsigned char>&     responseBuffer,
+        PACKET_WORKLOG_ROWS*&           responsePacket)
 {
-    std::string insertQuery;
-    ssprintf(insertQuery,
-             "INSERT INTO SupplyVoltages SET ShipID = %d, Reading_Time = now(), SupplyVoltage = %f",
-             shipId, voltage);
-    execute_insert(mysql_, insertQuery);
+    const unsigned int  grid_rows = worklog_.dim1();
+    const unsigned int  ncols = worklog_.dim2();
+    const int nbits = nrows * ncols * BITS_IN_MARK;
+    const int nbytes = (nbits + 7) / 8;
+    responseBuffer.resize(sizeof(PACKET_WORKLOG_ROWS) + nbytes - 1);
+    for (unsigned int i = 0; i < responseBuffer.size(); ++i) {
+        responseBuffer[i] = 0;
+    }
+    responsePacket = reinterpret_cast<PACKET_WORKLOG_ROWS*>(&responseBuffer[0]);
+
+    unsigned int max_id = 0;
+    unsigned int total_bit_index = 0;
+    for (unsigned int i = 0; i < nrows; ++i) {
+        const unsigned int row_index = start_row_index + i;
+        if (row_index >= grid_rows) {
+            // skip bad rows.
+            continue;
+        }
+        for (unsigned int col_index = 0; col_index < ncols; ++col_index) {
+            const unsigned int byte_index = total_bit_index / 8;
+            const unsigned int bit_shift = (8 - BITS_IN_MARK) - (total_bit_index & 0x07);
+            const unsigned int mark = worklog_[row_index][col_index];
+            uint8_t&   b = responsePacket->marks[byte_index];
+
+            b |= mark << bit_shift;
+
+            total_bit_index += BITS_IN_MARK;
+            max_id = mymax<unsigned int>(worklog_ids_[row_index][col_index], max_id);
+        }
+    }
+    responsePacket->latest_timestamp = max_id;
+    responsePacket->start_row = start_row_index;
+}
+
+/*****************************************************************************/
+void
+DigNetDB::encodeWorklogMarks(
+        const unsigned int              start_row_index,
+        const unsigned int              start_col_index,
+        const unsigned int              nmarks,
+        std::vector<unsigned char>&     responseBuffer)
+{
+    const unsigned int  ncols = worklog_.dim2();
+    const unsigned int  nbytes = (nmarks * BITS_IN_MARK + 7) / 8;
+    responseBuffer.assign(sizeof(PACKET_WORKLOG_CHANGED_ROWS) + nbytes - 1, 0);
+    PACKET_WORKLOG_CHANGED_ROWS* responsePacket = reinterpret_cast<PACKET_WORKLOG_CHANGED_ROWS*>(&responseBuffer[0]);
+
+    unsigned int max_id = 0;
+    unsigned int row_index = start_row_index;
+    unsigned int col_index = start_col_index;
+    for (unsigned int i = 0; i < nmarks; ++i) {
+        const unsigned int total_bit_index = i * BITS_IN_MARK;
+        const unsigned int bit_shift = (8 - BITS_IN_MARK) - (total_bit_index & 0x07);
+        responsePacket->marks[total_bit_index / 8] |= worklog_[row_index][col_index] << bit_shift;
+        max_id = mymax<unsigned int>(worklog_ids_[row_index][col_index], max_id);
+        if (++col_index >= ncols) {
+            col_index = 0;
+            ++row_index;
+        }
+    }
+    responsePacket->latest_timestamp = max_id;
+    responsePacket->start_row = start_row_index;
+    responsePacket->start_col = start_col_index;
+    responsePacket->nmarks = nmarks;
 }
 
 /*****************************************************************************/
@@ -588,82 +447,11 @@ DigNetDB::executeWorklogQueryByIndices(
         PACKET_WORKLOG_ROWS*&                   responsePacket
 )
 {
-    const unsigned int BITS_IN_MARK = 2;
     refreshArea();
     if (Area.IsValid() && queryPacket.nrows > 0) {
-        const WorkArea wa = Area();
-        const double        length = sqrt(sqr(wa.Start_X - wa.End_X) + sqr(wa.Start_Y - wa.End_Y));
-        const int  nrows = utils::round(length / wa.Step_Forward);
-        const int  ncols = static_cast<int>(wa.Pos_Sideways.size()) - 1;
-
-        if (nrows > 0 && ncols > 0) {
-            try {
-                // 1. Fetch the current worklog.
-                TNT::Array2D<unsigned int>    ids(nrows, ncols);
-                TNT::Array2D<WORKMARK>     worklog(nrows, ncols);
-                {
-                    for (int i = 0; i < nrows; ++i) {
-                      for (int j = 0; j < ncols; ++j) {
-                            ids[i][j] = 0;
-                            worklog[i][j] = WORKMARK_EMPTY;
-                        }
-                    }
-                    std::vector<std::vector<std::string> > results;
-                    querytable(
-                        mysql_,
-                        "SELECT id, Forward_Index,Sideways_Index,Mark FROM WorkLog ORDER BY id ASC",
-                        results);
-                    for (unsigned int i = 0; i < results.size(); ++i) {
-                        const std::vector<std::string>& row = results[i];
-                        int row_index = 0;
-                        int col_index = 0;
-                        int mark = 0;
-                        int id = 0;
-                        if (int_of(row[0], id), int_of(row[1], row_index) && int_of(row[2], col_index) && int_of(row[3], mark)) {
-                            if (row_index >= 0 && row_index < nrows && col_index >= 0 && col_index < ncols && mark >= 0 && mark < WORKMARK_SIZE) {
-                                worklog[row_index][col_index] = static_cast<WORKMARK>(mark);
-                                ids[row_index][col_index] = id;
-                            }
-                        }
-                    }
-                }
-
-                // 2. Fill responseBuffer & responsePacket.
-                const int nbits = queryPacket.nrows * ncols * BITS_IN_MARK;
-                const int nbytes = (nbits + 7) / 8;
-                responseBuffer.resize(sizeof(PACKET_WORKLOG_ROWS) + nbytes - 1);
-                for (unsigned int i = 0; i < responseBuffer.size(); ++i) {
-                    responseBuffer[i] = 0;
-                }
-                responsePacket = reinterpret_cast<PACKET_WORKLOG_ROWS*>(&responseBuffer[0]);
-
-                unsigned int max_id = 0;
-                unsigned int total_bit_index = 0;
-                for (unsigned int i = 0; i < queryPacket.nrows; ++i) {
-                    const int row_index = queryPacket.start_row_index + i;
-                    if (row_index >= nrows) {
-                        // skip bad rows.
-                        continue;
-                    }
-                    for (int col_index = 0; col_index < ncols; ++col_index) {
-                        const unsigned int byte_index = total_bit_index / 8;
-                        const unsigned int bit_shift = (8 - BITS_IN_MARK) - (total_bit_index & 0x07);
-                        const unsigned int mark = worklog[row_index][col_index];
-                        uint8_t&   b = responsePacket->marks[byte_index];
-
-                        b |= mark << bit_shift;
-
-                        total_bit_index += BITS_IN_MARK;
-                        max_id = mymax<unsigned int>(ids[row_index][col_index], max_id);
-                    }
-                }
-                responsePacket->latest_timestamp = max_id;
-                responsePacket->start_row = queryPacket.start_row_index;
-
-                return true;
-            } catch (const std::exception& e) {
-                cout << "DigNetDB::executeWorklogQueryByIndices: error: << " << e.what() << endl;
-            }
+        if (worklog_valid_ && worklog_.dim1() > 0 && worklog_.dim2() > 0) {
+            encodeWorklogRows(queryPacket.start_row_index, queryPacket.nrows, responseBuffer, responsePacket);
+            return true;
         }
     } else {
         cout << "executeWorklogQueryByIndices: unable to continue without working area." << endl;
@@ -672,6 +460,61 @@ DigNetDB::executeWorklogQueryByIndices(
     return false;
 }
 
+/*****************************************************************************/
+bool
+DigNetDB::executeWorklogQueryByTimestamp(
+        const PACKET_WORKLOG_QUERY_BY_TIMESTAMP&        queryPacket,
+        std::vector<std::vector<unsigned char> >&       responseBuffers
+)
+{
+    responseBuffers.clear();
+    refreshArea();
+    if (!Area.IsValid() || !worklog_valid_) {
+        cout << "executeWorklogQueryByTimestamp: unable to continue without working area." << endl;
+        return false;
+    }
+
+    const unsigned int  nrows = worklog_.dim1();
+    const unsigned int  ncols = worklog_.dim2();
+    if (nrows == 0 || ncols == 0) {
+        return false;
+    }
+    const unsigned int  max_marks = MAX_WORKLOG_MARK_BYTES * 8 / BITS_IN_MARK;
+
+    // 1. Send runs of consecutive changed rows, split to fit in a packet. Rows wider than
+    // a packet are split too.
+    unsigned int            row_index = 0;
+    while (row_index < nrows) {
+        unsigned int run = 0;
+        while (row_index + run < nrows) {
+            bool changed = false;
+            for (unsigned int col_index = 0; col_index < ncols && !changed; ++col_index) {
+                changed = worklog_ids_[row_index + run][col_index] > queryPacket.timestamp;
+            }
+            if (!changed) {
+                break;
+            }
+            ++run;
+        }
+        if (run > 0) {
+            const unsigned int  run_marks = run * ncols;
+            for (unsigned int first = 0; first < run_marks; first += max_marks) {
+                responseBuffers.push_back(std::vector<unsigned char>());
+                encodeWorklogMarks(row_index + first / ncols, first % ncols, mymin<unsigned int>(max_marks, run_marks - first), responseBuffers.back());
+            }
+            row_index += run;
+        } else {
+            ++row_index;
+        }
+    }
+
+    // 2. Nothing changed: latest_timestamp 0 tells the client to discard the marks.
+    if (responseBuffers.size() == 0) {
+        responseBuffers.push_back(std::vector<unsigned char>(sizeof(PACKET_WORKLOG_CHANGED_ROWS), 0));
+    }
+    return true;
+}
+
 /*****************************************************************************/
 bool
 DigNetDB::executeWorklogSetmark(
@@ -683,14 +526,19 @@ DigNetDB::executeWorklogSetmark(
 {
     try {
         // 1. Insert the packet.
-        execute_insert(
-            mysql_,
-            ssprintf("INSERT INTO WorkLog "
-                     "(Change_Time, Ship_Id, Forward_Index, Sideways_Index, Mark) "
-                     "VALUES (now(), %d, %d, %d, %d)",
-                     shipId, (int)queryPacket.row_index, (int)queryPacket.col_index, (int)queryPacket.workmark));
-
-        // 2. Return response.
+        const unsigned int id = insertWorkmark(shipId, queryPacket.row_index, queryPacket.col_index, queryPacket.workmark);
+
+        // 2. Update the grid.
+        const int row_index = queryPacket.row_index;
+        const int col_index = queryPacket.col_index;
+        if (worklog_valid_
+            && row_index >= 0 && row_index < worklog_.dim1() && col_index >= 0 && col_index < worklog_.dim2()
+            && queryPacket.workmark < WORKMARK_SIZE) {
+            worklog_[row_index][col_index] = static_cast<WORKMARK>(queryPacket.workmark);
+            worklog_ids_[row_index][col_index] = id;
+        }
+
+        // 3. Return response.
         PACKET_WORKLOG_QUERY_BY_INDICES qpacket;
         qpacket.start_row_index = queryPacket.row_index;
         qpacket.nrows = 1;
@@ -4,10 +4,17 @@
 #define DigNetDB_h_
 
 #include <string>  // std::string
+#include <vector>  // std::vector
+#include <map>     // std::map
+#include <memory>  // std::auto_ptr
+#include <time.h>  // time_t
 
 #include <utils/util.h>
+#include <tnt_array2d.h>    // TNT::Array2D.
 
 #include "DigNetMessages.h"
+#include "DigNetDBWriter.h" // SHIP_POSITION_ROW, SHIP_STATE, DBWRITER_STATISTICS
+#include "PositionStore.h"
 
 
 /** Position types when saving coordinates to DB */
@@ -16,44 +23,152 @@ typedef enum {
     POSITION_TYPE_MIXGPS = 'M'   ///< Calculated with MixGPS using GPS data
 } POSITION_TYPE;
 
-/** GpsServer database. */
+/** One row of the WorkLog table. */
+typedef struct {
+    unsigned int    id;             ///< Row ID, increasing
+    time_t          change_time;
+    int             ship_id;
+    int             row_index;      ///< Forward_Index
+    int             col_index;      ///< Sideways_Index
+    int             mark;           ///< \c WORKMARK
+} WORKLOG_ROW;
+
+/** Ships row in the cache of \c DigNetDB. */
+typedef struct {
+    SHIP_STATE      state;
+    time_t          loaded_time;    ///< Read from DB at
+    time_t          written_time;   ///< Last update handed to \c writeShipUpdate at, 0 if none
+} CACHED_SHIP;
+
+/**
+GpsServer database.
+
+Storage is left to the implementations: \c DigNetDBMySQL keeps everything in MySQL,
+\c DigNetDBMemory in the memory of the server. Ship state cache and the worklog grid of the
+WorkArea are common and kept here.
+*/
 class DigNetDB {
-    private:
-        void* mysql_;                       ///< MySql connection
-        utils::Option<WorkArea>  Area;
-    private:
+    protected:
+        utils::Option<WorkArea>     Area;
+        std::map<int, CACHED_SHIP>  ships_;         ///< Cached Ships rows, keyed by ship ID. Updates go here and are written by \c flushShips
+        std::map<int, time_t>       missing_ships_; ///< Ship IDs not found in DB, by the time they were looked for
+        TNT::Array2D<WORKMARK>      worklog_;       ///< Latest mark of every cell of the WorkArea, valid if \c worklog_valid_
+        TNT::Array2D<unsigned int>  worklog_ids_;   ///< WorkLog id of the latest mark of every cell
+        bool                        worklog_valid_; ///< Grids are loaded for the current \c Area
+        std::auto_ptr<PositionStore> position_store_;   ///< Positions go here instead of \c writePosition, if set
+
+        DigNetDB();
+
+        /** Sets the current \c Area, reloads the worklog grid when Change_Time has changed. */
+        void
+        setArea(
+            const WorkArea&     area);
+
+        /** Loads worklog grid for the current \c Area from \c readWorklog. */
         bool
-        refreshArea();
+        loadWorklog();
+
+        /** Reads WorkArea, calls \c setArea. Returns false if there is none. */
+        virtual bool
+        refreshArea() = 0;
+
+        /** Reads all the WorkLog rows, ordered by id. Throws \c std::runtime_error on errors. */
+        virtual void
+        readWorklog(
+            std::vector<WORKLOG_ROW>&   rows) = 0;
+
+        /** Adds a WorkLog row, returns its id. Throws \c std::runtime_error on errors. */
+        virtual unsigned int
+        insertWorkmark(
+            const int           shipId,
+            const int           row_index,
+            const int           col_index,
+            const int           mark) = 0;
+
+        /** Reads state of the ship. Returns false if ship is not in DB. */
+        virtual bool
+        readShipState(
+            const int           shipId,
+            SHIP_STATE&         state) = 0;
+
+        /** Writes the fields of \c update.state.dirty. */
+        virtual void
+        writeShipUpdate(
+            const SHIP_UPDATE&  update) = 0;
+
+        /** Adds a ShipPosition row. */
+        virtual void
+        writePosition(
+            const SHIP_POSITION_ROW& row) = 0;
+    private:
+        /** Stores a position to \c position_store_, or with \c writePosition if there is none or it fails. */
+        void
+        storePosition(
+            const SHIP_POSITION_ROW& row);
+
+        /** Encodes given rows of the worklog grid into PACKET_WORKLOG_ROWS. Grid must be valid. */
+        void
+        encodeWorklogRows(
+            const unsigned int              start_row_index,
+            const unsigned int              nrows,
+            std::vector<unsigned char>&     responseBuffer,
+            PACKET_WORKLOG_ROWS*&           responsePacket);
+
+        /** Encodes \c nmarks marks of the worklog grid, starting from the given row and column and
+            continuing row by row, into PACKET_WORKLOG_CHANGED_ROWS. Grid must be valid. */
+        void
+        encodeWorklogMarks(
+            const unsigned int              start_row_index,
+            const unsigned int              start_col_index,
+            const unsigned int              nmarks,
+            std::vector<unsigned char>&     responseBuffer);
+
+        /** Returns cached state of the ship, loading it from DB on first use. Returns 0 if ship is not in DB.
+            A ship not found isn't looked for again for a while.
+        */
+        SHIP_STATE*
+        shipState(
+            const int shipId);
     public:
-        /** Connects to the localhost MySQL database.
+        virtual ~DigNetDB();
+
+        /** Stores positions to \c store instead of ShipPosition table from now on. Takes ownership.
          */
-        DigNetDB(
-            const std::string& database,
-            const std::string& username,
-            const std::string& password);
+        void
+        setPositionStore(
+            PositionStore*  store);
 
-        ~DigNetDB();
+        /** Returns the position store, 0 if positions go to ShipPosition table.
+         */
+        const PositionStore*
+        positionStore() const { return position_store_.get(); }
+
+        /** Writes one merged update for every ship changed since last call. Call about once per second.
+            Drops cached ships and missing ships that have expired, they are read from DB again when needed.
+         */
+        virtual void
+        flushShips();
 
         /** Every time ships sends something it will update Contact_Time
          */
-        void 
+        void
         updateContactTime(
             const int shipId);
 
         /** Every time ship GPS sends something it will update GPS information
          */
-        void 
+        void
         updateGps(
-            const int       shipId, 
-            const int       gpsNum, 
+            const int       shipId,
+            const int       gpsNum,
             const double    x,
             const double    y);
 
         /** Every time ships send heading information it will update it in DB
          */
-        void 
+        void
         updateShipHeading(
-            const int       shipId, 
+            const int       shipId,
             const double    heading);
 
         /** Adds a new ship position of ship to database
@@ -104,7 +219,7 @@ class DigNetDB {
             const double    x,
             const double    y,
             const double    dir);
-        
+
         /** Returns ship shadow information in parameters
         \param[in] shipId ID of ship
         \param[out] x shadow X coordinate
@@ -117,7 +232,7 @@ class DigNetDB {
             double&     x,
             double&     y,
             double&     dir);
-        
+
         /** Returns last known ship position.
         \param[in] shipId ID of ship
         \param[out] x ship X coordinate
@@ -137,17 +252,17 @@ class DigNetDB {
         \param[out] minimum minimum safe voltage
         \param[out] secondsFromLastRead time since last information was received
         */
-        bool
+        virtual bool
         getShipVoltageInfo(
             const int           shipId,
             double&             lastReading,
             double&             minimum,
             int&                secondsFromLastRead,
-            utils::my_time&     timeLastRead);
-        
+            utils::my_time&     timeLastRead) = 0;
+
         /** If there is no ship with given IMEI it returns false. If it exists function returns the ship ID, name and other needed information
          */
-        bool 
+        virtual bool
         registerShip(
             int&                shipId,
             int&                groupId,
@@ -162,22 +277,22 @@ class DigNetDB {
             const std::string&  firmwareVersion,
             const std::string&  firmwareBuildDate,
             const std::string&  phone
-        );
+        ) = 0;
         /** Reads given ship GPS offsets from DB
         */
-        bool 
+        virtual bool
         getShipGpsOffsets(
             const int   shipId,
             double&     gps1_dx,
             double&     gps1_dy,
             double&     gps2_dx,
             double&     gps2_dy
-        );
+        ) = 0;
         /** Returns true if there is a ship with given ID registered in DB
         */
-        bool 
+        virtual bool
         shipExists(
-            const int shipId);
+            const int shipId) = 0;
 
         /** Query first workarea in the table. */
         bool
@@ -188,11 +303,15 @@ class DigNetDB {
         \param[in] shipId Ship identifier.
         \param[in] voltage Voltage, volts.
         */
-        void
+        virtual void
         logSupplyVoltage(
             const int  shipId,
             const double voltage
-        );
+        ) = 0;
+
+        /** Returns statistics of the background writer queue. */
+        virtual DBWRITER_STATISTICS
+        writerStatistics() = 0;
 
         /** Query by worklog indices.
         \param[in] queryPacket Query, gives starting row and number of rows.
@@ -206,6 +325,17 @@ class DigNetDB {
             PACKET_WORKLOG_ROWS*&                   responsePacket
         );
 
+        /** Query rows changed after the given timestamp (WorkLog id).
+        \param[in] queryPacket Query, gives the latest timestamp known to the client.
+        \param[out] responseBuffers PACKET_WORKLOG_CHANGED_ROWS packets, runs of changed rows split to fit in a packet.
+            If nothing has changed, a single packet with latest_timestamp 0.
+         */
+        bool
+        executeWorklogQueryByTimestamp(
+            const PACKET_WORKLOG_QUERY_BY_TIMESTAMP&    queryPacket,
+            std::vector<std::vector<unsigned char> >&   responseBuffers
+        );
+
         /** Set the worklog mark and prepare a response.
         \param[in] queryPacket Query, gives starting row and number of rows.
         \param[out] responseBuffer Buffer for response packet.
@@ -221,4 +351,3 @@ class DigNetDB {
 }; // class DigNetDB
 
 #endif /* DigNetDB_h_ */
-
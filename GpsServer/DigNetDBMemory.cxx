@@ -0,0 +1,480 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdexcept>
+#include <fstream>  // ifstream
+#include <iostream> // cout
+
+#include <utils/util.h>
+#include <utils/math.h>     // mymax
+
+#include <stdio.h>      // fopen, rename
+#include <string.h>     // memset
+#include <errno.h>
+#include <unistd.h>     // unlink
+#include <sys/time.h>   // gettimeofday
+
+#include "DigNetDBMemory.h"
+
+using namespace std;
+using namespace utils;
+
+/*****************************************************************************/
+/** Value for a DigNet message, in doublequotes. Doublequotes can't be escaped, they are replaced. */
+static string
+quoted(
+        const string&   s)
+{
+    string  r("\"");
+    for (unsigned int i = 0; i < s.size(); ++i) {
+        r += s[i] == '"' ? '\'' : s[i];
+    }
+    r += "\"";
+    return r;
+}
+
+/*****************************************************************************/
+static bool
+get_time(
+        const map<string, string>&  args,
+        const string&               key,
+        time_t&                     value)
+{
+    int t = 0;
+    if (GetArg(args, key, t)) {
+        value = t;
+        return true;
+    }
+    return false;
+}
+
+/*****************************************************************************/
+static unsigned int
+milliseconds_since(
+        const struct timeval&   start)
+{
+    struct timeval  now;
+    gettimeofday(&now, 0);
+    return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+}
+
+/*****************************************************************************/
+DigNetDBMemory::DigNetDBMemory(
+        const std::string&  snapshot_file,
+        const unsigned int  snapshot_interval,
+        const unsigned int  max_positions
+) :
+        snapshot_file_(snapshot_file),
+        snapshot_interval_(snapshot_interval),
+        last_snapshot_(time(0)),
+        max_positions_(max_positions)
+{
+    memset(&statistics_, 0, sizeof(statistics_));
+    statistics_.queue_size = max_positions;
+    if (snapshot_file_.size() > 0) {
+        loadSnapshot();
+    }
+    refreshArea();
+}
+
+/*****************************************************************************/
+DigNetDBMemory::~DigNetDBMemory()
+{
+    DigNetDB::flushShips();
+    if (snapshot_file_.size() > 0) {
+        saveSnapshot();
+    }
+}
+
+/*****************************************************************************/
+void
+DigNetDBMemory::addShip(
+        const MEMORY_SHIP&  ship)
+{
+    std::map<int, MEMORY_SHIP>::iterator it = ships_table_.find(ship.id);
+    if (it != ships_table_.end()) {
+        imeis_.erase(it->second.imei);
+    }
+    ships_table_[ship.id] = ship;
+    imeis_[ship.imei] = ship.id;
+}
+
+/*****************************************************************************/
+void
+DigNetDBMemory::loadSnapshot()
+{
+    ifstream    in(snapshot_file_.c_str());
+    if (!in.is_open()) {
+        cout << "DigNetDBMemory: no snapshot " << snapshot_file_ << ", starting with empty database." << endl;
+        return;
+    }
+
+    string          line;
+    unsigned int    line_number = 0;
+    while (getline(in, line)) {
+        ++line_number;
+        if (line.size() > 0 && line[line.size() - 1] == '\r') {
+            line.resize(line.size() - 1);
+        }
+        if (line.size() == 0 || line[0] == '#') {
+            continue;
+        }
+        string              name;
+        map<string, string> args;
+        bool                ok = true;
+        try {
+            ParseDigNetMessage(name, args, line);
+        } catch (const std::exception& e) {
+            ok = false;
+        }
+        if (ok && name == "ship") {
+            MEMORY_SHIP ship;
+            ship.group_id = 0;
+            ship.gps1_dx = ship.gps1_dy = ship.gps2_dx = ship.gps2_dy = 0;
+            ship.supply_voltage_limit = 0;
+            memset(&ship.state, 0, sizeof(ship.state));
+            ship.state.shadow_x = -1;
+            ship.has_voltage = false;
+            ship.voltage = 0;
+            ship.voltage_time = 0;
+            ok = GetArg(args, "id", ship.id) && GetArg(args, "IMEI", ship.imei);
+            GetArg(args, "GroupId", ship.group_id);
+            GetArg(args, "Name", ship.name);
+            GetArg(args, "Firmware_Name", ship.firmware_name);
+            GetArg(args, "Firmware_Version", ship.firmware_version);
+            GetArg(args, "Firmware_Build_date", ship.firmware_build_date);
+            GetArg(args, "Phone_no", ship.phone);
+            GetArg(args, "SupplyVoltageLimit", ship.supply_voltage_limit);
+            GetArg(args, "Gps1_dx", ship.gps1_dx);
+            GetArg(args, "Gps1_dy", ship.gps1_dy);
+            GetArg(args, "Gps2_dx", ship.gps2_dx);
+            GetArg(args, "Gps2_dy", ship.gps2_dy);
+            SHIP_STATE& state = ship.state;
+            get_time(args, "Contact_Time", state.contact_time);
+            get_time(args, "GPS1_Time", state.gps_time[0]);
+            GetArg(args, "GPS1_X", state.gps_x[0]);
+            GetArg(args, "GPS1_Y", state.gps_y[0]);
+            get_time(args, "GPS2_Time", state.gps_time[1]);
+            GetArg(args, "GPS2_X", state.gps_x[1]);
+            GetArg(args, "GPS2_Y", state.gps_y[1]);
+            get_time(args, "Heading_Time", state.heading_time);
+            GetArg(args, "Heading", state.heading);
+            GetArg(args, "Shadow_X", state.shadow_x);
+            GetArg(args, "Shadow_Y", state.shadow_y);
+            GetArg(args, "Shadow_Dir", state.shadow_dir);
+            ship.has_voltage =
+                GetArg(args, "SupplyVoltage", ship.voltage) &&
+                get_time(args, "SupplyVoltage_Time", ship.voltage_time) &&
+                GetArg(args, "SupplyVoltage_Reading_Time", ship.voltage_my_time);
+            if (ok) {
+                addShip(ship);
+            }
+        } else if (ok && name == DIGNETMESSAGE_WORKAREA) {
+            WorkArea    wa;
+            ok = GetArg(args, wa);
+            if (ok) {
+                work_area_ = wa;
+            }
+        } else if (ok && name == "worklog") {
+            WORKLOG_ROW row;
+            int         id = 0;
+            memset(&row, 0, sizeof(row));
+            ok =
+                GetArg(args, "id", id) &&
+                get_time(args, "Change_Time", row.change_time) &&
+                GetArg(args, "Ship_Id", row.ship_id) &&
+                GetArg(args, "Forward_Index", row.row_index) &&
+                GetArg(args, "Sideways_Index", row.col_index) &&
+                GetArg(args, "Mark", row.mark);
+            row.id = id;
+            if (ok && worklog_rows_.size() > 0 && row.id <= worklog_rows_.back().id) {
+                ok = false;
+            }
+            if (ok) {
+                worklog_rows_.push_back(row);
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            throw runtime_error(ssprintf("%s:%d: invalid line: %s", snapshot_file_.c_str(), line_number, line.c_str()));
+        }
+    }
+    cout << "DigNetDBMemory: loaded " << ships_table_.size() << " ships, " << worklog_rows_.size()
+         << " worklog rows from " << snapshot_file_ << "." << endl;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMemory::saveSnapshot()
+{
+    struct timeval  start;
+    gettimeofday(&start, 0);
+    last_snapshot_ = start.tv_sec;
+
+    const string    tmp_file(snapshot_file_ + ".tmp");
+    FILE*           f = fopen(tmp_file.c_str(), "w");
+    if (f == 0) {
+        cout << "DigNetDBMemory: can't write " << tmp_file << ", errno " << errno << endl;
+        ++statistics_.rows_failed;
+        return false;
+    }
+    fprintf(f, "# DigNet database snapshot, written by GpsServer.\n");
+    for (std::map<int, MEMORY_SHIP>::const_iterator it = ships_table_.begin(); it != ships_table_.end(); ++it) {
+        const MEMORY_SHIP&  ship = it->second;
+        const SHIP_STATE&   state = ship.state;
+        fprintf(f, "ship id=%d GroupId=%d IMEI=%s Name=%s Firmware_Name=%s Firmware_Version=%s Firmware_Build_date=%s Phone_no=%s"
+            " SupplyVoltageLimit=%g Gps1_dx=%g Gps1_dy=%g Gps2_dx=%g Gps2_dy=%g",
+            ship.id, ship.group_id, quoted(ship.imei).c_str(), quoted(ship.name).c_str(),
+            quoted(ship.firmware_name).c_str(), quoted(ship.firmware_version).c_str(),
+            quoted(ship.firmware_build_date).c_str(), quoted(ship.phone).c_str(),
+            ship.supply_voltage_limit, ship.gps1_dx, ship.gps1_dy, ship.gps2_dx, ship.gps2_dy);
+        fprintf(f, " Contact_Time=%ld GPS1_Time=%ld GPS1_X=%.3f GPS1_Y=%.3f GPS2_Time=%ld GPS2_X=%.3f GPS2_Y=%.3f"
+            " Heading_Time=%ld Heading=%.2f Shadow_X=%.3f Shadow_Y=%.3f Shadow_Dir=%.2f",
+            static_cast<long>(state.contact_time),
+            static_cast<long>(state.gps_time[0]), state.gps_x[0], state.gps_y[0],
+            static_cast<long>(state.gps_time[1]), state.gps_x[1], state.gps_y[1],
+            static_cast<long>(state.heading_time), state.heading,
+            state.shadow_x, state.shadow_y, state.shadow_dir);
+        if (ship.has_voltage) {
+            fprintf(f, " SupplyVoltage=%.2f SupplyVoltage_Time=%ld SupplyVoltage_Reading_Time=%s",
+                ship.voltage, static_cast<long>(ship.voltage_time), quoted(ship.voltage_my_time.ToString()).c_str());
+        }
+        fprintf(f, "\n");
+    }
+    if (work_area_.IsValid()) {
+        const WorkArea& wa = work_area_();
+        fprintf(f, "%s Change_Time=%s Start=%.3f;%.3f End=%.3f;%.3f Step_Forward=%.3f Pos_Sideways=\"",
+            DIGNETMESSAGE_WORKAREA, quoted(wa.Change_Time.ToString()).c_str(),
+            wa.Start_X, wa.Start_Y, wa.End_X, wa.End_Y, wa.Step_Forward);
+        for (unsigned int i = 0; i < wa.Pos_Sideways.size(); ++i) {
+            fprintf(f, i > 0 ? ";%.3f" : "%.3f", wa.Pos_Sideways[i]);
+        }
+        fprintf(f, "\"\n");
+    }
+    for (unsigned int i = 0; i < worklog_rows_.size(); ++i) {
+        const WORKLOG_ROW&  row = worklog_rows_[i];
+        fprintf(f, "worklog id=%u Change_Time=%ld Ship_Id=%d Forward_Index=%d Sideways_Index=%d Mark=%d\n",
+            row.id, static_cast<long>(row.change_time), row.ship_id, row.row_index, row.col_index, row.mark);
+    }
+    const bool  ok = ferror(f) == 0;
+    if (fclose(f) != 0 || !ok || rename(tmp_file.c_str(), snapshot_file_.c_str()) != 0) {
+        cout << "DigNetDBMemory: can't write " << snapshot_file_ << ", errno " << errno << endl;
+        unlink(tmp_file.c_str());
+        ++statistics_.rows_failed;
+        return false;
+    }
+
+    ++statistics_.flushes;
+    statistics_.last_flush_ms = milliseconds_since(start);
+    statistics_.max_flush_ms = mymax<unsigned int>(statistics_.max_flush_ms, statistics_.last_flush_ms);
+    return true;
+}
+
+/*****************************************************************************/
+void
+DigNetDBMemory::flushShips()
+{
+    DigNetDB::flushShips();
+    if (snapshot_file_.size() > 0 && snapshot_interval_ > 0 && time(0) >= last_snapshot_ + static_cast<time_t>(snapshot_interval_)) {
+        saveSnapshot();
+    }
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMemory::refreshArea()
+{
+    if (!work_area_.IsValid()) {
+        return false;
+    }
+    setArea(work_area_());
+    return true;
+}
+
+/*****************************************************************************/
+void
+DigNetDBMemory::readWorklog(
+        std::vector<WORKLOG_ROW>& rows)
+{
+    rows = worklog_rows_;
+}
+
+/*****************************************************************************/
+unsigned int
+DigNetDBMemory::insertWorkmark(
+        const int   shipId,
+        const int   row_index,
+        const int   col_index,
+        const int   mark)
+{
+    WORKLOG_ROW row;
+    row.id = worklog_rows_.size() > 0 ? worklog_rows_.back().id + 1 : 1;
+    row.change_time = time(0);
+    row.ship_id = shipId;
+    row.row_index = row_index;
+    row.col_index = col_index;
+    row.mark = mark;
+    worklog_rows_.push_back(row);
+    return row.id;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMemory::readShipState(
+        const int   shipId,
+        SHIP_STATE& state)
+{
+    std::map<int, MEMORY_SHIP>::const_iterator it = ships_table_.find(shipId);
+    if (it == ships_table_.end()) {
+        return false;
+    }
+    state = it->second.state;
+    state.dirty = 0;
+    return true;
+}
+
+/*****************************************************************************/
+void
+DigNetDBMemory::writeShipUpdate(
+        const SHIP_UPDATE&  update)
+{
+    std::map<int, MEMORY_SHIP>::iterator it = ships_table_.find(update.ship_id);
+    if (it != ships_table_.end()) {
+        it->second.state = update.state;
+        it->second.state.dirty = 0;
+        ++statistics_.rows_written;
+    }
+}
+
+/*****************************************************************************/
+void
+DigNetDBMemory::writePosition(
+        const SHIP_POSITION_ROW& row)
+{
+    if (max_positions_ == 0) {
+        ++statistics_.rows_dropped;
+        return;
+    }
+    if (positions_.size() >= max_positions_) {
+        positions_.pop_front();
+        ++statistics_.rows_dropped;
+    }
+    positions_.push_back(row);
+    ++statistics_.rows_written;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMemory::getShipVoltageInfo(
+        const int           shipId,
+        double&             lastReading,
+        double&             minimum,
+        int&                secondsFromLastRead,
+        my_time&            timeLastRead)
+{
+    std::map<int, MEMORY_SHIP>::const_iterator it = ships_table_.find(shipId);
+    if (it == ships_table_.end() || !it->second.has_voltage) {
+        return false;
+    }
+    const MEMORY_SHIP&  ship = it->second;
+    lastReading = ship.voltage;
+    minimum = ship.supply_voltage_limit;
+    secondsFromLastRead = time(0) - ship.voltage_time;
+    timeLastRead = ship.voltage_my_time;
+    return true;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMemory::registerShip(
+        int&            shipId,
+        int&            groupId,
+        string&         name,
+        double&         gps1_dx,
+        double&         gps1_dy,
+        double&         gps2_dx,
+        double&         gps2_dy,
+        double&         supplyVoltageLimit,
+        const string&   imei,
+        const string&   firmwareName,
+        const string&   firmwareVersion,
+        const string&   firmwareBuildDate,
+        const string&   phone
+)
+{
+    std::map<std::string, int>::const_iterator it = imeis_.find(imei);
+    if (it == imeis_.end()) {
+        // Ship doesn't exist, abort
+        return false;
+    }
+    MEMORY_SHIP&    ship = ships_table_[it->second];
+    shipId = ship.id;
+    groupId = ship.group_id;
+    name = ship.name;
+    gps1_dx = ship.gps1_dx;
+    gps1_dy = ship.gps1_dy;
+    gps2_dx = ship.gps2_dx;
+    gps2_dy = ship.gps2_dy;
+    supplyVoltageLimit = ship.supply_voltage_limit;
+    // If firmware version differs then update
+    if (ship.firmware_version != firmwareVersion) {
+        ship.firmware_name = firmwareName;
+        ship.firmware_version = firmwareVersion;
+        ship.firmware_build_date = firmwareBuildDate;
+    }
+    return true;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMemory::getShipGpsOffsets(
+        const int   shipId,
+        double&     gps1_dx,
+        double&     gps1_dy,
+        double&     gps2_dx,
+        double&     gps2_dy
+)
+{
+    std::map<int, MEMORY_SHIP>::const_iterator it = ships_table_.find(shipId);
+    if (it == ships_table_.end()) {
+        return false;
+    }
+    gps1_dx = it->second.gps1_dx;
+    gps1_dy = it->second.gps1_dy;
+    gps2_dx = it->second.gps2_dx;
+    gps2_dy = it->second.gps2_dy;
+    return true;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMemory::shipExists(
+        const int shipId)
+{
+    return ships_table_.find(shipId) != ships_table_.end();
+}
+
+/*****************************************************************************/
+void
+DigNetDBMemory::logSupplyVoltage(
+        const int    shipId,
+        const double voltage)
+{
+    std::map<int, MEMORY_SHIP>::iterator it = ships_table_.find(shipId);
+    if (it != ships_table_.end()) {
+        MEMORY_SHIP&    ship = it->second;
+        ship.has_voltage = true;
+        ship.voltage = voltage;
+        ship.voltage_time = time(0);
+        ship.voltage_my_time = my_time_of_now();
+    }
+}
+
+/*****************************************************************************/
+DBWRITER_STATISTICS
+DigNetDBMemory::writerStatistics()
+{
+    statistics_.queue_depth = positions_.size();
+    return statistics_;
+}
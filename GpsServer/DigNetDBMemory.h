@@ -0,0 +1,170 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef DigNetDBMemory_h_
+#define DigNetDBMemory_h_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <time.h>   // time_t
+
+#include "DigNetDB.h"
+
+/** Ships row of the memory database. */
+typedef struct {
+    int             id;
+    int             group_id;
+    std::string     imei;
+    std::string     name;
+    std::string     firmware_name;
+    std::string     firmware_version;
+    std::string     firmware_build_date;
+    std::string     phone;
+    double          gps1_dx;
+    double          gps1_dy;
+    double          gps2_dx;
+    double          gps2_dy;
+    double          supply_voltage_limit;
+    SHIP_STATE      state;              ///< Written by \c flushShips
+    bool            has_voltage;        ///< Supply voltage has been logged
+    double          voltage;            ///< Latest supply voltage
+    time_t          voltage_time;       ///< Time of \c voltage
+    utils::my_time  voltage_my_time;    ///< Same, as reported to GpsViewer
+} MEMORY_SHIP;
+
+/**
+GpsServer database in the memory of the server, for benchmarks and for sites without MySQL.
+
+Ships, WorkArea, WorkLog and the latest supply voltages are loaded from the snapshot file at
+startup and saved to it every \c snapshot_interval seconds and at exit. The snapshot is a text
+file of DigNet messages, one per line, so ships can be added with a text editor:
+
+    ship id=1 GroupId=0 IMEI=12345 Name="Dredger" SupplyVoltageLimit=11.5 Gps1_dx=0 Gps1_dy=0 Gps2_dx=20 Gps2_dy=0
+    WorkArea Change_Time="..." Start=6580000;540000 End=6580500;540000 Step_Forward=5 Pos_Sideways="-20;-10;0;10;20"
+    worklog id=1 Change_Time=1234567890 Ship_Id=1 Forward_Index=3 Sideways_Index=2 Mark=1
+
+ShipPosition rows are kept in a bounded queue and are not saved.
+*/
+class DigNetDBMemory : public DigNetDB {
+    private:
+        std::string                     snapshot_file_;     ///< Empty for none
+        unsigned int                    snapshot_interval_; ///< Seconds, 0 to save only at exit
+        time_t                          last_snapshot_;
+        std::map<int, MEMORY_SHIP>      ships_table_;       ///< Ships by ID
+        std::map<std::string, int>      imeis_;             ///< Ship ID by IMEI
+        utils::Option<WorkArea>         work_area_;         ///< WorkArea table
+        std::vector<WORKLOG_ROW>        worklog_rows_;      ///< WorkLog table
+        std::deque<SHIP_POSITION_ROW>   positions_;         ///< Latest ShipPosition rows
+        unsigned int                    max_positions_;     ///< Size limit of \c positions_
+        DBWRITER_STATISTICS             statistics_;
+
+        /** Reads the snapshot file. Throws \c std::runtime_error on errors. */
+        void
+        loadSnapshot();
+
+        /** Writes the snapshot file, replacing the old one when done. Returns false on errors. */
+        bool
+        saveSnapshot();
+
+        /** Adds a ship, replacing the one with the same ID. */
+        void
+        addShip(
+            const MEMORY_SHIP&  ship);
+    protected:
+        bool
+        refreshArea();
+
+        void
+        readWorklog(
+            std::vector<WORKLOG_ROW>&   rows);
+
+        unsigned int
+        insertWorkmark(
+            const int           shipId,
+            const int           row_index,
+            const int           col_index,
+            const int           mark);
+
+        bool
+        readShipState(
+            const int           shipId,
+            SHIP_STATE&         state);
+
+        void
+        writeShipUpdate(
+            const SHIP_UPDATE&  update);
+
+        void
+        writePosition(
+            const SHIP_POSITION_ROW& row);
+    public:
+        /** Loads the snapshot file, if it exists. Throws \c std::runtime_error if it can't be read.
+        \param[in] snapshot_file Snapshot file, empty for none
+        \param[in] snapshot_interval Save snapshot this often, seconds, 0 to save only at exit
+        \param[in] max_positions Keep this many latest ShipPosition rows
+        */
+        DigNetDBMemory(
+            const std::string&  snapshot_file,
+            const unsigned int  snapshot_interval,
+            const unsigned int  max_positions);
+
+        /** Saves the snapshot. */
+        ~DigNetDBMemory();
+
+        /** Also saves the snapshot when \c snapshot_interval has passed. */
+        void
+        flushShips();
+
+        bool
+        getShipVoltageInfo(
+            const int           shipId,
+            double&             lastReading,
+            double&             minimum,
+            int&                secondsFromLastRead,
+            utils::my_time&     timeLastRead);
+
+        bool
+        registerShip(
+            int&                shipId,
+            int&                groupId,
+            std::string&        name,
+            double&             gps1_dx,
+            double&             gps1_dy,
+            double&             gps2_dx,
+            double&             gps2_dy,
+            double&             supplyVoltageLimit,
+            const std::string&  imei,
+            const std::string&  firmwareName,
+            const std::string&  firmwareVersion,
+            const std::string&  firmwareBuildDate,
+            const std::string&  phone
+        );
+
+        bool
+        getShipGpsOffsets(
+            const int   shipId,
+            double&     gps1_dx,
+            double&     gps1_dy,
+            double&     gps2_dx,
+            double&     gps2_dy
+        );
+
+        bool
+        shipExists(
+            const int shipId);
+
+        void
+        logSupplyVoltage(
+            const int  shipId,
+            const double voltage
+        );
+
+        /** Queue is the ShipPosition rows kept, dropped are the rows pushed out of it,
+        flushes are the snapshots written.
+        */
+        DBWRITER_STATISTICS
+        writerStatistics();
+}; // class DigNetDBMemory
+
+#endif /* DigNetDBMemory_h_ */
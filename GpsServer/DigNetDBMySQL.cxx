@@ -0,0 +1,520 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdexcept>
+#include <vector>
+#include <string>
+
+#include <iostream> // cout, ofstream
+
+#include <utils/util.h>
+#include <utils/hxio.h>
+#include <utils/math.h>
+
+#include <mysql.h>
+
+#include <unistd.h>
+#include <assert.h>
+#include <time.h>
+
+#include "DigNetDBMySQL.h"
+
+using namespace std;
+using namespace utils;
+
+/*****************************************************************************/
+static int
+do_query(
+        void*           mysql,
+        const string&   query)
+{
+    //cout<<"Executing query: \""<<query<<"\""<<endl;
+    const int   r = mysql_real_query(reinterpret_cast<MYSQL*>(mysql), query.c_str(), query.size());
+    // cout << "MySQL result:" << r << endl << flush;
+    return r;
+}
+
+/*****************************************************************************/
+/**
+Query just 1 row from the database. FIXME: error handling.
+*/
+static bool
+query1row(
+        void*           mysql,
+        const string&   query,
+        vector<string>& row)
+{
+    //cout<<"Executing query: \""<<query<<"\""<<endl;
+    bool    r = false;
+    MYSQL*  sql = reinterpret_cast<MYSQL*>(mysql);
+    if (do_query(mysql, query) == 0) {
+        MYSQL_RES*  result = mysql_store_result(sql);
+        if (result == 0) {
+            throw runtime_error(ssprintf("query1row: Mysql misbehaved on query %s", query.c_str()));
+        } else {
+            MYSQL_ROW   mysql_row = mysql_fetch_row(result);
+            if (mysql_row != 0) {
+                const int   ncols = mysql_num_fields(result);
+                row.resize(ncols);
+                for (unsigned int i = 0; i < row.size(); ++i) {
+                    row[i] = mysql_row[i];
+                }
+                r = true;
+            }
+            mysql_free_result(result);
+        }
+    } else {
+        // bad error.
+        throw runtime_error(ssprintf("query1row: Invalid query \"%s\" or smth.", query.c_str()));
+    }
+    // unsuccessful.
+    return r;
+}
+
+/*****************************************************************************/
+/** Query a table from the MySQL.
+
+Throws exceptions on errors.
+*/
+static int
+querytable(
+        void*                                   mysql,
+        const std::string&                      query,
+        std::vector<std::vector<std::string> >& results)
+{
+    MYSQL*  sql = reinterpret_cast<MYSQL*>(mysql);
+    // Execute the query.
+    if (do_query(mysql, query) == 0) {
+        results.resize(0);
+        MYSQL_RES*  result = mysql_store_result(sql);
+        if (result == 0) {
+            // There were no results.
+            return mysql_affected_rows(sql);
+        } else {
+            // Fetch the results.
+            const int   ncols = mysql_num_fields(result);
+            MYSQL_ROW   mysql_row;
+            while ((mysql_row = mysql_fetch_row(result)) != 0) {
+                results.resize(results.size() + 1);
+                vector<string>& row = results[results.size()-1];
+                row.resize(ncols);
+                for (unsigned int i = 0; i < row.size(); ++i) {
+                    const char* cell = mysql_row[i];
+                    row[i] = cell == 0 ? "" : cell;
+                }
+            }
+            mysql_free_result(result);
+            return 0;
+        }
+    } else {
+        // bad error.
+        throw runtime_error(ssprintf("query1table: Invalid query \"%s\" or smth.", query.c_str()));
+    }
+    assert(0);
+    return -1;
+}
+
+/*****************************************************************************/
+typedef enum {
+    UPDATE_NULL_THROW,
+    UPDATE_NULL_OK
+} UPDATE_FLAGS;
+
+/**
+Update just 1 row.
+*/
+static bool
+update1row(
+        void*               mysql,
+        const string&       query,
+        const UPDATE_FLAGS  flags = UPDATE_NULL_THROW)
+{
+    //cout<<"update1row query: \""<<query<<"\""<<endl;
+    MYSQL*  sql = reinterpret_cast<MYSQL*>(mysql);
+    if (do_query(mysql, query) == 0) {
+        const int   nrows = mysql_affected_rows(sql);
+        if (flags == UPDATE_NULL_THROW ? (nrows != 1) : (nrows != 1 && nrows != 0)) {
+            throw runtime_error(ssprintf("update1row: Updated %d rows instead of just 1, query: %s", nrows, query.c_str()));
+        }
+        return true;
+    } else {
+        throw runtime_error(ssprintf("update1row: Invalid query \"%s\"or smth.", query.c_str()));
+    }
+    return false;
+}
+
+/*****************************************************************************/
+static string
+escape_string(
+        void*           mysql,
+        const string&   s)
+{
+    MYSQL*  sql = reinterpret_cast<MYSQL*>(mysql);
+    string  buffer;
+
+    buffer.resize(2*s.size() + 1);
+    const unsigned long l = mysql_real_escape_string(sql, &buffer[0], &s[0], s.size());
+    buffer.resize(l);
+
+    return buffer;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMySQL::refreshArea()
+{
+    WorkArea tmp;
+    bool  r = false;
+
+    string query("SELECT "
+                 "Change_Time, "
+                 "Start_X, "
+                 "Start_Y, "
+                 "End_X, "
+                 "End_Y, "
+                 "Step_Forward, "
+                 "Pos_Sideways "
+                 "FROM WorkArea "
+                 "LIMIT 1");
+
+    try {
+        vector<string> result;
+        vector<string> vsideways;
+        if (query1row(mysql_, query, result)) {
+            tmp.Change_Time = my_time_of_mysql(result[0]);
+            r =
+                double_of(result[1], tmp.Start_X) &&
+                double_of(result[2], tmp.Start_Y) &&
+                double_of(result[3], tmp.End_X) &&
+                double_of(result[4], tmp.End_Y) &&
+                double_of(result[5], tmp.Step_Forward);
+            split(result[6], ";",  vsideways);
+            for (unsigned int i = 0; i < vsideways.size(); ++i) {
+                double f = 0;
+                r = r && double_of(vsideways[i], f);
+                tmp.Pos_Sideways.push_back(f);
+            }
+            if (r) {
+                setArea(tmp);
+            }
+        }
+    } catch (const exception& e) {
+        cout << "Error querying WorkArea : %s" << e.what() << endl;
+    }
+
+    return r;
+}
+
+/*****************************************************************************/
+void
+DigNetDBMySQL::readWorklog(
+        std::vector<WORKLOG_ROW>& rows)
+{
+    std::vector<std::vector<std::string> > results;
+    querytable(
+        mysql_,
+        "SELECT id, Forward_Index,Sideways_Index,Mark FROM WorkLog ORDER BY id ASC",
+        results);
+    rows.clear();
+    rows.reserve(results.size());
+    for (unsigned int i = 0; i < results.size(); ++i) {
+        const std::vector<std::string>& row = results[i];
+        WORKLOG_ROW r;
+        memset(&r, 0, sizeof(r));
+        int id = 0;
+        if (int_of(row[0], id), int_of(row[1], r.row_index) && int_of(row[2], r.col_index) && int_of(row[3], r.mark)) {
+            r.id = id;
+            rows.push_back(r);
+        }
+    }
+}
+
+/*****************************************************************************/
+DigNetDBMySQL::DigNetDBMySQL(
+        const std::string&  database,
+        const std::string&  username,
+        const std::string&  password,
+        const unsigned int  writeQueueSize,
+        const unsigned int  writeBatchSize,
+        const unsigned int  writeFlushInterval
+) :
+        mysql_(0)
+{
+    mysql_ = mysql_init(0);
+    MYSQL* h = reinterpret_cast<MYSQL*>(mysql_);
+
+    if (mysql_ == 0) {
+        // mysql_library_end();
+        throw runtime_error("MySQL library error.");
+    }
+
+    if (mysql_real_connect(h, "localhost", username.c_str(), password.c_str(), database.c_str(), 0, 0, 0) == 0) {
+        string s(ssprintf(
+                     "Unable to connect MySQL server, tried %s:%s@%s. Error was: %s",
+                     username.c_str(), password.c_str(), database.c_str(), mysql_error(h)
+                 ));
+        mysql_close(h);
+        mysql_ = 0;
+        // mysql_library_end();
+        throw runtime_error(s.c_str());
+    }
+
+    try {
+        supply_voltage_insert_ = std::auto_ptr<PreparedStatement>(new PreparedStatement(mysql_,
+            "INSERT INTO SupplyVoltages (ShipID, Reading_Time, SupplyVoltage) VALUES (?, now(), ?)"));
+        worklog_insert_ = std::auto_ptr<PreparedStatement>(new PreparedStatement(mysql_,
+            "INSERT INTO WorkLog (Change_Time, Ship_Id, Forward_Index, Sideways_Index, Mark) VALUES (now(), ?, ?, ?, ?)"));
+        writer_ = std::auto_ptr<DigNetDBWriter>(new DigNetDBWriter(database, username, password, writeQueueSize, writeBatchSize, writeFlushInterval));
+        if (writer_->create() != 0) {
+            // Queued rows would never be written.
+            throw runtime_error("Can't start DB writer thread.");
+        }
+    } catch (const std::exception&) {
+        supply_voltage_insert_.reset();
+        worklog_insert_.reset();
+        mysql_close(h);
+        mysql_ = 0;
+        throw;
+    }
+
+    // Load the work area and worklog grid once, further changes are applied incrementally.
+    refreshArea();
+}
+
+/*****************************************************************************/
+DigNetDBMySQL::~DigNetDBMySQL()
+{
+    // Write out everything queued before closing.
+    flushShips();
+    writer_.reset();
+    supply_voltage_insert_.reset();
+    worklog_insert_.reset();
+    if (mysql_ != 0) {
+        mysql_close(reinterpret_cast<MYSQL*>(mysql_));
+        mysql_ = 0;
+        // mysql_library_end();
+    }
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMySQL::readShipState(
+        const int   shipId,
+        SHIP_STATE& state)
+{
+    string query(ssprintf("select GPS1_X, GPS1_Y, GPS2_X, GPS2_Y, Heading, Shadow_X, Shadow_Y, Shadow_Dir from Ships where id = %d", shipId));
+    try {
+        vector<string> result;
+        if (query1row(mysql_, query, result)) {
+            state.gps_x[0] = double_of(result[0]);
+            state.gps_y[0] = double_of(result[1]);
+            state.gps_x[1] = double_of(result[2]);
+            state.gps_y[1] = double_of(result[3]);
+            state.heading = double_of(result[4]);
+            state.shadow_x = double_of(result[5]);
+            state.shadow_y = double_of(result[6]);
+            state.shadow_dir = double_of(result[7]);
+            return true;
+        }
+    } catch (const exception& e) {
+        cout << "Error reading ship " << shipId << ": " << e.what() << endl;
+    }
+    return false;
+}
+
+/*****************************************************************************/
+void
+DigNetDBMySQL::writeShipUpdate(
+        const SHIP_UPDATE& update)
+{
+    writer_->addShipUpdate(update);
+}
+
+/*****************************************************************************/
+void
+DigNetDBMySQL::writePosition(
+        const SHIP_POSITION_ROW& row)
+{
+    writer_->addPosition(row);
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMySQL::getShipVoltageInfo(
+        const int           shipId,
+        double&             lastReading,
+        double&             minimum,
+        int&                secondsFromLastRead,
+        my_time&        timeLastRead)
+{
+    bool r = false;
+    string query = ssprintf(
+		"SELECT "
+			"now() - v.Reading_Time, "
+			"v.Reading_Time, "
+			"v.SupplyVoltage, "
+			"s.SupplyVoltageLimit "
+		"FROM "
+			"SupplyVoltages AS v, Ships AS s "
+		"WHERE "
+			"s.id = %d AND v.ShipId = s.id "
+		"ORDER BY v.Reading_Time DESC LIMIT 1", shipId);
+    try {
+        vector<string> result;
+        if (query1row(mysql_, query, result)) {
+            secondsFromLastRead = int_of(result[0]);
+            timeLastRead = my_time_of_mysql(result[1]);
+            lastReading = double_of(result[2]);
+            minimum = double_of(result[3]);
+            r = true;
+        }
+    } catch (const exception& e) {
+        cout << "Error reading last voltage: %s" << e.what() << endl;
+    }
+    return r;
+}
+        
+/*****************************************************************************/
+bool
+DigNetDBMySQL::registerShip(
+        int&            shipId,
+        int&            groupId,
+        string&         name,
+        double&         gps1_dx,
+        double&         gps1_dy,
+        double&         gps2_dx,
+        double&         gps2_dy,
+        double&         supplyVoltageLimit,
+        const string&   imei,
+        const string&   firmwareName,
+        const string&   firmwareVersion,
+        const string&   firmwareBuildDate,
+        const string&   phone
+)
+{
+    try {
+        string firmwareNameBuf(escape_string(mysql_, firmwareName));
+        string imeiBuf(escape_string(mysql_, imei));
+        string firmwareVersionBuf(escape_string(mysql_, firmwareVersion));
+        string firmwareDateBuf(escape_string(mysql_, firmwareBuildDate));
+        // FIXME: Get this from somewhere
+        string phoneNumberBuf(escape_string(mysql_, "12345678"));
+        string nameBuf(escape_string(mysql_, name));
+        string query = ssprintf("select id, GroupId, name, IMEI, Firmware_Name, Firmware_Version, Firmware_Build_date, Gps1_dx, Gps1_dy, Gps2_dx, Gps2_dy, SupplyVoltageLimit  from Ships where IMEI = '%s'", imeiBuf.c_str());
+        vector<string> result;
+        if (!query1row(mysql_, query, result)) {
+            // Ship doesn't exist, abort
+            return false;
+#if (0)
+            string insertQuery = ssprintf("insert into Ships SET SimNumber='', ShipType = '', IMEI = '%s', Firmware_Name = '%s', Firmware_Version = '%s', Firmware_Build_date = '%s', Phone_no = '%s', Name = '%s', Contact_Time = now()",
+                                          imeiBuf.c_str(),
+                                          firmwareNameBuf.c_str(),
+                                          firmwareVersionBuf.c_str(),
+                                          firmwareDateBuf.c_str(),
+                                          phoneNumberBuf.c_str(),
+                                          nameBuf.c_str());
+            execute_insert(mysql_, insertQuery);
+            // Re-fetch to get ID
+            query1row(mysql_, query, result);
+#endif
+        }
+        shipId = int_of(result[0]);
+        groupId = int_of(result[1]);
+        name = result[2];
+        gps1_dx = double_of(result[7]);
+        gps1_dy = double_of(result[8]);
+        gps2_dx = double_of(result[9]);
+        gps2_dy = double_of(result[10]);
+        supplyVoltageLimit = double_of(result[11]);
+        // If firmwarersion differs then update
+        if (result[5].compare(firmwareVersion) != 0) {
+            query = ssprintf("update Ships set Firmware_Name = '%s', Firmware_Version = '%s', Firmware_Build_date = '%s' where id = %d",
+                             firmwareNameBuf.c_str(), firmwareVersionBuf.c_str(), firmwareDateBuf.c_str(), shipId);
+            update1row(mysql_, query);
+        }
+        // Ship exists in DB
+    } catch (const exception& e) {
+        cout << "Can't register ship: " << e.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMySQL::getShipGpsOffsets(
+        const int   shipId,
+        double&     gps1_dx,
+        double&     gps1_dy,
+        double&     gps2_dx,
+        double&     gps2_dy
+)
+{
+    bool r = false;
+    string query = ssprintf("select Gps1_dx, Gps1_dy, Gps2_dx, Gps2_dy from Ships where id = %d", shipId);
+    try {
+        vector<string> result;
+        if (query1row(mysql_, query, result)) {
+            gps1_dx = double_of(result[0]);
+            gps1_dy = double_of(result[1]);
+            gps2_dx = double_of(result[2]);
+            gps2_dy = double_of(result[3]);
+            r = true;
+        }
+    } catch (const exception& e) {
+        cout << "Error reading offsets: %s" << e.what() << endl;
+    }
+    return r;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBMySQL::shipExists(
+        const int shipId)
+{
+    bool r = false;
+    string query(ssprintf("select id from Ships where id = %d", shipId));
+    try {
+        vector<string> result;
+        if (query1row(mysql_, query, result)) {
+            r = true;
+        }
+    } catch (const exception& e) {
+        cout << "Error checking for ship existance: %s" << e.what() << endl;
+    }
+    return r;
+}
+
+/*****************************************************************************/
+void
+DigNetDBMySQL::logSupplyVoltage(
+        const int    shipId,
+        const double voltage)
+{
+    supply_voltage_insert_->bindInt(0, shipId);
+    supply_voltage_insert_->bindDouble(1, voltage);
+    supply_voltage_insert_->execute();
+}
+
+/*****************************************************************************/
+DBWRITER_STATISTICS
+DigNetDBMySQL::writerStatistics()
+{
+    return writer_->statistics();
+}
+
+/*****************************************************************************/
+unsigned int
+DigNetDBMySQL::insertWorkmark(
+        const int   shipId,
+        const int   row_index,
+        const int   col_index,
+        const int   mark)
+{
+    worklog_insert_->bindInt(0, shipId);
+    worklog_insert_->bindInt(1, row_index);
+    worklog_insert_->bindInt(2, col_index);
+    worklog_insert_->bindInt(3, mark);
+    worklog_insert_->execute();
+    return worklog_insert_->insertId();
+}
@@ -0,0 +1,114 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef DigNetDBMySQL_h_
+#define DigNetDBMySQL_h_
+
+#include <string>  // std::string
+#include <memory>  // std::auto_ptr
+
+#include "DigNetDB.h"
+#include "DigNetDBWriter.h"
+#include "PreparedStatement.h"
+
+/** GpsServer database in MySQL. */
+class DigNetDBMySQL : public DigNetDB {
+    private:
+        void* mysql_;                       ///< MySql connection
+        std::auto_ptr<DigNetDBWriter> writer_;  ///< Writes position inserts and updates in background
+        std::auto_ptr<PreparedStatement> supply_voltage_insert_;   ///< INSERT INTO SupplyVoltages
+        std::auto_ptr<PreparedStatement> worklog_insert_;          ///< INSERT INTO WorkLog
+    protected:
+        bool
+        refreshArea();
+
+        void
+        readWorklog(
+            std::vector<WORKLOG_ROW>&   rows);
+
+        unsigned int
+        insertWorkmark(
+            const int           shipId,
+            const int           row_index,
+            const int           col_index,
+            const int           mark);
+
+        bool
+        readShipState(
+            const int           shipId,
+            SHIP_STATE&         state);
+
+        /** Queued to the background writer. */
+        void
+        writeShipUpdate(
+            const SHIP_UPDATE&  update);
+
+        /** Queued to the background writer. */
+        void
+        writePosition(
+            const SHIP_POSITION_ROW& row);
+    public:
+        /** Connects to the localhost MySQL database.
+        Position inserts and per-packet updates are queued and written by a separate connection.
+        \param[in] writeQueueSize maximum number of queued rows, rows over that are dropped
+        \param[in] writeBatchSize flush when this many rows are queued
+        \param[in] writeFlushInterval flush at least this often, milliseconds
+         */
+        DigNetDBMySQL(
+            const std::string& database,
+            const std::string& username,
+            const std::string& password,
+            const unsigned int writeQueueSize = 10000,
+            const unsigned int writeBatchSize = 100,
+            const unsigned int writeFlushInterval = 1000);
+
+        ~DigNetDBMySQL();
+
+        bool
+        getShipVoltageInfo(
+            const int           shipId,
+            double&             lastReading,
+            double&             minimum,
+            int&                secondsFromLastRead,
+            utils::my_time&     timeLastRead);
+
+        bool
+        registerShip(
+            int&                shipId,
+            int&                groupId,
+            std::string&        name,
+            double&             gps1_dx,
+            double&             gps1_dy,
+            double&             gps2_dx,
+            double&             gps2_dy,
+            double&             supplyVoltageLimit,
+            const std::string&  imei,
+            const std::string&  firmwareName,
+            const std::string&  firmwareVersion,
+            const std::string&  firmwareBuildDate,
+            const std::string&  phone
+        );
+
+        bool
+        getShipGpsOffsets(
+            const int   shipId,
+            double&     gps1_dx,
+            double&     gps1_dy,
+            double&     gps2_dx,
+            double&     gps2_dy
+        );
+
+        bool
+        shipExists(
+            const int shipId);
+
+        void
+        logSupplyVoltage(
+            const int  shipId,
+            const double voltage
+        );
+
+        DBWRITER_STATISTICS
+        writerStatistics();
+}; // class DigNetDBMySQL
+
+#endif /* DigNetDBMySQL_h_ */
@@ -0,0 +1,346 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdexcept>
+#include <vector>
+#include <string>
+#include <iostream> // cout
+
+#include <utils/util.h>
+
+#include <mysql.h>
+
+#include <time.h>
+#include <errno.h>
+
+#include "DigNetDBWriter.h"
+
+using namespace std;
+using namespace utils;
+
+/*****************************************************************************/
+/** Milliseconds from monotonic clock. */
+static uint64_t
+monotonic_ms()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+/*****************************************************************************/
+/** Binds double or NULL if not valid. */
+static void
+bind_double(
+        PreparedStatement&  stmt,
+        const unsigned int  index,
+        const bool          is_valid,
+        const double        value)
+{
+    if (is_valid) {
+        stmt.bindDouble(index, value);
+    } else {
+        stmt.bindNull(index);
+    }
+}
+
+/// Number of parameters per ShipPosition row.
+static const unsigned int POSITION_PARAMS = 9;
+
+/*****************************************************************************/
+DigNetDBWriter::DigNetDBWriter(
+        const std::string&  database,
+        const std::string&  username,
+        const std::string&  password,
+        const unsigned int  queue_size,
+        const unsigned int  batch_size,
+        const unsigned int  flush_interval_ms
+) :
+        mysql_(0),
+        run_(true),
+        queue_size_(queue_size),
+        batch_size_(batch_size > 0 ? batch_size : 1),
+        flush_interval_ms_(flush_interval_ms)
+{
+    memset(&statistics_, 0, sizeof(statistics_));
+    statistics_.queue_size = queue_size_;
+
+    mysql_ = mysql_init(0);
+    MYSQL* h = reinterpret_cast<MYSQL*>(mysql_);
+
+    if (mysql_ == 0) {
+        throw runtime_error("MySQL library error.");
+    }
+
+    if (mysql_real_connect(h, "localhost", username.c_str(), password.c_str(), database.c_str(), 0, 0, 0) == 0) {
+        string s(ssprintf(
+                     "DB writer unable to connect MySQL server, tried %s@%s. Error was: %s",
+                     username.c_str(), database.c_str(), mysql_error(h)
+                 ));
+        mysql_close(h);
+        mysql_ = 0;
+        throw runtime_error(s.c_str());
+    }
+
+    pthread_mutex_init(&queue_mutex_, 0);
+    pthread_cond_init(&queue_cond_, 0);
+}
+
+/*****************************************************************************/
+DigNetDBWriter::~DigNetDBWriter()
+{
+    pthread_mutex_lock(&queue_mutex_);
+    run_ = false;
+    pthread_cond_signal(&queue_cond_);
+    pthread_mutex_unlock(&queue_mutex_);
+    join();
+
+    for (std::map<unsigned int, PreparedStatement*>::iterator it = position_inserts_.begin(); it != position_inserts_.end(); ++it) {
+        delete it->second;
+    }
+    for (std::map<unsigned int, PreparedStatement*>::iterator it = ship_update_statements_.begin(); it != ship_update_statements_.end(); ++it) {
+        delete it->second;
+    }
+    pthread_cond_destroy(&queue_cond_);
+    pthread_mutex_destroy(&queue_mutex_);
+    if (mysql_ != 0) {
+        mysql_close(reinterpret_cast<MYSQL*>(mysql_));
+        mysql_ = 0;
+    }
+}
+
+/*****************************************************************************/
+bool
+DigNetDBWriter::addPosition(
+        const SHIP_POSITION_ROW&    row)
+{
+    bool r = false;
+    pthread_mutex_lock(&queue_mutex_);
+    if (positions_.size() + ship_updates_.size() < queue_size_) {
+        positions_.push_back(row);
+        if (positions_.size() >= batch_size_) {
+            pthread_cond_signal(&queue_cond_);
+        }
+        r = true;
+    } else {
+        ++statistics_.rows_dropped;
+    }
+    pthread_mutex_unlock(&queue_mutex_);
+    return r;
+}
+
+/*****************************************************************************/
+bool
+DigNetDBWriter::addShipUpdate(
+        const SHIP_UPDATE&          update)
+{
+    bool r = false;
+    pthread_mutex_lock(&queue_mutex_);
+    if (positions_.size() + ship_updates_.size() < queue_size_) {
+        ship_updates_.push_back(update);
+        r = true;
+    } else {
+        ++statistics_.rows_dropped;
+    }
+    pthread_mutex_unlock(&queue_mutex_);
+    return r;
+}
+
+/*****************************************************************************/
+DBWRITER_STATISTICS
+DigNetDBWriter::statistics()
+{
+    pthread_mutex_lock(&queue_mutex_);
+    DBWRITER_STATISTICS r = statistics_;
+    r.queue_depth = positions_.size() + ship_updates_.size();
+    pthread_mutex_unlock(&queue_mutex_);
+    return r;
+}
+
+/*****************************************************************************/
+void
+DigNetDBWriter::setup()
+{
+    mysql_thread_init();
+}
+
+/*****************************************************************************/
+void
+DigNetDBWriter::execute()
+{
+    std::vector<SHIP_POSITION_ROW>  positions;
+    std::vector<SHIP_UPDATE>        updates;
+    for (;;) {
+        pthread_mutex_lock(&queue_mutex_);
+        if (run_ && positions_.size() < batch_size_) {
+            // Sleep until batch is full, timeout or shutdown.
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += flush_interval_ms_ / 1000;
+            deadline.tv_nsec += (flush_interval_ms_ % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&queue_cond_, &queue_mutex_, &deadline);
+        }
+        positions.assign(positions_.begin(), positions_.end());
+        positions_.clear();
+        updates.assign(ship_updates_.begin(), ship_updates_.end());
+        ship_updates_.clear();
+        const bool stop = !run_;
+        pthread_mutex_unlock(&queue_mutex_);
+
+        if (positions.size() > 0 || updates.size() > 0) {
+            flush(positions, updates);
+        }
+        if (stop) {
+            break;
+        }
+    }
+    mysql_thread_end();
+}
+
+/*****************************************************************************/
+PreparedStatement&
+DigNetDBWriter::positionInsert(
+        const unsigned int  nrows)
+{
+    std::map<unsigned int, PreparedStatement*>::iterator it = position_inserts_.find(nrows);
+    if (it != position_inserts_.end()) {
+        return *it->second;
+    }
+    string query("INSERT INTO ShipPosition "
+                 "(Create_Time, ShipId, type, x, y, z, GpsStatus, heading, speed) VALUES ");
+    for (unsigned int i = 0; i < nrows; ++i) {
+        if (i > 0) {
+            query += ',';
+        }
+        query += "(FROM_UNIXTIME(?), ?, ?, ?, ?, ?, ?, ?, ?)";
+    }
+    PreparedStatement* stmt = new PreparedStatement(mysql_, query);
+    position_inserts_[nrows] = stmt;
+    return *stmt;
+}
+
+/*****************************************************************************/
+PreparedStatement&
+DigNetDBWriter::shipUpdate(
+        const unsigned int  dirty)
+{
+    std::map<unsigned int, PreparedStatement*>::iterator it = ship_update_statements_.find(dirty);
+    if (it != ship_update_statements_.end()) {
+        return *it->second;
+    }
+    std::vector<std::string> fields;
+    if (dirty & SHIP_DIRTY_CONTACT) {
+        fields.push_back("Contact_Time = FROM_UNIXTIME(?)");
+    }
+    if (dirty & SHIP_DIRTY_GPS1) {
+        fields.push_back("GPS1_Time = FROM_UNIXTIME(?), GPS1_X = ?, GPS1_Y = ?");
+    }
+    if (dirty & SHIP_DIRTY_GPS2) {
+        fields.push_back("GPS2_Time = FROM_UNIXTIME(?), GPS2_X = ?, GPS2_Y = ?");
+    }
+    if (dirty & SHIP_DIRTY_HEADING) {
+        fields.push_back("Heading_Time = FROM_UNIXTIME(?), Heading = ?");
+    }
+    if (dirty & SHIP_DIRTY_SHADOW) {
+        fields.push_back("Shadow_X = ?, Shadow_Y = ?, Shadow_Dir = ?");
+    }
+    string query("update Ships set ");
+    for (unsigned int i = 0; i < fields.size(); ++i) {
+        if (i > 0) {
+            query += ", ";
+        }
+        query += fields[i];
+    }
+    query += " where id = ?";
+    PreparedStatement* stmt = new PreparedStatement(mysql_, query);
+    ship_update_statements_[dirty] = stmt;
+    return *stmt;
+}
+
+/*****************************************************************************/
+void
+DigNetDBWriter::flush(
+        std::vector<SHIP_POSITION_ROW>& positions,
+        std::vector<SHIP_UPDATE>&       updates)
+{
+    const uint64_t  start_ms = monotonic_ms();
+    uint64_t        written = 0;
+    uint64_t        failed = 0;
+
+    // 1. Positions, at most batch_size_ rows per INSERT.
+    for (unsigned int first = 0; first < positions.size(); first += batch_size_) {
+        const unsigned int  last = mymin<unsigned int>(first + batch_size_, positions.size());
+        try {
+            PreparedStatement&  stmt = positionInsert(last - first);
+            for (unsigned int i = first; i < last; ++i) {
+                const SHIP_POSITION_ROW&    row = positions[i];
+                const unsigned int          p = (i - first) * POSITION_PARAMS;
+                stmt.bindInt(p + 0, row.create_time);
+                stmt.bindInt(p + 1, row.ship_id);
+                stmt.bindString(p + 2, string(1, row.type));
+                stmt.bindDouble(p + 3, row.x);
+                stmt.bindDouble(p + 4, row.y);
+                bind_double(stmt, p + 5, row.has_z, row.z);
+                if (row.has_gps_status) {
+                    stmt.bindInt(p + 6, row.gps_status);
+                } else {
+                    stmt.bindNull(p + 6);
+                }
+                bind_double(stmt, p + 7, row.has_heading, row.heading);
+                bind_double(stmt, p + 8, row.has_speed, row.speed);
+            }
+            stmt.execute();
+            written += last - first;
+        } catch (const exception& e) {
+            cout << "DigNetDBWriter: error inserting " << (last - first) << " positions: " << e.what() << endl;
+            failed += last - first;
+        }
+    }
+
+    // 2. Ships updates, in order.
+    for (unsigned int i = 0; i < updates.size(); ++i) {
+        const SHIP_STATE&   state = updates[i].state;
+        try {
+            PreparedStatement&  stmt = shipUpdate(state.dirty);
+            unsigned int        p = 0;
+            if (state.dirty & SHIP_DIRTY_CONTACT) {
+                stmt.bindInt(p++, state.contact_time);
+            }
+            for (int gps = 0; gps < 2; ++gps) {
+                if (state.dirty & (gps == 0 ? SHIP_DIRTY_GPS1 : SHIP_DIRTY_GPS2)) {
+                    stmt.bindInt(p++, state.gps_time[gps]);
+                    stmt.bindDouble(p++, state.gps_x[gps]);
+                    stmt.bindDouble(p++, state.gps_y[gps]);
+                }
+            }
+            if (state.dirty & SHIP_DIRTY_HEADING) {
+                stmt.bindInt(p++, state.heading_time);
+                stmt.bindDouble(p++, state.heading);
+            }
+            if (state.dirty & SHIP_DIRTY_SHADOW) {
+                stmt.bindDouble(p++, state.shadow_x);
+                stmt.bindDouble(p++, state.shadow_y);
+                stmt.bindDouble(p++, state.shadow_dir);
+            }
+            stmt.bindInt(p++, updates[i].ship_id);
+            stmt.execute();
+            ++written;
+        } catch (const exception& e) {
+            cout << "DigNetDBWriter: error updating ship " << updates[i].ship_id << ": " << e.what() << endl;
+            ++failed;
+        }
+    }
+
+    const unsigned int  flush_ms = static_cast<unsigned int>(monotonic_ms() - start_ms);
+    pthread_mutex_lock(&queue_mutex_);
+    statistics_.rows_written += written;
+    statistics_.rows_failed += failed;
+    ++statistics_.flushes;
+    statistics_.last_flush_ms = flush_ms;
+    statistics_.max_flush_ms = mymax(statistics_.max_flush_ms, flush_ms);
+    pthread_mutex_unlock(&queue_mutex_);
+}
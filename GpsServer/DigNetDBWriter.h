@@ -0,0 +1,153 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef DigNetDBWriter_h_
+#define DigNetDBWriter_h_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <time.h>       // time_t
+#include <stdint.h>
+#include <pthread.h>
+
+#include "Thread.h"
+#include "PreparedStatement.h"
+
+/** One row of the ShipPosition table waiting to be written. */
+typedef struct {
+    time_t      create_time;    ///< Time the row was queued, becomes Create_Time
+    int         ship_id;        ///< Ship ID
+    char        type;           ///< Position type: 'M', 'V', '1' or '2'
+    double      x;              ///< X coordinate in meters
+    double      y;              ///< Y coordinate in meters
+    double      z;              ///< Z coordinate in meters, valid if \c has_z
+    double      heading;        ///< Heading in degrees, valid if \c has_heading
+    double      speed;          ///< Speed in km/h, valid if \c has_speed
+    int         gps_status;     ///< GPS status, valid if \c has_gps_status
+    bool        has_z;
+    bool        has_heading;
+    bool        has_speed;
+    bool        has_gps_status;
+} SHIP_POSITION_ROW;
+
+/** Fields of \c SHIP_STATE that need to be written to Ships table, bitfield. */
+typedef enum {
+    SHIP_DIRTY_CONTACT  = 01,   ///< Contact_Time
+    SHIP_DIRTY_GPS1     = 02,   ///< GPS1_Time, GPS1_X, GPS1_Y
+    SHIP_DIRTY_GPS2     = 04,   ///< GPS2_Time, GPS2_X, GPS2_Y
+    SHIP_DIRTY_HEADING  = 010,  ///< Heading_Time, Heading
+    SHIP_DIRTY_SHADOW   = 020   ///< Shadow_X, Shadow_Y, Shadow_Dir
+} SHIP_DIRTY;
+
+/** Cached state of a row in Ships table. */
+typedef struct {
+    time_t      contact_time;
+    time_t      gps_time[2];
+    double      gps_x[2];
+    double      gps_y[2];
+    time_t      heading_time;
+    double      heading;
+    double      shadow_x;
+    double      shadow_y;
+    double      shadow_dir;
+    unsigned int dirty;         ///< Fields changed since last flush, \c SHIP_DIRTY bitfield
+} SHIP_STATE;
+
+/** Ships row update waiting to be written. */
+typedef struct {
+    int         ship_id;        ///< Ship ID
+    SHIP_STATE  state;          ///< Fields given by \c state.dirty are written
+} SHIP_UPDATE;
+
+/** Snapshot of the writer statistics. */
+typedef struct {
+    unsigned int    queue_depth;        ///< Rows currently waiting in the queue
+    unsigned int    queue_size;         ///< Maximum number of rows in the queue
+    uint64_t        rows_written;       ///< Total rows written to DB
+    uint64_t        rows_dropped;       ///< Total rows dropped because the queue was full
+    uint64_t        rows_failed;        ///< Total rows lost because the insert failed
+    uint64_t        flushes;            ///< Total number of flushes
+    unsigned int    last_flush_ms;      ///< Duration of the last flush, milliseconds
+    unsigned int    max_flush_ms;       ///< Longest flush so far, milliseconds
+} DBWRITER_STATISTICS;
+
+/**
+Write-behind queue for the DigNet database.
+
+Rows are queued by the event loop and written by a separate thread using its own MySQL connection.
+ShipPosition rows are coalesced into multi-row INSERT statements. Statements are prepared once per
+row count and per set of updated Ships fields and reused with binary parameters.
+Queue is flushed when \c batch_size rows have accumulated or \c flush_interval_ms milliseconds
+have passed, whichever comes first.
+When the queue is full new rows are dropped and counted.
+*/
+class DigNetDBWriter : public Thread {
+    private:
+        void*                           mysql_;             ///< MySql connection, used only by the writer thread
+        bool                            run_;               ///< Run thread while true
+
+        pthread_mutex_t                 queue_mutex_;       ///< Guards queues and statistics
+        pthread_cond_t                  queue_cond_;        ///< Signalled on full batch and on shutdown
+        std::deque<SHIP_POSITION_ROW>   positions_;         ///< Queued ShipPosition rows
+        std::deque<SHIP_UPDATE>         ship_updates_;      ///< Queued Ships updates
+
+        unsigned int                    queue_size_;        ///< Maximum number of queued rows and updates
+        unsigned int                    batch_size_;        ///< Flush when this many rows are queued, also maximum rows per INSERT
+        unsigned int                    flush_interval_ms_; ///< Flush at least this often, milliseconds
+
+        DBWRITER_STATISTICS             statistics_;        ///< Statistics, guarded by \c queue_mutex_
+
+        std::map<unsigned int, PreparedStatement*>  position_inserts_;       ///< INSERT INTO ShipPosition by number of rows
+        std::map<unsigned int, PreparedStatement*>  ship_update_statements_; ///< UPDATE Ships by \c SHIP_DIRTY bitfield
+    public:
+        /** Connects to the localhost MySQL database. Call \c create() to start writing. */
+        DigNetDBWriter(
+            const std::string&  database,
+            const std::string&  username,
+            const std::string&  password,
+            const unsigned int  queue_size,
+            const unsigned int  batch_size,
+            const unsigned int  flush_interval_ms);
+
+        /** Stops the thread after writing out everything queued so far. */
+        ~DigNetDBWriter();
+
+        /** Queues a ShipPosition row. Returns false if the queue was full and the row was dropped. */
+        bool
+        addPosition(
+            const SHIP_POSITION_ROW&    row);
+
+        /** Queues an update of the fields in \c update.state.dirty. Returns false if dropped. */
+        bool
+        addShipUpdate(
+            const SHIP_UPDATE&          update);
+
+        /** Returns a snapshot of the statistics. */
+        DBWRITER_STATISTICS
+        statistics();
+    protected:
+        void
+        setup();
+
+        void
+        execute();
+    private:
+        /** Writes given rows and updates to the database. Called from writer thread without lock. */
+        void
+        flush(
+            std::vector<SHIP_POSITION_ROW>& positions,
+            std::vector<SHIP_UPDATE>&       updates);
+
+        /** Returns statement inserting \c nrows rows into ShipPosition, preparing it on first use. */
+        PreparedStatement&
+        positionInsert(
+            const unsigned int              nrows);
+
+        /** Returns statement updating given \c SHIP_DIRTY fields in Ships, preparing it on first use. */
+        PreparedStatement&
+        shipUpdate(
+            const unsigned int              dirty);
+};
+
+#endif /* DigNetDBWriter_h_ */
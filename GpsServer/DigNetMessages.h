@@ -184,17 +184,35 @@ typedef struct {
     uint8_t     nrows;
 } PACKET_WORKLOG_QUERY_BY_INDICES;
 
-/** Query to send fresh rows from the client.
-Not in use, reserved.
+/** Query from client to send rows changed after the given timestamp.
+Server responds with PACKET_WORKLOG_CHANGED_ROWS for every run of changed rows, split to packets
+as needed, or with a single PACKET_WORKLOG_CHANGED_ROWS having latest_timestamp zero if nothing has changed.
 */
 typedef struct {
     enum {
         CMRTYPE = 0xBC16
     };
-    /** Minimum timestamp with which send rows. */
+    /** Latest timestamp known to the client, rows with newer marks are sent. */
     uint32_t    timestamp;
 } PACKET_WORKLOG_QUERY_BY_TIMESTAMP;
 
+/** Reply to PACKET_WORKLOG_QUERY_BY_TIMESTAMP, marks of the changed rows.
+
+Separate type tells the client the rows answer its own query: the reply holds every row changed
+after the timestamp of the query, so only its latest_timestamp is safe to query from next time.
+Marks start at any column, so that rows too wide for one packet can be split.
+*/
+typedef struct {
+    enum {
+        CMRTYPE = 0xBC24
+    };
+    uint32_t    latest_timestamp;   ///< As in PACKET_WORKLOG_ROWS
+    uint16_t    start_row;          ///< Row index of the first mark
+    uint16_t    start_col;          ///< Column index of the first mark
+    uint16_t    nmarks;             ///< Number of marks
+    uint8_t     marks[1];           ///< Marks encoded as in PACKET_WORKLOG_ROWS, continuing on the next row at the end of a row
+} PACKET_WORKLOG_CHANGED_ROWS;
+
 /** Ship and GPS information in condensed form
  *  Size of packet may be bigger than sizeof(PACKET_SHIP_INFO) because of variable length name and IMEI
 */
@@ -235,8 +253,25 @@ typedef struct {
     };
     uint16_t    number;   ///< latest points file number
     uint32_t    size;     ///< File size in bytes
+    uint8_t     flags;    ///< \c POINTSFILE_WINDOWED, missing from packets of older servers
+    uint8_t     codec;              ///< \c POINTSFILE_CODEC_ZLIB if the file can be downloaded compressed, missing from packets of older servers
+    uint32_t    compressed_size;    ///< Size of the compressed file in bytes, 0 if \c codec is POINTSFILE_CODEC_NONE
+    uint32_t    delta_size;         ///< Size of the POINTSFILE_CODEC_DELTA variant in bytes, 0 if there is none, missing from packets of older servers
 } PACKET_POINTSFILE_INFO;
 
+/// PACKET_POINTSFILE_INFO::flags: server streams the chunks asked for with PACKET_POINTSFILE_WINDOW_REQUEST
+#define     POINTSFILE_WINDOWED         0x01
+
+/// Points file as it is
+#define     POINTSFILE_CODEC_NONE       0
+/// Points file compressed by zlib (RFC 1950), offered to windowed transfers only
+#define     POINTSFILE_CODEC_ZLIB       1
+/// Delta from the points file numbered one less (PointsDelta.h), offered to windowed transfers only
+#define     POINTSFILE_CODEC_DELTA      2
+
+/// Maximum size of PACKET_POINTSFILE_WINDOW_REQUEST::missing, keeps the packet within a CMR data block
+#define     POINTSFILE_WINDOW_BYTES     240
+
 typedef struct {
     enum {
         CMRTYPE = 0xBC20            ///< CMR type
@@ -252,8 +287,25 @@ typedef struct {
     uint16_t    file_number;        ///< File number
     uint16_t    chunk_number;       ///< Chunk number (offset = 64*chunk_number, max file size 4MB)
     uint8_t     data[CHUNK_SIZE];           ///< chunk itself
+    uint8_t     codec;              ///< Variant the chunk is of, \c POINTSFILE_CODEC_XXX. Missing from packets of older servers, meaning \c POINTSFILE_CODEC_NONE
 } PACKET_POINTSFILE_CHUNK;
 
+/** Asks for a window of points file chunks, replaces PACKET_POINTSFILE_CHUNK_REQUEST for servers
+    sending POINTSFILE_WINDOWED. Server streams the chunks whose bits are set as fast as the link
+    takes them. Clear bits are no acknowledgement: chunks asked for by earlier windows and not yet
+    sent stay queued, so a client can ask for the next window while the previous one is on its way.
+    Size of packet gives the length of \c missing, at most POINTSFILE_WINDOW_BYTES.
+*/
+typedef struct {
+    enum {
+        CMRTYPE = 0xBC23            ///< CMR type
+    };
+    uint16_t    file_number;        ///< File number
+    uint16_t    first_chunk;        ///< Chunk number of bit 0 of \c missing
+    uint8_t     codec;              ///< Chunks of this variant of the file, \c POINTSFILE_CODEC_XXX
+    uint8_t     missing[POINTSFILE_WINDOW_BYTES];   ///< Bit i (least significant first) set if chunk first_chunk+i is needed
+} PACKET_POINTSFILE_WINDOW_REQUEST;
+
 // Measures are in cm to avoid floating point. 2^16-1 = not set
 typedef struct {
     enum {
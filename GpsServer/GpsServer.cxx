@@ -13,12 +13,15 @@ vim: ts=4
 #include <list>     // std::list
 #include <map>      // std::map
 #include <numeric>  // std::numeric_limits
-#include <fstream>
 
 #include <stdio.h>  // printf, sprintf
 #include <stdarg.h> // varargs.
+#include <stddef.h> // offsetof
 
 #include <event.h>  // libevent.
+#if defined(EVENT__NUMERIC_VERSION) || defined(_EVENT_NUMERIC_VERSION)
+#include <event2/thread.h>  // evthread_use_pthreads, libevent 2 only.
+#endif
 
 #include <utils/Config.h>       // FileConfig
 #include <utils/mysockets.h>        // open_server_socket
@@ -28,6 +31,10 @@ vim: ts=4
 #include "GpsServer.h"
 #include "DigNetMessages.h"
 #include "DigNetDB.h"
+#include "DigNetDBMemory.h"
+#ifndef WITHOUT_MYSQL
+#include "DigNetDBMySQL.h"
+#endif
 #include "utils.h"
 #include "SendEmail.h"
 
@@ -38,9 +45,6 @@ vim: ts=4
 using namespace utils;
 using namespace std;
 
-// If defined log all incoming packages
-#define LOG_PACKETS
-
 static const char*  FILENAME_CONFIGURATION  = "GpsServer.ini";
 
 
@@ -51,9 +55,24 @@ static const char*  AUTHENTICATION_GPSADMIN     = "GpsAdministrator";
 
 std::string GpsServer::rtcm_source_;
 
-//const LOG_LEVEL MAX_LOGGED_LEVEL=LOG_LEVEL_3;
-const LOG_LEVEL MAX_LOGGED_LEVEL = LOG_LEVEL_DEBUG;
-//const LOG_LEVEL MAX_LOGGED_LEVEL=LOG_LEVEL_ESSENTIAL;
+std::auto_ptr<LogWriter> GpsServer::log_writer_;
+volatile sig_atomic_t GpsServer::log_level_ = LOG_LEVEL_DEBUG;
+volatile sig_atomic_t GpsServer::log_level_configured_ = LOG_LEVEL_DEBUG;
+
+/** Holds the server lock while in scope. Event handlers take it before touching the client
+registry, the database or other shared state, so that is touched by one worker thread at a time.
+The state of a single client is left to the worker owning it.
+*/
+class ServerLock {
+    private:
+        pthread_mutex_t&    mutex_;
+        bool                locked_;
+    public:
+        ServerLock(pthread_mutex_t& mutex, const bool lock_now = true) : mutex_(mutex), locked_(false) { if (lock_now) acquire(); }
+        ~ServerLock() { if (locked_) pthread_mutex_unlock(&mutex_); }
+        /** Takes the lock unless held already. */
+        void acquire() { if (!locked_) { pthread_mutex_lock(&mutex_); locked_ = true; } }
+};
 
 
 
@@ -96,7 +115,19 @@ TCP_CLIENT::TCP_CLIENT(
         group_id(0),
         gpsviewer_build_number(BUILD_NO_NUMBER),
         // FIXME: until no sure way is found to check if GPSViewer is attached assume it is
-        has_gpsviewer (true)
+        has_gpsviewer (true),
+        rtcm_dropped(0),
+        frames_superseded(0),
+        frames_dropped(0),
+        output_overflow(false),
+        output_size(0),
+        parked_count(0),
+        transfer_file(-1),
+        transfer_codec(POINTSFILE_CODEC_NONE),
+        transfer_next(0),
+        transfer_pending(0),
+        worker(0),
+        closing(false)
 {
 }
 
@@ -112,6 +143,11 @@ TCP_CLIENT::reportMinuteStatistics(){
     uint64_t bRec = bytes_received_.countAtInterval(60);
     uint64_t bSen = bytes_sent_.countAtInterval(60);
     ss<<" Bytes received/sent: "<<bRec<<"/"<<bSen<<" "<<bRec/60.0<<"/"<<bSen/60.0<<" per second";
+    ss<<" Output queue: "<<output_size<<" bytes, "<<parked_count<<" parked";
+    ss<<" Superseded/dropped: "<<frames_superseded<<"/"<<frames_dropped;
+    if (rtcm_dropped > 0) {
+        ss<<" RTCM dropped: "<<rtcm_dropped;
+    }
     return ss.str();
 }
 
@@ -211,12 +247,18 @@ GpsServer::log(
     const char*         fmt,
     va_list             arguments)
 {
-    if (level >= MAX_LOGGED_LEVEL) {
+    if (level < log_level_) {
+        return;
+    }
+    const bool has_ship = client != 0 && client->ship_id.get() != 0;
+    if (log_writer_.get() != 0) {
+        log_writer_->append(has_ship ? (int)client->ship_id->ship_number : -1, has_ship ? client->ship_id->ship_name : 0, fmt, arguments);
+    } else {
         my_time rtime;
         my_time_of_now(rtime);
         printf("%02d%02d%02d: ", rtime.hour, rtime.minute, rtime.second);
 
-        if (client != 0 && client->ship_id.get() != 0) {
+        if (has_ship) {
             printf("'#%d:%s': ", client->ship_id->ship_number, client->ship_id->ship_name);
         }
 
@@ -262,19 +304,172 @@ GpsServer::log(
     va_end(ap);
 }
 
+/*****************************************************************************/
+void
+GpsServer::log_signal_handler(
+    int                 signal)
+{
+    log_level_ = log_level_ == LOG_LEVEL_DEBUG ? log_level_configured_ : LOG_LEVEL_DEBUG;
+}
+
+/*****************************************************************************/
+/** Number of bytes waiting to be sent to the client. Only the loop owning the client may ask. */
+static unsigned int
+pending_output(
+    const TCP_CLIENT*   tcp_client)
+{
+    return EVBUFFER_LENGTH(EVBUFFER_OUTPUT(tcp_client->event));
+}
+
+/*****************************************************************************/
+/** Publishes the output state of the client for the statistics, called by the owning loop. */
+static void
+note_output(
+    TCP_CLIENT*         tcp_client)
+{
+    tcp_client->output_size = pending_output(tcp_client);
+    tcp_client->parked_count = tcp_client->parked_frames.size();
+}
+
+/*****************************************************************************/
+bool
+GpsServer::output_full(
+    TCP_CLIENT*                         tcp_client,
+    const bool                          droppable)
+{
+    if (tcp_client->closing || tcp_client->output_overflow) {
+        return true;
+    }
+    if (pending_output(tcp_client) <= (unsigned int)output_max_pending_) {
+        return false;
+    }
+    ++tcp_client->frames_dropped;
+    if (!droppable) {
+        log(LOG_LEVEL_ESSENTIAL, tcp_client, "output over %d bytes, reply lost, disconnecting.", output_max_pending_);
+        tcp_client->output_overflow = true;
+    }
+    return true;
+}
+
 /*****************************************************************************/
 void
 GpsServer::send_raw_data(
     TCP_CLIENT*                         tcp_client,
-    std::vector<unsigned char>&         data)
+    std::vector<unsigned char>&         data,
+    const bool                          droppable)
 {
+    if (tcp_client->worker != Worker::current()) {
+        // Client belongs to another event loop.
+        std::vector<unsigned char>  copy(data);
+        SharedFrame*    frame = SharedFrame::wrap(copy);
+        send_frame(tcp_client, frame, droppable);
+        frame->release();
+        return;
+    }
+    if (output_full(tcp_client, droppable)) {
+        return;
+    }
     bufferevent_write(tcp_client->event, &data[0], data.size());
-    ++tcp_client->server->packets_sent_;
-    tcp_client->server->bytes_sent_+=data.size();
+    note_output(tcp_client);
+    ++packets_sent_;
+    bytes_sent_+=data.size();
     ++tcp_client->packets_sent_;
     tcp_client->bytes_sent_+=data.size();
 }
 
+/*****************************************************************************/
+void
+GpsServer::send_frame(
+    TCP_CLIENT*                         tcp_client,
+    SharedFrame*                        frame,
+    const bool                          droppable)
+{
+    if (tcp_client->worker != Worker::current()) {
+        // Client belongs to another event loop, it checks the output limits.
+        if (!tcp_client->closing && !tcp_client->output_overflow) {
+            tcp_client->worker->send(tcp_client, frame, droppable ? WORKER_SEND_DROPPABLE : WORKER_SEND);
+        }
+        return;
+    }
+    if (output_full(tcp_client, droppable)) {
+        return;
+    }
+    frame->write(tcp_client->event);
+    note_output(tcp_client);
+    ++packets_sent_;
+    bytes_sent_+=frame->size();
+    ++tcp_client->packets_sent_;
+    tcp_client->bytes_sent_+=frame->size();
+}
+
+/*****************************************************************************/
+void
+GpsServer::send_latest(
+    TCP_CLIENT*                         tcp_client,
+    SharedFrame*                        frame,
+    const int                           type,
+    const int                           source)
+{
+    if (tcp_client->worker != Worker::current()) {
+        // Parked frames belong to the event loop of the client.
+        if (!tcp_client->closing && !tcp_client->output_overflow) {
+            tcp_client->worker->send(tcp_client, frame, WORKER_SEND_LATEST, type, source);
+        }
+        return;
+    }
+    const SUPERSEDE_KEY key(type, source);
+    std::map<SUPERSEDE_KEY, SharedFrame*>::iterator it = tcp_client->parked_frames.find(key);
+    if (it != tcp_client->parked_frames.end()) {
+        // Older one never went out.
+        it->second->release();
+        tcp_client->parked_frames.erase(it);
+        ++tcp_client->frames_superseded;
+    }
+    if (pending_output(tcp_client) > (unsigned int)output_high_water_) {
+        tcp_client->parked_frames[key] = frame->retain();
+        note_output(tcp_client);
+    } else {
+        send_frame(tcp_client, frame, true);
+    }
+}
+
+/*****************************************************************************/
+void
+GpsServer::send_parked(
+    TCP_CLIENT*                         tcp_client)
+{
+    std::map<SUPERSEDE_KEY, SharedFrame*> parked;
+    parked.swap(tcp_client->parked_frames);
+    for (std::map<SUPERSEDE_KEY, SharedFrame*>::iterator it = parked.begin(); it != parked.end(); ++it) {
+        send_frame(tcp_client, it->second, true);
+        it->second->release();
+    }
+    note_output(tcp_client);
+}
+
+/*****************************************************************************/
+void
+GpsServer::deliver_frame(
+    TCP_CLIENT*                         tcp_client,
+    SharedFrame*                        frame,
+    const WORKER_DELIVERY               delivery,
+    const int                           type,
+    const int                           source)
+{
+    // Runs in the loop owning the client, the send functions write the frame out.
+    switch (delivery) {
+        case WORKER_SEND_LATEST:
+            send_latest(tcp_client, frame, type, source);
+            break;
+        case WORKER_RELAY_RTCM:
+            rtcm_relay_to(tcp_client, frame);
+            break;
+        default:
+            send_frame(tcp_client, frame, delivery == WORKER_SEND_DROPPABLE);
+            break;
+    }
+}
+
 /*****************************************************************************/
 void
 GpsServer::send_event(
@@ -312,38 +507,31 @@ GpsServer::send_packet(
 /*****************************************************************************/
 void
 GpsServer::send_buffer_to_all(
-    std::list<TCP_CLIENT*>&         tcp_clients,
+    const std::list<TCP_CLIENT*>&   tcp_clients,
     void*                           buffer,
     int                             size,
     unsigned int                    mask,
-    int                             type
+    int                             type,
+    const bool                      droppable
 )
 {
-    std::vector<unsigned char> buf;
 	// ModemBox is broken: it can't accept packets larger than 126 bytes.
-	const char*	buffer_ptr = reinterpret_cast<const char*>(buffer);
 	const int	max_size = 120;
-	int			todo = size;
-	while (todo > 0) {
-		int this_round = todo>max_size ? max_size : todo;
-		CMR::encode(buf, type, buffer_ptr, this_round);
-
-		buffer_ptr += this_round;
-		todo -= this_round;
-	}
-    
+    SharedFrame*    frame = SharedFrame::encode(buffer, size, type, max_size);
+
     for (std::list<TCP_CLIENT*>::const_iterator it = tcp_clients.begin(); it != tcp_clients.end(); ++it) {
         TCP_CLIENT* tcp_client = *it;
         if (tcp_client->mode & mask) {
-            tcp_client->server->send_raw_data(tcp_client, buf);
+            tcp_client->server->send_frame(tcp_client, frame, droppable);
         }
     }
+    frame->release();
 }
 
 /*****************************************************************************/
 void
 GpsServer::send_buffer_to_all(
-    std::list<TCP_CLIENT*>&         tcp_clients,
+    const std::list<TCP_CLIENT*>&   tcp_clients,
     std::vector<unsigned char>&     buffer,
     unsigned int                    mask,
     int                             type
@@ -355,26 +543,35 @@ GpsServer::send_buffer_to_all(
 /*****************************************************************************/
 void
 GpsServer::forward_packet_to_all(
-    std::list<TCP_CLIENT*>&         clients,
     const TCP_CLIENT*               sender,
-    const utils::CMR&               packet
+    const CMR_VIEW&                 packet
 )
 {
 
-    std::vector<unsigned char>  msgbuf(sizeof(PACKET_FORWARD) - 1 + packet.data.size());
+    std::vector<unsigned char>  msgbuf(sizeof(PACKET_FORWARD) - 1 + packet.size);
     PACKET_FORWARD*             msg = (PACKET_FORWARD*)(&msgbuf[0]);
     msg->ship_id = (sender->ship_id.get() == 0) ? 0 : sender->ship_id->ship_number;
     msg->original_type = packet.type;
-    memcpy(&msg->original_data_block[0], &packet.data[0], packet.data.size());
-    std::vector<unsigned char> buf;
-    CMR::encode(buf, PACKET_FORWARD::CMRTYPE, msg, msgbuf.size());
-
-    for (std::list<TCP_CLIENT*>::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+    memcpy(&msg->original_data_block[0], packet.data, packet.size);
+    SharedFrame*    frame = SharedFrame::encode(msg, msgbuf.size(), PACKET_FORWARD::CMRTYPE);
+
+    // Plain ship positions supersede older ones of the same ship, shadows and other packets don't.
+    const bool supersedes =
+        packet.type == CMRTYPE_SHIP_POSITION
+        && packet.size == sizeof(PACKET_SHIP_POSITION)
+        && (reinterpret_cast<const PACKET_SHIP_POSITION*>(packet.data)->flags & SHIP_POSITION_SHADOW) == 0;
+    const ClientSet& clients = tcp_clients_.group(sender->group_id);
+    for (ClientSet::const_iterator it = clients.begin(); it != clients.end(); ++it) {
         TCP_CLIENT*   client = *it;
-        if (client->group_id == sender->group_id && client != sender) {
-            client->server->send_raw_data(client, buf);
+        if (client != sender) {
+            if (supersedes) {
+                send_latest(client, frame, PACKET_FORWARD::CMRTYPE, msg->ship_id);
+            } else {
+                send_frame(client, frame, true);
+            }
         }
     }
+    frame->release();
 }
 
 /*****************************************************************************/
@@ -383,10 +580,13 @@ GpsServer::send_startup_info(
     TCP_CLIENT*               client)
 {
     // send pointfile information ASAP
-    check_pointfile();
-    for (std::list<TCP_CLIENT*>::const_iterator it = tcp_clients_.begin(); it != tcp_clients_.end(); ++it) {
+    if (points_catalog_->latest().number != -1) {
+        send_packet(client, &pointfile_info_, sizeof(pointfile_info_), PACKET_POINTSFILE_INFO::CMRTYPE);
+    }
+    const ClientSet& group = tcp_clients_.group(client->group_id);
+    for (ClientSet::const_iterator it = group.begin(); it != group.end(); ++it) {
         TCP_CLIENT* other = *it;
-        if (other->group_id == client->group_id && other->mode != CLIENTMODE_GPSVIEWER && other->ship_id.get() != 0) {
+        if (other->mode != CLIENTMODE_GPSVIEWER && other->ship_id.get() != 0) {
             const int id = other->ship_id->ship_number;
             log(client, "Sending information about %s", other->ship_id->ship_name);
             // Ship info
@@ -435,50 +635,176 @@ GpsServer::send_startup_info(
     }
 }
 
+/*****************************************************************************/
+bool
+GpsServer::make_pointfile_info()
+{
+    const POINTS_FILE_ENTRY&    latest = points_catalog_->latest();
+    if (latest.number == -1) {
+        log("Couldn't find pointfile");
+        return false;
+    }
+    PACKET_POINTSFILE_INFO& p = pointfile_info_;
+    p.number = latest.number;
+    log("File name: %s, %d bytes, CRC %08x", points_files_->path(p.number).c_str(), latest.size, latest.crc);
+    p.size = latest.size;
+    p.flags = POINTSFILE_WINDOWED;
+    const int compressed_size = points_files_->size(p.number, POINTSFILE_CODEC_ZLIB);
+    if (compressed_size >= 0) {
+        p.codec = POINTSFILE_CODEC_ZLIB;
+        p.compressed_size = compressed_size;
+        log("Compressed size: %d of %d bytes", compressed_size, p.size);
+    } else {
+        p.codec = POINTSFILE_CODEC_NONE;
+        p.compressed_size = 0;
+        log("Compressed pointfile not ready, offering it uncompressed");
+    }
+    // Delta is worth it only if it is smaller than the file boats would get otherwise.
+    const int delta_size = points_files_->size(p.number, POINTSFILE_CODEC_DELTA);
+    const unsigned int full_size = p.codec == POINTSFILE_CODEC_ZLIB ? p.compressed_size : p.size;
+    p.delta_size = delta_size >= 0 && static_cast<unsigned int>(delta_size) < full_size ? delta_size : 0;
+    if (delta_size >= 0) {
+        log("Delta size from #%d: %d bytes%s", p.number - 1, delta_size, p.delta_size == 0 ? ", not offered" : "");
+    }
+    return true;
+}
+
 /*****************************************************************************/
 void
 GpsServer::check_pointfile()
 {
-    PACKET_POINTSFILE_INFO p;
-    const int num = getLatestPointsFileNum(points_file_dir_);
-    if (num != -1){
-        p.number = num;
-        std::string filename(ssprintf("%s/points_%05d.ipt", points_file_dir_.c_str(), p.number));
-        log("File name: %s", filename.c_str());
-        std::ifstream pointfile;
-        pointfile.open(filename.c_str(), std::ios::binary);
-        pointfile.seekg(0, ios::end);
-        p.size = pointfile.tellg();
-        vector<unsigned char> buf;
-        CMR::encode(buf, PACKET_POINTSFILE_INFO::CMRTYPE, &p, sizeof(p));
-        for (std::list<TCP_CLIENT*>::const_iterator it = tcp_clients_.begin(); it != tcp_clients_.end(); ++it) {
-            TCP_CLIENT* tcp_client = *it;
-            send_raw_data(tcp_client, buf);
-        }
-    } else {
-        log("Couldn't find pointfile");
+    if (!points_catalog_->update() || !make_pointfile_info()) {
+        return;
     }
+    send_pointfile_info();
+}
+
+/*****************************************************************************/
+void
+GpsServer::check_pointfile_variants()
+{
+    if (!points_files_->poll(pointfile_info_.number)) {
+        return;
+    }
+    // Boats still downloading the file switch to the variant.
+    const PACKET_POINTSFILE_INFO    previous = pointfile_info_;
+    if (make_pointfile_info() && memcmp(&previous, &pointfile_info_, sizeof(previous)) != 0) {
+        send_pointfile_info();
+    }
+}
+
+/*****************************************************************************/
+void
+GpsServer::send_pointfile_info()
+{
+    SharedFrame*    frame = SharedFrame::encode(&pointfile_info_, sizeof(pointfile_info_), PACKET_POINTSFILE_INFO::CMRTYPE);
+    for (std::list<TCP_CLIENT*>::const_iterator it = tcp_clients_.begin(); it != tcp_clients_.end(); ++it) {
+        TCP_CLIENT* tcp_client = *it;
+        send_frame(tcp_client, frame);
+    }
+    frame->release();
+}
+
+/*****************************************************************************/
+void
+GpsServer::points_catalog_handler(
+    int             fd,
+    short           event,
+    void*           _self)
+{
+    GpsServer*      server = reinterpret_cast<GpsServer*>(_self);
+    ServerLock      lock(server->lock_);
+    server->check_pointfile();
 }
 
 /*****************************************************************************/
 bool
 GpsServer::get_chunck(
     uint16_t                    file_no,
+    int                         codec,
     uint16_t                    chunk_no,
     PACKET_POINTSFILE_CHUNK&    packet)
 {
-    const std::string filename(ssprintf("%s/points_%05d.ipt", points_file_dir_.c_str(), file_no));
-    // log("File path: %s path length: %d", filename.c_str(), filename.length());
-    std::ifstream in(filename.c_str(), ios::binary);
-    if (!in.is_open()){
-        log("Unable to open pointfile '%s'", filename.c_str());
-        return false;
+    return points_files_->get_chunk(file_no, codec, chunk_no, packet);
+}
+
+/*****************************************************************************/
+void
+GpsServer::queue_chunk(
+    TCP_CLIENT*                     tcp_client,
+    const PACKET_POINTSFILE_CHUNK&  chunk)
+{
+    std::vector<unsigned char> buf;
+    CMR::encode(buf, PACKET_POINTSFILE_CHUNK::CMRTYPE, &chunk, sizeof(chunk));
+    tcp_client->chunk_batch.insert(tcp_client->chunk_batch.end(), buf.begin(), buf.end());
+    if (tcp_client->chunk_batch.size() >= (unsigned int)output_high_water_) {
+        flush_chunks(tcp_client);
+    }
+}
+
+/*****************************************************************************/
+void
+GpsServer::flush_chunks(
+    TCP_CLIENT*                     tcp_client)
+{
+    send_raw_data(tcp_client, tcp_client->chunk_batch);
+    tcp_client->chunk_batch.clear();
+}
+
+/*****************************************************************************/
+void
+GpsServer::request_window(
+    TCP_CLIENT*                                 tcp_client,
+    const PACKET_POINTSFILE_WINDOW_REQUEST&     request,
+    const unsigned int                          bitmap_size)
+{
+    if (tcp_client->transfer_file != request.file_number || tcp_client->transfer_codec != request.codec) {
+        const int size = points_files_->size(request.file_number, request.codec);
+        if (size < 0) {
+            log(LOG_LEVEL_ESSENTIAL, tcp_client, "error, requested window of file #%d codec %d, but not found.", request.file_number, request.codec);
+            return;
+        }
+        tcp_client->transfer_file = request.file_number;
+        tcp_client->transfer_codec = request.codec;
+        tcp_client->transfer_wanted.assign(size / CHUNK_SIZE + 1, false);
+        tcp_client->transfer_next = 0;
+        tcp_client->transfer_pending = 0;
+    }
+    std::vector<bool>&  wanted = tcp_client->transfer_wanted;
+    for (unsigned int i = 0; i < bitmap_size * 8 && request.first_chunk + i < wanted.size(); ++i) {
+        if ((request.missing[i / 8] & (1 << (i % 8))) != 0 && !wanted[request.first_chunk + i]) {
+            wanted[request.first_chunk + i] = true;
+            ++tcp_client->transfer_pending;
+        }
+    }
+    log(LOG_LEVEL_3, tcp_client, "window of file #%d codec %d from chunk #%d, %d chunks to send",
+        request.file_number, request.codec, request.first_chunk, tcp_client->transfer_pending);
+    send_window(tcp_client);
+}
+
+/*****************************************************************************/
+void
+GpsServer::send_window(
+    TCP_CLIENT*                     tcp_client)
+{
+    std::vector<bool>&  wanted = tcp_client->transfer_wanted;
+    // Always something on the way when the output is empty, even with a tiny high-water mark.
+    while (tcp_client->transfer_pending > 0 && !tcp_client->closing
+           && (pending_output(tcp_client) + tcp_client->chunk_batch.size() == 0
+               || pending_output(tcp_client) + tcp_client->chunk_batch.size() < (unsigned int)output_high_water_)) {
+        while (!wanted[tcp_client->transfer_next]) {
+            tcp_client->transfer_next = (tcp_client->transfer_next + 1) % wanted.size();
+        }
+        wanted[tcp_client->transfer_next] = false;
+        --tcp_client->transfer_pending;
+        PACKET_POINTSFILE_CHUNK chunk;
+        if (get_chunck(tcp_client->transfer_file, tcp_client->transfer_codec, tcp_client->transfer_next, chunk)) {
+            queue_chunk(tcp_client, chunk);
+        }
+    }
+    if (!tcp_client->chunk_batch.empty()) {
+        flush_chunks(tcp_client);
     }
-    in.seekg(chunk_no*CHUNK_SIZE, ios::beg);
-    in.read(reinterpret_cast<char*>(&packet.data[0]), CHUNK_SIZE);
-    packet.file_number = file_no;
-    packet.chunk_number = chunk_no;
-    return true;
 }
 
 /*****************************************************************************/
@@ -486,13 +812,7 @@ TCP_CLIENT*
 GpsServer::find_client(
     int ship_no)
 {
-    for (std::list<TCP_CLIENT*>::const_iterator it = tcp_clients_.begin(); it != tcp_clients_.end(); ++it) {
-        TCP_CLIENT* tcp_client = *it;
-        if (tcp_client->ship_id.get() != 0 && tcp_client->ship_id->ship_number == ship_no) {
-            return tcp_client;
-        }
-    }
-    return 0;
+    return tcp_clients_.findShip(ship_no);
 }
 
 
@@ -503,15 +823,9 @@ GpsServer::kill_tcp_client(
     const char*        reason)
 {
     log(tcp_client, "Shutting down client 0x%0x, name %s. Reason: %s", tcp_client->fd, tcp_client->name.c_str(), reason);
-    // Shutdown events.
-    bufferevent_disable(tcp_client->event, EV_READ | EV_WRITE);
-    bufferevent_free(tcp_client->event);
-    tcp_client->event = 0;
-
-    // Close socket.
-    close_socket(tcp_client->fd);
-    tcp_client->fd = 0;
-
+    if (capture_.get() != 0) {
+        capture_->record(CAPTURE_CLOSE, tcp_client->fd, reason, strlen(reason));
+    }
     // Remove client from the chain...
     tcp_clients_.remove(tcp_client);
 // XXX With more than 1 GpsBase/GpsAdmin this won't work. Must have separate lists for them. Currently it assumes that two admins and GpsBases won't connect at once.
@@ -528,6 +842,47 @@ GpsServer::kill_tcp_client(
             // pass
             break;
     }
+    close_tcp_client(tcp_client, reason);
+}
+
+/*****************************************************************************/
+void
+GpsServer::close_tcp_client(
+    TCP_CLIENT*&        tcp_client,
+    const char*         reason)
+{
+    if (workers_.empty()) {
+        destroy_tcp_client(tcp_client, reason);
+    } else {
+        // Other threads may have frames queued for it, the owner deletes it after them.
+        tcp_client->closing = true;
+        tcp_client->worker->close(tcp_client, reason);
+    }
+    tcp_client = 0;
+}
+
+/*****************************************************************************/
+void
+GpsServer::destroy_tcp_client(
+    TCP_CLIENT*         tcp_client,
+    const char*         reason)
+{
+    // Client is out of the registry, only its owner touches it.
+
+    // Shutdown events.
+    bufferevent_disable(tcp_client->event, EV_READ | EV_WRITE);
+    bufferevent_free(tcp_client->event);
+    tcp_client->event = 0;
+
+    // Close socket.
+    close_socket(tcp_client->fd);
+    tcp_client->fd = 0;
+
+    // Drop frames waiting for output.
+    for (std::map<SUPERSEDE_KEY, SharedFrame*>::iterator it = tcp_client->parked_frames.begin(); it != tcp_client->parked_frames.end(); ++it) {
+        it->second->release();
+    }
+    tcp_client->parked_frames.clear();
     xdelete(tcp_client);
 }
 
@@ -535,14 +890,11 @@ GpsServer::kill_tcp_client(
 void
 GpsServer::modembox_handle_packet(
     TCP_CLIENT* tcp_client,
-    CMR&  Packet
+    const CMR_VIEW&  Packet
 )
 {
     // 1. Log (if not ping).
-    if (Packet.type != utils::CMR::PING) {
-        std::string msg(Packet.data.begin(), Packet.data.end());
-        //log ( tcp_client, "ModemBox sent something: %s", msg.c_str() );
-    }
+    //LOG_AT(LOG_LEVEL_DEBUG, tcp_client, "ModemBox sent something: %s", std::string(Packet.data, Packet.data + Packet.size).c_str());
 
     // 2. Update contact time.
     database_->updateContactTime(tcp_client->ship_id->ship_number);
@@ -551,7 +903,7 @@ GpsServer::modembox_handle_packet(
     switch (Packet.type) {
         case CMR::SERIAL: {
             //log ( tcp_client, "Parsing serial" );
-            if (Packet.data.begin() == Packet.data.end() || Packet.data.size() == 0) {
+            if (Packet.size == 0) {
                 log(LOG_LEVEL_3, tcp_client, "Null-length serial packet");
                 break;
             }
@@ -560,9 +912,9 @@ GpsServer::modembox_handle_packet(
                 log(LOG_LEVEL_ESSENTIAL, tcp_client, "Wrong GPS number: %d", gps_no);
                 break;
             }
-            std::string tmp(Packet.data.begin() + 1, Packet.data.end());
+            std::string tmp(Packet.data + 1, Packet.data + Packet.size);
             my_time time = my_time_of_now();
-            log(LOG_LEVEL_ESSENTIAL, tcp_client,
+            LOG_AT(LOG_LEVEL_DEBUG, tcp_client,
 					"GPS %d: %s",
 					gps_no, tmp.c_str());
             tcp_client->nmea_decoder[gps_no].feed(tmp);
@@ -618,17 +970,18 @@ GpsServer::modembox_handle_packet(
                     local_of_gps(gga.latitude, gga.longitude, gga.altitude,  packet.pos.gps1_x, packet.pos.gps1_y, ship_z);
                     packet.pos.heading = compass_direction;
                     packet.pos.flags = 0;
-                    std::vector<unsigned char> v;
-                    v.assign(&packet.dat[0], &packet.dat[0] + sizeof(packet));
+                    SharedFrame*    frame = SharedFrame::encode(packet.dat, sizeof(packet), CMRTYPE_SHIP_POSITION);
                     // FIXME send only to needed clients (clients with GpsViewer)
-                    for (std::list<TCP_CLIENT*>::const_iterator it = tcp_clients_.begin(); it != tcp_clients_.end(); ++it) {
+                    const ClientSet& group = tcp_clients_.group(tcp_client->group_id);
+                    for (ClientSet::const_iterator it = group.begin(); it != group.end(); ++it) {
                         TCP_CLIENT*   client = *it;
                         // Send to all other clients belonging to same group, don't send back to original GPS info sender
-                        if (client->group_id == tcp_client->group_id && client->ship_id.get() != 0 && client->ship_id->ship_number != packet.pos.ship_number) {
+                        if (client->ship_id.get() != 0 && client->ship_id->ship_number != packet.pos.ship_number) {
                             //log(tcp_client, "Sending coords to %s", name.c_str());
-                            send_event(client, v, CMRTYPE_SHIP_POSITION);
+                            send_latest(client, frame, CMRTYPE_SHIP_POSITION, packet.pos.ship_number);
                         }
                     }
+                    frame->release();
                 }
 
                 PACKET_GPS_POSITION gpspos;
@@ -642,23 +995,26 @@ GpsServer::modembox_handle_packet(
                 };
                 GpsPacket gp;
                 gp.pos = gpspos;
-                v.assign(gp.dat, gp.dat + sizeof(GpsPacket));
-                for (std::list<TCP_CLIENT*>::const_iterator it = tcp_clients_.begin(); it != tcp_clients_.end(); ++it) {
+                SharedFrame*    frame = SharedFrame::encode(gp.dat, sizeof(GpsPacket), CMRTYPE_GPS_POSITION);
+                const ClientSet& group = tcp_clients_.group(tcp_client->group_id);
+                for (ClientSet::const_iterator it = group.begin(); it != group.end(); ++it) {
                     TCP_CLIENT*   client = *it;
-                    if (client->group_id == tcp_client->group_id) {
-                        //log(tcp_client, "Sending GPS %d coords to %s", gps_no, client->identity["Boat name"].c_str());
-                        send_event(client,  v, CMRTYPE_GPS_POSITION);
-                    }
+                    //log(tcp_client, "Sending GPS %d coords to %s", gps_no, client->identity["Boat name"].c_str());
+                    send_latest(client, frame, CMRTYPE_GPS_POSITION, gpspos.ship_number * 2 + gps_no);
                 }
+                frame->release();
             }
             break;
         }
         case CMRTYPE_SHIP_POSITION: {
-            if (Packet.data.size() != sizeof(PACKET_SHIP_POSITION)) {
-                log("Wrong length ship position packet: %d vs %d. Ignoring", Packet.data.size(), sizeof(PACKET_SHIP_POSITION));
+            if (Packet.size != sizeof(PACKET_SHIP_POSITION)) {
+                log("Wrong length ship position packet: %d vs %d. Ignoring", Packet.size, sizeof(PACKET_SHIP_POSITION));
                 break;
             }
-            PACKET_SHIP_POSITION* pos = reinterpret_cast<PACKET_SHIP_POSITION*>(&Packet.data[0]);
+            // Copy, ship number gets patched before forwarding.
+            PACKET_SHIP_POSITION    position;
+            memcpy(&position, Packet.data, sizeof(position));
+            PACKET_SHIP_POSITION*   pos = &position;
             if (tcp_client->ship_id.get() != 0) {
                 if (isnan(pos->heading)) {
                     log(LOG_LEVEL_3, tcp_client, "Ship heading is NaN: %d", pos->heading);
@@ -676,13 +1032,14 @@ GpsServer::modembox_handle_packet(
             } else {
                 log(LOG_LEVEL_3, tcp_client, "Got ship %d position but current client has no ship_id", pos->ship_number);
             }
-            forward_packet_to_all(tcp_clients_, tcp_client, Packet);
+            const CMR_VIEW  forwarded = { Packet.type, reinterpret_cast<const unsigned char*>(pos), sizeof(position) };
+            forward_packet_to_all(tcp_client, forwarded);
             break;
         }
         case CMR::DIGNET: {
             string              msg_name;
             map<string, string> msg_args;
-            string              data_block(Packet.data.begin(), Packet.data.end());
+            string              data_block(Packet.data, Packet.data + Packet.size);
             try {
                 ParseDigNetMessage(msg_name, msg_args, data_block);
             } catch (Error &e) {
@@ -746,12 +1103,12 @@ GpsServer::modembox_handle_packet(
                 log(LOG_LEVEL_ESSENTIAL, tcp_client, "DIGNET unknown: '%s'", data_block.c_str());
             }
             // Forward the message to others
-            forward_packet_to_all(tcp_clients_, tcp_client, Packet);
+            forward_packet_to_all(tcp_client, Packet);
             break;
         }
         case CMRTYPE_REQUEST_FROM_SHIP:
-            if (Packet.data.size() >= sizeof(PACKET_REQUEST_FROM_SHIP)) {
-                const PACKET_REQUEST_FROM_SHIP* req = reinterpret_cast<const PACKET_REQUEST_FROM_SHIP*>(&Packet.data[0]);
+            if (Packet.size >= sizeof(PACKET_REQUEST_FROM_SHIP)) {
+                const PACKET_REQUEST_FROM_SHIP* req = reinterpret_cast<const PACKET_REQUEST_FROM_SHIP*>(Packet.data);
                 // Flags are in first byte
                 switch (req->flags) {
                     case REQUEST_SHIP_INFO: {
@@ -786,12 +1143,12 @@ GpsServer::modembox_handle_packet(
                         break;
                 }
             } else {
-                log("Wrong length request packet: %d vs %d. Ignoring", Packet.data.size(), sizeof(PACKET_REQUEST_FROM_SHIP));
+                log("Wrong length request packet: %d vs %d. Ignoring", Packet.size, sizeof(PACKET_REQUEST_FROM_SHIP));
             }
             break;
         case PACKET_WORKLOG_SETMARK::CMRTYPE:
-            if (Packet.data.size() >= sizeof(PACKET_WORKLOG_SETMARK)) {
-                const PACKET_WORKLOG_SETMARK*   query = reinterpret_cast<const PACKET_WORKLOG_SETMARK*>(&Packet.data[0]);
+            if (Packet.size >= sizeof(PACKET_WORKLOG_SETMARK)) {
+                const PACKET_WORKLOG_SETMARK*   query = reinterpret_cast<const PACKET_WORKLOG_SETMARK*>(Packet.data);
                 log("PACKET_WORKLOG_SETMARK: mark=%d at %d, %d", query->workmark, query->row_index, query->col_index);
                 if (tcp_client->mode == CLIENTMODE_MODEMBOX) {
                     std::vector<unsigned char>      responseBuffer;
@@ -800,7 +1157,7 @@ GpsServer::modembox_handle_packet(
                     if (database_->executeWorklogSetmark(*query, tcp_client->ship_id->ship_number, responseBuffer, responsePacket)) {
                         // yes :)
                         send_buffer_to_all(
-                            tcp_clients_,
+                            tcp_clients_.all(),
                             responseBuffer,
                             CLIENTMODE_MODEMBOX | CLIENTMODE_GPSVIEWER,
                             PACKET_WORKLOG_ROWS::CMRTYPE);
@@ -812,12 +1169,12 @@ GpsServer::modembox_handle_packet(
                 }
             } else {
                 log("Wrong length PACKET_WORKLOG_SETMARK: %d bytes, should be %d. Ignoring",
-                    Packet.data.size(), sizeof(PACKET_WORKLOG_SETMARK));
+                    Packet.size, sizeof(PACKET_WORKLOG_SETMARK));
             }
             break;
         case PACKET_WORKLOG_QUERY_BY_INDICES::CMRTYPE:
-            if (Packet.data.size() >= sizeof(PACKET_WORKLOG_QUERY_BY_INDICES)) {
-                const PACKET_WORKLOG_QUERY_BY_INDICES*  query = reinterpret_cast<const PACKET_WORKLOG_QUERY_BY_INDICES*>(&Packet.data[0]);
+            if (Packet.size >= sizeof(PACKET_WORKLOG_QUERY_BY_INDICES)) {
+                const PACKET_WORKLOG_QUERY_BY_INDICES*  query = reinterpret_cast<const PACKET_WORKLOG_QUERY_BY_INDICES*>(Packet.data);
                 log("PACKET_WORKLOG_QUERY_BY_INDICES: start_row %d, total %d rows",
                     (int)query->start_row_index, (int)query->nrows);
 
@@ -831,29 +1188,48 @@ GpsServer::modembox_handle_packet(
                 }
             } else {
                 log("Wrong length PACKET_WORKLOG_QUERY_BY_INDICES : %d bytes, should be %d. Ignoring",
-                    Packet.data.size(), sizeof(PACKET_WORKLOG_QUERY_BY_INDICES));
+                    Packet.size, sizeof(PACKET_WORKLOG_QUERY_BY_INDICES));
+            }
+            break;
+        case PACKET_WORKLOG_QUERY_BY_TIMESTAMP::CMRTYPE:
+            if (Packet.size >= sizeof(PACKET_WORKLOG_QUERY_BY_TIMESTAMP)) {
+                const PACKET_WORKLOG_QUERY_BY_TIMESTAMP*    query = reinterpret_cast<const PACKET_WORKLOG_QUERY_BY_TIMESTAMP*>(Packet.data);
+                log("PACKET_WORKLOG_QUERY_BY_TIMESTAMP: timestamp %u", (unsigned int)query->timestamp);
+
+                std::vector<std::vector<unsigned char> >    responseBuffers;
+
+                if (database_->executeWorklogQueryByTimestamp(*query, responseBuffers)) {
+                    for (unsigned int i = 0; i < responseBuffers.size(); ++i) {
+                        send_event(tcp_client, responseBuffers[i], PACKET_WORKLOG_CHANGED_ROWS::CMRTYPE);
+                    }
+                } else {
+                    log("worklog timestamp query database failed.");
+                }
+            } else {
+                log("Wrong length PACKET_WORKLOG_QUERY_BY_TIMESTAMP : %d bytes, should be %d. Ignoring",
+                    Packet.size, sizeof(PACKET_WORKLOG_QUERY_BY_TIMESTAMP));
             }
             break;
         case PACKET_BUILD_INFO::CMRTYPE:
-            if (Packet.data.size() >= sizeof(PACKET_BUILD_INFO)) {
-                const PACKET_BUILD_INFO*    build = reinterpret_cast<const PACKET_BUILD_INFO*>(&Packet.data[0]);
+            if (Packet.size >= sizeof(PACKET_BUILD_INFO)) {
+                const PACKET_BUILD_INFO*    build = reinterpret_cast<const PACKET_BUILD_INFO*>(Packet.data);
                 log("PACKET_BUILD_INFO: build %d", build->build_number);
                 tcp_client->gpsviewer_build_number = build->build_number;
                 tcp_client->has_gpsviewer = true;
             } else {
                 log("Wrong length PACKET_WORKLOG_SETMARK: %d bytes, should be %d. Ignoring",
-                    Packet.data.size(), sizeof(PACKET_WORKLOG_SETMARK));
+                    Packet.size, sizeof(PACKET_WORKLOG_SETMARK));
             }
             break;
         case PACKET_POINTSFILE_CHUNK_REQUEST::CMRTYPE:
             {
-                PACKET_POINTSFILE_CHUNK_REQUEST* req = reinterpret_cast<PACKET_POINTSFILE_CHUNK_REQUEST*>(&Packet.data[0]);
+                const PACKET_POINTSFILE_CHUNK_REQUEST* req = reinterpret_cast<const PACKET_POINTSFILE_CHUNK_REQUEST*>(Packet.data);
                 PACKET_POINTSFILE_CHUNK chunk;
-                if (get_chunck(req->file_number, req->chunk_number, chunk)){
-                    log(LOG_LEVEL_ESSENTIAL, tcp_client,
+                if (get_chunck(req->file_number, POINTSFILE_CODEC_NONE, req->chunk_number, chunk)){
+                    log(LOG_LEVEL_3, tcp_client,
 							"sending file #%d chunk #%d",
 							req->file_number, req->chunk_number);
-                    send_packet(tcp_client, &chunk, sizeof(chunk), PACKET_POINTSFILE_CHUNK::CMRTYPE);
+                    queue_chunk(tcp_client, chunk);
                 } else {
                     log(LOG_LEVEL_ESSENTIAL, tcp_client,
 							"error, requested #%d chunk #%d, but not found.",
@@ -861,6 +1237,15 @@ GpsServer::modembox_handle_packet(
 				}
             }
             break;
+        case PACKET_POINTSFILE_WINDOW_REQUEST::CMRTYPE:
+            if (Packet.size > offsetof(PACKET_POINTSFILE_WINDOW_REQUEST, missing) && Packet.size <= sizeof(PACKET_POINTSFILE_WINDOW_REQUEST)) {
+                const PACKET_POINTSFILE_WINDOW_REQUEST* req = reinterpret_cast<const PACKET_POINTSFILE_WINDOW_REQUEST*>(Packet.data);
+                request_window(tcp_client, *req, Packet.size - offsetof(PACKET_POINTSFILE_WINDOW_REQUEST, missing));
+            } else {
+                log("Wrong length PACKET_POINTSFILE_WINDOW_REQUEST: %d bytes, should be %d..%d. Ignoring",
+                    Packet.size, offsetof(PACKET_POINTSFILE_WINDOW_REQUEST, missing) + 1, sizeof(PACKET_POINTSFILE_WINDOW_REQUEST));
+            }
+            break;
         default:
             log(LOG_LEVEL_3, tcp_client, "Got some unknown message: 0x%0x", Packet.type);
     }
@@ -874,8 +1259,12 @@ GpsServer::timer_handler(
     void*           _self)
 {
     GpsServer*      server = reinterpret_cast<GpsServer*>(_self);
+    ServerLock      lock(server->lock_);
     std::list<TCP_CLIENT*>  clients_to_kill;
     server->timer_ticks_++;
+    // 0. Write out ship updates gathered during last second.
+    server->database_->flushShips();
+    server->check_pointfile_variants();
     // 1. Report clients...
     if (++(server->timer_count10_) >= 10) {
         server->timer_count10_ = 0;
@@ -885,7 +1274,14 @@ GpsServer::timer_handler(
             if (server->weather_info_downloader_->popContents(weather)){
                 parse_weather_info(weather, server->weather_);
                 log(0, "Weather: Wind: %d Gust: %d Dir: %d water: %d time: %d", server->weather_.wind_speed, server->weather_.gust_speed, server->weather_.wind_direction, server->weather_.water_level, server->weather_.time);
-                server->send_buffer_to_all(server->tcp_clients_, &server->weather_, sizeof(server->weather_), CLIENTMODE_MODEMBOX|CLIENTMODE_GPSVIEWER, PACKET_WEATHER_INFORMATION::CMRTYPE);
+                SharedFrame*    frame = SharedFrame::encode(&server->weather_, sizeof(server->weather_), PACKET_WEATHER_INFORMATION::CMRTYPE);
+                for (std::list<TCP_CLIENT*>::const_iterator it = server->tcp_clients_.begin(); it != server->tcp_clients_.end(); ++it) {
+                    TCP_CLIENT* tcp_client = *it;
+                    if (tcp_client->mode & (CLIENTMODE_MODEMBOX|CLIENTMODE_GPSVIEWER)) {
+                        server->send_latest(tcp_client, frame, PACKET_WEATHER_INFORMATION::CMRTYPE, 0);
+                    }
+                }
+                frame->release();
             }
         }
         const uint64_t packetsSent = server->packets_sent_.countAtInterval(10);
@@ -898,7 +1294,10 @@ GpsServer::timer_handler(
     }
     if (++ (server->timer_count60_) >= 60) {
         server->timer_count60_ = 0;
-        server->check_pointfile();
+        // inotify tells of new points files as they come.
+        if (server->points_catalog_->fd() < 0) {
+            server->check_pointfile();
+        }
         // Send out voltage information 10 minutes after startup.
         // FIXME Time should be configurable?
         static bool startup_mail_sent = false;
@@ -931,21 +1330,47 @@ GpsServer::timer_handler(
         const float bpsSen = bytesSen/60.0;
         const float bpsRec = bytesRec/60.0;
         log(LOG_LEVEL_ESSENTIAL, 0, "1-minute timer. Uptime %d, total of %d clients. Packets sent/received: %lld/%lld. Bytes: %lld/%lld per second: %3.1f/%3.1f ", server->timer_ticks_, server->tcp_clients_.size(), server->packets_sent_.countAtInterval(60), server->packets_received_.countAtInterval(60), bytesSen, bytesRec, bpsSen, bpsRec);
+        {
+            const DBWRITER_STATISTICS st = server->database_->writerStatistics();
+            log(LOG_LEVEL_ESSENTIAL, 0, "DB writer: queue %u/%u, written %llu, dropped %llu, failed %llu, flushes %llu, last flush %u ms, max %u ms",
+                st.queue_depth, st.queue_size, (unsigned long long)st.rows_written, (unsigned long long)st.rows_dropped,
+                (unsigned long long)st.rows_failed, (unsigned long long)st.flushes, st.last_flush_ms, st.max_flush_ms);
+        }
+        if (server->database_->positionStore() != 0) {
+            const POSITION_STORE_STATISTICS st = server->database_->positionStore()->statistics();
+            log(LOG_LEVEL_ESSENTIAL, 0, "Position store: %lld records, %lld failed, %d segments open, %lld opened",
+                st.records, st.failed, st.segments, st.segments_opened);
+        }
+        {
+            const POINTS_FILE_CACHE_STATISTICS st = server->points_files_->statistics();
+            log(LOG_LEVEL_ESSENTIAL, 0, "Points files: %lld chunks, %lld failed, %d files mapped, %lld misses, %lld evictions, %lld compressed, %lld deltas",
+                st.chunks, st.failed, st.files, st.misses, st.evictions, st.compressed, st.deltas);
+        }
+        {
+            const POINTS_CATALOG_STATISTICS st = server->points_catalog_->statistics();
+            log(LOG_LEVEL_ESSENTIAL, 0, "Points catalog: %lld events, %lld scans, %lld changes, %d files",
+                st.events, st.scans, st.changes, st.files);
+        }
+        if (server->capture_.get() != 0) {
+            const CAPTURE_STATISTICS st = server->capture_->statistics();
+            log(LOG_LEVEL_ESSENTIAL, 0, "Capture: %lld records, %lld bytes, %lld dropped, %lld rotations",
+                st.records, st.bytes, st.dropped, st.rotations);
+        }
         // Send everyones GPS offsets to everyone else
         // FIXME: Send only if changed?
         for (std::list<TCP_CLIENT*>::const_iterator it = server->tcp_clients_.begin(); it != server->tcp_clients_.end(); ++it) {
             TCP_CLIENT* tcp_client = *it;
-            string s = tcp_client->reportMinuteStatistics();
-            log(LOG_LEVEL_ESSENTIAL, tcp_client, s.c_str());
+            LOG_AT(LOG_LEVEL_ESSENTIAL, tcp_client, "%s", tcp_client->reportMinuteStatistics().c_str());
         }
         // Handle RTCM source
         if (rtcm_source_.size() > 0) {
             const bool  is_connected = server->rtcm_source_socket_ != (int) INVALID_SOCKET;
             const int   delta_bytes = server->rtcm_source_bytes_read_ - server->rtcm_source_bytes_read_last_;
-            log(0, "RTCM source: %s, %d bytes last minute, %d bytes total.",
+            log(0, "RTCM source: %s, %d bytes last minute, %d bytes total, %d frames dropped for lagging clients.",
                 is_connected ? "connected" : "disconnected",
                 delta_bytes,
-                server->rtcm_source_bytes_read_
+                server->rtcm_source_bytes_read_,
+                server->rtcm_dropped_
                );
 
             server->rtcm_source_bytes_read_last_ = server->rtcm_source_bytes_read_;
@@ -1023,7 +1448,8 @@ GpsServer::timer_handler(
     if (++ (server->timer_countping_) >= PING_TICKS) {
         server->timer_countping_ = 0;
         log(LOG_LEVEL_ESSENTIAL, 0, "Ping time.");
-        send_buffer_to_all(server->tcp_clients_, 0, 0, CLIENTMODE_PINGABLE, utils::CMR::PING);
+        // Pending output keeps the connection alive as well as a ping.
+        send_buffer_to_all(server->tcp_clients_.all(), 0, 0, CLIENTMODE_PINGABLE, utils::CMR::PING, true);
     }
 
     // 3. Kill idle clients.
@@ -1032,8 +1458,8 @@ GpsServer::timer_handler(
         for (std::list<TCP_CLIENT*>::const_iterator it = server->tcp_clients_.begin(); it != server->tcp_clients_.end(); ++it)
         {
             TCP_CLIENT* tcp_client = *it;
-            ++tcp_client->idle_ticks;
-            if (tcp_client->idle_ticks >= MAX_IDLE_TICKS) {
+            // Reset by the owning worker without the lock.
+            if (__sync_add_and_fetch(&tcp_client->idle_ticks, 1) >= MAX_IDLE_TICKS || tcp_client->output_overflow) {
                 clients_to_kill.push_front(tcp_client);
             }
         }
@@ -1042,7 +1468,7 @@ GpsServer::timer_handler(
         {
             TCP_CLIENT *c = *it;
             log(c, "Killing client 0x%0x, idle ticks %d", c->fd, c->idle_ticks);
-            server->kill_tcp_client(*it, "No activity.");
+            server->kill_tcp_client(*it, c->output_overflow ? "Output over OutputMaxPending." : "No activity.");
         }
     }
 
@@ -1058,85 +1484,67 @@ GpsServer::tcp_client_read_handler(
 {
     TCP_CLIENT* tcp_client = reinterpret_cast<TCP_CLIENT*>(_tcp_client);
     GpsServer*  server = tcp_client->server;
-    std::string&    buffer = server->tcp_read_buffer_;
-
+    // Reading and decoding touch only this client, packets are handled under the lock.
+    ServerLock  lock(server->lock_, false);
+    if (tcp_client->closing) {
+        return;
+    }
 
     // Reset idle activity counter.
     tcp_client->idle_ticks = 0;
 
-    // Read from buffer.
-    int so_far = 0;
-
-    for (;;) {
-        if (((int)(buffer.size())) == so_far)
-            buffer.resize(so_far <= 0 ? 1024 : 2*so_far);
-        int this_round = bufferevent_read(event, &buffer[so_far], buffer.size() - so_far);
-        if (this_round <= 0)
-            break;
-        so_far += this_round;
-    }
-
-    if (so_far == 0) {
+    // Decode straight from the input buffer, drained when done.
+    struct evbuffer*        input = EVBUFFER_INPUT(event);
+    const unsigned int      size = EVBUFFER_LENGTH(input);
+    if (size == 0) {
+        lock.acquire();
         server->kill_tcp_client(tcp_client, "TCP End-of-stream.");
         return;
     }
-    std::vector<unsigned char> buf(buffer.begin(), buffer.begin() + so_far);
-#ifdef LOG_PACKETS
-    {
-        // Log all packets
-        FILE* f = fopen("packets.raw", "ab");
-        if (f != 0) {
-            fwrite(&buf[0], sizeof(unsigned char), buf.size(), f);
-            fclose(f);
-        }
+    const unsigned char*    data = EVBUFFER_DATA(input);
+    if (server->capture_.get() != 0) {
+        server->capture_->record(CAPTURE_DATA, tcp_client->fd, data, size);
     }
-#endif
-    server->bytes_received_ += buf.size();
-    tcp_client->bytes_received_ += buf.size();
+    server->bytes_received_ += size;
+    tcp_client->bytes_received_ += size;
 
-    //log ( tcp_client, "Parsing buffer of %d bytes coming from 0x%0x: %s", buf.size(), tcp_client->fd, tcp_client->name.c_str() );
+    //log ( tcp_client, "Parsing buffer of %d bytes coming from 0x%0x: %s", size, tcp_client->fd, tcp_client->name.c_str() );
     //OsKando
-    if ((tcp_client->mode == CLIENTMODE_OSKANDO) || (tcp_client->mode == CLIENTMODE_UNIDENTIFIED && buf[0] == 'P')) {
-        //log("Oskando sent a message: %s", std::string(buf.begin(), buf.end()).c_str());
-        tcp_client->mode = CLIENTMODE_OSKANDO;
+    if ((tcp_client->mode == CLIENTMODE_OSKANDO) || (tcp_client->mode == CLIENTMODE_UNIDENTIFIED && data[0] == 'P')) {
+        //log("Oskando sent a message: %s", std::string(data, data + size).c_str());
+        lock.acquire();
+        if (tcp_client->mode != CLIENTMODE_OSKANDO) {
+            tcp_client->mode = CLIENTMODE_OSKANDO;
+            server->tcp_clients_.update(tcp_client);
+        }
         tcp_client->name = "Oskando MK3";
+        evbuffer_drain(input, size);
         return;
     }
 
-    tcp_client->cmr_decoder.feed(buf);
-    utils::CMR cmr;
-    buffer.resize(0);
-
-    std::vector<std::string>    args;
-    std::vector<unsigned char>  write_buffer;
+    tcp_client->cmr_stream.feed(data, size);
+    CMR_VIEW            cmr;
     bool                kill_client = false;
 
     // Handle packets...
-    while (tcp_client->cmr_decoder.pop(cmr)) {
+    while (tcp_client->cmr_stream.pop(cmr)) {
         ++server->packets_received_;
         ++tcp_client->packets_received_;
-#ifdef LOG_PACKETS
-        {
-            // Log last packet
-            FILE *f = fopen("lastpacket.raw", "wb");
-            if (f != 0) {
-                fwrite(&cmr.data[0], sizeof(unsigned char), cmr.data.size(), f);
-                fclose(f);
-            }
-        }
-#endif
-        std::string s(cmr.ToString());
-        if (cmr.type == utils::CMR::PING) {
+        if (cmr.type == CMR_TYPE_PING) {
             // Ping packets are considered "processed" when they are received
             continue;
         } else {
-            //std::string type_name=cmr.TypeName();
-            //log ( tcp_client, "Got CMR packet type 0x%0x:%s from 0x%0x:%s, size %d", cmr.type, type_name.c_str(), tcp_client->fd, tcp_client->name.c_str(), cmr.data.size() );
+            //log ( tcp_client, "Got CMR packet type 0x%0x from 0x%0x:%s, size %d", cmr.type, tcp_client->fd, tcp_client->name.c_str(), cmr.size );
         }
-        if (cmr.type != utils::CMR::PING && (cmr.data.begin() == cmr.data.end() || cmr.data.size() == 0)) {
+        if (cmr.size == 0) {
             log(LOG_LEVEL_3, tcp_client, "Null-length packet, skipping");
             continue;
         }
+        lock.acquire();
+        if (tcp_client->closing) {
+            // Killed by another thread meanwhile.
+            break;
+        }
 
 #ifdef FORCED_CRASH
         if (cmr.type == CMRTYPE_CRASH) {
@@ -1151,7 +1559,7 @@ GpsServer::tcp_client_read_handler(
 
                 string              msg_name;
                 map<string, string>  msg_args;
-                string              data_block(cmr.data.begin(), cmr.data.end());
+                string              data_block(cmr.data, cmr.data + cmr.size);
                 try {
                     ParseDigNetMessage(msg_name, msg_args, data_block);
                 } catch (Error &e) {
@@ -1162,51 +1570,45 @@ GpsServer::tcp_client_read_handler(
                     // If can't authenticate kill klient
                     kill_client = !tcp_client->server->authenticate(tcp_client, msg_args, data_block);
                 } else {
-                    std::string type_name(cmr.TypeName());
-                    std::string value(cmr.ToString());
-                    log(LOG_LEVEL_ESSENTIAL, tcp_client,
-                        "Unknown packet from 0x%0x:%s, type: %s:%s",
-                        tcp_client->fd, tcp_client->name.c_str(), type_name.c_str(), value.c_str()
+                    LOG_AT(LOG_LEVEL_ESSENTIAL, tcp_client,
+                        "Unknown packet from 0x%0x:%s: %s",
+                        tcp_client->fd, tcp_client->name.c_str(), CmrStream::toString(cmr).c_str()
                        );
                 }
             }
             break;
             case CLIENTMODE_GPSBASE:
-                if (cmr.type != utils::CMR::PING) {
-                    std::string value = cmr.ToString();
-                    //log ( tcp_client, "GPSbase sent something: %s", value.c_str() );
-                }
+                //LOG_AT(LOG_LEVEL_DEBUG, tcp_client, "GPSbase sent something: %s", CmrStream::toString(cmr).c_str());
                 switch (cmr.type) {
                     case (utils::CMR::LAMPNET) :
                             // send Lampnet to gpsadmin
                             if (tcp_client->server->gps_admin_ != 0) {
-                                tcp_client->server->send_event(tcp_client->server->gps_admin_, cmr.data);
+                                tcp_client->server->send_packet(tcp_client->server->gps_admin_, cmr.data, cmr.size);
                             }
                         break;
                         //Send raw RTCM, no need to encode into CMR
                     case (utils::CMR::RTCM) :
+                        {
+                            std::vector<unsigned char> raw(cmr.data, cmr.data + cmr.size);
+                            SharedFrame* frame = SharedFrame::wrap(raw);
                             for (std::list<TCP_CLIENT*>::const_iterator it = tcp_client->server->rtcm_listening_clients_.begin();it != tcp_client->server->rtcm_listening_clients_.end();it++) {
-                                TCP_CLIENT* rtcm_client = *it;
-                                std::string value = cmr.ToString();
-                                //log ( tcp_client, "Sending %s to client %d", value.c_str(), rtcm_client->name.c_str() );
-                                rtcm_client->server->send_raw_data(rtcm_client, cmr.data);
-                                server->bytes_sent_ += cmr.data.size();
+                                //log ( tcp_client, "Sending %d bytes to client %s", frame->size(), (*it)->name.c_str() );
+                                server->rtcm_relay_to(*it, frame);
                             }
+                            frame->release();
+                        }
                         break;
                     default:
                         break;
                 }
                 break;
             case CLIENTMODE_GPSADMIN:
-                if (cmr.type != utils::CMR::PING) {
-                    std::string value = cmr.ToString();
-                    //log ( tcp_client, "GpsAdmin sent something: %s", value.c_str() );
-                }
+                //LOG_AT(LOG_LEVEL_DEBUG, tcp_client, "GpsAdmin sent something: %s", CmrStream::toString(cmr).c_str());
                 switch (cmr.type) {
                     case (utils::CMR::LAMPNET) :
                             // send Lampnet to gpsadmin
                             if (tcp_client->server->gps_base_ != 0) {
-                                tcp_client->server->send_event(tcp_client->server->gps_base_, cmr.data);
+                                tcp_client->server->send_packet(tcp_client->server->gps_base_, cmr.data, cmr.size);
                             } else {
                                 std::string s = "Admin tries to talk with base but base does not exist!";
                                 log(tcp_client, "%s", s.c_str());
@@ -1223,12 +1625,15 @@ GpsServer::tcp_client_read_handler(
                 server->modembox_handle_packet(tcp_client, cmr);
                 break;
             default: {
-                std::string packet = cmr.ToString();
-                log(LOG_LEVEL_3, tcp_client, "WARNING! Unknow client 0x%0x:%s, mode %d sent something: %s", tcp_client->fd, tcp_client->name.c_str(), tcp_client->mode, packet.c_str());
+                LOG_AT(LOG_LEVEL_3, tcp_client, "WARNING! Unknow client 0x%0x:%s, mode %d sent something: %s", tcp_client->fd, tcp_client->name.c_str(), tcp_client->mode, CmrStream::toString(cmr).c_str());
                 //assert(false);
             }
         }
     }
+    evbuffer_drain(input, size);
+    if (!tcp_client->chunk_batch.empty()) {
+        server->flush_chunks(tcp_client);
+    }
 
     if (kill_client) {
         server->kill_tcp_client(tcp_client, "Rejected.");
@@ -1397,6 +1802,8 @@ GpsServer::authenticate(
             }
         }
     }
+    // Mode, ship and group are known now.
+    tcp_clients_.update(client);
     return success;
 }
 
@@ -1409,10 +1816,16 @@ GpsServer::tcp_client_write_handler(
 {
     TCP_CLIENT* tcp_client = reinterpret_cast<TCP_CLIENT*>(_tcp_client);
     GpsServer*  server = tcp_client->server;
-    // printf("TCP client write event.\n");
-    // Pass.
-
-    (void) server;
+    // Output has drained below the low-water mark.
+    note_output(tcp_client);
+    if (!tcp_client->closing && tcp_client->parked_frames.size() > 0) {
+        server->send_parked(tcp_client);
+    }
+    if (!tcp_client->closing && tcp_client->transfer_pending > 0) {
+        // Points file cache is shared.
+        ServerLock  lock(server->lock_);
+        server->send_window(tcp_client);
+    }
 }
 
 /*****************************************************************************/
@@ -1424,6 +1837,10 @@ GpsServer::tcp_client_error_handler(
 {
     TCP_CLIENT* tcp_client = reinterpret_cast<TCP_CLIENT*>(_tcp_client);
     GpsServer*  server = tcp_client->server;
+    ServerLock  lock(server->lock_);
+    if (tcp_client->closing) {
+        return;
+    }
 
     server->kill_tcp_client(tcp_client, "TCP read error.");
 }
@@ -1437,6 +1854,17 @@ GpsServer::listening_socket_handler(
     void*           _self)
 {
     GpsServer*  server = reinterpret_cast<GpsServer*>(_self);
+    server->accept_client(fd, server->main_worker_.get());
+}
+
+/*****************************************************************************/
+void
+GpsServer::accept_client(
+    int             fd,
+    Worker*         worker)
+{
+    // Only the registry is shared.
+    ServerLock  lock(lock_, false);
 
     struct sockaddr_in  addr;
 #ifdef WIN32
@@ -1449,14 +1877,22 @@ GpsServer::listening_socket_handler(
         log(0, "Error: Failed to get client.\n");
     } else {
         const string address(inet_ntoa(addr.sin_addr));
-        log(0, "New client from %s: 0x%0x!", address.c_str(), sd);
-        TCP_CLIENT*     tcp_client = new TCP_CLIENT(sd, server, CLIENTMODE_UNIDENTIFIED, address);
+        log(0, "New client from %s: 0x%0x, worker %d!", address.c_str(), sd, worker->index());
+        TCP_CLIENT*     tcp_client = new TCP_CLIENT(sd, this, CLIENTMODE_UNIDENTIFIED, address);
+        tcp_client->worker = worker;
+        if (capture_.get() != 0) {
+            capture_->record(CAPTURE_CONNECT, sd, address.data(), address.size());
+        }
         tcp_client->event = bufferevent_new(sd,
                                             tcp_client_read_handler,
                                             tcp_client_write_handler,
                                             tcp_client_error_handler,
                                             tcp_client);
-        server->tcp_clients_.push_front(tcp_client);
+        bufferevent_base_set(worker->base(), tcp_client->event);
+        // Write handler is called when output drains to half of the high-water mark, before the link goes idle.
+        bufferevent_setwatermark(tcp_client->event, EV_WRITE, mymax(output_high_water_ / 2, 1), 0);
+        lock.acquire();
+        tcp_clients_.add(tcp_client);
         bufferevent_enable(tcp_client->event, EV_READ | EV_WRITE);
     }
 }
@@ -1469,6 +1905,7 @@ GpsServer::rtcm_socket_handler(
     void*          _self)
 {
     GpsServer*  server = reinterpret_cast<GpsServer*>(_self);
+    ServerLock  lock(server->lock_);
 
     struct sockaddr_in  addr;
 #ifdef WIN32
@@ -1483,6 +1920,7 @@ GpsServer::rtcm_socket_handler(
         const string address(inet_ntoa(addr.sin_addr));
         log(0, "New RTCM listening client from %s: 0x%0x!", address.c_str(), sd);
         TCP_CLIENT*     tcp_client = new TCP_CLIENT(sd, server, CLIENTMODE_RTCMLISTENER, address);
+        tcp_client->worker = server->main_worker_.get();
         tcp_client->event = bufferevent_new(sd,
                                             0,
                                             rtcm_write_handler,
@@ -1517,6 +1955,10 @@ GpsServer::rtcm_error_handler(
 {
     TCP_CLIENT* tcp_client = reinterpret_cast<TCP_CLIENT*>(_tcp_client);
     GpsServer*  server = tcp_client->server;
+    ServerLock  lock(server->lock_);
+    if (tcp_client->closing) {
+        return;
+    }
 
     server->kill_rtcm_client(tcp_client, "TCP read error.");
 
@@ -1529,18 +1971,9 @@ GpsServer::kill_rtcm_client(
     const char*     reason)
 {
     log(tcp_client, "Shutting down RTCM reading client 0x%0x, name %s. Reason: %s", tcp_client->fd, tcp_client->name.c_str(), reason);
-    // Shutdown events.
-    bufferevent_disable(tcp_client->event, EV_WRITE);
-    bufferevent_free(tcp_client->event);
-    tcp_client->event = 0;
-
-    // Close socket.
-    close_socket(tcp_client->fd);
-    tcp_client->fd = 0;
-
     // Remove client from the chain...
     rtcm_listening_clients_.remove(tcp_client);
-    xdelete(tcp_client);
+    close_tcp_client(tcp_client, reason);
 }
 
 /*****************************************************************************/
@@ -1559,6 +1992,11 @@ GpsServer::GpsServer()
         rtcm_source_socket_(INVALID_SOCKET),
         rtcm_source_bytes_read_(0),
         rtcm_source_bytes_read_last_(0),
+        rtcm_max_pending_(4096),
+        output_high_water_(8192),
+        output_max_pending_(65536),
+        rtcm_dropped_(0),
+        worker_threads_(0),
         rtcm_source_event_(0),
         database_(0)
 {
@@ -1575,6 +2013,11 @@ GpsServer::GpsServer()
         throw;
     }
     timer_ticks_ = 0;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&lock_, &attr);
+    pthread_mutexattr_destroy(&attr);
     log("GpsServer class created");
 }
 
@@ -1585,36 +2028,21 @@ GpsServer::rtcm_source_read_handler(
     void*                   gps_server)
 {
     GpsServer*          server = reinterpret_cast<GpsServer*>(gps_server);
-    std::vector<unsigned char>& buffer = server->rtcm_source_read_buffer_;
+    ServerLock          lock(server->lock_);
 
-    // Read from buffer.
-    unsigned int    so_far = 0;
-    for (;;)
-    {
-        if (buffer.size() == so_far) {
-            buffer.resize(so_far <= 0 ? 1024 : 2*so_far);
-        }
-        int this_round = bufferevent_read(event, &buffer[so_far], buffer.size() - so_far);
-        if (this_round <= 0)
-            break;
-        so_far += this_round;
-    }
-    buffer.resize(so_far);
-    server->rtcm_source_bytes_read_ += so_far;
+    // Relay straight from the input buffer.
+    const unsigned int  size = EVBUFFER_LENGTH(EVBUFFER_INPUT(event));
+    server->rtcm_source_bytes_read_ += size;
 
     // Detect EOF.
-    if (so_far == 0)
+    if (size == 0)
     {
         server->rtcm_source_close("Connection closed.");
     } else
     {
-        // Forward good stuff.
-        // Not needed for GpsViewers? Might be with simple GPS
-        server->send_buffer_to_all(server->tcp_clients_, buffer, CLIENTMODE_MODEMBOX, utils::CMR::RTCM);
-        // RTCM listeners
-        server->send_buffer_to_all(server->rtcm_listening_clients_, buffer, CLIENTMODE_RTCMLISTENER, utils::CMR::RTCM);
+        server->rtcm_relay(EVBUFFER_DATA(EVBUFFER_INPUT(event)), size);
+        evbuffer_drain(EVBUFFER_INPUT(event), size);
     }
-
 }
 
 /*****************************************************************************/
@@ -1625,10 +2053,53 @@ GpsServer::rtcm_source_error_handler(
     void*                   gps_server)
 {
     GpsServer*  server = reinterpret_cast<GpsServer*>(gps_server);
+    ServerLock  lock(server->lock_);
     server->rtcm_source_close("Read error.");
 
 }
 
+/*****************************************************************************/
+void
+GpsServer::rtcm_relay_to(
+    TCP_CLIENT*             tcp_client,
+    SharedFrame*            frame)
+{
+    if (tcp_client->worker != Worker::current()) {
+        // Client belongs to another event loop, it checks the output limit.
+        if (!tcp_client->closing) {
+            tcp_client->worker->send(tcp_client, frame, WORKER_RELAY_RTCM);
+        }
+        return;
+    }
+    if (pending_output(tcp_client) > (unsigned int)rtcm_max_pending_) {
+        ++tcp_client->rtcm_dropped;
+        ++rtcm_dropped_;
+    } else {
+        send_frame(tcp_client, frame, true);
+    }
+}
+
+/*****************************************************************************/
+void
+GpsServer::rtcm_relay(
+    const unsigned char*    data,
+    const unsigned int      size)
+{
+	// ModemBox is broken: it can't accept packets larger than 126 bytes.
+    SharedFrame*    frame = SharedFrame::encode(data, size, utils::CMR::RTCM, 120);
+
+    // Not needed for GpsViewers? Might be with simple GPS
+    const ClientSet& modemboxes = tcp_clients_.mode(CLIENTMODE_MODEMBOX);
+    for (ClientSet::const_iterator it = modemboxes.begin(); it != modemboxes.end(); ++it) {
+        rtcm_relay_to(*it, frame);
+    }
+    // RTCM listeners
+    for (std::list<TCP_CLIENT*>::const_iterator it = rtcm_listening_clients_.begin(); it != rtcm_listening_clients_.end(); ++it) {
+        rtcm_relay_to(*it, frame);
+    }
+    frame->release();
+}
+
 /*****************************************************************************/
 void
 GpsServer::rtcm_source_close(
@@ -1683,6 +2154,7 @@ GpsServer::rtcm_source_reconnect(
 // FIXME Lots of cleanup still missing
 GpsServer::~GpsServer()
 {
+    pthread_mutex_destroy(&lock_);
     unload_winsock();
 }
 
@@ -1692,15 +2164,72 @@ GpsServer::run()
 {
     log("Starting to run GpsServer");
     // Initalize \c libevent.
+#ifdef EVTHREAD_USE_PTHREADS_IMPLEMENTED
+    // Before any event base: worker threads run event loops of their own.
+    evthread_use_pthreads();
+#endif
     evb_ = reinterpret_cast<struct event_base*>(event_init());
+    main_worker_ = std::auto_ptr<Worker>(new Worker(this, evb_));
 
     // Read configuration file.
     utils::FileConfig cfg(FILENAME_CONFIGURATION);
     cfg.load();
 
+    cfg.set_section("Log");
+    {
+        std::string level;
+        bool        asynchronous;
+        int         ring_size, flush_interval;
+        cfg.get_string("Level", "debug", level);
+        cfg.get_bool("Asynchronous", true, asynchronous);
+        cfg.get_int("RingSize", 4096, ring_size);
+        cfg.get_int("FlushInterval", 100, flush_interval);
+        if (level == "essential") {
+            log_level_configured_ = LOG_LEVEL_ESSENTIAL;
+        } else if (level == "3") {
+            log_level_configured_ = LOG_LEVEL_3;
+        } else {
+            log_level_configured_ = LOG_LEVEL_DEBUG;
+        }
+        log(LOG_LEVEL_ESSENTIAL, 0, "Log level %s, %s, SIGUSR1 toggles debug", level.c_str(), asynchronous ? "asynchronous" : "synchronous");
+        log_level_ = log_level_configured_;
+        signal(SIGUSR1, log_signal_handler);
+        if (asynchronous) {
+            log_writer_ = std::auto_ptr<LogWriter>(new LogWriter(ring_size, flush_interval));
+            if (log_writer_->create() != 0) {
+                // Appended messages would never be printed.
+                log_writer_.reset();
+                log(LOG_LEVEL_ESSENTIAL, 0, "Can't start log writer thread, logging synchronously");
+            }
+        }
+    }
+
 
     cfg.set_section("Database");
-    {
+    std::string backend;
+    cfg.get_string("Backend", "mysql", backend);
+    if (backend == "memory") {
+        std::string snapshot_file;
+        int snapshot_interval, max_positions;
+        cfg.get_string("SnapshotFile", "", snapshot_file);
+        cfg.get_int("SnapshotInterval", 300, snapshot_interval);
+        cfg.get_int("MaxPositions", 100000, max_positions);
+        log(0, "Memory DB: snapshot '%s' every %d s, keeping %d positions", snapshot_file.c_str(), snapshot_interval, max_positions);
+
+        try {
+            database_ = std::auto_ptr<DigNetDB>(new DigNetDBMemory(snapshot_file, snapshot_interval, max_positions));
+        } catch (const std::exception& e) {
+            log(LOG_LEVEL_ESSENTIAL, 0, "Can't open memory DB: %s", e.what());
+            return;
+        }
+    } else if (backend != "mysql") {
+        log(LOG_LEVEL_ESSENTIAL, 0, "Unknown database Backend %s!", backend.c_str());
+        return;
+    } else {
+#ifdef WITHOUT_MYSQL
+        log(LOG_LEVEL_ESSENTIAL, 0, "Built without MySQL, only Backend=memory is available!");
+        return;
+#else
         std::string base, username, passwd;
 
         if (!cfg.get_string("Database", "", base)) {
@@ -1718,19 +2247,45 @@ GpsServer::run()
             return;
         }
 
+        int queue_size, batch_size, flush_interval;
+        cfg.get_int("WriteQueueSize", 10000, queue_size);
+        cfg.get_int("WriteBatchSize", 100, batch_size);
+        cfg.get_int("WriteFlushInterval", 1000, flush_interval);
+        log(0, "DB writer: queue %d rows, batch %d rows, flush every %d ms", queue_size, batch_size, flush_interval);
+
         try {
-            database_ = std::auto_ptr<DigNetDB>(new DigNetDB(base, username, passwd));
+            database_ = std::auto_ptr<DigNetDB>(new DigNetDBMySQL(base, username, passwd, queue_size, batch_size, flush_interval));
         } catch (const std::exception& e) {
             log(LOG_LEVEL_ESSENTIAL, 0, "Can't open connection to DB: %s", e.what());
             return;
         }
+#endif
+    }
 
+    cfg.set_section("PositionStore");
+    {
+        std::string directory;
+        cfg.get_string("Directory", "", directory);
+        if (directory != "") {
+            try {
+                database_->setPositionStore(new PositionStore(directory));
+                log(0, "Storing positions to %s", directory.c_str());
+            } catch (const std::exception& e) {
+                log(LOG_LEVEL_ESSENTIAL, 0, "Can't store positions, using ShipPosition table: %s", e.what());
+            }
+        } else {
+            log(0, "Storing positions to ShipPosition table");
+        }
     }
 
     cfg.set_section("GpsServer");
     {
         cfg.get_int("ListeningPort", 5001, listening_port_);
         cfg.get_int("RtcmOutputPort", 5002, rtcm_output_port_);
+        cfg.get_int("RtcmMaxPending", 4096, rtcm_max_pending_);
+        cfg.get_int("OutputHighWater", 8192, output_high_water_);
+        cfg.get_int("OutputMaxPending", 65536, output_max_pending_);
+        cfg.get_int("WorkerThreads", 0, worker_threads_);
         if (cfg.get_string("RtcmSource", rtcm_source_)) {
             log(0, "Rtcm source set to %s", rtcm_source_.c_str());
         } else {
@@ -1774,6 +2329,31 @@ GpsServer::run()
             log(0, "Warning: couldn't parse daily voltage report time! %s", report_time.c_str());
         }
     }
+    cfg.set_section("Capture");
+    {
+        std::string file;
+        int file_size, files, flush_interval;
+        cfg.get_string("File", "", file);
+        cfg.get_int("FileSize", 16*1024*1024, file_size);
+        cfg.get_int("Files", 8, files);
+        cfg.get_int("FlushInterval", 1000, flush_interval);
+        if (file != "") {
+            try {
+                capture_ = std::auto_ptr<PacketCapture>(new PacketCapture(file, file_size, files, flush_interval));
+                if (capture_->create() != 0) {
+                    // Nothing would flush or rotate the files.
+                    capture_.reset();
+                    log(LOG_LEVEL_ESSENTIAL, 0, "Can't capture client data: can't start capture thread");
+                } else {
+                    log(0, "Capturing client data to %s, %d bytes per file, %d old files kept", file.c_str(), file_size, files);
+                }
+            } catch (const std::exception& e) {
+                log(LOG_LEVEL_ESSENTIAL, 0, "Can't capture client data: %s", e.what());
+            }
+        } else {
+            log(0, "Client data capture disabled");
+        }
+    }
     cfg.set_section("PointsFile");
     {
         if (cfg.get_string("NewPointsDirectory", "", points_file_dir_)){
@@ -1781,12 +2361,47 @@ GpsServer::run()
         } else {
             log(LOG_LEVEL_ESSENTIAL, 0, "WARNING! Points file directory not set!");
         }
+        int cached_files;
+        cfg.get_int("CachedFiles", 4, cached_files);
+        PointsVariantWriter*    variant_writer = new PointsVariantWriter();
+        if (variant_writer->create() != 0) {
+            // Queued variants would never be written.
+            delete variant_writer;
+            variant_writer = 0;
+            log(LOG_LEVEL_ESSENTIAL, 0, "Can't start points variant thread, compressing points files on the event loop");
+        }
+        points_files_ = std::auto_ptr<PointsFileCache>(new PointsFileCache(points_file_dir_, cached_files, variant_writer));
+        points_catalog_ = std::auto_ptr<PointsCatalog>(new PointsCatalog(points_file_dir_));
+        if (points_catalog_->fd() >= 0) {
+            event_set(&points_catalog_event_, points_catalog_->fd(), EV_READ | EV_PERSIST, points_catalog_handler, this);
+            event_add(&points_catalog_event_, 0);
+            log(0, "Watching points file directory");
+        } else if (points_file_dir_ != "") {
+            log(LOG_LEVEL_ESSENTIAL, 0, "Can't watch points file directory, scanning it every minute");
+        }
+        memset(&pointfile_info_, 0, sizeof(pointfile_info_));
+        make_pointfile_info();
+    }
+    if (worker_threads_ > 0) {
+        // Every worker accepts clients on its own socket.
+        for (int i = 0; i < worker_threads_; ++i) {
+            try {
+                Worker* worker = new Worker(this, i + 1);
+                worker->listen(listening_port_);
+                workers_.push_back(worker);
+            } catch (const std::exception& e) {
+                log(LOG_LEVEL_ESSENTIAL, 0, "Can't start worker thread: %s", e.what());
+                return;
+            }
+        }
+        log(0, "Running on port %d with %d worker threads", listening_port_, workers_.size());
+    } else {
+        // Open listening socket.
+        listening_socket_ = open_server_socket(listening_port_);
+        log(0, "Running on port %d", listening_port_);
+        event_set(&listening_socket_event_, listening_socket_, EV_READ | EV_PERSIST, listening_socket_handler,  this);
+        event_add(&listening_socket_event_, 0);
     }
-    // Open listening socket.
-    listening_socket_ = open_server_socket(listening_port_);
-    log(0, "Running on port %d", listening_port_);
-    event_set(&listening_socket_event_, listening_socket_, EV_READ | EV_PERSIST, listening_socket_handler,  this);
-    event_add(&listening_socket_event_, 0);
 
     // Open listening socket to wait for clients who want to read RTCM.
 
@@ -1807,5 +2422,10 @@ GpsServer::run()
     timer_countping_ = 0;
     evtimer_add(&timer_event_, &timer_period_);
 
+    // Workers start accepting only now that everything is set up.
+    for (unsigned int i = 0; i < workers_.size(); ++i) {
+        workers_[i]->create();
+    }
+
     event_dispatch();
 }
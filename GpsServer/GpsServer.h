@@ -16,6 +16,8 @@ See \c gps_server.doc for complete specification.
 
 #include <stdio.h>      // printf, sprintf
 #include <stdarg.h>     // varargs.
+#include <signal.h>     // sig_atomic_t
+#include <pthread.h>
 
 #include <event.h>      // libevent.
 
@@ -33,6 +35,14 @@ See \c gps_server.doc for complete specification.
 #include "Counter.h"
 #include "FileDownloader.h"
 #include "SendEmail.h"
+#include "ClientRegistry.h"
+#include "SharedFrame.h"
+#include "Worker.h"
+#include "PacketCapture.h"
+#include "PointsFileCache.h"
+#include "PointsCatalog.h"
+#include "LogWriter.h"
+#include "CmrStream.h"
 
 
 /// Timeout, in seconds.
@@ -50,6 +60,16 @@ typedef enum {
     LOG_LEVEL_ESSENTIAL         // Only most neede information, shown in server log
 } LOG_LEVEL;
 
+/** Logs with \c GpsServer::log, but evaluates the arguments only if \c level is not filtered out.
+Use when arguments are expensive to build, like \c cmr.ToString().
+*/
+#define LOG_AT(level, client, ...) \
+    do { \
+        if (GpsServer::log_enabled(level)) { \
+            GpsServer::log(level, client, __VA_ARGS__); \
+        } \
+    } while (0)
+
 typedef struct {
     double x, y;
 } Point2;
@@ -74,6 +94,9 @@ typedef enum  {
 } GPSVIEWER_BUILD;
 class GpsServer;
 
+/** Key of a frame that supersedes older unsent ones: packet type and source (usually ship number). */
+typedef std::pair<int, int>     SUPERSEDE_KEY;
+
 /// Client info.
 class TCP_CLIENT {
     public:
@@ -91,7 +114,7 @@ class TCP_CLIENT {
         setVoltage(
             const double voltage);
 
-        /** Returns a string meant to be logged once per minute */
+        /** Returns a string meant to be logged once per minute. Any thread, the output state is the one published by \c worker. */
         std::string reportMinuteStatistics();
 
         unsigned int            fd;             ///< Client socket.
@@ -107,8 +130,8 @@ class TCP_CLIENT {
         std::string             imei;
         std::string             build_info;
 
-        int                     idle_ticks;         ///< Number of idle ticks.
-        utils::CMRDecoder       cmr_decoder;        ///< Decodes incoming CMR packets from this client
+        volatile int            idle_ticks;         ///< Number of idle ticks. Incremented atomically by the timer, reset by \c worker.
+        CmrStream               cmr_stream;         ///< Decodes incoming CMR packets from this client
         utils::LineDecoder      nmea_decoder[2];    ///< Decodes incoming messages from bot GPSes
         Point2                  gps_coordinates[2]; ///< GPS positions
         std::auto_ptr<utils::MixGPS>    mixgps;     ///< MixGPS
@@ -124,6 +147,21 @@ class TCP_CLIENT {
         int                     group_id;                   ///< Group ID of the client, gets read from DB. Clients from different groups do not communicate
         int                     gpsviewer_build_number;     ///< Build number of associated GpsViewer. Defaults to 0 if not set
         bool                    has_gpsviewer;              ///< If true then this client has GpsViewer attached
+        unsigned int            rtcm_dropped;               ///< RTCM frames dropped because the client was lagging behind
+        std::map<SUPERSEDE_KEY, SharedFrame*>   parked_frames;  ///< Latest unsent frame per key while output is over the high-water mark
+        std::vector<unsigned char>  chunk_batch;            ///< Encoded PACKET_POINTSFILE_CHUNK responses, sent together
+        unsigned int            frames_superseded;          ///< Parked frames replaced by newer ones
+        unsigned int            frames_dropped;             ///< Frames dropped because output was over the hard limit
+        volatile bool           output_overflow;            ///< Reply didn't fit under the hard limit, send nothing more, disconnected by the timer
+        volatile unsigned int   output_size;                ///< Bytes unsent, as last seen by \c worker
+        volatile unsigned int   parked_count;               ///< Size of \c parked_frames, as last seen by \c worker
+        int                     transfer_file;              ///< Points file streamed by windowed transfer, -1 for none
+        int                     transfer_codec;             ///< Variant of \c transfer_file streamed, \c POINTSFILE_CODEC_XXX
+        std::vector<bool>       transfer_wanted;            ///< Chunks of \c transfer_file still to be sent
+        unsigned int            transfer_next;              ///< Next chunk to look at in \c transfer_wanted
+        unsigned int            transfer_pending;           ///< Number of chunks set in \c transfer_wanted
+        Worker*                 worker;                     ///< Event loop owning \c event and the output state above, touched by it only
+        volatile bool           closing;                    ///< Close is queued to \c worker, send nothing more
 
         Counter                 packets_received_;              ///< Total number of packets received
         Counter                 packets_sent_;                  ///< Total number of packets sent
@@ -135,8 +173,12 @@ class TCP_CLIENT {
 /*****************************************************************************/
 /// Server main.
 class GpsServer {
+    friend class Worker;
     private:
         struct event_base*          evb_;
+        pthread_mutex_t             lock_;                          ///< Server lock, guards the client registry, the database and the rest of the shared state. Recursive.
+        std::auto_ptr<Worker>       main_worker_;                   ///< Main event loop: timer, RTCM, clients when there are no worker threads.
+        std::vector<Worker*>        workers_;                       ///< Worker threads accepting TCP clients, empty if single-threaded.
         unsigned int                listening_socket_;              ///< Listening TCP/IP socket.
         struct event                listening_socket_event_;        ///< TCP port "listen" events.
         struct timeval              timer_period_;                  ///< Timer period, every 5 minutes.
@@ -155,9 +197,8 @@ class GpsServer {
         unsigned int                rtcm_socket_;                   ///< RTCM output socket.
         struct event                rtcm_socket_event_;             ///< RTCM socket "listen" events.
 
-        std::list<TCP_CLIENT*>      tcp_clients_;                   ///< List of clients :)
+        ClientRegistry              tcp_clients_;                   ///< All clients, indexed by ship, group and mode
 
-        std::string                 tcp_read_buffer_;               ///< Temporary buffer for TCP reads.
         std::vector<unsigned char>  tcp_write_buffer_;              ///< Global write buffer.
 
         int                         listening_port_;                ///< TCP listening port. Listens for client connections
@@ -172,13 +213,18 @@ class GpsServer {
 
         static std::string          rtcm_source_;                   ///< Raw RTCM comes from this server. Holds ip:port to connect to.
         int                         rtcm_source_socket_;            ///< Connection socket for connecting to rtcm server.
-        std::vector<unsigned char>  rtcm_source_read_buffer_;       ///< Temporary buffer for TCP reads.
         unsigned int                rtcm_source_bytes_read_;
         unsigned int                rtcm_source_bytes_read_last_;
+        int                         rtcm_max_pending_;              ///< Drop RTCM for clients with more than this many bytes unsent.
+        int                         output_high_water_;             ///< Park superseding frames for clients with more than this many bytes unsent.
+        int                         output_max_pending_;            ///< Drop droppable frames for clients with more than this many bytes unsent, disconnect on others.
+        unsigned int                rtcm_dropped_;                  ///< Total RTCM frames dropped because of lagging clients.
+        int                         worker_threads_;                ///< Number of worker threads accepting TCP clients, 0 to run everything in the main loop.
         struct bufferevent*         rtcm_source_event_;             ///< Buffered events. Default: 0.
 
         std::auto_ptr<DigNetDB>     database_;                      ///< Database holding ship information.
         std::auto_ptr<FileDownloader> weather_info_downloader_;     ///< Asynchronusly downloads weather information
+        std::auto_ptr<PacketCapture> capture_;                      ///< Captures data received from clients, 0 if disabled
         PACKET_WEATHER_INFORMATION  weather_;                       ///< Weather information is saved here and sent to clients as needed. Saving is needed to get the information to clients as soon as possible
 
         // Voltage reporting via e-mail
@@ -189,6 +235,19 @@ class GpsServer {
         
 
         std::string                 points_file_dir_;               ///< Directory where pointsfile updates are held
+        std::auto_ptr<PointsFileCache> points_files_;               ///< Serves chunks of the points files in \c points_file_dir_
+        std::auto_ptr<PointsCatalog> points_catalog_;               ///< Latest points file in \c points_file_dir_
+        struct event                points_catalog_event_;          ///< inotify events of \c points_catalog_
+        PACKET_POINTSFILE_INFO      pointfile_info_;                ///< Information about the latest points file, sent to every client at startup
+
+        static std::auto_ptr<LogWriter>     log_writer_;            ///< Writes log in background, 0 to log synchronously
+        static volatile sig_atomic_t        log_level_;             ///< Messages below this \c LOG_LEVEL are discarded
+        static volatile sig_atomic_t        log_level_configured_;  ///< \c log_level_ from .ini, restored by SIGUSR1
+
+        /// SIGUSR1 toggles between debug level and configured level.
+        static void
+        log_signal_handler(
+            int                 signal);
     public:
         /*****************************************************************************/
         /// Log a message preceded by time in format "HHMMSS" and sender name, if known.
@@ -217,6 +276,11 @@ class GpsServer {
         log(
             const char*         fmt, ...);
 
+        /// True if messages of given level are logged, see \c LOG_AT.
+        static bool
+        log_enabled(
+            LOG_LEVEL           level) { return level >= log_level_; }
+
     private:
 // Raw RTCM input. Special handlers that read raw RTCM from remote server and forward it to GpsViewers.
         static void
@@ -238,14 +302,70 @@ class GpsServer {
         rtcm_source_reconnect(
             const std::string&  reason);
 
+        /** Frames RTCM data once and queues it to every ModemBox and RTCM listener.
+        Clients that have more than \c rtcm_max_pending_ bytes unsent get nothing, old corrections are useless.
+        */
+        void
+        rtcm_relay(
+            const unsigned char*    data,
+            const unsigned int      size);
+
+        /// Queue RTCM frame to the client unless it is lagging behind.
+        void
+        rtcm_relay_to(
+            TCP_CLIENT*             tcp_client,
+            SharedFrame*            frame);
+
 
         /*****************************************************************************/
 
+        /** Returns true if the frame must not be queued to the client. Over OutputMaxPending droppable
+            frames are dropped, any other frame marks the client for disconnection: a reply it waits for would be lost.
+        */
+        bool
+        output_full(
+            TCP_CLIENT*                         tcp_client,
+            const bool                          droppable);
+
         /// Send raw data to client
         void
         send_raw_data(
             TCP_CLIENT*                         tcp_client,
-            std::vector<unsigned char>&         data);
+            std::vector<unsigned char>&         data,
+            const bool                          droppable = false);
+
+        /// Send frame shared by many clients, encoded only once.
+        void
+        send_frame(
+            TCP_CLIENT*                         tcp_client,
+            SharedFrame*                        frame,
+            const bool                          droppable = false   ///< Positions and raw data, superseded or useless when late
+        );
+
+        /** Send frame that makes older frames with the same key useless (positions, weather).
+        If the client output is over the high-water mark, the frame is parked and replaces
+        the parked one with the same key. Parked frames are sent when the output drains.
+        */
+        void
+        send_latest(
+            TCP_CLIENT*                         tcp_client,
+            SharedFrame*                        frame,
+            const int                           type,
+            const int                           source);
+
+        /// Send frames parked by send_latest.
+        void
+        send_parked(
+            TCP_CLIENT*                         tcp_client);
+
+        /// Send frame queued by another thread, called by the worker owning the client.
+        void
+        deliver_frame(
+            TCP_CLIENT*                         tcp_client,
+            SharedFrame*                        frame,
+            const WORKER_DELIVERY               delivery,
+            const int                           type,
+            const int                           source);
 
         /// Send event to given client.
         void
@@ -272,7 +392,7 @@ class GpsServer {
         /// Send buffer contents to all TCP/IP clients, filtered by mask.
         static void
         send_buffer_to_all(
-            std::list<TCP_CLIENT*>&         tcp_clients,
+            const std::list<TCP_CLIENT*>&   tcp_clients,
             std::vector<unsigned char>&     buffer,
             unsigned int                    mask = CLIENTMODE_MODEMBOX | CLIENTMODE_GPSVIEWER,
             int                             type = utils::CMR::LAMPNET
@@ -281,18 +401,18 @@ class GpsServer {
         /// Send buffer contents to all TCP/IP clients, filtered by mask.
         static void
         send_buffer_to_all(
-            std::list<TCP_CLIENT*>&         tcp_clients,
+            const std::list<TCP_CLIENT*>&   tcp_clients,
             void*                           buffer,
             int                             size,
             unsigned int                    mask = CLIENTMODE_MODEMBOX | CLIENTMODE_GPSVIEWER,
-            int                             type = utils::CMR::LAMPNET
+            int                             type = utils::CMR::LAMPNET,
+            const bool                      droppable = false
         );
-        /** Forwards given packet to all clients besides the sender itself */
-        static void
+        /** Forwards given packet to all clients in the sender group besides the sender itself */
+        void
         forward_packet_to_all(
-            std::list<TCP_CLIENT*>&         clients,    ///< List of clients to recieve
             const TCP_CLIENT*               sender,        ///< Sender ID, won't be sent back to this client
-            const utils::CMR&               packet        ///< Packet to be sent
+            const CMR_VIEW&                 packet        ///< Packet to be sent
         );
 
         /*****************************************************************************/
@@ -302,18 +422,72 @@ class GpsServer {
             TCP_CLIENT*                     tcp_client      ///< Client to be recieving the information
         );
 
+        /** Makes \c pointfile_info_ for the latest file of \c points_catalog_, writing its variants if needed.
+            Returns false if there is no points file.
+        */
+        bool
+        make_pointfile_info();
+
         /** Sees if new pointfile is present and sends information about it to clients */
         void
         check_pointfile();
 
+        /** Sends information about the pointfile again if its variants written since last call change it */
+        void
+        check_pointfile_variants();
+
+        /** Sends \c pointfile_info_ to all clients */
+        void
+        send_pointfile_info();
+
+        /// inotify says points file directory has changed.
+        static void
+        points_catalog_handler(
+            int             fd,
+            short           event,
+            void*           _self);
+
         /** Gets a chunk from a given file. 
             @returns true on success 
         */
         bool
         get_chunck(
             const uint16_t              file_no,    ///< File number
+            const int                   codec,      ///< Variant of the file, \c POINTSFILE_CODEC_XXX
             const uint16_t              chunk_no,   ///< Chunk number
-            PACKET_POINTSFILE_CHUNK&    data        ///< Data is inserted here, including file and chunk number
+            PACKET_POINTSFILE_CHUNK&    data        ///< Data is inserted here, including file number, chunk number and codec
+        );
+
+        /** Queues a chunk to \c tcp_client->chunk_batch, sends the batch when it has reached the high-water mark. */
+        void
+        queue_chunk(
+            TCP_CLIENT*                     tcp_client,
+            const PACKET_POINTSFILE_CHUNK&  chunk
+        );
+
+        /** Sends the chunks queued by \c queue_chunk. */
+        void
+        flush_chunks(
+            TCP_CLIENT*                     tcp_client
+        );
+
+        /** Adds the chunks asked for by PACKET_POINTSFILE_WINDOW_REQUEST to the windowed transfer of the client
+            and starts sending them. Request for another file or codec cancels the transfer.
+        */
+        void
+        request_window(
+            TCP_CLIENT*                                 tcp_client,
+            const PACKET_POINTSFILE_WINDOW_REQUEST&     request,
+            const unsigned int                          bitmap_size ///< Bytes of \c request.missing present
+        );
+
+        /** Sends chunks of the windowed transfer until the output of the client is over the high-water mark.
+            Called again by \c tcp_client_write_handler when the output has drained to half of the high-water mark,
+            so the link doesn't go idle while the next chunks are read.
+        */
+        void
+        send_window(
+            TCP_CLIENT*                     tcp_client
         );
 
         /// Finds a client with given ship number. Returns 0 if not found
@@ -329,11 +503,28 @@ class GpsServer {
             const char*     reason
         );
 
+        /** Deletes client at once in single-threaded mode, otherwise marks it closing and
+        lets the owning worker delete it after the frames queued to it.
+        The client must already be removed from all lists.
+        */
+        void
+        close_tcp_client(
+            TCP_CLIENT*&    tcp_client,
+            const char*     reason
+        );
+
+        /// Free events, close socket and delete client. Runs in the thread owning the client.
+        void
+        destroy_tcp_client(
+            TCP_CLIENT*     tcp_client,
+            const char*     reason
+        );
+
         /*****************************************************************************/
         void
         modembox_handle_packet(
             TCP_CLIENT*         tcp_client,
-            utils::CMR&   Packet
+            const CMR_VIEW&     Packet
         );
 
         /*****************************************************************************/
@@ -378,6 +569,12 @@ class GpsServer {
             short       event,
             void*       _self);
 
+        /// Accepts a client on the listening socket and attaches it to the event loop of given worker.
+        void
+        accept_client(
+            int         fd,
+            Worker*     worker);
+
         static void
         rtcm_write_handler(
             struct bufferevent*     event,
@@ -0,0 +1,153 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdio.h>      // printf, vsnprintf
+#include <string.h>     // strncpy
+#include <time.h>       // localtime_r, nanosleep
+
+#include "LogWriter.h"
+
+/*****************************************************************************/
+LogWriter::LogWriter(
+    const unsigned int  ring_size,
+    const unsigned int  flush_interval_ms) :
+        enqueue_pos_(0),
+        dequeue_pos_(0),
+        dropped_(0),
+        dropped_reported_(0),
+        flush_interval_ms_(flush_interval_ms > 0 ? flush_interval_ms : 1),
+        run_(true)
+{
+    unsigned int size = 2;
+    while (size < ring_size) {
+        size *= 2;
+    }
+    ring_.resize(size);
+    mask_ = size - 1;
+    for (unsigned int i = 0; i < size; ++i) {
+        ring_[i].sequence = i;
+    }
+}
+
+/*****************************************************************************/
+LogWriter::~LogWriter()
+{
+    run_ = false;
+    join();
+}
+
+/*****************************************************************************/
+bool
+LogWriter::append(
+    const int           ship_number,
+    const char*         ship_name,
+    const char*         fmt,
+    va_list             arguments)
+{
+    // Bounded multiple-producer ring: slot is free for position pos when its sequence is pos,
+    // and holds a message for the writer when its sequence is pos+1.
+    LOG_RECORD*     record;
+    unsigned int    pos = enqueue_pos_;
+    for (;;) {
+        record = &ring_[pos & mask_];
+        const int diff = (int)record->sequence - (int)pos;
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&enqueue_pos_, pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __sync_add_and_fetch(&dropped_, 1);
+            return false;
+        }
+        pos = enqueue_pos_;
+    }
+
+    gettimeofday(&record->time, 0);
+    record->ship_number = ship_number;
+    if (ship_name != 0) {
+        strncpy(record->ship_name, ship_name, sizeof(record->ship_name) - 1);
+        record->ship_name[sizeof(record->ship_name) - 1] = 0;
+    } else {
+        record->ship_name[0] = 0;
+    }
+    vsnprintf(record->text, sizeof(record->text), fmt, arguments);
+
+    __sync_synchronize();
+    record->sequence = pos + 1;
+    return true;
+}
+
+/*****************************************************************************/
+void
+LogWriter::print(
+    const struct timeval&   time,
+    const int               ship_number,
+    const char*             ship_name,
+    const char*             text)
+{
+    struct tm   tm;
+    const time_t seconds = time.tv_sec;
+    localtime_r(&seconds, &tm);
+    printf("%02d%02d%02d: ", tm.tm_hour, tm.tm_min, tm.tm_sec);
+    if (ship_number >= 0) {
+        printf("'#%d:%s': ", ship_number, ship_name);
+    }
+    printf("%s\n", text);
+}
+
+/*****************************************************************************/
+unsigned int
+LogWriter::drain()
+{
+    unsigned int    n = 0;
+    for (;;) {
+        LOG_RECORD* record = &ring_[dequeue_pos_ & mask_];
+        if ((int)record->sequence - (int)(dequeue_pos_ + 1) < 0) {
+            break;
+        }
+        __sync_synchronize();
+        print(record->time, record->ship_number, record->ship_name, record->text);
+        __sync_synchronize();
+        record->sequence = dequeue_pos_ + mask_ + 1;
+        ++dequeue_pos_;
+        ++n;
+    }
+    const unsigned int dropped = dropped_;
+    if (dropped != dropped_reported_) {
+        struct timeval  now;
+        gettimeofday(&now, 0);
+        char            text[64];
+        snprintf(text, sizeof(text), "Log: %u messages dropped", dropped - dropped_reported_);
+        print(now, -1, 0, text);
+        dropped_reported_ = dropped;
+        ++n;
+    }
+    if (n > 0) {
+        fflush(stdout);
+    }
+    return n;
+}
+
+/*****************************************************************************/
+void
+LogWriter::setup()
+{
+}
+
+/*****************************************************************************/
+void
+LogWriter::execute()
+{
+    for (;;) {
+        const bool stop = !run_;
+        if (drain() == 0) {
+            if (stop) {
+                break;
+            }
+            timespec delay;
+            delay.tv_sec = flush_interval_ms_ / 1000;
+            delay.tv_nsec = (flush_interval_ms_ % 1000) * 1000000;
+            nanosleep(&delay, 0);
+        }
+    }
+}
@@ -0,0 +1,81 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef LogWriter_h_
+#define LogWriter_h_
+
+#include <vector>
+#include <stdarg.h>     // va_list
+#include <stdint.h>
+#include <sys/time.h>   // struct timeval
+
+#include "Thread.h"
+
+/// Longer messages are truncated.
+#define LOG_TEXT_SIZE       480
+
+/** Log message waiting to be written. */
+typedef struct {
+    volatile unsigned int   sequence;           ///< Ring slot state, see \c LogWriter
+    struct timeval          time;               ///< Time of logging
+    int                     ship_number;        ///< Ship number of the client, -1 if none
+    char                    ship_name[32];      ///< Ship name of the client, 0-terminated
+    char                    text[LOG_TEXT_SIZE];///< Formatted message, 0-terminated
+} LOG_RECORD;
+
+/**
+Background writer for log messages.
+
+Messages are formatted by the caller into a slot of a lock-free bounded ring, any number of
+threads may append concurrently. The writer thread adds the timestamp and ship prefix, prints
+them to stdout and flushes stdout once per batch. When the ring is full messages are dropped
+and the number of dropped messages is logged by the writer.
+*/
+class LogWriter : public Thread {
+    private:
+        std::vector<LOG_RECORD> ring_;
+        unsigned int            mask_;              ///< Ring size - 1, ring size is a power of 2
+        volatile unsigned int   enqueue_pos_;       ///< Next slot for producers
+        unsigned int            dequeue_pos_;       ///< Next slot for writer thread
+        volatile unsigned int   dropped_;           ///< Messages dropped because the ring was full
+        unsigned int            dropped_reported_;  ///< \c dropped_ at last report
+        unsigned int            flush_interval_ms_; ///< Poll interval of writer thread when idle, milliseconds
+        volatile bool           run_;               ///< Run thread while true
+
+        /** Writes out everything in the ring. Returns number of messages written. */
+        unsigned int
+        drain();
+    public:
+        /** Call \c create() to start writing.
+        \param[in] ring_size Number of messages the ring holds, rounded up to a power of 2.
+        */
+        LogWriter(
+            const unsigned int  ring_size,
+            const unsigned int  flush_interval_ms);
+
+        /** Stops the thread after writing out everything appended so far. */
+        ~LogWriter();
+
+        /** Formats and queues a message. Returns false if the ring was full and the message was dropped. */
+        bool
+        append(
+            const int           ship_number,
+            const char*         ship_name,
+            const char*         fmt,
+            va_list             arguments);
+
+        /** Prints message in the log format, synchronously. */
+        static void
+        print(
+            const struct timeval&   time,
+            const int               ship_number,
+            const char*             ship_name,
+            const char*             text);
+    protected:
+        void
+        setup();
+
+        void
+        execute();
+};
+
+#endif /* LogWriter_h_ */
@@ -0,0 +1,304 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdexcept>
+#include <string>
+
+#include <utils/util.h>     // ssprintf
+
+#include <stdio.h>          // rename
+#include <string.h>         // memcpy, memcmp
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/time.h>       // gettimeofday
+
+#include "PacketCapture.h"
+
+using namespace std;
+using namespace utils;
+
+/// Records are padded to this many bytes.
+static const uint32_t CAPTURE_ALIGN = 4;
+
+/*****************************************************************************/
+static uint32_t
+aligned_size(
+    const uint32_t  size)
+{
+    return (size + CAPTURE_ALIGN - 1) & ~(CAPTURE_ALIGN - 1);
+}
+
+/*****************************************************************************/
+/** Returns true if \c path is a capture file holding records. */
+static bool
+has_records(
+    const std::string&  path)
+{
+    CAPTURE_FILE_HEADER header;
+    const int           fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const bool  ok = read(fd, &header, sizeof(header)) == sizeof(header);
+    close(fd);
+    return ok && memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) == 0 && header.used > header.header_size;
+}
+
+/*****************************************************************************/
+PacketCapture::PacketCapture(
+    const std::string&  path,
+    const unsigned int  file_size,
+    const unsigned int  files,
+    const unsigned int  flush_interval_ms) :
+        path_(path),
+        file_size_(aligned_size(file_size)),
+        files_(files),
+        flush_interval_ms_(flush_interval_ms),
+        run_(true)
+{
+    memset(&statistics_, 0, sizeof(statistics_));
+    active_.fd = spare_.fd = retired_.fd = -1;
+    active_.data = spare_.data = retired_.data = 0;
+    active_.size = spare_.size = retired_.size = 0;
+    if (file_size_ < sizeof(CAPTURE_FILE_HEADER) + sizeof(CAPTURE_RECORD)) {
+        throw runtime_error(ssprintf("Capture file size %d is too small", file_size));
+    }
+
+    // Keep capture of the previous run. If it stopped before the spare file that had become
+    // active was renamed, the spare holds the latest records.
+    rotate_files();
+    if (has_records(path_ + ".next")) {
+        rename((path_ + ".next").c_str(), path_.c_str());
+        rotate_files();
+    }
+    active_ = open_segment(path_);
+    try {
+        spare_ = open_segment(path_ + ".next");
+    } catch (...) {
+        close_segment(active_);
+        throw;
+    }
+
+    pthread_mutex_init(&mutex_, 0);
+    pthread_cond_init(&cond_, 0);
+}
+
+/*****************************************************************************/
+PacketCapture::~PacketCapture()
+{
+    pthread_mutex_lock(&mutex_);
+    run_ = false;
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mutex_);
+    join();
+
+    if (retired_.data != 0) {
+        // Rotation the thread didn't get to, active file is still called path.next.
+        close_segment(retired_);
+        rotate_files();
+        rename((path_ + ".next").c_str(), path_.c_str());
+    }
+    close_segment(active_);
+    if (spare_.data != 0) {
+        close_segment(spare_);
+        unlink((path_ + ".next").c_str());
+    }
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+/*****************************************************************************/
+PacketCapture::SEGMENT
+PacketCapture::open_segment(
+    const std::string&  path)
+{
+    SEGMENT segment;
+    segment.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (segment.fd < 0) {
+        throw runtime_error(ssprintf("Can't create capture file %s, errno %d", path.c_str(), errno));
+    }
+    // Blocks are allocated now, a sparse file would raise SIGBUS on write when the disk is full.
+    const int error = posix_fallocate(segment.fd, 0, file_size_);
+    if (error != 0) {
+        close(segment.fd);
+        unlink(path.c_str());
+        throw runtime_error(ssprintf("Can't allocate %d bytes for capture file %s, errno %d", file_size_, path.c_str(), error));
+    }
+    void* data = mmap(0, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+    if (data == MAP_FAILED) {
+        close(segment.fd);
+        throw runtime_error(ssprintf("Can't map capture file %s, errno %d", path.c_str(), errno));
+    }
+    segment.data = reinterpret_cast<unsigned char*>(data);
+    segment.size = file_size_;
+
+    CAPTURE_FILE_HEADER* header = reinterpret_cast<CAPTURE_FILE_HEADER*>(segment.data);
+    memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+    header->version = CAPTURE_VERSION;
+    header->header_size = aligned_size(sizeof(CAPTURE_FILE_HEADER));
+    header->file_size = file_size_;
+    header->used = header->header_size;
+    return segment;
+}
+
+/*****************************************************************************/
+void
+PacketCapture::close_segment(
+    SEGMENT&            segment)
+{
+    const uint32_t used = reinterpret_cast<CAPTURE_FILE_HEADER*>(segment.data)->used;
+    msync(segment.data, segment.size, MS_SYNC);
+    munmap(segment.data, segment.size);
+    // Unused tail is of no interest.
+    if (ftruncate(segment.fd, used) != 0) {
+        // pass
+    }
+    close(segment.fd);
+    segment.fd = -1;
+    segment.data = 0;
+    segment.size = 0;
+}
+
+/*****************************************************************************/
+void
+PacketCapture::rotate_files()
+{
+    if (files_ == 0) {
+        unlink(path_.c_str());
+        return;
+    }
+    if (access(path_.c_str(), F_OK) != 0) {
+        // Nothing to keep, don't push the old files further.
+        return;
+    }
+    for (unsigned int i = files_ - 1; i >= 1; --i) {
+        rename(ssprintf("%s.%d", path_.c_str(), i).c_str(), ssprintf("%s.%d", path_.c_str(), i + 1).c_str());
+    }
+    rename(path_.c_str(), (path_ + ".1").c_str());
+}
+
+/*****************************************************************************/
+bool
+PacketCapture::record(
+    const CAPTURE_KIND  kind,
+    const int           client,
+    const void*         data,
+    const unsigned int  size)
+{
+    const uint32_t  need = aligned_size(sizeof(CAPTURE_RECORD) + size);
+    bool            r = false;
+    struct timeval  now;
+    gettimeofday(&now, 0);
+
+    pthread_mutex_lock(&mutex_);
+    CAPTURE_FILE_HEADER* header = reinterpret_cast<CAPTURE_FILE_HEADER*>(active_.data);
+    if (header->used + need > active_.size && need <= file_size_ - header->header_size) {
+        // Full, switch to the spare file unless the capture thread is behind.
+        if (spare_.data != 0 && retired_.data == 0) {
+            retired_ = active_;
+            active_ = spare_;
+            spare_.fd = -1;
+            spare_.data = 0;
+            spare_.size = 0;
+            ++statistics_.rotations;
+            pthread_cond_signal(&cond_);
+            header = reinterpret_cast<CAPTURE_FILE_HEADER*>(active_.data);
+        }
+    }
+    if (header->used + need <= active_.size) {
+        unsigned char*  ptr = active_.data + header->used;
+        CAPTURE_RECORD  rec;
+        rec.size = size;
+        rec.sec = now.tv_sec;
+        rec.usec = now.tv_usec;
+        rec.client = client;
+        rec.kind = kind;
+        rec.reserved = 0;
+        memcpy(ptr, &rec, sizeof(rec));
+        if (size > 0) {
+            memcpy(ptr + sizeof(rec), data, size);
+        }
+        // Record has to be complete before it becomes visible to readers.
+        __sync_synchronize();
+        header->used += need;
+        ++statistics_.records;
+        statistics_.bytes += need;
+        r = true;
+    } else {
+        ++statistics_.dropped;
+    }
+    pthread_mutex_unlock(&mutex_);
+    return r;
+}
+
+/*****************************************************************************/
+CAPTURE_STATISTICS
+PacketCapture::statistics()
+{
+    pthread_mutex_lock(&mutex_);
+    CAPTURE_STATISTICS r = statistics_;
+    pthread_mutex_unlock(&mutex_);
+    return r;
+}
+
+/*****************************************************************************/
+void
+PacketCapture::setup()
+{
+}
+
+/*****************************************************************************/
+void
+PacketCapture::execute()
+{
+    for (;;) {
+        pthread_mutex_lock(&mutex_);
+        if (run_ && retired_.data == 0) {
+            // Sleep until rotation, timeout or shutdown.
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += flush_interval_ms_ / 1000;
+            deadline.tv_nsec += (flush_interval_ms_ % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&cond_, &mutex_, &deadline);
+        }
+        // Only this thread unmaps, so the active mapping stays valid after unlock.
+        SEGMENT     active = active_;
+        SEGMENT     retired = retired_;
+        const bool  need_spare = spare_.data == 0;
+        const bool  stop = !run_;
+        pthread_mutex_unlock(&mutex_);
+
+        if (stop) {
+            break;
+        }
+        msync(active.data, active.size, MS_ASYNC);
+        if (retired.data != 0) {
+            // Full file is closed and rotated, the spare file takes its name.
+            close_segment(retired);
+            rotate_files();
+            rename((path_ + ".next").c_str(), path_.c_str());
+            pthread_mutex_lock(&mutex_);
+            retired_.fd = -1;
+            retired_.data = 0;
+            retired_.size = 0;
+            pthread_mutex_unlock(&mutex_);
+        }
+        if (need_spare) {
+            try {
+                SEGMENT spare = open_segment(path_ + ".next");
+                pthread_mutex_lock(&mutex_);
+                spare_ = spare;
+                pthread_mutex_unlock(&mutex_);
+            } catch (const std::exception& e) {
+                // Records get dropped when the file is full, try again next round.
+            }
+        }
+    }
+}
@@ -0,0 +1,127 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef PacketCapture_h_
+#define PacketCapture_h_
+
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "Thread.h"
+
+/// First bytes of a capture file.
+#define CAPTURE_MAGIC       "DNCAPTR1"
+
+/// Version of the capture file format.
+#define CAPTURE_VERSION     1
+
+/** Header at the start of every capture file. */
+typedef struct {
+    char                magic[8];       ///< \c CAPTURE_MAGIC, not 0-terminated
+    uint32_t            version;        ///< \c CAPTURE_VERSION
+    uint32_t            header_size;    ///< Records start at this offset
+    uint32_t            file_size;      ///< Size of the file while being written
+    volatile uint32_t   used;           ///< Records end at this offset, updated after every record
+} CAPTURE_FILE_HEADER;
+
+/** Kind of a capture record. */
+typedef enum {
+    CAPTURE_CONNECT = 1,    ///< Client connected, data is its IP address
+    CAPTURE_DATA    = 2,    ///< Bytes received from client
+    CAPTURE_CLOSE   = 3     ///< Client was shut down, data is the reason
+} CAPTURE_KIND;
+
+/** Record header, followed by \c size bytes of data and padding to 4 bytes. */
+typedef struct {
+    uint32_t            size;           ///< Size of data
+    uint32_t            sec;            ///< Time of capture, seconds since 1970
+    uint32_t            usec;           ///< Microseconds
+    int32_t             client;         ///< Client socket, tags records of one connection
+    uint16_t            kind;           ///< \c CAPTURE_KIND
+    uint16_t            reserved;
+} CAPTURE_RECORD;
+
+/** Snapshot of the capture statistics. */
+typedef struct {
+    uint64_t            records;        ///< Total records captured
+    uint64_t            bytes;          ///< Total bytes captured, including record headers
+    uint64_t            dropped;        ///< Records dropped because no file was ready
+    uint64_t            rotations;      ///< Number of times the file was full
+} CAPTURE_STATISTICS;
+
+/**
+Capture of the data received from TCP clients, for debugging and replay with GpsReplay.
+
+Records are copied into a memory-mapped file, so capturing costs a \c memcpy and the data
+survives a crash of the server. When the file is full the writer switches to a spare file
+prepared in advance. The capture thread flushes the mapping to disk every \c flush_interval_ms,
+closes the full file and rotates it to \c path.1 ... \c path.N, keeping \c files old files.
+*/
+class PacketCapture : public Thread {
+    private:
+        /** Mapped capture file. */
+        typedef struct {
+            int             fd;             ///< -1 if none
+            unsigned char*  data;           ///< Mapping, 0 if none
+            uint32_t        size;           ///< Size of mapping
+        } SEGMENT;
+
+        std::string         path_;              ///< Current capture file
+        uint32_t            file_size_;         ///< Size of one capture file
+        unsigned int        files_;             ///< Number of rotated files to keep
+        unsigned int        flush_interval_ms_; ///< Flush mapping at least this often, milliseconds
+        bool                run_;               ///< Run thread while true
+
+        pthread_mutex_t     mutex_;             ///< Guards segments and statistics
+        pthread_cond_t      cond_;              ///< Signalled on rotation and on shutdown
+        SEGMENT             active_;            ///< Records are written here
+        SEGMENT             spare_;             ///< Becomes active when active is full
+        SEGMENT             retired_;           ///< Full file waiting to be closed and rotated
+        CAPTURE_STATISTICS  statistics_;        ///< Statistics, guarded by \c mutex_
+
+        /** Creates, allocates and maps a new capture file. Throws \c std::runtime_error on errors, a full disk among them. */
+        SEGMENT
+        open_segment(
+            const std::string&  path);
+
+        /** Unmaps the file and truncates it to the used size. */
+        void
+        close_segment(
+            SEGMENT&            segment);
+
+        /** Renames \c path to \c path.1, \c path.1 to \c path.2 and so on, dropping the oldest. */
+        void
+        rotate_files();
+    public:
+        /** Rotates existing capture file away and opens a new one. Call \c create() to start the flushing thread.
+        Throws \c std::runtime_error on errors.
+        */
+        PacketCapture(
+            const std::string&  path,
+            const unsigned int  file_size,
+            const unsigned int  files,
+            const unsigned int  flush_interval_ms);
+
+        /** Stops the thread and closes the files. */
+        ~PacketCapture();
+
+        /** Captures one record. Returns false if it was dropped. */
+        bool
+        record(
+            const CAPTURE_KIND  kind,
+            const int           client,
+            const void*         data,
+            const unsigned int  size);
+
+        /** Returns a snapshot of the statistics. */
+        CAPTURE_STATISTICS
+        statistics();
+    protected:
+        void
+        setup();
+
+        void
+        execute();
+};
+
+#endif /* PacketCapture_h_ */
@@ -0,0 +1,190 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <string>
+#include <set>
+
+#include <utils/util.h>     // ssprintf
+
+#include <string.h>         // memset, strlen
+#include <ctype.h>          // isdigit
+#include <stdlib.h>         // atoi
+#include <zlib.h>           // crc32
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+#include "PointsCatalog.h"
+
+using namespace std;
+using namespace utils;
+
+/*****************************************************************************/
+/** Parses the number of \c points_XXXXX.ipt. Returns false for other names, compressed variants and such. */
+static bool
+number_of(
+    const char*         name,
+    int&                number)
+{
+    if (strlen(name) != 16 || strncmp(name, "points_", 7) != 0 || strcmp(name + 12, ".ipt") != 0) {
+        return false;
+    }
+    for (int i = 7; i < 12; ++i) {
+        if (!isdigit(name[i])) {
+            return false;
+        }
+    }
+    number = atoi(name + 7);
+    return true;
+}
+
+/*****************************************************************************/
+/** Reads size and CRC-32 of the file. Returns false if it can't be read. */
+static bool
+checksum_file(
+    const std::string&  filename,
+    uint32_t&           size,
+    uint32_t&           crc)
+{
+    const int   fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    size = 0;
+    crc = crc32(0L, Z_NULL, 0);
+    unsigned char   buffer[65536];
+    ssize_t         n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        size += n;
+        crc = crc32(crc, buffer, n);
+    }
+    close(fd);
+    return n == 0;
+}
+
+/*****************************************************************************/
+PointsCatalog::PointsCatalog(
+    const std::string&  directory) :
+        directory_(directory),
+        fd_(-1)
+{
+    memset(&statistics_, 0, sizeof(statistics_));
+    latest_.number = -1;
+    latest_.size = 0;
+    latest_.crc = 0;
+    // Watch first, so no file slips in between.
+    if (directory_ != "") {
+        fd_ = inotify_init();
+        if (fd_ >= 0) {
+            fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+            fcntl(fd_, F_SETFD, FD_CLOEXEC);
+            if (inotify_add_watch(fd_, directory_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0) {
+                close(fd_);
+                fd_ = -1;
+            }
+        }
+    }
+    scan();
+    refresh_latest(true);
+}
+
+/*****************************************************************************/
+PointsCatalog::~PointsCatalog()
+{
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+/*****************************************************************************/
+void
+PointsCatalog::scan()
+{
+    ++statistics_.scans;
+    numbers_.clear();
+    DIR*    dir = directory_ == "" ? 0 : opendir(directory_.c_str());
+    if (dir == 0) {
+        return;
+    }
+    for (struct dirent* e = readdir(dir); e != 0; e = readdir(dir)) {
+        int number;
+        if (number_of(e->d_name, number)) {
+            numbers_.insert(number);
+        }
+    }
+    closedir(dir);
+}
+
+/*****************************************************************************/
+bool
+PointsCatalog::refresh_latest(
+    const bool          reread)
+{
+    if (!reread && (numbers_.empty() ? -1 : *numbers_.rbegin()) == latest_.number) {
+        return false;
+    }
+    POINTS_FILE_ENTRY   entry;
+    entry.number = -1;
+    entry.size = 0;
+    entry.crc = 0;
+    while (!numbers_.empty()) {
+        const int   number = *numbers_.rbegin();
+        if (checksum_file(ssprintf("%s/points_%05d.ipt", directory_.c_str(), number), entry.size, entry.crc)) {
+            entry.number = number;
+            break;
+        }
+        // Gone meanwhile, its event is on the way.
+        numbers_.erase(number);
+    }
+    const bool  changed = entry.number != latest_.number || entry.size != latest_.size || entry.crc != latest_.crc;
+    latest_ = entry;
+    if (changed) {
+        ++statistics_.changes;
+    }
+    return changed;
+}
+
+/*****************************************************************************/
+bool
+PointsCatalog::update()
+{
+    if (fd_ < 0) {
+        scan();
+        return refresh_latest(false);
+    }
+    bool    reread = false;
+    char    buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(fd_, buffer, sizeof(buffer))) > 0) {
+        for (const char* p = buffer; p < buffer + n; ) {
+            const struct inotify_event* e = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + e->len;
+            int     number;
+            if ((e->mask & IN_Q_OVERFLOW) != 0) {
+                // Events lost.
+                scan();
+                reread = true;
+            } else if (e->len > 0 && number_of(e->name, number)) {
+                ++statistics_.events;
+                if ((e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0) {
+                    numbers_.insert(number);
+                    // Latest file rewritten.
+                    reread = reread || number == latest_.number;
+                } else {
+                    numbers_.erase(number);
+                }
+            }
+        }
+    }
+    return refresh_latest(reread);
+}
+
+/*****************************************************************************/
+POINTS_CATALOG_STATISTICS
+PointsCatalog::statistics() const
+{
+    POINTS_CATALOG_STATISTICS   r = statistics_;
+    r.files = numbers_.size();
+    return r;
+}
@@ -0,0 +1,81 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef PointsCatalog_h_
+#define PointsCatalog_h_
+
+#include <string>
+#include <set>
+#include <utils/mystdint.h>     // uint32_t, uint64_t
+
+/** Latest points file of the catalog. */
+typedef struct {
+    int                 number;         ///< File number, -1 if there are no points files
+    uint32_t            size;           ///< Size in bytes
+    uint32_t            crc;            ///< CRC-32 of the file
+} POINTS_FILE_ENTRY;
+
+/** Snapshot of the points catalog statistics. */
+typedef struct {
+    uint64_t            events;         ///< inotify events about points files
+    uint64_t            scans;          ///< Directory scans
+    uint64_t            changes;        ///< Times the latest file has changed
+    unsigned int        files;          ///< Points files in the directory now
+} POINTS_CATALOG_STATISTICS;
+
+/**
+Keeps track of the points files \c directory/points_XXXXX.ipt and of the latest of them.
+
+The directory is scanned once, after that inotify tells of the files written, moved in, deleted or
+moved away, so nothing is read until a points file actually appears. Without inotify the directory
+is scanned on every \c update instead.
+
+Must be used under the server lock.
+*/
+class PointsCatalog {
+    private:
+        std::string                 directory_;
+        int                         fd_;            ///< inotify descriptor, -1 if the directory is scanned instead
+        std::set<int>               numbers_;       ///< Numbers of the points files in the directory
+        POINTS_FILE_ENTRY           latest_;
+        POINTS_CATALOG_STATISTICS   statistics_;
+
+        /** Reads the file numbers from the directory. */
+        void
+        scan();
+
+        /** Makes the highest number of \c numbers_ the latest file, reading its size and checksum if it has
+            changed or \c reread is set. Returns true if the number, size or checksum has changed.
+        */
+        bool
+        refresh_latest(
+            const bool              reread);
+    public:
+        /**
+        \param[in] directory Directory of the points files
+        */
+        PointsCatalog(
+            const std::string&      directory);
+
+        /** Stops watching the directory. */
+        ~PointsCatalog();
+
+        /** inotify descriptor, readable when \c update has something to do. -1 if the directory is scanned instead. */
+        int
+        fd() const { return fd_; }
+
+        /** Reads the pending inotify events, or scans the directory without inotify. Returns true if the
+            latest file has changed: a newer file has appeared, or the latest has been rewritten or removed.
+        */
+        bool
+        update();
+
+        /** Latest points file. */
+        const POINTS_FILE_ENTRY&
+        latest() const { return latest_; }
+
+        /** Returns a snapshot of the statistics. */
+        POINTS_CATALOG_STATISTICS
+        statistics() const;
+}; // class PointsCatalog
+
+#endif /* PointsCatalog_h_ */
@@ -0,0 +1,247 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <vector>
+
+#include <string.h>         // memcmp, memcpy, memset
+#include <zlib.h>
+
+#include "PointsDelta.h"
+
+/// Bytes in a block of the base file.
+static const unsigned int   BLOCK_SIZE = 64;
+/// Hash table of the base blocks has 2^HASH_BITS buckets.
+static const unsigned int   HASH_BITS = 16;
+/// Blocks with the same hash compared at most, files full of zeros would be slow otherwise.
+static const unsigned int   MAX_CANDIDATES = 16;
+
+/*****************************************************************************/
+static uint32_t
+checksum(
+    const unsigned char*    data,
+    const unsigned int      size)
+{
+    const uLong crc = crc32(0L, Z_NULL, 0);
+    return size == 0 ? crc : crc32(crc, data, size);
+}
+
+/*****************************************************************************/
+static unsigned int
+bucket_of(
+    const uint32_t          sum)
+{
+    return (sum * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/*****************************************************************************/
+/** rsync weak checksum of a block, \c a is the sum of the bytes and \c b the sum of the sums. */
+static void
+block_sum(
+    const unsigned char*    data,
+    uint32_t&               a,
+    uint32_t&               b)
+{
+    a = 0;
+    b = 0;
+    for (unsigned int i=0; i<BLOCK_SIZE; ++i) {
+        a += data[i];
+        b += (BLOCK_SIZE - i) * data[i];
+    }
+}
+
+/*****************************************************************************/
+static void
+append_u32(
+    std::vector<unsigned char>&     out,
+    const uint32_t                  value)
+{
+    const unsigned char*    p = reinterpret_cast<const unsigned char*>(&value);
+    out.insert(out.end(), p, p + sizeof(value));
+}
+
+/*****************************************************************************/
+static void
+append_data(
+    std::vector<unsigned char>&     out,
+    const unsigned char*            data,
+    const unsigned int              size)
+{
+    if (size > 0) {
+        out.push_back(POINTS_DELTA_DATA);
+        append_u32(out, size);
+        out.insert(out.end(), data, data + size);
+    }
+}
+
+/*****************************************************************************/
+void
+make_points_delta(
+    const unsigned char*            base,
+    const unsigned int              base_size,
+    const unsigned char*            target,
+    const unsigned int              target_size,
+    std::vector<unsigned char>&     delta)
+{
+    std::vector<unsigned char>  ops;
+    POINTS_DELTA_HEADER         header;
+    memcpy(header.magic, POINTS_DELTA_MAGIC, sizeof(header.magic));
+    header.base_size = base_size;
+    header.base_crc = checksum(base, base_size);
+    header.target_size = target_size;
+    header.target_crc = checksum(target, target_size);
+    const unsigned char*        p = reinterpret_cast<const unsigned char*>(&header);
+    ops.insert(ops.end(), p, p + sizeof(header));
+
+    // 1. Hash table of the base blocks, chains list the earlier blocks first.
+    const unsigned int  nblocks = base_size / BLOCK_SIZE;
+    std::vector<int>        buckets(1 << HASH_BITS, -1);
+    std::vector<int>        chain(nblocks, -1);
+    std::vector<uint32_t>   sums(nblocks);
+    for (unsigned int i=nblocks; i-- > 0; ) {
+        uint32_t    a;
+        uint32_t    b;
+        block_sum(base + i * BLOCK_SIZE, a, b);
+        sums[i] = (a & 0xFFFF) | (b << 16);
+        const unsigned int  bucket = bucket_of(sums[i]);
+        chain[i] = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    // 2. Roll over the target, copy from the base whatever matches.
+    unsigned int    literal = 0;    // Start of the bytes not matched yet
+    unsigned int    pos = 0;
+    uint32_t        a = 0;
+    uint32_t        b = 0;
+    bool            rolling = false;
+    while (nblocks > 0 && pos + BLOCK_SIZE <= target_size) {
+        if (!rolling) {
+            block_sum(target + pos, a, b);
+            rolling = true;
+        }
+        const uint32_t  sum = (a & 0xFFFF) | (b << 16);
+        int             match = -1;
+        unsigned int    candidates = 0;
+        for (int c = buckets[bucket_of(sum)]; c != -1 && candidates < MAX_CANDIDATES; c = chain[c], ++candidates) {
+            if (sums[c] == sum && memcmp(base + c * BLOCK_SIZE, target + pos, BLOCK_SIZE) == 0) {
+                match = c;
+                break;
+            }
+        }
+        if (match == -1) {
+            if (pos + BLOCK_SIZE < target_size) {
+                const unsigned char out = target[pos];
+                const unsigned char in = target[pos + BLOCK_SIZE];
+                a = a - out + in;
+                b = b - BLOCK_SIZE * out + a;
+            }
+            ++pos;
+            continue;
+        }
+        // Grow the match byte by byte both ways, unchanged parts of points files are long.
+        unsigned int    from = match * BLOCK_SIZE;
+        unsigned int    start = pos;
+        while (start > literal && from > 0 && base[from - 1] == target[start - 1]) {
+            --from;
+            --start;
+        }
+        unsigned int    end = pos + BLOCK_SIZE;
+        unsigned int    to = match * BLOCK_SIZE + BLOCK_SIZE;
+        while (end < target_size && to < base_size && base[to] == target[end]) {
+            ++end;
+            ++to;
+        }
+        append_data(ops, target + literal, start - literal);
+        ops.push_back(POINTS_DELTA_COPY);
+        append_u32(ops, from);
+        append_u32(ops, end - start);
+        pos = end;
+        literal = end;
+        rolling = false;
+    }
+    append_data(ops, target + literal, target_size - literal);
+
+    // 3. Compress.
+    uLongf  n = compressBound(ops.size());
+    delta.resize(n);
+    if (compress2(&delta[0], &n, &ops[0], ops.size(), Z_BEST_COMPRESSION) != Z_OK) {
+        n = 0;
+    }
+    delta.resize(n);
+}
+
+/*****************************************************************************/
+bool
+apply_points_delta(
+    const unsigned char*            base,
+    const unsigned int              base_size,
+    const unsigned char*            delta,
+    const unsigned int              delta_size,
+    std::vector<unsigned char>&     target)
+{
+    // 1. Inflate.
+    std::vector<unsigned char>  ops;
+    z_stream                    z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit(&z) != Z_OK) {
+        return false;
+    }
+    z.next_in = const_cast<Bytef*>(delta);
+    z.avail_in = delta_size;
+    int r = Z_OK;
+    while (r == Z_OK) {
+        unsigned char   buffer[4096];
+        z.next_out = buffer;
+        z.avail_out = sizeof(buffer);
+        r = inflate(&z, Z_NO_FLUSH);
+        ops.insert(ops.end(), buffer, buffer + sizeof(buffer) - z.avail_out);
+    }
+    inflateEnd(&z);
+    if (r != Z_STREAM_END) {
+        return false;
+    }
+
+    // 2. Header, delta has to be made from this very base.
+    POINTS_DELTA_HEADER header;
+    if (ops.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, &ops[0], sizeof(header));
+    if (memcmp(header.magic, POINTS_DELTA_MAGIC, sizeof(header.magic)) != 0
+        || header.base_size != base_size || header.base_crc != checksum(base, base_size)) {
+        return false;
+    }
+
+    // 3. Operations.
+    target.clear();
+    target.reserve(header.target_size);
+    unsigned int    i = sizeof(header);
+    while (i < ops.size()) {
+        const unsigned char op = ops[i++];
+        uint32_t            length;
+        if (op == POINTS_DELTA_COPY && i + 2 * sizeof(uint32_t) <= ops.size()) {
+            uint32_t    offset;
+            memcpy(&offset, &ops[i], sizeof(offset));
+            memcpy(&length, &ops[i + sizeof(offset)], sizeof(length));
+            i += sizeof(offset) + sizeof(length);
+            if (offset > base_size || length > base_size - offset) {
+                return false;
+            }
+            target.insert(target.end(), base + offset, base + offset + length);
+        } else if (op == POINTS_DELTA_DATA && i + sizeof(uint32_t) <= ops.size()) {
+            memcpy(&length, &ops[i], sizeof(length));
+            i += sizeof(length);
+            if (length > ops.size() - i) {
+                return false;
+            }
+            target.insert(target.end(), ops.begin() + i, ops.begin() + i + length);
+            i += length;
+        } else {
+            return false;
+        }
+        if (target.size() > header.target_size) {
+            return false;
+        }
+    }
+    return target.size() == header.target_size
+        && checksum(target.empty() ? 0 : &target[0], target.size()) == header.target_crc;
+}
@@ -0,0 +1,59 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef PointsDelta_h_
+#define PointsDelta_h_
+
+#include <vector>
+
+#include <utils/mystdint.h>     // uint32_t
+
+/**
+Binary delta between two points files, shared by GpsServer and GpsViewer.
+
+Delta is compressed with zlib. Inflated, it is a POINTS_DELTA_HEADER followed by operations,
+each a byte \c POINTS_DELTA_COPY followed by uint32_t offset and length of bytes to copy from
+the base file, or \c POINTS_DELTA_DATA followed by uint32_t length and the bytes themselves.
+Matching blocks are found rsync-style with a rolling checksum over the blocks of the base file,
+so points moved within the file are copied as well.
+*/
+
+#pragma pack(push, 1)
+
+/** Start of an inflated delta. */
+typedef struct {
+    char        magic[4];       ///< POINTS_DELTA_MAGIC
+    uint32_t    base_size;      ///< Size of the base file
+    uint32_t    base_crc;       ///< CRC-32 of the base file
+    uint32_t    target_size;    ///< Size of the file made by the delta
+    uint32_t    target_crc;     ///< CRC-32 of the file made by the delta
+} POINTS_DELTA_HEADER;
+
+#pragma pack(pop)
+
+#define     POINTS_DELTA_MAGIC  "IPTD"
+/// Copy bytes of the base file
+#define     POINTS_DELTA_COPY   1
+/// Bytes included in the delta
+#define     POINTS_DELTA_DATA   2
+
+/** Makes the delta turning \c base into \c target. */
+void
+make_points_delta(
+    const unsigned char*            base,
+    const unsigned int              base_size,
+    const unsigned char*            target,
+    const unsigned int              target_size,
+    std::vector<unsigned char>&     delta);
+
+/** Applies the delta to \c base. Returns false if the delta is corrupt, was made from another base,
+    or the result doesn't match the checksum of the target.
+*/
+bool
+apply_points_delta(
+    const unsigned char*            base,
+    const unsigned int              base_size,
+    const unsigned char*            delta,
+    const unsigned int              delta_size,
+    std::vector<unsigned char>&     target);
+
+#endif /* PointsDelta_h_ */
@@ -0,0 +1,276 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <string>
+#include <vector>
+
+#include <utils/util.h>     // ssprintf
+
+#include <string.h>         // memcpy, memset
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PointsFileCache.h"
+
+using namespace std;
+using namespace utils;
+
+/*****************************************************************************/
+PointsFileCache::PointsFileCache(
+    const std::string&  directory,
+    const unsigned int  max_files,
+    PointsVariantWriter* writer) :
+        directory_(directory),
+        max_files_(max_files < 1 ? 1 : max_files),
+        writer_(writer)
+{
+    memset(&statistics_, 0, sizeof(statistics_));
+}
+
+/*****************************************************************************/
+PointsFileCache::~PointsFileCache()
+{
+    while (!files_.empty()) {
+        unmap(files_.begin());
+    }
+}
+
+/*****************************************************************************/
+std::string
+PointsFileCache::path(
+    const int           file_no,
+    const int           codec) const
+{
+    const char* suffix = codec == POINTSFILE_CODEC_ZLIB ? ".z" : codec == POINTSFILE_CODEC_DELTA ? ".delta" : "";
+    return ssprintf("%s/points_%05d.ipt%s", directory_.c_str(), file_no, suffix);
+}
+
+/*****************************************************************************/
+void
+PointsFileCache::unmap(
+    std::map<FILE_KEY, MAPPED_FILE>::iterator   it)
+{
+    if (it->second.data != 0) {
+        munmap(const_cast<unsigned char*>(it->second.data), it->second.size);
+    }
+    lru_.erase(it->second.lru);
+    files_.erase(it);
+}
+
+/*****************************************************************************/
+/** True if \c a is later than \c b. */
+static bool
+later(
+    const struct timespec&  a,
+    const struct timespec&  b)
+{
+    return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+
+/*****************************************************************************/
+bool
+PointsFileCache::publish(
+    const int           file_no,
+    const int           codec)
+{
+    const FILE_KEY      key(file_no, codec);
+    const std::string   filename(path(file_no, codec));
+    struct stat         st_variant;
+    struct stat         st;
+    struct stat         st_base;
+    if (stat(path(file_no).c_str(), &st) != 0
+        || (codec == POINTSFILE_CODEC_DELTA && stat(path(file_no - 1).c_str(), &st_base) != 0)) {
+        return false;
+    }
+    struct timespec     mtime = st.st_mtim;
+    if (codec == POINTSFILE_CODEC_DELTA && later(st_base.st_mtim, mtime)) {
+        mtime = st_base.st_mtim;
+    }
+    // Up to date unless a file it is made of was modified after it. Nanoseconds, a variant
+    // written in the same second as the file is not stale.
+    if (stat(filename.c_str(), &st_variant) == 0 && !later(mtime, st_variant.st_mtim)) {
+        return true;
+    }
+    if (pending_.find(key) != pending_.end()) {
+        return false;
+    }
+    const std::map<FILE_KEY, struct timespec>::const_iterator failed = failed_.find(key);
+    if (failed != failed_.end() && !later(mtime, failed->second)) {
+        return false;
+    }
+
+    POINTS_VARIANT_JOB  job;
+    job.file_no = file_no;
+    job.codec = codec;
+    job.source = path(file_no);
+    job.base = path(file_no - 1);
+    job.variant = filename;
+    job.ok = false;
+    if (writer_.get() == 0) {
+        job.ok = PointsVariantWriter::write(job);
+        finish(job, mtime);
+        return job.ok;
+    }
+    pending_[key] = mtime;
+    writer_->add(job);
+    return false;
+}
+
+/*****************************************************************************/
+void
+PointsFileCache::finish(
+    const POINTS_VARIANT_JOB&   job,
+    const struct timespec&      mtime)
+{
+    const FILE_KEY      key(job.file_no, job.codec);
+    if (job.ok) {
+        ++(job.codec == POINTSFILE_CODEC_ZLIB ? statistics_.compressed : statistics_.deltas);
+        failed_.erase(key);
+    } else {
+        failed_[key] = mtime;
+    }
+}
+
+/*****************************************************************************/
+bool
+PointsFileCache::poll(
+    const int           file_no)
+{
+    bool                r = false;
+    POINTS_VARIANT_JOB  job;
+    while (writer_.get() != 0 && writer_->pop(job)) {
+        const std::map<FILE_KEY, struct timespec>::iterator it = pending_.find(FILE_KEY(job.file_no, job.codec));
+        if (it != pending_.end()) {
+            finish(job, it->second);
+            pending_.erase(it);
+        }
+        r = r || (job.ok && job.file_no == file_no);
+    }
+    return r;
+}
+
+/*****************************************************************************/
+const PointsFileCache::MAPPED_FILE*
+PointsFileCache::find(
+    const int           file_no,
+    const int           codec,
+    const bool          remap)
+{
+    const FILE_KEY      key(file_no, codec);
+    std::map<FILE_KEY, MAPPED_FILE>::iterator it = files_.find(key);
+    if (it != files_.end() && !remap) {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return &it->second;
+    }
+    if (codec != POINTSFILE_CODEC_NONE && codec != POINTSFILE_CODEC_ZLIB && codec != POINTSFILE_CODEC_DELTA) {
+        return 0;
+    }
+    if (codec != POINTSFILE_CODEC_NONE && !publish(file_no, codec)) {
+        if (it != files_.end()) {
+            unmap(it);
+        }
+        return 0;
+    }
+
+    const std::string   filename(path(file_no, codec));
+    const int           fd = open(filename.c_str(), O_RDONLY);
+    struct stat         st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (it != files_.end()) {
+            unmap(it);
+        }
+        return 0;
+    }
+    if (it != files_.end()) {
+        const MAPPED_FILE&  mapped = it->second;
+        if (mapped.size == static_cast<unsigned int>(st.st_size) && mapped.dev == st.st_dev && mapped.ino == st.st_ino
+            && mapped.mtime.tv_sec == st.st_mtim.tv_sec && mapped.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            // Unchanged.
+            close(fd);
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            return &it->second;
+        }
+        unmap(it);
+    }
+
+    MAPPED_FILE file;
+    file.data = 0;
+    file.size = st.st_size;
+    file.dev = st.st_dev;
+    file.ino = st.st_ino;
+    file.mtime = st.st_mtim;
+    if (file.size > 0) {
+        void* data = mmap(0, file.size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return 0;
+        }
+        file.data = reinterpret_cast<const unsigned char*>(data);
+    }
+    // Mapping stays valid without the descriptor.
+    close(fd);
+    ++statistics_.misses;
+
+    while (files_.size() >= max_files_) {
+        unmap(files_.find(lru_.back()));
+        ++statistics_.evictions;
+    }
+    lru_.push_front(key);
+    file.lru = lru_.begin();
+    return &(files_[key] = file);
+}
+
+/*****************************************************************************/
+int
+PointsFileCache::size(
+    const int           file_no,
+    const int           codec)
+{
+    const MAPPED_FILE*  file = find(file_no, codec, true);
+    return file == 0 ? -1 : file->size;
+}
+
+/*****************************************************************************/
+bool
+PointsFileCache::get_chunk(
+    const uint16_t              file_no,
+    const int                   codec,
+    const uint16_t              chunk_no,
+    PACKET_POINTSFILE_CHUNK&    packet)
+{
+    const unsigned int  offset = chunk_no * CHUNK_SIZE;
+    const MAPPED_FILE*  file = find(file_no, codec, false);
+    if (file != 0 && offset > file->size) {
+        // Maybe it has grown since.
+        file = find(file_no, codec, true);
+    }
+    // GpsViewer asks for one chunk more than needed when the size is a multiple of CHUNK_SIZE.
+    if (file == 0 || offset > file->size) {
+        ++statistics_.failed;
+        return false;
+    }
+    const unsigned int  n = file->size - offset < CHUNK_SIZE ? file->size - offset : CHUNK_SIZE;
+    if (n > 0) {
+        memcpy(packet.data, file->data + offset, n);
+    }
+    memset(packet.data + n, 0, CHUNK_SIZE - n);
+    packet.file_number = file_no;
+    packet.chunk_number = chunk_no;
+    packet.codec = codec;
+    ++statistics_.chunks;
+    return true;
+}
+
+/*****************************************************************************/
+POINTS_FILE_CACHE_STATISTICS
+PointsFileCache::statistics() const
+{
+    POINTS_FILE_CACHE_STATISTICS    r = statistics_;
+    r.files = files_.size();
+    return r;
+}
@@ -0,0 +1,146 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef PointsFileCache_h_
+#define PointsFileCache_h_
+
+#include <string>
+#include <list>
+#include <map>
+#include <memory>           // std::auto_ptr
+#include <utility>
+#include <stdint.h>
+#include <sys/types.h>      // dev_t, ino_t
+#include <sys/stat.h>       // struct stat
+
+#include "DigNetMessages.h" // PACKET_POINTSFILE_CHUNK
+#include "PointsVariantWriter.h"
+
+/** Snapshot of the points file cache statistics. */
+typedef struct {
+    uint64_t            chunks;         ///< Total chunks served
+    uint64_t            misses;         ///< Files mapped because they were not in the cache
+    uint64_t            evictions;      ///< Files unmapped to make room
+    uint64_t            failed;         ///< Requests for missing files or chunks beyond the end
+    uint64_t            compressed;     ///< Compressed variants written
+    uint64_t            deltas;         ///< Delta variants written
+    unsigned int        files;          ///< Files mapped now
+} POINTS_FILE_CACHE_STATISTICS;
+
+/**
+Serves chunks of the published points files, \c directory/points_XXXXX.ipt, and of their variants:
+compressed \c directory/points_XXXXX.ipt.z and the delta from the previous file
+\c directory/points_XXXXX.ipt.delta (see PointsDelta.h).
+
+A variant is written when it is first asked for, and again whenever a file it is made of is newer
+than it. Point clouds shrink several-fold, and a new file usually changes only the area dredged
+since the previous one, so making the variants once costs far less than sending the whole file to
+every boat. Variants are written by a \c PointsVariantWriter thread; until one is done it is
+missing, and boats are offered the plain file. \c poll() tells when it is done.
+
+Every file is memory-mapped once, and a chunk is copied straight from the mapping, so
+thousands of boats downloading a new file cost no system calls. The \c max_files most
+recently used files stay mapped. Published files are not expected to change, but a file
+that is still growing is mapped again when a chunk beyond the mapped end is asked for, and
+\c size() maps a file again if it has been replaced or rewritten since.
+
+Must be used under the server lock.
+*/
+class PointsFileCache {
+    private:
+        /** File number and \c POINTSFILE_CODEC_XXX of a variant. */
+        typedef std::pair<int, int> FILE_KEY;
+
+        /** Mapped points file. */
+        typedef struct {
+            const unsigned char*    data;       ///< Mapping, 0 for an empty file
+            unsigned int            size;       ///< Size of mapping and file
+            dev_t                   dev;        ///< Device, inode and modification time of the mapped file,
+            ino_t                   ino;        ///< a file renamed over it or rewritten is mapped again
+            struct timespec         mtime;
+            std::list<FILE_KEY>::iterator lru;  ///< Position in \c lru_
+        } MAPPED_FILE;
+
+        std::string                 directory_;
+        unsigned int                max_files_;
+        std::map<FILE_KEY, MAPPED_FILE> files_;     ///< Mapped files by number and codec
+        std::list<FILE_KEY>         lru_;           ///< Mapped files, most recently used first
+        std::auto_ptr<PointsVariantWriter> writer_; ///< Writes the variants, 0 to write them right away
+        std::map<FILE_KEY, struct timespec> pending_;   ///< Variants queued to \c writer_, by modification time of the files they are made of
+        std::map<FILE_KEY, struct timespec> failed_;    ///< Variants that couldn't be written, not tried again until their files change
+        POINTS_FILE_CACHE_STATISTICS statistics_;
+
+        /** Returns the mapped file, mapping it if needed. Returns 0 if it can't be opened. */
+        const MAPPED_FILE*
+        find(
+            const int               file_no,
+            const int               codec,
+            const bool              remap);
+
+        /** Returns true if the variant of the points file is up to date with the files it is made of.
+            Otherwise queues it to be written and returns false, or writes it right away if there is
+            no \c writer_ and returns false if that fails.
+        */
+        bool
+        publish(
+            const int               file_no,
+            const int               codec);
+
+        /** Counts the variant written, or remembers that it failed with files of \c mtime. */
+        void
+        finish(
+            const POINTS_VARIANT_JOB&   job,
+            const struct timespec&      mtime);
+
+        /** Unmaps the file and forgets it. */
+        void
+        unmap(
+            std::map<FILE_KEY, MAPPED_FILE>::iterator   it);
+    public:
+        /**
+        \param[in] directory Directory of the points files
+        \param[in] max_files Keep this many files mapped
+        \param[in] writer Started thread writing the variants, 0 to write them on the calling thread. Takes ownership.
+        */
+        PointsFileCache(
+            const std::string&      directory,
+            const unsigned int      max_files,
+            PointsVariantWriter*    writer);
+
+        /** Unmaps all files, stops the writer thread. */
+        ~PointsFileCache();
+
+        /** Collects the variants written since the last call. Returns true if a variant of
+            the points file \c file_no was written, its size is known now.
+        */
+        bool
+        poll(
+            const int               file_no);
+
+        /** Path of the points file \c file_no, or of its variant. */
+        std::string
+        path(
+            const int               file_no,
+            const int               codec = POINTSFILE_CODEC_NONE) const;
+
+        /** Size of the points file or of its variant, -1 if it can't be opened or isn't written yet. */
+        int
+        size(
+            const int               file_no,
+            const int               codec = POINTSFILE_CODEC_NONE);
+
+        /** Copies a chunk into \c packet, including file number, chunk number and codec. The last chunk is padded
+        with zeros. Returns false if the file can't be opened or the chunk starts beyond its end.
+        */
+        bool
+        get_chunk(
+            const uint16_t              file_no,
+            const int                   codec,
+            const uint16_t              chunk_no,
+            PACKET_POINTSFILE_CHUNK&    packet);
+
+        /** Returns a snapshot of the statistics. */
+        POINTS_FILE_CACHE_STATISTICS
+        statistics() const;
+}; // class PointsFileCache
+
+#endif /* PointsFileCache_h_ */
@@ -0,0 +1,168 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>          // rename
+#include <zlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "DigNetMessages.h" // POINTSFILE_CODEC_XXX
+#include "PointsVariantWriter.h"
+#include "PointsDelta.h"
+
+using namespace std;
+
+/*****************************************************************************/
+static bool
+read_file(
+    const std::string&              filename,
+    std::vector<unsigned char>&     data)
+{
+    const int   fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    data.resize(st.st_size);
+    const bool  ok = data.empty() || read(fd, &data[0], data.size()) == static_cast<ssize_t>(data.size());
+    close(fd);
+    return ok;
+}
+
+/*****************************************************************************/
+/** Writes a temporary file and renames it, chunks are never served from a half-written file. */
+static bool
+write_file(
+    const std::string&                  filename,
+    const std::vector<unsigned char>&   data)
+{
+    const std::string   temporary(filename + ".tmp");
+    const int           fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const bool  ok = data.empty() || write(fd, &data[0], data.size()) == static_cast<ssize_t>(data.size());
+    close(fd);
+    if (!ok || rename(temporary.c_str(), filename.c_str()) != 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*****************************************************************************/
+PointsVariantWriter::PointsVariantWriter() :
+    run_(true)
+{
+    pthread_mutex_init(&queue_mutex_, 0);
+    pthread_cond_init(&queue_cond_, 0);
+}
+
+/*****************************************************************************/
+PointsVariantWriter::~PointsVariantWriter()
+{
+    pthread_mutex_lock(&queue_mutex_);
+    run_ = false;
+    pthread_cond_signal(&queue_cond_);
+    pthread_mutex_unlock(&queue_mutex_);
+    join();
+
+    pthread_cond_destroy(&queue_cond_);
+    pthread_mutex_destroy(&queue_mutex_);
+}
+
+/*****************************************************************************/
+void
+PointsVariantWriter::add(
+    const POINTS_VARIANT_JOB&   job)
+{
+    pthread_mutex_lock(&queue_mutex_);
+    queue_.push_back(job);
+    pthread_cond_signal(&queue_cond_);
+    pthread_mutex_unlock(&queue_mutex_);
+}
+
+/*****************************************************************************/
+bool
+PointsVariantWriter::pop(
+    POINTS_VARIANT_JOB&         job)
+{
+    pthread_mutex_lock(&queue_mutex_);
+    const bool  r = !done_.empty();
+    if (r) {
+        job = done_.front();
+        done_.pop_front();
+    }
+    pthread_mutex_unlock(&queue_mutex_);
+    return r;
+}
+
+/*****************************************************************************/
+bool
+PointsVariantWriter::write(
+    const POINTS_VARIANT_JOB&   job)
+{
+    std::vector<unsigned char>  target;
+    std::vector<unsigned char>  buffer;
+    if (!read_file(job.source, target)) {
+        return false;
+    }
+    if (job.codec == POINTSFILE_CODEC_ZLIB) {
+        uLongf  n = compressBound(target.size());
+        buffer.resize(n);
+        if (compress2(&buffer[0], &n, target.empty() ? 0 : &target[0], target.size(), Z_BEST_COMPRESSION) != Z_OK) {
+            return false;
+        }
+        buffer.resize(n);
+    } else if (job.codec == POINTSFILE_CODEC_DELTA) {
+        std::vector<unsigned char>  base;
+        if (!read_file(job.base, base)) {
+            return false;
+        }
+        make_points_delta(base.empty() ? 0 : &base[0], base.size(), target.empty() ? 0 : &target[0], target.size(), buffer);
+        if (buffer.empty()) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    return write_file(job.variant, buffer);
+}
+
+/*****************************************************************************/
+void
+PointsVariantWriter::setup()
+{
+}
+
+/*****************************************************************************/
+void
+PointsVariantWriter::execute()
+{
+    for (;;) {
+        pthread_mutex_lock(&queue_mutex_);
+        while (run_ && queue_.empty()) {
+            pthread_cond_wait(&queue_cond_, &queue_mutex_);
+        }
+        if (!run_) {
+            pthread_mutex_unlock(&queue_mutex_);
+            break;
+        }
+        POINTS_VARIANT_JOB  job = queue_.front();
+        queue_.pop_front();
+        pthread_mutex_unlock(&queue_mutex_);
+
+        job.ok = write(job);
+
+        pthread_mutex_lock(&queue_mutex_);
+        done_.push_back(job);
+        pthread_mutex_unlock(&queue_mutex_);
+    }
+}
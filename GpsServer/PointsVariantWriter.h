@@ -0,0 +1,66 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef PointsVariantWriter_h_
+#define PointsVariantWriter_h_
+
+#include <string>
+#include <deque>
+#include <pthread.h>
+
+#include "Thread.h"
+
+/** Variant of a points file to write. */
+typedef struct {
+    int             file_no;        ///< Number of the points file
+    int             codec;          ///< \c POINTSFILE_CODEC_XXX of the variant
+    std::string     source;         ///< Path of the points file
+    std::string     base;           ///< Path of the previous points file, for \c POINTSFILE_CODEC_DELTA
+    std::string     variant;        ///< Path of the variant
+    bool            ok;             ///< Variant was written, set when done
+} POINTS_VARIANT_JOB;
+
+/**
+Writes variants of the points files in a separate thread.
+
+Compressing a points file or making a delta takes far longer than the event loop may stall, so the event loop
+queues the variants with \c add() and collects the finished ones with \c pop().
+*/
+class PointsVariantWriter : public Thread {
+    private:
+        bool                            run_;           ///< Run thread while true
+        pthread_mutex_t                 queue_mutex_;   ///< Guards the queues
+        pthread_cond_t                  queue_cond_;    ///< Signalled on new job and on shutdown
+        std::deque<POINTS_VARIANT_JOB>  queue_;         ///< Variants waiting to be written
+        std::deque<POINTS_VARIANT_JOB>  done_;          ///< Variants written or failed, waiting for \c pop()
+    public:
+        /** Call \c create() to start writing. */
+        PointsVariantWriter();
+
+        /** Stops the thread after the variant being written, the rest are dropped. */
+        ~PointsVariantWriter();
+
+        /** Queues a variant to be written. */
+        void
+        add(
+            const POINTS_VARIANT_JOB&   job);
+
+        /** Takes the next finished variant. Returns false if there is none. */
+        bool
+        pop(
+            POINTS_VARIANT_JOB&         job);
+
+        /** Writes the variant, returns false if the points files can't be read or the variant
+            can't be written. Used by the thread, or directly if there is no thread.
+        */
+        static bool
+        write(
+            const POINTS_VARIANT_JOB&   job);
+    protected:
+        void
+        setup();
+
+        void
+        execute();
+}; // class PointsVariantWriter
+
+#endif /* PointsVariantWriter_h_ */
@@ -0,0 +1,376 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdexcept>
+#include <string>
+#include <algorithm>  // std::min, std::max
+
+#include <utils/util.h>     // ssprintf
+
+#include <math.h>           // floor, fmod
+#include <string.h>         // memcpy
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>       // mkdir
+#include <sys/time.h>       // gettimeofday
+
+#include "PositionStore.h"
+
+using namespace std;
+using namespace utils;
+
+/// Seconds in a segment.
+static const uint32_t   SEGMENT_DAY = 24 * 60 * 60;
+/// New segment has room for this many bytes of records.
+static const uint32_t   SEGMENT_INITIAL_SIZE = 64 * 1024;
+/// Segment grows at most this much at once.
+static const uint32_t   SEGMENT_MAX_GROWTH = 4 * 1024 * 1024;
+
+/*****************************************************************************/
+static int32_t
+fixed_of(
+    const double    value,
+    const double    scale)
+{
+    return static_cast<int32_t>(floor(value * scale + 0.5));
+}
+
+/*****************************************************************************/
+static bool
+make_directory(
+    const std::string&  path)
+{
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+/*****************************************************************************/
+std::string
+PositionStore::segment_path(
+    const std::string&  directory,
+    const int           ship_id,
+    const time_t        day_start)
+{
+    struct tm   tm;
+    gmtime_r(&day_start, &tm);
+    return ssprintf("%s/%04d-%02d-%02d/%d.pos", directory.c_str(), tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, ship_id);
+}
+
+/*****************************************************************************/
+PositionStore::PositionStore(
+    const std::string&  directory) :
+        directory_(directory)
+{
+    memset(&statistics_, 0, sizeof(statistics_));
+    if (!make_directory(directory_)) {
+        throw runtime_error(ssprintf("Can't create position directory %s, errno %d", directory_.c_str(), errno));
+    }
+}
+
+/*****************************************************************************/
+PositionStore::~PositionStore()
+{
+    for (std::map<int, SEGMENT>::iterator it = segments_.begin(); it != segments_.end(); ++it) {
+        close_segment(it->second);
+    }
+}
+
+/*****************************************************************************/
+bool
+PositionStore::open_segment(
+    const int           ship_id,
+    const uint32_t      day_start,
+    const double        x,
+    const double        y,
+    SEGMENT&            segment)
+{
+    const std::string   path(segment_path(directory_, ship_id, day_start));
+    if (!make_directory(path.substr(0, path.rfind('/')))) {
+        return false;
+    }
+    segment.fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (segment.fd < 0) {
+        return false;
+    }
+    segment.data = 0;
+    segment.day_start = day_start;
+
+    // Server restarted during the day: continue the segment.
+    struct stat st;
+    POSITION_SEGMENT_HEADER header;
+    bool        resume = false;
+    if (fstat(segment.fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(header))
+        && pread(segment.fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header))) {
+        resume = memcmp(header.magic, POSITION_SEGMENT_MAGIC, sizeof(header.magic)) == 0
+            && header.version == POSITION_SEGMENT_VERSION
+            && header.header_size == sizeof(POSITION_SEGMENT_HEADER)
+            && header.record_size == sizeof(POSITION_RECORD)
+            && header.ship_id == ship_id
+            && header.day_start == day_start;
+        if (resume) {
+            // Records beyond the end of file are lost.
+            const uint32_t  stored = (st.st_size - header.header_size) / header.record_size;
+            if (header.count > stored) {
+                header.count = stored;
+            }
+        }
+    }
+    if (!resume) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, POSITION_SEGMENT_MAGIC, sizeof(header.magic));
+        header.version = POSITION_SEGMENT_VERSION;
+        header.header_size = sizeof(POSITION_SEGMENT_HEADER);
+        header.record_size = sizeof(POSITION_RECORD);
+        header.ship_id = ship_id;
+        header.day_start = day_start;
+        header.origin_x = floor(x);
+        header.origin_y = floor(y);
+        header.count = 0;
+    }
+
+    const uint32_t  used = header.header_size + header.count * header.record_size;
+    segment.size = used + SEGMENT_INITIAL_SIZE;
+    // Blocks are allocated now, a sparse file would raise SIGBUS on append when the disk is full.
+    if (posix_fallocate(segment.fd, 0, segment.size) != 0) {
+        close(segment.fd);
+        return false;
+    }
+    void* data = mmap(0, segment.size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+    if (data == MAP_FAILED) {
+        close(segment.fd);
+        return false;
+    }
+    segment.data = reinterpret_cast<unsigned char*>(data);
+    memcpy(segment.data, &header, sizeof(header));
+    ++statistics_.segments_opened;
+    return true;
+}
+
+/*****************************************************************************/
+bool
+PositionStore::grow_segment(
+    SEGMENT&            segment)
+{
+    const POSITION_SEGMENT_HEADER*  header = reinterpret_cast<const POSITION_SEGMENT_HEADER*>(segment.data);
+    const uint32_t  used = header->header_size + header->count * header->record_size;
+    if (used + sizeof(POSITION_RECORD) <= segment.size) {
+        return true;
+    }
+    const uint32_t  size = segment.size + std::min(segment.size, SEGMENT_MAX_GROWTH);
+    if (posix_fallocate(segment.fd, segment.size, size - segment.size) != 0) {
+        return false;
+    }
+    void* data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    munmap(segment.data, segment.size);
+    segment.data = reinterpret_cast<unsigned char*>(data);
+    segment.size = size;
+    return true;
+}
+
+/*****************************************************************************/
+void
+PositionStore::close_segment(
+    SEGMENT&            segment)
+{
+    const POSITION_SEGMENT_HEADER*  header = reinterpret_cast<const POSITION_SEGMENT_HEADER*>(segment.data);
+    const uint32_t  used = header->header_size + header->count * header->record_size;
+    munmap(segment.data, segment.size);
+    // Unused tail is of no interest.
+    if (ftruncate(segment.fd, used) != 0) {
+        // pass
+    }
+    close(segment.fd);
+    segment.fd = -1;
+    segment.data = 0;
+    segment.size = 0;
+}
+
+/*****************************************************************************/
+bool
+PositionStore::append(
+    const SHIP_POSITION_ROW&    row)
+{
+    // Time of the row, like Create_Time of ShipPosition. Milliseconds are known only if it is of this second.
+    struct timeval  now;
+    gettimeofday(&now, 0);
+    const time_t    t = row.create_time;
+    const uint32_t  ms = t == now.tv_sec ? now.tv_usec / 1000 : 0;
+    const uint32_t  day_start = t - t % SEGMENT_DAY;
+
+    // 1. Segment of the ship for today.
+    std::map<int, SEGMENT>::iterator it = segments_.find(row.ship_id);
+    if (it != segments_.end() && it->second.day_start != day_start) {
+        close_segment(it->second);
+        segments_.erase(it);
+        it = segments_.end();
+    }
+    if (it == segments_.end()) {
+        SEGMENT segment;
+        if (!open_segment(row.ship_id, day_start, row.x, row.y, segment)) {
+            ++statistics_.failed;
+            return false;
+        }
+        it = segments_.insert(std::make_pair(row.ship_id, segment)).first;
+    }
+    SEGMENT&    segment = it->second;
+    if (!grow_segment(segment)) {
+        ++statistics_.failed;
+        return false;
+    }
+
+    // 2. Record.
+    POSITION_SEGMENT_HEADER*    header = reinterpret_cast<POSITION_SEGMENT_HEADER*>(segment.data);
+    POSITION_RECORD             record;
+    memset(&record, 0, sizeof(record));
+    record.time_ms = (t - day_start) * 1000 + ms;
+    record.x = fixed_of(row.x - header->origin_x, 100.0);
+    record.y = fixed_of(row.y - header->origin_y, 100.0);
+    record.type = row.type;
+    if (row.has_z) {
+        record.z = fixed_of(row.z, 1000.0);
+        record.flags |= POSITION_HAS_Z;
+    }
+    if (row.has_heading) {
+        double  heading = fmod(row.heading, 360.0);
+        if (heading < 0) {
+            heading += 360.0;
+        }
+        record.heading = fixed_of(heading, 100.0) % 36000;
+        record.flags |= POSITION_HAS_HEADING;
+    }
+    if (row.has_speed) {
+        record.speed = std::min(0xFFFF, std::max(0, fixed_of(row.speed, 100.0)));
+        record.flags |= POSITION_HAS_SPEED;
+    }
+    if (row.has_gps_status) {
+        record.gps_status = row.gps_status;
+        record.flags |= POSITION_HAS_GPS_STATUS;
+    }
+    memcpy(segment.data + header->header_size + header->count * header->record_size, &record, sizeof(record));
+    ++header->count;
+    ++statistics_.records;
+    return true;
+}
+
+/*****************************************************************************/
+void
+PositionStore::flush()
+{
+    const time_t    now = time(0);
+    const uint32_t  day_start = now - now % SEGMENT_DAY;
+    std::map<int, SEGMENT>::iterator it = segments_.begin();
+    while (it != segments_.end()) {
+        if (it->second.day_start != day_start) {
+            close_segment(it->second);
+            segments_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/*****************************************************************************/
+POSITION_STORE_STATISTICS
+PositionStore::statistics() const
+{
+    POSITION_STORE_STATISTICS   r = statistics_;
+    r.segments = segments_.size();
+    return r;
+}
+
+/*****************************************************************************/
+PositionSegmentReader::PositionSegmentReader(
+    const std::string&  path) :
+        path_(path),
+        fd_(-1),
+        data_(0),
+        size_(0),
+        header_(0),
+        records_(0),
+        count_(0)
+{
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        throw runtime_error(ssprintf("Can't open position segment %s, errno %d", path.c_str(), errno));
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(POSITION_SEGMENT_HEADER))) {
+        close(fd_);
+        throw runtime_error(ssprintf("%s is not a position segment", path.c_str()));
+    }
+    size_ = st.st_size;
+    void* data = mmap(0, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) {
+        close(fd_);
+        throw runtime_error(ssprintf("Can't map position segment %s, errno %d", path.c_str(), errno));
+    }
+    data_ = reinterpret_cast<const unsigned char*>(data);
+    header_ = reinterpret_cast<const POSITION_SEGMENT_HEADER*>(data_);
+    if (memcmp(header_->magic, POSITION_SEGMENT_MAGIC, sizeof(header_->magic)) != 0
+        || header_->version != POSITION_SEGMENT_VERSION
+        || header_->header_size < sizeof(POSITION_SEGMENT_HEADER) || header_->header_size > size_
+        || header_->record_size != sizeof(POSITION_RECORD)) {
+        munmap(const_cast<unsigned char*>(data_), size_);
+        close(fd_);
+        throw runtime_error(ssprintf("%s is not a position segment of version %d", path.c_str(), POSITION_SEGMENT_VERSION));
+    }
+    records_ = reinterpret_cast<const POSITION_RECORD*>(data_ + header_->header_size);
+    count_ = std::min<unsigned int>(static_cast<unsigned int>(header_->count), (size_ - header_->header_size) / header_->record_size);
+}
+
+/*****************************************************************************/
+PositionSegmentReader::~PositionSegmentReader()
+{
+    munmap(const_cast<unsigned char*>(data_), size_);
+    close(fd_);
+}
+
+/*****************************************************************************/
+unsigned int
+PositionSegmentReader::find(
+    const double        t) const
+{
+    // Records are in time order, search the first one not before t.
+    const double    offset_ms = (t - header_->day_start) * 1000.0;
+    unsigned int    low = 0;
+    unsigned int    high = count_;
+    while (low < high) {
+        const unsigned int  middle = low + (high - low) / 2;
+        if (records_[middle].time_ms < offset_ms) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/*****************************************************************************/
+double
+PositionSegmentReader::get(
+    const unsigned int  index,
+    SHIP_POSITION_ROW&  row) const
+{
+    const POSITION_RECORD&  record = records_[index];
+    const double            t = header_->day_start + record.time_ms / 1000.0;
+    memset(&row, 0, sizeof(row));
+    row.create_time = static_cast<time_t>(t);
+    row.ship_id = header_->ship_id;
+    row.type = record.type;
+    row.x = header_->origin_x + record.x / 100.0;
+    row.y = header_->origin_y + record.y / 100.0;
+    row.z = record.z / 1000.0;
+    row.heading = record.heading / 100.0;
+    row.speed = record.speed / 100.0;
+    row.gps_status = record.gps_status;
+    row.has_z = (record.flags & POSITION_HAS_Z) != 0;
+    row.has_heading = (record.flags & POSITION_HAS_HEADING) != 0;
+    row.has_speed = (record.flags & POSITION_HAS_SPEED) != 0;
+    row.has_gps_status = (record.flags & POSITION_HAS_GPS_STATUS) != 0;
+    return t;
+}
@@ -0,0 +1,178 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef PositionStore_h_
+#define PositionStore_h_
+
+#include <string>
+#include <map>
+#include <stdint.h>
+#include <time.h>       // time_t
+
+#include "DigNetDBWriter.h" // SHIP_POSITION_ROW
+
+/// First bytes of a position segment file.
+#define POSITION_SEGMENT_MAGIC      "DNPOSSG1"
+
+/// Version of the position segment file format.
+#define POSITION_SEGMENT_VERSION    1
+
+/** Header at the start of every position segment file. */
+typedef struct {
+    char                magic[8];       ///< \c POSITION_SEGMENT_MAGIC, not 0-terminated
+    uint32_t            version;        ///< \c POSITION_SEGMENT_VERSION
+    uint32_t            header_size;    ///< Records start at this offset
+    uint32_t            record_size;    ///< sizeof(POSITION_RECORD)
+    int32_t             ship_id;
+    uint32_t            day_start;      ///< Start of the UTC day of the segment, seconds since 1970
+    uint32_t            reserved;
+    double              origin_x;       ///< Coordinates of the records are relative to this point, meters
+    double              origin_y;
+    volatile uint32_t   count;          ///< Number of records, updated after every record
+    uint32_t            reserved2;
+} POSITION_SEGMENT_HEADER;
+
+/** Fields present in \c POSITION_RECORD, bitfield. */
+typedef enum {
+    POSITION_HAS_Z          = 01,
+    POSITION_HAS_HEADING    = 02,
+    POSITION_HAS_SPEED      = 04,
+    POSITION_HAS_GPS_STATUS = 010
+} POSITION_FLAGS;
+
+/** One position fix, delta encoded against the segment header. */
+typedef struct {
+    uint32_t            time_ms;        ///< Milliseconds since \c day_start
+    int32_t             x;              ///< Centimeters from \c origin_x
+    int32_t             y;              ///< Centimeters from \c origin_y
+    int32_t             z;              ///< Millimeters, valid if \c POSITION_HAS_Z
+    uint16_t            heading;        ///< Hundredths of degree, valid if \c POSITION_HAS_HEADING
+    uint16_t            speed;          ///< Hundredths of km/h, valid if \c POSITION_HAS_SPEED
+    char                type;           ///< Position type: 'M', 'V', '1' or '2'
+    uint8_t             gps_status;     ///< Valid if \c POSITION_HAS_GPS_STATUS
+    uint8_t             flags;          ///< \c POSITION_FLAGS bitfield
+    uint8_t             reserved;
+} POSITION_RECORD;
+
+/** Snapshot of the position store statistics. */
+typedef struct {
+    uint64_t            records;        ///< Total records stored
+    uint64_t            failed;         ///< Records lost because a segment couldn't be opened or grown
+    unsigned int        segments;       ///< Segments open now
+    uint64_t            segments_opened;///< Total segments opened
+} POSITION_STORE_STATISTICS;
+
+/**
+Append-only history of ship positions, replaces ShipPosition table.
+
+Every ship has a segment file per UTC day, \c directory/YYYY-MM-DD/SHIP.pos, of fixed size
+records. The file is memory-mapped, so appending a record costs a \c memcpy and the data
+survives a crash of the server. Files grow in steps with their blocks allocated up front, and
+are truncated to their records when closed. Segments of the previous days are closed by \c flush().
+
+Must be used only from the thread that owns the database.
+*/
+class PositionStore {
+    private:
+        /** Mapped segment file. */
+        typedef struct {
+            int             fd;
+            unsigned char*  data;           ///< Mapping
+            uint32_t        size;           ///< Size of mapping and file
+            uint32_t        day_start;
+        } SEGMENT;
+
+        std::string                 directory_;
+        std::map<int, SEGMENT>      segments_;      ///< Open segments by ship ID
+        POSITION_STORE_STATISTICS   statistics_;
+
+        /** Opens segment of the ship for the day, appending to an existing one. Returns false on errors,
+            a full disk among them.
+        */
+        bool
+        open_segment(
+            const int               ship_id,
+            const uint32_t          day_start,
+            const double            x,
+            const double            y,
+            SEGMENT&                segment);
+
+        /** Makes room for at least one more record. Returns false on errors, a full disk among them. */
+        bool
+        grow_segment(
+            SEGMENT&                segment);
+
+        /** Unmaps the file and truncates it to the records. */
+        void
+        close_segment(
+            SEGMENT&                segment);
+    public:
+        /** Creates the directory if needed. Throws \c std::runtime_error if it can't be created. */
+        PositionStore(
+            const std::string&      directory);
+
+        /** Closes all segments. */
+        ~PositionStore();
+
+        /** Appends a position to the segment of the day of \c row.create_time. Returns false if it was lost. */
+        bool
+        append(
+            const SHIP_POSITION_ROW& row);
+
+        /** Closes the segments of the previous days. Call about once per second. */
+        void
+        flush();
+
+        /** Returns a snapshot of the statistics. */
+        POSITION_STORE_STATISTICS
+        statistics() const;
+
+        /** Path of the segment file of the ship for the UTC day starting at \c day_start. */
+        static std::string
+        segment_path(
+            const std::string&      directory,
+            const int               ship_id,
+            const time_t            day_start);
+}; // class PositionStore
+
+/**
+Reads a position segment file written by \c PositionStore.
+
+The file is mapped read-only; a segment that is still being written is read up to its last
+complete record.
+*/
+class PositionSegmentReader {
+    private:
+        std::string                     path_;
+        int                             fd_;
+        const unsigned char*            data_;      ///< Mapping of the whole file
+        unsigned int                    size_;
+        const POSITION_SEGMENT_HEADER*  header_;
+        const POSITION_RECORD*          records_;
+        unsigned int                    count_;
+    public:
+        /** Opens and maps the file. Throws \c std::runtime_error on errors. */
+        PositionSegmentReader(
+            const std::string&      path);
+
+        ~PositionSegmentReader();
+
+        int
+        ship_id() const { return header_->ship_id; }
+
+        /** Number of records. */
+        unsigned int
+        size() const { return count_; }
+
+        /** Index of the first record at or after \c t, \c size() if none. */
+        unsigned int
+        find(
+            const double            t) const;
+
+        /** Decodes record \c index. Returns its time, seconds since 1970, with milliseconds. */
+        double
+        get(
+            const unsigned int      index,
+            SHIP_POSITION_ROW&      row) const;
+}; // class PositionSegmentReader
+
+#endif /* PositionStore_h_ */
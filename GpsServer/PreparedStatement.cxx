@@ -0,0 +1,165 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <utils/util.h>
+
+#include <mysql.h>
+#include <string.h>
+
+#include "PreparedStatement.h"
+
+using namespace std;
+using namespace utils;
+
+// MySQL 8.0 replaced my_bool with bool, MariaDB still has my_bool.
+#if MYSQL_VERSION_ID >= 80000 && !defined(MARIADB_BASE_VERSION) && !defined(MARIADB_VERSION_ID)
+typedef bool        mysql_bool;
+#else
+typedef my_bool     mysql_bool;
+#endif
+
+/*****************************************************************************/
+static MYSQL_BIND&
+bind_at(
+        void*               binds,
+        const unsigned int  index)
+{
+    return reinterpret_cast<MYSQL_BIND*>(binds)[index];
+}
+
+/*****************************************************************************/
+PreparedStatement::PreparedStatement(
+        void*               mysql,
+        const std::string&  query
+) :
+        stmt_(0),
+        query_(query),
+        binds_(0)
+{
+    MYSQL_STMT* stmt = mysql_stmt_init(reinterpret_cast<MYSQL*>(mysql));
+    if (stmt == 0) {
+        throw runtime_error(ssprintf("PreparedStatement: out of memory preparing \"%s\"", query.c_str()));
+    }
+    if (mysql_stmt_prepare(stmt, query.c_str(), query.size()) != 0) {
+        const string s(ssprintf("PreparedStatement: can't prepare \"%s\": %s", query.c_str(), mysql_stmt_error(stmt)));
+        mysql_stmt_close(stmt);
+        throw runtime_error(s);
+    }
+    stmt_ = stmt;
+
+    const unsigned int  n = mysql_stmt_param_count(stmt);
+    params_.resize(n);
+    MYSQL_BIND* binds = new MYSQL_BIND[n > 0 ? n : 1];
+    memset(binds, 0, (n > 0 ? n : 1) * sizeof(MYSQL_BIND));
+    binds_ = binds;
+    for (unsigned int i = 0; i < n; ++i) {
+        bindNull(i);
+    }
+}
+
+/*****************************************************************************/
+PreparedStatement::~PreparedStatement()
+{
+    if (stmt_ != 0) {
+        mysql_stmt_close(reinterpret_cast<MYSQL_STMT*>(stmt_));
+        stmt_ = 0;
+    }
+    delete[] reinterpret_cast<MYSQL_BIND*>(binds_);
+    binds_ = 0;
+}
+
+/*****************************************************************************/
+unsigned int
+PreparedStatement::paramCount() const
+{
+    return params_.size();
+}
+
+/*****************************************************************************/
+void
+PreparedStatement::bindInt(
+        const unsigned int  index,
+        const long long     value)
+{
+    PARAM&      p = params_.at(index);
+    MYSQL_BIND& b = bind_at(binds_, index);
+    p.int_value = value;
+    p.is_null = 0;
+    b.buffer_type = MYSQL_TYPE_LONGLONG;
+    b.buffer = &p.int_value;
+    b.is_null = reinterpret_cast<mysql_bool*>(&p.is_null);
+    b.length = 0;
+}
+
+/*****************************************************************************/
+void
+PreparedStatement::bindDouble(
+        const unsigned int  index,
+        const double        value)
+{
+    PARAM&      p = params_.at(index);
+    MYSQL_BIND& b = bind_at(binds_, index);
+    p.double_value = value;
+    p.is_null = 0;
+    b.buffer_type = MYSQL_TYPE_DOUBLE;
+    b.buffer = &p.double_value;
+    b.is_null = reinterpret_cast<mysql_bool*>(&p.is_null);
+    b.length = 0;
+}
+
+/*****************************************************************************/
+void
+PreparedStatement::bindString(
+        const unsigned int  index,
+        const std::string&  value)
+{
+    PARAM&      p = params_.at(index);
+    MYSQL_BIND& b = bind_at(binds_, index);
+    p.string_value = value;
+    p.length = p.string_value.size();
+    p.is_null = 0;
+    b.buffer_type = MYSQL_TYPE_STRING;
+    b.buffer = const_cast<char*>(p.string_value.data());
+    b.buffer_length = p.length;
+    b.is_null = reinterpret_cast<mysql_bool*>(&p.is_null);
+    b.length = &p.length;
+}
+
+/*****************************************************************************/
+void
+PreparedStatement::bindNull(
+        const unsigned int  index)
+{
+    PARAM&      p = params_.at(index);
+    MYSQL_BIND& b = bind_at(binds_, index);
+    p.is_null = 1;
+    b.buffer_type = MYSQL_TYPE_NULL;
+    b.buffer = 0;
+    b.is_null = reinterpret_cast<mysql_bool*>(&p.is_null);
+    b.length = 0;
+}
+
+/*****************************************************************************/
+unsigned long long
+PreparedStatement::execute()
+{
+    MYSQL_STMT* stmt = reinterpret_cast<MYSQL_STMT*>(stmt_);
+    if (params_.size() > 0 && mysql_stmt_bind_param(stmt, reinterpret_cast<MYSQL_BIND*>(binds_)) != 0) {
+        throw runtime_error(ssprintf("PreparedStatement: can't bind \"%s\": %s", query_.c_str(), mysql_stmt_error(stmt)));
+    }
+    if (mysql_stmt_execute(stmt) != 0) {
+        throw runtime_error(ssprintf("PreparedStatement: can't execute \"%s\": %s", query_.c_str(), mysql_stmt_error(stmt)));
+    }
+    return mysql_stmt_affected_rows(stmt);
+}
+
+/*****************************************************************************/
+unsigned long long
+PreparedStatement::insertId()
+{
+    return mysql_stmt_insert_id(reinterpret_cast<MYSQL_STMT*>(stmt_));
+}
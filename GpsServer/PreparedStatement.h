@@ -0,0 +1,81 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef PreparedStatement_h_
+#define PreparedStatement_h_
+
+#include <string>
+#include <vector>
+
+/**
+MySQL prepared statement with binary parameters.
+
+Statement is parsed by the server once, in constructor. Parameters are set with \c bind* functions
+by their index, starting from 0, and stay set until changed. Throws \c std::runtime_error on errors.
+
+Must be used only from the thread that owns the connection.
+*/
+class PreparedStatement {
+    private:
+        /** Storage for one parameter value. */
+        typedef struct {
+            long long       int_value;
+            double          double_value;
+            std::string     string_value;
+            unsigned long   length;
+            char            is_null;
+        } PARAM;
+
+        void*               stmt_;          ///< MYSQL_STMT
+        std::string         query_;         ///< Query text, for error messages
+        std::vector<PARAM>  params_;        ///< Parameter values
+        void*               binds_;         ///< MYSQL_BIND array, one per parameter
+    public:
+        /** Prepares given query on the connection.
+        \param[in] mysql MySql connection (MYSQL*).
+        \param[in] query SQL with ? for parameters.
+        */
+        PreparedStatement(
+            void*               mysql,
+            const std::string&  query);
+
+        ~PreparedStatement();
+
+        /** Number of parameters in the statement. */
+        unsigned int
+        paramCount() const;
+
+        void
+        bindInt(
+            const unsigned int  index,
+            const long long     value);
+
+        void
+        bindDouble(
+            const unsigned int  index,
+            const double        value);
+
+        void
+        bindString(
+            const unsigned int  index,
+            const std::string&  value);
+
+        void
+        bindNull(
+            const unsigned int  index);
+
+        /** Executes the statement with the current parameters.
+        \return Number of affected rows.
+        */
+        unsigned long long
+        execute();
+
+        /** ID of the row inserted by last \c execute. */
+        unsigned long long
+        insertId();
+    private:
+        /** Not copyable. */
+        PreparedStatement(const PreparedStatement&);
+        PreparedStatement& operator=(const PreparedStatement&);
+};
+
+#endif /* PreparedStatement_h_ */
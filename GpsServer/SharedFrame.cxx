@@ -0,0 +1,96 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <event.h>      // libevent.
+
+#include <utils/CMR.h>
+
+#include "SharedFrame.h"
+
+using namespace utils;
+
+#if defined(LIBEVENT_VERSION_NUMBER) && (LIBEVENT_VERSION_NUMBER >= 0x02000000)
+#define SHAREDFRAME_ADD_REFERENCE
+#endif
+
+/*****************************************************************************/
+SharedFrame::SharedFrame() :
+    refs_(1)
+{
+}
+
+/*****************************************************************************/
+SharedFrame::~SharedFrame()
+{
+}
+
+/*****************************************************************************/
+SharedFrame*
+SharedFrame::encode(
+    const void*     data,
+    const int       size,
+    const int       type,
+    const int       max_size)
+{
+    SharedFrame*    frame = new SharedFrame;
+    if (max_size <= 0) {
+        CMR::encode(frame->data_, type, data, size);
+    } else {
+        const char* ptr = reinterpret_cast<const char*>(data);
+        int         todo = size;
+        while (todo > 0) {
+            const int this_round = todo > max_size ? max_size : todo;
+            CMR::encode(frame->data_, type, ptr, this_round);
+            ptr += this_round;
+            todo -= this_round;
+        }
+    }
+    return frame;
+}
+
+/*****************************************************************************/
+SharedFrame*
+SharedFrame::wrap(
+    std::vector<unsigned char>& data)
+{
+    SharedFrame*    frame = new SharedFrame;
+    frame->data_.swap(data);
+    return frame;
+}
+
+/*****************************************************************************/
+void
+SharedFrame::write(
+    struct bufferevent* event)
+{
+    if (data_.size() == 0) {
+        return;
+    }
+#if defined(SHAREDFRAME_ADD_REFERENCE)
+    retain();
+    if (evbuffer_add_reference(bufferevent_get_output(event), &data_[0], data_.size(), cleanup, this) != 0) {
+        release();
+    }
+#else
+    bufferevent_write(event, &data_[0], data_.size());
+#endif
+}
+
+/*****************************************************************************/
+void
+SharedFrame::cleanup(
+    const void*     data,
+    size_t          size,
+    void*           _self)
+{
+    reinterpret_cast<SharedFrame*>(_self)->release();
+}
+
+/*****************************************************************************/
+void
+SharedFrame::release()
+{
+    if (__sync_sub_and_fetch(&refs_, 1) == 0) {
+        delete this;
+    }
+}
@@ -0,0 +1,71 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef SharedFrame_h_
+#define SharedFrame_h_
+
+#include <vector>
+
+struct bufferevent;
+
+/**
+Encoded frame shared by all recipients of a broadcast.
+
+The frame is encoded once and reference counted. With libevent 2 it is attached to
+every recipient's output buffer with \c evbuffer_add_reference, without copying; with
+older libevent it is copied into the output buffers, but still encoded only once.
+
+Created with reference count 1, call \c release when done with it. The reference
+count is atomic, frames may be shared by clients of different worker threads.
+*/
+class SharedFrame {
+    private:
+        std::vector<unsigned char>  data_;      ///< Encoded frame(s).
+        volatile unsigned int       refs_;      ///< Reference count, updated atomically.
+
+        SharedFrame();
+        ~SharedFrame();
+
+        /** Not copyable. */
+        SharedFrame(const SharedFrame&);
+        SharedFrame& operator=(const SharedFrame&);
+
+        /** evbuffer_add_reference cleanup callback. */
+        static void
+        cleanup(
+            const void*     data,
+            size_t          size,
+            void*           _self);
+    public:
+        /** Encodes \c size bytes of \c data as CMR packets of given type.
+        \param[in] max_size Split into packets of at most this many bytes, 0 for no splitting.
+        */
+        static SharedFrame*
+        encode(
+            const void*     data,
+            const int       size,
+            const int       type,
+            const int       max_size = 0);
+
+        /** Takes over already encoded frame, \c data is left empty. */
+        static SharedFrame*
+        wrap(
+            std::vector<unsigned char>& data);
+
+        /** Queues the frame to the output of given bufferevent. */
+        void
+        write(
+            struct bufferevent* event);
+
+        /** Adds one reference. */
+        SharedFrame*
+        retain() { __sync_add_and_fetch(&refs_, 1); return this; }
+
+        /** Drops one reference, deletes the frame when there are none left. */
+        void
+        release();
+
+        unsigned int
+        size() const { return data_.size(); }
+}; // class SharedFrame
+
+#endif /* SharedFrame_h_ */
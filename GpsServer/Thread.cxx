@@ -5,6 +5,7 @@
 Thread::Thread()
 {
     status_ = CREATED;
+    started_ = false;
 }
 
 
@@ -18,7 +19,21 @@ Thread::~Thread()
 int 
 Thread::create()
 {
-    return pthread_create(&threadId_, 0, &Thread::entryPoint, this);
+    const int r = pthread_create(&threadId_, 0, &Thread::entryPoint, this);
+    started_ = r == 0;
+    return r;
+}
+
+
+/*****************************************************************************/
+int
+Thread::join()
+{
+    if (!started_) {
+        return 0;
+    }
+    started_ = false;
+    return pthread_join(threadId_, 0);
 }
 
 
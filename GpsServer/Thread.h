@@ -18,6 +18,10 @@ public:
     int 
     create();
 
+    /** Waits until the thread has finished running. Returns the \c pthread_join result, 0 if \c create() hasn't succeeded. */
+    int
+    join();
+
     virtual 
     ~Thread();
 
@@ -51,6 +55,9 @@ private:
 
     /** Thread status */
     Status status_;
+
+    /** True once \c create() has succeeded, nothing to join otherwise */
+    bool started_;
 };
 
 #endif
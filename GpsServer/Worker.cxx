@@ -0,0 +1,293 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <stdexcept>
+
+#include <unistd.h>         // pipe, read, write
+#include <fcntl.h>          // fcntl
+#include <string.h>         // memset
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifndef WITHOUT_MYSQL
+#include <mysql.h>          // mysql_thread_init
+#endif
+
+#include <utils/util.h>     // ssprintf
+
+#include "GpsServer.h"
+#include "Worker.h"
+
+using namespace utils;
+
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT    15
+#endif
+
+__thread Worker* Worker::current_ = 0;
+
+/*****************************************************************************/
+static void
+set_nonblocking(
+    int     fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+/*****************************************************************************/
+Worker::Worker(
+    GpsServer*          server,
+    const unsigned int  index) :
+        server_(server),
+        index_(index),
+        base_(event_base_new()),
+        own_base_(true),
+        listening_socket_(-1),
+        wake_pending_(0),
+        head_(&stub_),
+        tail_(&stub_)
+{
+    if (base_ == 0) {
+        throw std::runtime_error(ssprintf("Worker %d: event_base_new failed", index));
+    }
+    stub_.next = 0;
+    if (pipe(wake_pipe_) != 0) {
+        throw std::runtime_error(ssprintf("Worker %d: pipe failed, errno %d", index, errno));
+    }
+    set_nonblocking(wake_pipe_[0]);
+    set_nonblocking(wake_pipe_[1]);
+    event_set(&wake_event_, wake_pipe_[0], EV_READ | EV_PERSIST, wake_handler, this);
+    event_base_set(base_, &wake_event_);
+    event_add(&wake_event_, 0);
+}
+
+/*****************************************************************************/
+Worker::Worker(
+    GpsServer*          server,
+    struct event_base*  base) :
+        server_(server),
+        index_(0),
+        base_(base),
+        own_base_(false),
+        listening_socket_(-1),
+        wake_pending_(0),
+        head_(&stub_),
+        tail_(&stub_)
+{
+    stub_.next = 0;
+    if (pipe(wake_pipe_) != 0) {
+        throw std::runtime_error(ssprintf("Worker 0: pipe failed, errno %d", errno));
+    }
+    set_nonblocking(wake_pipe_[0]);
+    set_nonblocking(wake_pipe_[1]);
+    event_set(&wake_event_, wake_pipe_[0], EV_READ | EV_PERSIST, wake_handler, this);
+    event_base_set(base_, &wake_event_);
+    event_add(&wake_event_, 0);
+    current_ = this;
+}
+
+/*****************************************************************************/
+Worker::~Worker()
+{
+    event_del(&wake_event_);
+    if (listening_socket_ >= 0) {
+        event_del(&listening_event_);
+        ::close(listening_socket_);
+    }
+    // Drop whatever was not delivered.
+    WORKER_ITEM*    item;
+    while ((item = pop()) != 0) {
+        if (item->frame != 0) {
+            item->frame->release();
+        }
+        delete item;
+    }
+    ::close(wake_pipe_[0]);
+    ::close(wake_pipe_[1]);
+    if (own_base_) {
+        event_base_free(base_);
+    }
+}
+
+/*****************************************************************************/
+void
+Worker::listen(
+    const int           port)
+{
+    const int   sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sd < 0) {
+        throw std::runtime_error(ssprintf("Worker %d: socket failed, errno %d", index_, errno));
+    }
+    int         on = 1;
+    setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    // Every worker has its own socket on the same port, kernel spreads the connections.
+    if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+        ::close(sd);
+        throw std::runtime_error(ssprintf("Worker %d: SO_REUSEPORT not supported, errno %d", index_, errno));
+    }
+    struct sockaddr_in  addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(sd, 64) != 0) {
+        ::close(sd);
+        throw std::runtime_error(ssprintf("Worker %d: can't listen on port %d, errno %d", index_, port, errno));
+    }
+    set_nonblocking(sd);
+    listening_socket_ = sd;
+    event_set(&listening_event_, listening_socket_, EV_READ | EV_PERSIST, accept_handler, this);
+    event_base_set(base_, &listening_event_);
+    event_add(&listening_event_, 0);
+}
+
+/*****************************************************************************/
+void
+Worker::push(
+    WORKER_ITEM*        item)
+{
+    item->next = 0;
+    __sync_synchronize();
+    WORKER_ITEM*    prev = __sync_lock_test_and_set(&head_, item);
+    prev->next = item;
+}
+
+/*****************************************************************************/
+Worker::WORKER_ITEM*
+Worker::pop()
+{
+    WORKER_ITEM*    tail = tail_;
+    WORKER_ITEM*    next = tail->next;
+    if (tail == &stub_) {
+        if (next == 0) {
+            return 0;
+        }
+        tail_ = next;
+        tail = next;
+        next = next->next;
+    }
+    if (next != 0) {
+        tail_ = next;
+        return tail;
+    }
+    if (tail != head_) {
+        // Producer is half way through push, it will wake us up again.
+        return 0;
+    }
+    push(&stub_);
+    next = tail->next;
+    if (next != 0) {
+        tail_ = next;
+        return tail;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+void
+Worker::send(
+    TCP_CLIENT*             client,
+    SharedFrame*            frame,
+    const WORKER_DELIVERY   delivery,
+    const int               type,
+    const int               source)
+{
+    WORKER_ITEM*    item = new WORKER_ITEM;
+    item->client = client;
+    item->frame = frame->retain();
+    item->delivery = delivery;
+    item->type = type;
+    item->source = source;
+    item->reason = 0;
+    push(item);
+    if (__sync_bool_compare_and_swap(&wake_pending_, 0, 1)) {
+        const char  c = 0;
+        (void)write(wake_pipe_[1], &c, 1);
+    }
+}
+
+/*****************************************************************************/
+void
+Worker::close(
+    TCP_CLIENT*         client,
+    const char*         reason)
+{
+    WORKER_ITEM*    item = new WORKER_ITEM;
+    item->client = client;
+    item->frame = 0;
+    item->delivery = WORKER_SEND;
+    item->type = 0;
+    item->source = 0;
+    item->reason = reason;
+    push(item);
+    if (__sync_bool_compare_and_swap(&wake_pending_, 0, 1)) {
+        const char  c = 0;
+        (void)write(wake_pipe_[1], &c, 1);
+    }
+}
+
+/*****************************************************************************/
+void
+Worker::drain()
+{
+    WORKER_ITEM*    item;
+    while ((item = pop()) != 0) {
+        if (item->frame != 0) {
+            server_->deliver_frame(item->client, item->frame, item->delivery, item->type, item->source);
+            item->frame->release();
+        } else {
+            server_->destroy_tcp_client(item->client, item->reason);
+        }
+        delete item;
+    }
+}
+
+/*****************************************************************************/
+void
+Worker::wake_handler(
+    int                 fd,
+    short               event,
+    void*               _self)
+{
+    Worker*     self = reinterpret_cast<Worker*>(_self);
+    char        buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+        // pass
+    }
+    // Re-arm before draining, pushes from now on write to the pipe again.
+    __sync_lock_release(&self->wake_pending_);
+    self->drain();
+}
+
+/*****************************************************************************/
+void
+Worker::accept_handler(
+    int                 fd,
+    short               event,
+    void*               _self)
+{
+    Worker*     self = reinterpret_cast<Worker*>(_self);
+    self->server_->accept_client(fd, self);
+}
+
+/*****************************************************************************/
+void
+Worker::setup()
+{
+    current_ = this;
+#ifndef WITHOUT_MYSQL
+    mysql_thread_init();
+#endif
+}
+
+/*****************************************************************************/
+void
+Worker::execute()
+{
+    event_base_dispatch(base_);
+#ifndef WITHOUT_MYSQL
+    mysql_thread_end();
+#endif
+}
@@ -0,0 +1,133 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef Worker_h_
+#define Worker_h_
+
+#include <event.h>      // libevent.
+
+#include "Thread.h"
+
+class GpsServer;
+class TCP_CLIENT;
+class SharedFrame;
+
+/** What the owning loop does with a frame queued by another thread. Only the owner reads
+the output buffer of a client, so the output limits are checked there. */
+typedef enum {
+    WORKER_SEND,                ///< \c GpsServer::send_frame, reply the client waits for
+    WORKER_SEND_DROPPABLE,      ///< \c GpsServer::send_frame, droppable
+    WORKER_SEND_LATEST,         ///< \c GpsServer::send_latest
+    WORKER_RELAY_RTCM           ///< \c GpsServer::rtcm_relay_to
+} WORKER_DELIVERY;
+
+/**
+Event loop owning a share of the TCP clients.
+
+Only the owning loop touches the bufferevent and the output state of a client, without the
+server lock. Other threads hand frames and close requests over through a lock-free
+multiple-producer single-consumer queue; the loop is woken up through a pipe.
+
+A worker either runs its own \c event_base in a separate thread (\c create()) and accepts
+clients on its own SO_REUSEPORT listening socket, or is attached to the main loop.
+*/
+class Worker : public Thread {
+    private:
+        /** Queued frame or close request. */
+        typedef struct WORKER_ITEM {
+            struct WORKER_ITEM* volatile    next;
+            TCP_CLIENT*                     client;
+            SharedFrame*                    frame;      ///< Frame to send, 0 to close the client.
+            WORKER_DELIVERY                 delivery;
+            int                             type;       ///< Supersede key of \c WORKER_SEND_LATEST.
+            int                             source;
+            const char*                     reason;     ///< Reason for closing, static string.
+        } WORKER_ITEM;
+
+        GpsServer*              server_;
+        unsigned int            index_;             ///< 0 for main loop, 1... for worker threads.
+        struct event_base*      base_;
+        bool                    own_base_;          ///< \c base_ was created by us.
+        int                     listening_socket_;  ///< -1 if not listening.
+        struct event            listening_event_;
+        int                     wake_pipe_[2];      ///< Read end, write end.
+        struct event            wake_event_;
+        volatile int            wake_pending_;      ///< Byte written to the pipe and not read yet.
+
+        WORKER_ITEM* volatile   head_;              ///< Producers push here.
+        WORKER_ITEM*            tail_;              ///< Consumer pops here.
+        WORKER_ITEM             stub_;
+
+        static __thread Worker* current_;           ///< Worker of the calling thread.
+
+        void
+        push(
+            WORKER_ITEM*        item);
+
+        WORKER_ITEM*
+        pop();
+
+        void
+        drain();
+
+        static void
+        wake_handler(
+            int                 fd,
+            short               event,
+            void*               _self);
+
+        static void
+        accept_handler(
+            int                 fd,
+            short               event,
+            void*               _self);
+    public:
+        /** Worker with its own event loop, call \c listen and \c create to run it. */
+        Worker(
+            GpsServer*          server,
+            const unsigned int  index);
+
+        /** Worker attached to an existing event loop run by the calling thread. */
+        Worker(
+            GpsServer*          server,
+            struct event_base*  base);
+
+        ~Worker();
+
+        /** Opens SO_REUSEPORT listening socket on the given port. Throws \c std::runtime_error on errors. */
+        void
+        listen(
+            const int           port);
+
+        struct event_base*
+        base() const { return base_; }
+
+        unsigned int
+        index() const { return index_; }
+
+        /** Queues frame to be sent to the client by this loop. Takes a reference on the frame. Any thread. */
+        void
+        send(
+            TCP_CLIENT*             client,
+            SharedFrame*            frame,
+            const WORKER_DELIVERY   delivery,
+            const int               type = 0,       ///< Supersede key of \c WORKER_SEND_LATEST
+            const int               source = 0);
+
+        /** Queues closing of the client, after all frames queued so far. Any thread. */
+        void
+        close(
+            TCP_CLIENT*         client,
+            const char*         reason);
+
+        /** Worker whose loop runs in the calling thread, 0 if none. */
+        static Worker*
+        current() { return current_; }
+    protected:
+        void
+        setup();
+
+        void
+        execute();
+}; // class Worker
+
+#endif /* Worker_h_ */
@@ -2,7 +2,6 @@
 #include <iostream>
 #include <sstream>
 #include <sys/types.h>
-#include <dirent.h>
 
 #include <utils/utils.h>
 
@@ -87,40 +86,6 @@ parse_weather_info(
     }
 }
 
-/*****************************************************************************/
-int
-getLatestPointsFileNum(
-    const string& dirName)
-{
-    int maxNum = -1;
-    if (dirName != "") {
-        DIR* dir = opendir(dirName.c_str());
-        while (dir != 0){
-            dirent* file = readdir(dir);
-            if (file == 0){
-                break;
-            }
-            char* begin = strstr(file->d_name, "points_");
-            if (begin == 0) {
-                continue;
-            }
-            char* end = strstr(file->d_name, ".ipt");
-            if (end == 0){
-                continue;
-            }
-            // File name format is always points_XXXXX.ipt so no string manipulation is needed to extract the sequence number
-            const string numpart(&file->d_name[7],&file->d_name[12]);
-            int num;
-            const bool int_ok= int_of(numpart, num);
-            if (int_ok){
-                maxNum = mymax(maxNum, num);
-            }
-        }
-        closedir(dir);
-    }
-    return maxNum;
-}
-
 void 
 tmpname(
     const string&   base,
@@ -12,10 +12,6 @@ parse_weather_info(
     PACKET_WEATHER_INFORMATION& info);
 
 
-int
-getLatestPointsFileNum(
-    const std::string& dirName);
-
 /** Generates temporary file name from process ID, user ID and current time in format $TEMP/base_$UID_$PID_$curtimens.tmp
 @param base base of filename
 @param fileName string where to write the file name 
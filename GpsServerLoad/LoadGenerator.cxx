@@ -0,0 +1,486 @@
+// vim: shiftwidth=4
+// vim: ts=4
+
+#include <algorithm>        // std::sort
+#include <stdexcept>
+
+#include <stdio.h>          // printf
+#include <stdlib.h>         // rand
+#include <string.h>         // memset
+#include <math.h>           // cos, sin
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>          // gethostbyname
+#include <sys/time.h>       // gettimeofday
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <utils/util.h>     // ssprintf, my_time_of_now
+#include <utils/math.h>     // deg2rad
+
+#include "DigNetMessages.h"
+#include "ModemBoxProtocol.h"
+#include "LoadGenerator.h"
+
+using namespace utils;
+
+/// Period of the timer driving the clients, milliseconds.
+static const int    TICK_MS = 50;
+/// Give up connecting after this many seconds.
+static const int    CONNECT_TIMEOUT = 10;
+/// Distance between the GPS-s of a ship, meters.
+static const double GPS_DISTANCE = 20.0;
+/// Build number of simulated GpsViewers. GpsServer lets older ones in only from whitelisted IPs
+/// and doesn't send them ship info, see BUILD_BLOCK_OLDER_THAN and BUILD_ACCEPTS_SHIP_INFO.
+static const int    GPSVIEWER_BUILD = 63;
+/// Query is taken as lost if not answered in this many seconds.
+static const double QUERY_TIMEOUT = 30.0;
+
+/*****************************************************************************/
+static double
+random_between(
+    const double    low,
+    const double    high)
+{
+    return low + (high - low) * (rand() / (RAND_MAX + 1.0));
+}
+
+/*****************************************************************************/
+LoadClient::LoadClient(
+    LoadGenerator*      generator,
+    const bool          gpsviewer,
+    const unsigned int  index) :
+        generator_(generator),
+        gpsviewer_(gpsviewer),
+        index_(index),
+        fd_(-1),
+        bev_(0),
+        connect_time_(0),
+        logged_in_(false),
+        retry_time_(0),
+        last_gga_(0),
+        next_gga_(0),
+        next_query_(0),
+        next_voltage_(0)
+{
+    const LOAD_CONFIG&  config = generator->config_;
+    x_ = config.origin_x + random_between(-config.spread, config.spread);
+    y_ = config.origin_y + random_between(-config.spread, config.spread);
+    heading_ = random_between(0, 360);
+}
+
+/*****************************************************************************/
+LoadClient::~LoadClient()
+{
+    close(0, 0);
+}
+
+/*****************************************************************************/
+bool
+LoadClient::can_connect(
+    const double        now) const
+{
+    return fd_ < 0 && now >= retry_time_;
+}
+
+/*****************************************************************************/
+void
+LoadClient::connect(
+    const double        now)
+{
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0) {
+        retry_time_ = now + 1;
+        return;
+    }
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+    // Set before connecting, close() deletes it.
+    event_set(&connect_event_, fd_, EV_WRITE, connect_handler, this);
+    event_base_set(generator_->base_, &connect_event_);
+    const struct sockaddr_in&   address = generator_->address_;
+    if (::connect(fd_, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0 && errno != EINPROGRESS) {
+        close(now, 1);
+        return;
+    }
+    connect_time_ = now;
+    struct timeval  timeout;
+    timeout.tv_sec = CONNECT_TIMEOUT;
+    timeout.tv_usec = 0;
+    event_add(&connect_event_, &timeout);
+}
+
+/*****************************************************************************/
+void
+LoadClient::close(
+    const double        now,
+    const double        retry)
+{
+    if (fd_ < 0) {
+        return;
+    }
+    if (bev_ != 0) {
+        bufferevent_free(bev_);
+        bev_ = 0;
+        ++generator_->interval_.disconnects;
+        ++generator_->total_.disconnects;
+    } else {
+        event_del(&connect_event_);
+    }
+    ::close(fd_);
+    fd_ = -1;
+    logged_in_ = false;
+    queries_.clear();
+    decoder_ = utils::CMRDecoder();
+    retry_time_ = now + retry;
+}
+
+/*****************************************************************************/
+void
+LoadClient::write(
+    const utils::CMR&   packet)
+{
+    std::vector<unsigned char>  buffer;
+    packet.emit(buffer);
+    bufferevent_write(bev_, &buffer[0], buffer.size());
+    generator_->count_sent(buffer.size());
+}
+
+/*****************************************************************************/
+void
+LoadClient::connected(
+    const double        now)
+{
+    ++generator_->interval_.connects;
+    ++generator_->total_.connects;
+    if (gpsviewer_) {
+        write(CMR(CMR::DIGNET, gpsviewer_identification(GPSVIEWER_BUILD, "2008-01-01 00:00:00")));
+    } else {
+        const std::string   imei(ssprintf("%s%d", generator_->config_.imei_prefix.c_str(), index_));
+        write(CMR(CMR::DIGNET, modembox_identification(imei, "1", "2008-01-01 00:00:00", "GpsServerLoad")));
+        write(modembox_supply_voltage("24.0"));
+        next_voltage_ = now + MODEMBOX_SUPPLY_SEND_PERIOD / 1000.0;
+        // Spread GGA lines of different ships over the period.
+        last_gga_ = now;
+        next_gga_ = now + random_between(0, generator_->config_.gga_interval_ms / 1000.0);
+    }
+    write(CMR(CMR::DIGNET, startupinfo_query()));
+    if (generator_->config_.query_interval_ms > 0) {
+        next_query_ = now + random_between(0, generator_->config_.query_interval_ms / 1000.0);
+    }
+}
+
+/*****************************************************************************/
+void
+LoadClient::handle_packet(
+    const utils::CMR&   packet,
+    const double        now)
+{
+    switch (packet.type) {
+        case CMR::PING:
+            write(packet);
+            break;
+        case CMRTYPE_SHIP_ID:
+            if (!logged_in_) {
+                logged_in_ = true;
+                generator_->login_latency_.push_back((now - connect_time_) * 1000.0);
+            }
+            break;
+        case CMR::DIGNET: {
+            const std::string   workarea(DIGNETMESSAGE_WORKAREA);
+            if (!queries_.empty()
+                    && packet.data.size() >= workarea.size()
+                    && std::equal(workarea.begin(), workarea.end(), packet.data.begin())) {
+                generator_->query_latency_.push_back((now - queries_.front()) * 1000.0);
+                queries_.pop_front();
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/*****************************************************************************/
+void
+LoadClient::poll(
+    const double        now)
+{
+    if (bev_ == 0) {
+        return;
+    }
+    const LOAD_CONFIG&  config = generator_->config_;
+    if (!gpsviewer_ && now >= next_gga_) {
+        // Sail on, turning a little.
+        modembox_move(x_, y_, config.speed, heading_, now - last_gga_);
+        heading_ += random_between(-5, 5);
+        last_gga_ = now;
+        next_gga_ = now + config.gga_interval_ms / 1000.0;
+
+        const my_time   time(my_time_of_now());
+        const double    x2 = x_ + GPS_DISTANCE * cos(deg2rad(heading_));
+        const double    y2 = y_ + GPS_DISTANCE * sin(deg2rad(heading_));
+        write(modembox_serial_packet(0, modembox_gga_line(x_, y_, time) + "\r\n"));
+        write(modembox_serial_packet(1, modembox_gga_line(x2, y2, time) + "\r\n"));
+    }
+    if (!gpsviewer_ && now >= next_voltage_) {
+        write(modembox_supply_voltage("24.0"));
+        next_voltage_ = now + MODEMBOX_SUPPLY_SEND_PERIOD / 1000.0;
+    }
+    // Answers pair with queries in order, a query never answered would shift all the later ones.
+    while (!queries_.empty() && now - queries_.front() > QUERY_TIMEOUT) {
+        queries_.pop_front();
+        ++generator_->interval_.queries_lost;
+        ++generator_->total_.queries_lost;
+    }
+    if (config.query_interval_ms > 0 && now >= next_query_) {
+        write(CMR(CMR::DIGNET, std::string(DIGNETMESSAGE_QUERY " " DIGNETMESSAGE_WORKAREA)));
+        queries_.push_back(now);
+        next_query_ = now + config.query_interval_ms / 1000.0;
+    }
+}
+
+/*****************************************************************************/
+void
+LoadClient::connect_handler(
+    int                 fd,
+    short               event,
+    void*               _self)
+{
+    LoadClient*     self = reinterpret_cast<LoadClient*>(_self);
+    const double    now = LoadGenerator::now();
+    int             error = 0;
+    socklen_t       len = sizeof(error);
+    if ((event & EV_TIMEOUT) != 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+        self->close(now, random_between(1, 3));
+        return;
+    }
+    self->bev_ = bufferevent_new(fd, read_handler, 0, error_handler, self);
+    bufferevent_base_set(self->generator_->base_, self->bev_);
+    bufferevent_enable(self->bev_, EV_READ | EV_WRITE);
+    self->connected(now);
+}
+
+/*****************************************************************************/
+void
+LoadClient::read_handler(
+    struct bufferevent* event,
+    void*               _self)
+{
+    LoadClient*             self = reinterpret_cast<LoadClient*>(_self);
+    const double            now = LoadGenerator::now();
+    struct evbuffer*        input = EVBUFFER_INPUT(event);
+    const unsigned int      size = EVBUFFER_LENGTH(input);
+    self->decoder_.feed(EVBUFFER_DATA(input), size);
+    evbuffer_drain(input, size);
+    self->generator_->interval_.bytes_received += size;
+    self->generator_->total_.bytes_received += size;
+
+    CMR     packet;
+    while (self->decoder_.pop(packet)) {
+        ++self->generator_->interval_.packets_received;
+        ++self->generator_->total_.packets_received;
+        self->handle_packet(packet, now);
+        if (self->bev_ == 0) {
+            break;
+        }
+    }
+}
+
+/*****************************************************************************/
+void
+LoadClient::error_handler(
+    struct bufferevent* event,
+    short               what,
+    void*               _self)
+{
+    LoadClient*     self = reinterpret_cast<LoadClient*>(_self);
+    // Server closed the connection: rejected or restarted.
+    self->close(LoadGenerator::now(), random_between(1, 3));
+}
+
+/*****************************************************************************/
+LoadGenerator::LoadGenerator(
+    const LOAD_CONFIG&  config) :
+        config_(config),
+        base_(reinterpret_cast<struct event_base*>(event_init())),  // bufferevent_new needs the current base.
+        next_client_(0),
+        connect_credit_(0)
+{
+    memset(&address_, 0, sizeof(address_));
+    address_.sin_family = AF_INET;
+    address_.sin_port = htons(config.port);
+    if (inet_aton(config.host.c_str(), &address_.sin_addr) == 0) {
+        struct hostent* host = gethostbyname(config.host.c_str());
+        if (host == 0 || host->h_addrtype != AF_INET) {
+            throw std::runtime_error(ssprintf("Can't resolve host %s", config.host.c_str()));
+        }
+        memcpy(&address_.sin_addr, host->h_addr_list[0], sizeof(address_.sin_addr));
+    }
+    memset(&interval_, 0, sizeof(interval_));
+    memset(&total_, 0, sizeof(total_));
+    for (unsigned int i=0; i<config.modemboxes; ++i) {
+        clients_.push_back(new LoadClient(this, false, i));
+    }
+    for (unsigned int i=0; i<config.gpsviewers; ++i) {
+        clients_.push_back(new LoadClient(this, true, i));
+    }
+    // Don't let ModemBoxes and GpsViewers connect in blocks.
+    std::random_shuffle(clients_.begin(), clients_.end());
+}
+
+/*****************************************************************************/
+LoadGenerator::~LoadGenerator()
+{
+    for (unsigned int i=0; i<clients_.size(); ++i) {
+        delete clients_[i];
+    }
+    event_base_free(base_);
+}
+
+/*****************************************************************************/
+double
+LoadGenerator::now()
+{
+    struct timeval  tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/*****************************************************************************/
+void
+LoadGenerator::count_sent(
+    const unsigned int  bytes)
+{
+    ++interval_.packets_sent;
+    ++total_.packets_sent;
+    interval_.bytes_sent += bytes;
+    total_.bytes_sent += bytes;
+}
+
+/*****************************************************************************/
+static void
+percentiles(
+    std::vector<double>&    samples,
+    char*                   buf,
+    const unsigned int      size)
+{
+    if (samples.empty()) {
+        snprintf(buf, size, "%7s %7s %7s %7s", "-", "-", "-", "-");
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    const unsigned int  n = samples.size();
+    snprintf(buf, size, "%7.1f %7.1f %7.1f %7.1f",
+        samples[n * 50 / 100], samples[n * 90 / 100], samples[n * 99 / 100], samples[n - 1]);
+}
+
+/*****************************************************************************/
+void
+LoadGenerator::report(
+    const double            now,
+    const double            seconds,
+    const LOAD_COUNTERS&    counters,
+    std::vector<double>&    login_latency,
+    std::vector<double>&    query_latency)
+{
+    unsigned int    connected = 0;
+    for (unsigned int i=0; i<clients_.size(); ++i) {
+        if (clients_[i]->is_connected()) {
+            ++connected;
+        }
+    }
+    char            login[64];
+    char            query[64];
+    percentiles(login_latency, login, sizeof(login));
+    percentiles(query_latency, query, sizeof(query));
+    printf("%6.0f %5u %5lu %5lu %8.0f %9.0f %8.0f %9.0f | %s | %s\n",
+        now - start_, connected, counters.connects, counters.disconnects,
+        counters.packets_sent / seconds, counters.bytes_sent / seconds,
+        counters.packets_received / seconds, counters.bytes_received / seconds,
+        login, query);
+    fflush(stdout);
+}
+
+/*****************************************************************************/
+void
+LoadGenerator::tick()
+{
+    const double    now = LoadGenerator::now();
+
+    // Connect at the configured rate.
+    connect_credit_ += config_.connect_rate * (now - last_tick_);
+    if (connect_credit_ > config_.connect_rate) {
+        connect_credit_ = config_.connect_rate;
+    }
+    for (unsigned int n=0; n<clients_.size() && connect_credit_ >= 1; ++n) {
+        LoadClient* client = clients_[next_client_];
+        next_client_ = (next_client_ + 1) % clients_.size();
+        if (client->can_connect(now)) {
+            client->connect(now);
+            connect_credit_ -= 1;
+        }
+    }
+    last_tick_ = now;
+
+    for (unsigned int i=0; i<clients_.size(); ++i) {
+        clients_[i]->poll(now);
+    }
+
+    if (now >= last_report_ + config_.report_interval) {
+        report(now, now - last_report_, interval_, login_latency_, query_latency_);
+        total_login_latency_.insert(total_login_latency_.end(), login_latency_.begin(), login_latency_.end());
+        total_query_latency_.insert(total_query_latency_.end(), query_latency_.begin(), query_latency_.end());
+        login_latency_.clear();
+        query_latency_.clear();
+        memset(&interval_, 0, sizeof(interval_));
+        last_report_ = now;
+    }
+
+    if (config_.duration > 0 && now >= start_ + config_.duration) {
+        event_base_loopbreak(base_);
+    }
+}
+
+/*****************************************************************************/
+void
+LoadGenerator::tick_handler(
+    int                 fd,
+    short               event,
+    void*               _self)
+{
+    LoadGenerator*  self = reinterpret_cast<LoadGenerator*>(_self);
+    self->tick();
+    struct timeval  tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = TICK_MS * 1000;
+    evtimer_add(&self->tick_event_, &tv);
+}
+
+/*****************************************************************************/
+void
+LoadGenerator::run()
+{
+    start_ = last_tick_ = last_report_ = now();
+    printf("%d ModemBoxes and %d GpsViewers against %s:%d\n",
+        config_.modemboxes, config_.gpsviewers, config_.host.c_str(), config_.port);
+    printf("%6s %5s %5s %5s %8s %9s %8s %9s | %-31s | %-31s\n",
+        "time", "conn", "new", "lost", "out pk/s", "out B/s", "in pk/s", "in B/s",
+        "login ms p50 p90 p99 max", "query ms p50 p90 p99 max");
+
+    evtimer_set(&tick_event_, tick_handler, this);
+    event_base_set(base_, &tick_event_);
+    struct timeval  tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = TICK_MS * 1000;
+    evtimer_add(&tick_event_, &tv);
+    event_base_dispatch(base_);
+    evtimer_del(&tick_event_);
+
+    const double    end = now();
+    total_login_latency_.insert(total_login_latency_.end(), login_latency_.begin(), login_latency_.end());
+    total_query_latency_.insert(total_query_latency_.end(), query_latency_.begin(), query_latency_.end());
+    printf("Total:\n");
+    report(end, end - start_, total_, total_login_latency_, total_query_latency_);
+    printf("%lu logins, %lu queries answered, %lu lost\n", total_login_latency_.size(), total_query_latency_.size(), total_.queries_lost);
+}
@@ -0,0 +1,202 @@
+// vim: shiftwidth=4
+// vim: ts=4
+#ifndef LoadGenerator_h_
+#define LoadGenerator_h_
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <netinet/in.h>     // sockaddr_in
+#include <event.h>
+
+#include <utils/CMR.h>
+
+/** Settings of the load generator. */
+typedef struct {
+    std::string     host;               ///< GpsServer address
+    int             port;               ///< GpsServer ListeningPort
+    unsigned int    modemboxes;         ///< Number of simulated ModemBoxes
+    unsigned int    gpsviewers;         ///< Number of simulated GpsViewers
+    std::string     imei_prefix;        ///< ModemBox i has IMEI \c imei_prefix followed by i
+    unsigned int    connect_rate;       ///< New connections per second
+    unsigned int    gga_interval_ms;    ///< SERIAL GGA period of a ModemBox, both GPS-s
+    unsigned int    query_interval_ms;  ///< "? WorkArea" period of every client, 0 for none
+    double          speed;              ///< Ship speed, knots
+    double          origin_x;           ///< Ships start around this point, local coordinates
+    double          origin_y;
+    double          spread;             ///< Ships start at most this far from origin, meters
+    unsigned int    duration;           ///< Seconds to run, 0 to run until interrupted
+    unsigned int    report_interval;    ///< Seconds between reports
+} LOAD_CONFIG;
+
+/** Traffic counters. */
+typedef struct {
+    unsigned long   connects;
+    unsigned long   disconnects;
+    unsigned long   packets_sent;
+    unsigned long   bytes_sent;
+    unsigned long   packets_received;
+    unsigned long   bytes_received;
+    unsigned long   queries_lost;       ///< Queries not answered within QUERY_TIMEOUT
+} LOAD_COUNTERS;
+
+class LoadGenerator;
+
+/**
+Simulated ModemBox or GpsViewer connection to GpsServer.
+
+Speaks what ModemBoxSimulator speaks, see ModemBoxProtocol.h: identification,
+"? StartupInfo", supply voltage and SERIAL GGA lines of a moving ship for ModemBoxes,
+ping replies. Every client also asks "? WorkArea" periodically, the answer time is the
+server response latency.
+*/
+class LoadClient {
+    private:
+        LoadGenerator*          generator_;
+        const bool              gpsviewer_;         ///< GpsViewer if true, ModemBox otherwise
+        const unsigned int      index_;
+        int                     fd_;                ///< -1 if not connected
+        struct event            connect_event_;
+        struct bufferevent*     bev_;               ///< 0 until connected
+        utils::CMRDecoder       decoder_;
+        double                  connect_time_;      ///< Connection started, login latency is measured from here
+        bool                    logged_in_;         ///< Got ship ID from the server
+        double                  retry_time_;        ///< Don't reconnect before this time
+        double                  last_gga_;
+        double                  next_gga_;
+        double                  next_query_;
+        double                  next_voltage_;
+        double                  x_;                 ///< GPS 1 position, local coordinates
+        double                  y_;
+        double                  heading_;           ///< Degrees
+        std::deque<double>      queries_;           ///< Send times of unanswered queries
+
+        void
+        write(
+            const utils::CMR&       packet);
+
+        void
+        connected(
+            const double            now);
+
+        void
+        handle_packet(
+            const utils::CMR&       packet,
+            const double            now);
+
+        static void
+        connect_handler(
+            int                     fd,
+            short                   event,
+            void*                   _self);
+
+        static void
+        read_handler(
+            struct bufferevent*     event,
+            void*                   _self);
+
+        static void
+        error_handler(
+            struct bufferevent*     event,
+            short                   what,
+            void*                   _self);
+    public:
+        LoadClient(
+            LoadGenerator*          generator,
+            const bool              gpsviewer,
+            const unsigned int      index);
+
+        ~LoadClient();
+
+        /** True if neither connected nor connecting, and may connect at \c now. */
+        bool
+        can_connect(
+            const double            now) const;
+
+        /** Starts connecting. */
+        void
+        connect(
+            const double            now);
+
+        /** Closes the connection, reconnect is allowed after \c retry seconds. */
+        void
+        close(
+            const double            now,
+            const double            retry);
+
+        /** Periodic work: GGA lines, queries, supply voltage. */
+        void
+        poll(
+            const double            now);
+
+        bool
+        is_connected() const { return bev_ != 0; }
+}; // class LoadClient
+
+/**
+Runs \c LoadClient-s against GpsServer in a single libevent loop and reports the
+throughput and response latencies.
+*/
+class LoadGenerator {
+    private:
+        friend class LoadClient;
+
+        LOAD_CONFIG                 config_;
+        struct sockaddr_in          address_;
+        struct event_base*          base_;
+        struct event                tick_event_;
+        std::vector<LoadClient*>    clients_;
+        unsigned int                next_client_;       ///< Round robin for connecting
+        double                      connect_credit_;    ///< Connections allowed by \c connect_rate
+        double                      start_;
+        double                      last_tick_;
+        double                      last_report_;
+        LOAD_COUNTERS               interval_;          ///< Since last report
+        LOAD_COUNTERS               total_;
+        std::vector<double>         login_latency_;     ///< Since last report, milliseconds
+        std::vector<double>         query_latency_;
+        std::vector<double>         total_login_latency_;
+        std::vector<double>         total_query_latency_;
+
+        void
+        count_sent(
+            const unsigned int      bytes);
+
+        void
+        count_received(
+            const unsigned int      bytes);
+
+        void
+        tick();
+
+        void
+        report(
+            const double            now,
+            const double            seconds,
+            const LOAD_COUNTERS&    counters,
+            std::vector<double>&    login_latency,
+            std::vector<double>&    query_latency);
+
+        static void
+        tick_handler(
+            int                     fd,
+            short                   event,
+            void*                   _self);
+    public:
+        /** Throws \c std::runtime_error if the host can't be resolved. */
+        LoadGenerator(
+            const LOAD_CONFIG&      config);
+
+        ~LoadGenerator();
+
+        /** Runs for \c duration seconds, then prints the summary. */
+        void
+        run();
+
+        /** Current time, seconds. */
+        static double
+        now();
+}; // class LoadGenerator
+
+#endif /* LoadGenerator_h_ */
@@ -0,0 +1,191 @@
+// vim: shiftwidth=4
+// vim: ts=4
+/**
+Headless load generator for GpsServer: hundreds or thousands of simulated ModemBoxes
+and GpsViewers on one machine.
+
+ModemBoxes must be known to the server, print the rows for the Ships table with -sql:
+    GpsServerLoad -m 1000 -groups 10 -sql | mysql -u gpsserver dignet
+or the snapshot of Backend=memory database with -snapshot:
+    GpsServerLoad -m 1000 -groups 10 -snapshot > dignet.snapshot
+*/
+
+#include <stdexcept>
+
+#include <stdio.h>          // printf
+#include <stdlib.h>         // atoi, atof, srand
+#include <string.h>         // strcmp
+#include <signal.h>         // signal
+#include <sys/resource.h>   // setrlimit
+
+#include "LoadGenerator.h"
+
+/*****************************************************************************/
+static int
+print_usage()
+{
+    printf("Usage:\n");
+    printf("\tGpsServerLoad [options]\n");
+    printf("\tGpsServerLoad [options] -sql\n");
+    printf("\tGpsServerLoad [options] -snapshot\n");
+    printf("where options are:\n");
+    printf("\t-h host\t\tGpsServer host, default localhost.\n");
+    printf("\t-p port\t\tGpsServer ListeningPort, default 5002.\n");
+    printf("\t-m count\tNumber of ModemBoxes, default 100.\n");
+    printf("\t-v count\tNumber of GpsViewers, default 10.\n");
+    printf("\t-i prefix\tIMEI prefix of ModemBoxes, default 990000.\n");
+    printf("\t-c rate\t\tNew connections per second, default 50.\n");
+    printf("\t-g ms\t\tGGA period of ModemBoxes, default 1000.\n");
+    printf("\t-q ms\t\tWorkArea query period of every client, 0 for none, default 10000.\n");
+    printf("\t-s knots\tShip speed, default 3.\n");
+    printf("\t-x x,y\t\tShips start around this point, local coordinates, default 6580000,540000.\n");
+    printf("\t-r meters\tShips start at most this far from the point, default 5000.\n");
+    printf("\t-t seconds\tRun time, 0 to run until interrupted, default 60.\n");
+    printf("\t-report seconds\tReport period, default 5.\n");
+    printf("\t-groups count\tWith -sql and -snapshot: spread ModemBoxes over this many groups, default 1.\n");
+    printf("\t-sql\t\tPrint SQL adding the ModemBoxes to the Ships table and exit.\n");
+    printf("\t-snapshot\tPrint the ModemBoxes as memory database snapshot and exit.\n");
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+print_sql(
+    const LOAD_CONFIG&  config,
+    const unsigned int  groups)
+{
+    printf("-- Ships of GpsServerLoad.\n");
+    printf("delete from Ships where IMEI like '%s%%' and Firmware_Name = 'GpsServerLoad';\n", config.imei_prefix.c_str());
+    for (unsigned int i=0; i<config.modemboxes; ++i) {
+        printf("insert into Ships set GroupId = %u, SimNumber = '', ShipType = '', IMEI = '%s%u',"
+            " Firmware_Name = 'GpsServerLoad', Firmware_Version = '', Firmware_Build_date = now(), Phone_no = '',"
+            " Name = 'Load #%u', SupplyVoltageLimit = 11.5,"
+            " Gps1_dx = 0, Gps1_dy = 0, Gps2_dx = 20, Gps2_dy = 0;\n",
+            i % groups, config.imei_prefix.c_str(), i, i);
+    }
+    printf("-- GpsViewers log in with IMEI 12345, skip this if the row exists already.\n");
+    printf("insert into Ships set GroupId = 0, SimNumber = '', ShipType = '', IMEI = '12345',"
+        " Firmware_Name = 'GpsViewer', Firmware_Version = '', Firmware_Build_date = now(), Phone_no = '',"
+        " Name = 'GpsViewer', SupplyVoltageLimit = 0;\n");
+}
+
+/*****************************************************************************/
+static void
+print_snapshot(
+    const LOAD_CONFIG&  config,
+    const unsigned int  groups)
+{
+    printf("# Ships of GpsServerLoad.\n");
+    printf("ship id=1 GroupId=0 IMEI=12345 Name=\"GpsViewer\" SupplyVoltageLimit=0\n");
+    for (unsigned int i=0; i<config.modemboxes; ++i) {
+        printf("ship id=%u GroupId=%u IMEI=%s%u Name=\"Load #%u\" Firmware_Name=GpsServerLoad SupplyVoltageLimit=11.5"
+            " Gps1_dx=0 Gps1_dy=0 Gps2_dx=20 Gps2_dy=0\n",
+            i + 2, i % groups, config.imei_prefix.c_str(), i, i);
+    }
+}
+
+/*****************************************************************************/
+int
+main(
+    int     argc,
+    char**  argv)
+{
+    LOAD_CONFIG     config;
+    config.host = "localhost";
+    config.port = 5002;
+    config.modemboxes = 100;
+    config.gpsviewers = 10;
+    config.imei_prefix = "990000";
+    config.connect_rate = 50;
+    config.gga_interval_ms = 1000;
+    config.query_interval_ms = 10000;
+    config.speed = 3;
+    config.origin_x = 6580000;
+    config.origin_y = 540000;
+    config.spread = 5000;
+    config.duration = 60;
+    config.report_interval = 5;
+    unsigned int    groups = 1;
+    bool            sql = false;
+    bool            snapshot = false;
+
+    for (int i=1; i<argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i+1 < argc ? argv[i+1] : 0;
+        if (strcmp(arg, "-sql") == 0) {
+            sql = true;
+            continue;
+        }
+        if (strcmp(arg, "-snapshot") == 0) {
+            snapshot = true;
+            continue;
+        }
+        if (value == 0) {
+            return print_usage();
+        }
+        ++i;
+        if (strcmp(arg, "-h") == 0) {
+            config.host = value;
+        } else if (strcmp(arg, "-p") == 0) {
+            config.port = atoi(value);
+        } else if (strcmp(arg, "-m") == 0) {
+            config.modemboxes = atoi(value);
+        } else if (strcmp(arg, "-v") == 0) {
+            config.gpsviewers = atoi(value);
+        } else if (strcmp(arg, "-i") == 0) {
+            config.imei_prefix = value;
+        } else if (strcmp(arg, "-c") == 0) {
+            config.connect_rate = atoi(value);
+        } else if (strcmp(arg, "-g") == 0) {
+            config.gga_interval_ms = atoi(value);
+        } else if (strcmp(arg, "-q") == 0) {
+            config.query_interval_ms = atoi(value);
+        } else if (strcmp(arg, "-s") == 0) {
+            config.speed = atof(value);
+        } else if (strcmp(arg, "-x") == 0) {
+            if (sscanf(value, "%lf,%lf", &config.origin_x, &config.origin_y) != 2) {
+                return print_usage();
+            }
+        } else if (strcmp(arg, "-r") == 0) {
+            config.spread = atof(value);
+        } else if (strcmp(arg, "-t") == 0) {
+            config.duration = atoi(value);
+        } else if (strcmp(arg, "-report") == 0) {
+            config.report_interval = atoi(value);
+        } else if (strcmp(arg, "-groups") == 0) {
+            groups = atoi(value);
+        } else {
+            return print_usage();
+        }
+    }
+    if (config.connect_rate == 0 || config.gga_interval_ms == 0 || config.report_interval == 0 || groups == 0) {
+        return print_usage();
+    }
+
+    if (sql) {
+        print_sql(config, groups);
+        return 0;
+    }
+    if (snapshot) {
+        print_snapshot(config, groups);
+        return 0;
+    }
+
+    // One socket per client.
+    struct rlimit   limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);
+
+    try {
+        LoadGenerator   generator(config);
+        generator.run();
+    } catch (const std::exception& e) {
+        printf("Error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
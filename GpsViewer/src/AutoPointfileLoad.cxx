@@ -2,37 +2,62 @@
 #include <string>
 #include <fstream>
 #include <algorithm> //std::count
+#include <vector>
+#include <iterator> // istreambuf_iterator
+#include <stddef.h> // offsetof
+#include <string.h> // memset
+#include <stdio.h> // remove
+#include <time.h>
 #include <fx.h>
 
 #include <utils/CMR.h>
 #include <utils/util.h>
 #include <utils/mystring.h>
 
+#include "PointsDelta.h"
+
 using namespace std;
 using namespace utils;
 
 
 //=====================================================================================//
 void 
-AutoPointfileLoad::InitDownload(const PACKET_POINTSFILE_INFO& info)
+AutoPointfileLoad::InitDownload(const PACKET_POINTSFILE_INFO& info, const int codec)
 {
     download_pointfile_name_ = ssprintf("points_%05d.ipt", info.number);
+    download_info_ = info;
+    download_codec_ = codec;
+    // Compressed file or delta is saved next to the points file, which stays empty until inflated or patched
+    const uint32_t size = codec==POINTSFILE_CODEC_ZLIB ? info.compressed_size
+        : codec==POINTSFILE_CODEC_DELTA ? info.delta_size : info.size;
     ofstream out(download_pointfile_name_.c_str());
     string buf;
-    buf.resize(info.size);
-    out.write(&buf[0], info.size);
+    buf.resize(size);
+    if (codec!=POINTSFILE_CODEC_NONE){
+        ofstream stream(StreamName().c_str());
+        stream.write(&buf[0], size);
+    } else {
+        out.write(&buf[0], size);
+    }
     const string trackname(ssprintf("%s.track", download_pointfile_name_.c_str()));
     ofstream track(trackname.c_str());
-    track.write(reinterpret_cast<const char*>(&info.size), sizeof(info.size));
-    buf.resize(info.size/CHUNK_SIZE+1);
+    track.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    buf.resize(size/CHUNK_SIZE+1);
     fill(buf.begin(), buf.end(), '0');
     track.write(buf.c_str(), buf.size());
+    ResetInflate();
     download_last_chunk_ = -1;
-    download_pointfile_size_ = info.size;
+    download_pointfile_size_ = size;
     download_done_ = false;
     download_pointfile_number_ = info.number;
     downloaded_chunks_ = 0;
     popped_ = false;
+    requested_ = "";
+    requested_count_ = 0;
+    window_next_ = 0;
+    last_chunk_time_ = 0;
+    window_time_ = 0;
+    window_rtt_ = 0;
 }
 
 
@@ -61,6 +86,153 @@ AutoPointfileLoad::GetNextChunk()
 }
 
 
+//=====================================================================================//
+void
+AutoPointfileLoad::ReadChunkInfo(string& chunks)
+{
+    const string trackname(ssprintf("%s.track", download_pointfile_name_.c_str()));
+    ifstream in(trackname.c_str(), ios::binary);
+    in.read(reinterpret_cast<char*>(&download_pointfile_size_), sizeof(uint32_t));
+    chunks.resize(download_pointfile_size_/CHUNK_SIZE+1);
+    in.read(&chunks[0], chunks.size());
+}
+
+
+//=====================================================================================//
+string
+AutoPointfileLoad::StreamName() const
+{
+    switch (download_codec_){
+    case POINTSFILE_CODEC_ZLIB:
+        return download_pointfile_name_+".z";
+    case POINTSFILE_CODEC_DELTA:
+        return download_pointfile_name_+".delta";
+    default:
+        return download_pointfile_name_;
+    }
+}
+
+
+//=====================================================================================//
+int
+AutoPointfileLoad::ChooseCodec(const PACKET_POINTSFILE_INFO& info, const int latest_done) const
+{
+    // Variants can be asked for only with window requests
+    if (!windowed_){
+        return POINTSFILE_CODEC_NONE;
+    }
+    if (info.delta_size>0 && info.number==latest_done+1 && info.number!=delta_failed_){
+        return POINTSFILE_CODEC_DELTA;
+    }
+    return info.codec==POINTSFILE_CODEC_ZLIB ? POINTSFILE_CODEC_ZLIB : POINTSFILE_CODEC_NONE;
+}
+
+
+//=====================================================================================//
+/** Reads whole file to \c data, returns false if it can't be read */
+static bool
+read_file(const string& name, string& data)
+{
+    ifstream in(name.c_str(), ios::binary);
+    if (!in){
+        return false;
+    }
+    data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+
+//=====================================================================================//
+bool
+AutoPointfileLoad::Patch()
+{
+    const string base_name(ssprintf("points_%05d.ipt", download_pointfile_number_-1));
+    string base, delta;
+    if (!read_file(base_name, base) || !read_file(StreamName(), delta)){
+        return false;
+    }
+    vector<unsigned char> target;
+    if (!apply_points_delta(reinterpret_cast<const unsigned char*>(base.data()), base.size(),
+            reinterpret_cast<const unsigned char*>(delta.data()), delta.size(), target)){
+        return false;
+    }
+    ofstream out(download_pointfile_name_.c_str(), ios::binary|ios::trunc);
+    if (!target.empty()){
+        out.write(reinterpret_cast<const char*>(&target[0]), target.size());
+    }
+    TRACE_PRINT("info", ("Patched %s with %d bytes of delta to %d bytes", base_name.c_str(), (int)delta.size(), (int)target.size()));
+    return out.good();
+}
+
+
+//=====================================================================================//
+bool
+AutoPointfileLoad::Inflate(const string& chunks)
+{
+    if (!inflating_ && inflated_chunks_>0){
+        // Whole file has been inflated
+        return true;
+    }
+    if (!inflating_){
+        memset(&inflater_, 0, sizeof(inflater_));
+        if (inflateInit(&inflater_)!=Z_OK){
+            return false;
+        }
+        inflating_ = true;
+        ofstream points(download_pointfile_name_.c_str(), ios::binary|ios::trunc);
+    }
+    ifstream in(StreamName().c_str(), ios::binary);
+    ofstream out(download_pointfile_name_.c_str(), ios::binary|ios::app);
+    const int n = chunks.size();
+    while (inflated_chunks_<n && chunks[inflated_chunks_]=='1'){
+        const int chunk_size = inflated_chunks_<n-1 ? CHUNK_SIZE : download_pointfile_size_%CHUNK_SIZE;
+        char input[CHUNK_SIZE];
+        in.seekg(inflated_chunks_*CHUNK_SIZE, ios::beg);
+        in.read(input, chunk_size);
+        inflater_.next_in = reinterpret_cast<Bytef*>(input);
+        inflater_.avail_in = chunk_size;
+        int r;
+        do {
+            char output[4096];
+            inflater_.next_out = reinterpret_cast<Bytef*>(output);
+            inflater_.avail_out = sizeof(output);
+            r = inflate(&inflater_, Z_NO_FLUSH);
+            if (r!=Z_OK && r!=Z_STREAM_END && r!=Z_BUF_ERROR){
+                TRACE_PRINT("info", ("Inflating chunk # %d failed: %d", inflated_chunks_, r));
+                ResetInflate();
+                return false;
+            }
+            out.write(output, sizeof(output)-inflater_.avail_out);
+        } while (r==Z_OK && (inflater_.avail_in>0 || inflater_.avail_out==0));
+        inflated_chunks_++;
+        if (r==Z_STREAM_END){
+            TRACE_PRINT("info", ("Inflated %d bytes to %s", (int)inflater_.total_out, download_pointfile_name_.c_str()));
+            inflateEnd(&inflater_);
+            inflating_ = false;
+            return true;
+        }
+    }
+    // Compressed data must end with the last chunk
+    if (inflated_chunks_==n){
+        ResetInflate();
+        return false;
+    }
+    return true;
+}
+
+
+//=====================================================================================//
+void
+AutoPointfileLoad::ResetInflate()
+{
+    if (inflating_){
+        inflateEnd(&inflater_);
+        inflating_ = false;
+    }
+    inflated_chunks_ = 0;
+}
+
+
 //=====================================================================================//
 AutoPointfileLoad::AutoPointfileLoad():
     download_pointfile_name_("")
@@ -70,7 +242,25 @@ AutoPointfileLoad::AutoPointfileLoad():
     ,download_done_(true)
     ,downloaded_chunks_(-1)
     ,popped_(false)
+    ,windowed_(false)
+    ,requested_count_(0)
+    ,window_next_(0)
+    ,last_chunk_time_(0)
+    ,window_time_(0)
+    ,window_rtt_(0)
+    ,download_codec_(POINTSFILE_CODEC_NONE)
+    ,inflating_(false)
+    ,inflated_chunks_(0)
+    ,delta_failed_(-1)
 {
+    memset(&info_, 0, sizeof(info_));
+    memset(&download_info_, 0, sizeof(download_info_));
+}
+
+//=====================================================================================//
+AutoPointfileLoad::~AutoPointfileLoad()
+{
+    ResetInflate();
 }
 
 //=====================================================================================//
@@ -78,7 +268,8 @@ bool
 AutoPointfileLoad::GetRequest(
     PACKET_POINTSFILE_CHUNK_REQUEST& packet)
 {
-    if (download_done_){
+    // Chunk requests are always for the file as it is
+    if (download_done_ || download_codec_!=POINTSFILE_CODEC_NONE){
         return false;
     }
     const string::size_type pos = GetNextChunk();
@@ -93,6 +284,70 @@ AutoPointfileLoad::GetRequest(
 }
 
 
+//=====================================================================================//
+bool
+AutoPointfileLoad::GetWindowRequest(
+    PACKET_POINTSFILE_WINDOW_REQUEST& packet,
+    int& size)
+{
+    // Stream is considered stalled after this many seconds plus two round trips without chunks
+    const int WINDOW_STALL_SECONDS = 3;
+    // Chunks asked for but not received yet, at most
+    const int WINDOW_MAX_REQUESTED = 4*POINTSFILE_WINDOW_BYTES*8;
+    if (download_done_){
+        return false;
+    }
+    const time_t now = time(0);
+    if (requested_count_>0 && now-last_chunk_time_ >= WINDOW_STALL_SECONDS+2*window_rtt_){
+        TRACE_PRINT("info", ("No chunks for %d s, asking for %d chunks again", (int)(now-last_chunk_time_), requested_count_));
+        requested_ = "";
+    }
+    string chunks;
+    ReadChunkInfo(chunks);
+    if (requested_.size()!=chunks.size()){
+        requested_.assign(chunks.size(), '0');
+        requested_count_ = 0;
+        window_next_ = 0;
+    }
+    if (requested_count_>=WINDOW_MAX_REQUESTED){
+        return false;
+    }
+    // First chunk that is missing and not on its way, from where the previous window ended
+    const int n = chunks.size();
+    int first = -1;
+    for (int i=0; i<n && first==-1; i++){
+        const int chunk = (window_next_+i)%n;
+        if (chunks[chunk]=='0' && requested_[chunk]=='0'){
+            first = chunk;
+        }
+    }
+    if (first==-1){
+        return false;
+    }
+    if (requested_count_==0){
+        last_chunk_time_ = now;
+        window_time_ = now;
+    }
+    memset(packet.missing, 0, sizeof(packet.missing));
+    int last = first;
+    for (int i=0; i<POINTSFILE_WINDOW_BYTES*8 && first+i<n; i++){
+        if (chunks[first+i]=='0' && requested_[first+i]=='0'){
+            packet.missing[i/8] |= 1<<(i%8);
+            requested_[first+i] = '1';
+            requested_count_++;
+            last = first+i;
+        }
+    }
+    packet.file_number = download_pointfile_number_;
+    packet.first_chunk = first;
+    packet.codec = download_codec_;
+    size = offsetof(PACKET_POINTSFILE_WINDOW_REQUEST, missing) + (last-first)/8+1;
+    window_next_ = last+1;
+    TRACE_PRINT("info", ("Requesting window of chunks # %d..%d, %d on their way", first, last, requested_count_));
+    return true;
+}
+
+
 //=====================================================================================//
 bool 
 AutoPointfileLoad::HandlePacket(
@@ -100,17 +355,23 @@ AutoPointfileLoad::HandlePacket(
 {
     switch (packet.type){
     case PACKET_POINTSFILE_INFO::CMRTYPE: {
-        if (packet.data.size()<sizeof(PACKET_POINTSFILE_INFO)){
+        // Older servers don't send flags
+        if (packet.data.size()<offsetof(PACKET_POINTSFILE_INFO, flags)){
             TRACE_PRINT("info", ("Wrong pointfile info size. Got %d, expected %d", packet.data.size(), sizeof(PACKET_POINTSFILE_INFO)));
             break;
         }
-        const PACKET_POINTSFILE_INFO* info = reinterpret_cast<const PACKET_POINTSFILE_INFO*>(&packet.data[0]);
+        // Fields missing from packets of older servers are left zero
+        memset(&info_, 0, sizeof(info_));
+        memcpy(&info_, &packet.data[0], min(packet.data.size(), sizeof(info_)));
+        const PACKET_POINTSFILE_INFO* info = &info_;
+        windowed_ = (info->flags & POINTSFILE_WINDOWED)!=0;
         string filename;
         if (!GetNewFile(filename)){
             filename="";
         }
         // File name is in fixed format points_XXXXX.ipt
-        
+        const int codec = ChooseCodec(*info, filename=="" ? -1 : get_pointfile_number(filename));
+
         int latestNum = -1;
         if (filename==""){
             if (!download_done_){
@@ -121,12 +382,15 @@ AutoPointfileLoad::HandlePacket(
         }
         if (latestNum<info->number && download_done_ || (!download_done_ && download_pointfile_number_ < info->number)){
             download_pointfile_number_ = info->number;
-            InitDownload(*info);
+            InitDownload(*info, codec);
+        } else if (!download_done_ && download_pointfile_number_==info->number && download_codec_!=codec){
+            TRACE_PRINT("info", ("Server offers file #%d with codec %d instead of %d, starting over", info->number, codec, download_codec_));
+            InitDownload(*info, codec);
         }
         return true;
     }
     case PACKET_POINTSFILE_CHUNK::CMRTYPE:{
-        if (packet.data.size()<sizeof(PACKET_POINTSFILE_CHUNK)){
+        if (packet.data.size()<offsetof(PACKET_POINTSFILE_CHUNK, codec)){
             TRACE_PRINT("info", ("Wrong pointfile chunk size. Got %d, expected %d", packet.data.size(), sizeof(PACKET_POINTSFILE_CHUNK)));
             break;
         }
@@ -135,26 +399,73 @@ AutoPointfileLoad::HandlePacket(
             TRACE_PRINT("info", ("Got chunk from file #%d when expecting chunks from #%d, discarding", chunk->file_number, download_pointfile_number_));
             break;
         }
+        // Chunks still streamed after switching codec belong to the previous download.
+        const int chunk_codec = packet.data.size()<sizeof(PACKET_POINTSFILE_CHUNK) ? POINTSFILE_CODEC_NONE : chunk->codec;
+        if (chunk_codec != download_codec_){
+            TRACE_PRINT("info", ("Got chunk of file #%d with codec %d when expecting codec %d, discarding", chunk->file_number, chunk_codec, download_codec_));
+            break;
+        }
+        if (chunk->chunk_number > download_pointfile_size_/CHUNK_SIZE){
+            TRACE_PRINT("info", ("Got chunk # %d beyond the end of file #%d, discarding", chunk->chunk_number, download_pointfile_number_));
+            break;
+        }
         const int chunk_size = chunk->chunk_number < download_pointfile_size_/CHUNK_SIZE ? CHUNK_SIZE : download_pointfile_size_%CHUNK_SIZE;
-        fstream points(download_pointfile_name_.c_str(), ios::in|ios::out|ios::binary);
-        string buf;
-        buf.resize(download_pointfile_size_);
-        points.read(&buf[0], download_pointfile_size_);
-        memcpy(&buf[chunk->chunk_number*CHUNK_SIZE], chunk->data, chunk_size);
-        points.seekp(0, ios::beg);
-        points.write(buf.c_str(), download_pointfile_size_);
+        // Streamed chunks come fast, write only the chunk itself.
+        {
+            fstream points(StreamName().c_str(), ios::in|ios::out|ios::binary);
+            points.seekp(chunk->chunk_number*CHUNK_SIZE, ios::beg);
+            points.write(reinterpret_cast<const char*>(chunk->data), chunk_size);
+        }
+
+        if (chunk->chunk_number < requested_.size() && requested_[chunk->chunk_number]=='1'){
+            requested_[chunk->chunk_number] = '0';
+            requested_count_--;
+        }
+        last_chunk_time_ = time(0);
+        if (window_time_!=0){
+            window_rtt_ = last_chunk_time_-window_time_;
+            window_time_ = 0;
+        }
 
         string trackname(ssprintf("%s.track", download_pointfile_name_.c_str()));
         const int trackSize = download_pointfile_size_/CHUNK_SIZE+1+4;
+        string buf;
         buf.resize(trackSize);
         fstream track(trackname.c_str(), ios::in|ios::out|ios::binary);
         track.read(&buf[0], trackSize);
         buf[chunk->chunk_number+4] = '1';
-        track.seekp(0, ios::beg);
-        track.write(buf.c_str(), trackSize);
+        // File is done only when the last chunk has been inflated or the delta applied too
+        bool ok = true;
+        if (download_codec_==POINTSFILE_CODEC_ZLIB){
+            ok = Inflate(buf.substr(4));
+        } else if (download_codec_==POINTSFILE_CODEC_DELTA && count(buf.begin()+4, buf.end(), '0')==0){
+            ok = Patch();
+            if (!ok){
+                TRACE_PRINT("info", ("Delta of file #%d doesn't apply, downloading the whole file", download_pointfile_number_));
+                delta_failed_ = download_pointfile_number_;
+                track.close();
+                remove(StreamName().c_str());
+                // Same file without delta, even if server has announced a newer one since
+                const PACKET_POINTSFILE_INFO info = download_info_;
+                InitDownload(info, ChooseCodec(info, info.number-1));
+                return true;
+            }
+        }
+        if (!ok){
+            TRACE_PRINT("info", ("Compressed file #%d is corrupt, downloading it again", download_pointfile_number_));
+            fill(buf.begin()+4, buf.end(), '0');
+            track.seekp(4, ios::beg);
+            track.write(&buf[4], buf.size()-4);
+        } else {
+            track.seekp(chunk->chunk_number+4, ios::beg);
+            track.write(&buf[chunk->chunk_number+4], 1);
+        }
         const int chunks_left = count(buf.begin()+4, buf.end(), '0');
         download_done_ = chunks_left == 0 ? true : false;
         downloaded_chunks_ = buf.size() - 4 - chunks_left;
+        if (download_done_ && download_codec_!=POINTSFILE_CODEC_NONE){
+            remove(StreamName().c_str());
+        }
         return true;
     }
     default:
@@ -208,8 +519,15 @@ AutoPointfileLoad::GetNewFile(string& file)
     }
     if (maxNotDoneNum>maxDoneNum){
         TRACE_PRINT("info", ("Resume downloading file %d", maxNotDoneNum));
-        download_pointfile_number_ = maxNotDoneNum;
         download_pointfile_name_ = fileList[fileNotDoneNum].text();
+        // Compressed download or delta if the .ipt.z or .ipt.delta file is there
+        const int codec = ifstream(ssprintf("%s.z", download_pointfile_name_.c_str()).c_str()) ? POINTSFILE_CODEC_ZLIB
+            : ifstream(ssprintf("%s.delta", download_pointfile_name_.c_str()).c_str()) ? POINTSFILE_CODEC_DELTA : POINTSFILE_CODEC_NONE;
+        if (maxNotDoneNum!=download_pointfile_number_ || codec!=download_codec_){
+            ResetInflate();
+        }
+        download_pointfile_number_ = maxNotDoneNum;
+        download_codec_ = codec;
         download_done_ = false;
         download_last_chunk_ = GetNextChunk();
         // kind of ugly way to get download status. Needed only when resuming download
@@ -2,6 +2,8 @@
 #define Auto_pointfile_Load_h_
 
 #include <string>
+#include <time.h> // time_t
+#include <zlib.h>
 
 #include <utils/CMR.h> 
 #include "DigNetMessages.h"
@@ -19,6 +21,14 @@
     uint32_t                        file_size:  pointfile size in bytes
     char[file_size/CHUNK_SIZE+1]    chunk_info: Basically a byte-sized boolean for every chunk. If a byte is '0' chunk is not downloaded, if '1' it is
     If chunk_info is all '1'-s then file is fully downloaded.
+
+    When the server offers the file compressed (POINTSFILE_CODEC_ZLIB), chunks of the compressed file are saved
+    to the .ipt.z file and file_size in the .track file is the compressed size. Chunks are inflated to the .ipt file
+    as soon as all the chunks before them have arrived. The .ipt.z file exists only while the download is in progress.
+
+    When the previous file has been downloaded and the server offers a delta from it (POINTSFILE_CODEC_DELTA),
+    the delta is downloaded the same way to the .ipt.delta file and applied once complete. If it doesn't apply,
+    the whole file is downloaded instead.
 */
 class AutoPointfileLoad {
     std::string download_pointfile_name_;   ///< File to save pointfile information
@@ -31,21 +41,74 @@ class AutoPointfileLoad {
     int         latest_pointfile_;          ///< Latest finished pointfile
     bool        popped_;                    ///< True if completed file name has already been requested once.
 
+    bool        windowed_;                  ///< Server takes PACKET_POINTSFILE_WINDOW_REQUEST
+    std::string requested_;                 ///< '1' for every chunk asked for with a window request and not received yet
+    int         requested_count_;           ///< Number of '1's in \crequested_
+    int         window_next_;               ///< Next window request starts looking for missing chunks here
+    time_t      last_chunk_time_;           ///< Time a chunk was last received, or chunks were asked for when none were on their way
+    time_t      window_time_;               ///< Time of the window request whose round trip is being measured, 0 if none
+    int         window_rtt_;                ///< Seconds from a window request to its first chunk
+
+    int         download_codec_;            ///< POINTSFILE_CODEC_XXX of the chunks being downloaded
+    z_stream    inflater_;                  ///< Inflates the compressed file, valid if \cinflating_
+    bool        inflating_;                 ///< \cinflater_ is initialized
+    int         inflated_chunks_;           ///< Chunks of the compressed file inflated so far
+    int         delta_failed_;              ///< Number of the file whose delta didn't apply, -1 if none
+    PACKET_POINTSFILE_INFO info_;           ///< Latest pointfile info from server
+    PACKET_POINTSFILE_INFO download_info_;  ///< Pointfile info the current download was started with
+
     
-    /** Initializes pointfile file downloading */
-    void InitDownload(const PACKET_POINTSFILE_INFO& info);
+    /** Initializes pointfile file downloading, \ccodec is the variant of the file to download */
+    void InitDownload(const PACKET_POINTSFILE_INFO& info, const int codec);
 
     /** Returns the number of next chunk to be downloaded */
     std::string::size_type GetNextChunk();
+
+    /** Reads chunk_info of the .track file, '0' for every missing chunk and '1' for every downloaded one */
+    void ReadChunkInfo(std::string& chunks);
+
+    /** Returns the name of the file chunks are saved to, the .ipt.z file for compressed downloads */
+    std::string StreamName() const;
+
+    /** Inflates compressed chunks that have arrived in order since last call. \cchunks is the chunk_info of the
+        .track file. Returns false if the compressed file is corrupt, the inflated file is started over then.
+    */
+    bool Inflate(const std::string& chunks);
+
+    /** Forgets the inflated part of the file */
+    void ResetInflate();
+
+    /** Applies the downloaded delta to the previous file. Returns false if it doesn't apply */
+    bool Patch();
+
+    /** Returns the POINTSFILE_CODEC_XXX to download the file in, \clatest_done is the number of the latest downloaded file */
+    int ChooseCodec(const PACKET_POINTSFILE_INFO& info, const int latest_done) const;
 public:
     AutoPointfileLoad();
 
+    ~AutoPointfileLoad();
+
     /** Fills a pointfile chunk request packet. Returns true if file is missing a chunk, false if file has been completely downloaded */
     bool 
     GetRequest(
         PACKET_POINTSFILE_CHUNK_REQUEST& packet
     );
 
+    /** Returns true if the server streams windows of chunks, use \cGetWindowRequest() instead of \cGetRequest() then */
+    bool
+    IsWindowed() const { return windowed_; }
+
+    /** Fills a window request for missing chunks that haven't been asked for yet. Call until it returns false once
+        per second; at most a few windows are on their way at a time. Chunks that haven't arrived when the stream has
+        stalled for a few round trips are asked for again. Returns false if nothing needs to be sent now, else the
+        packet size in \c size.
+    */
+    bool
+    GetWindowRequest(
+        PACKET_POINTSFILE_WINDOW_REQUEST& packet,
+        int& size
+    );
+
     /** Handles pointfile packets (chunks and information). Takes in raw CMR and decodes it itself */
     bool 
     HandlePacket(
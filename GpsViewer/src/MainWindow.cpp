@@ -56,6 +56,8 @@ using namespace fxutils;
 #define     COUNTDOWN_SERIAL_READER_ERROR_RECONNECT     (5000 / TIMEOUT_SERIAL_POLL)
 /// Time betwen pings sent, ms.
 #define     COUNTDOWN_TCPSEND_PING      (5000 / TIMEOUT_SERIAL_POLL)
+/// Worklog rows are swept fully every 10 minutes of delta mode, in 10s timer ticks.
+#define     COUNTDOWN_WORKMARK_SWEEP    (10*6)
 /// Voltage is sent once per 5 minutes. If no message is recieved for 12 minutes show a warning
 #define     COUNTDOWN_MODEMBOX_VOLTAGE  (12*60)
 
@@ -368,6 +370,10 @@ MainWindow::MainWindow(FXApp *a, const FXString& title, const bool log)
     ,workarea_(FILENAME_WORKAREALOG)
     ,workmark_current_(WORKMARK_EMPTY)
     ,workmark_update_index_(0)
+    ,workmark_timestamp_(0)
+    ,workmark_sweep_timestamp_(0)
+    ,workmark_delta_mode_(false)
+    ,workmark_sweep_countdown_(COUNTDOWN_WORKMARK_SWEEP)
     ,background_index_(0)
     ,map_rotation_angle_(0)
     ,workarea_packets_(0)
@@ -1321,9 +1327,19 @@ MainWindow::dataParse(
                     }
                 } else if (name==DIGNETMESSAGE_WORKAREA) {
                     WorkArea    wa;
-                    if (GetArg(params, wa) && workarea_.SetWorkArea(wa)) {
-                        // yes.
-                        map_area_->update();
+                    if (GetArg(params, wa)) {
+                        const bool changed = !workarea_.Area.IsValid() || workarea_.Area().Change_Time.ToString() != wa.Change_Time.ToString();
+                        if (workarea_.SetWorkArea(wa)) {
+                            // yes.
+                            map_area_->update();
+                            if (changed) {
+                                // New area, start over with the full sweep.
+                                workmark_update_index_ = 0;
+                                workmark_timestamp_ = 0;
+                                workmark_sweep_timestamp_ = 0;
+                                workmark_delta_mode_ = false;
+                            }
+                        }
                     }
                 } else if (name == DIGNETMESSAGE_VOLTAGE) {
                     int ship_id;
@@ -1362,6 +1378,26 @@ MainWindow::dataParse(
                 }
             }
             break;
+        case PACKET_WORKLOG_CHANGED_ROWS::CMRTYPE:
+			if (modembox_disabled_) {
+				TRACE_PRINT("Info", ("Got changed worklog rows, forced to ignore."));
+			} else {
+				TRACE_PRINT("Info", ("Got changed worklog rows"));
+				if (cmr.data.size()>=sizeof(PACKET_WORKLOG_CHANGED_ROWS)) {
+					const PACKET_WORKLOG_CHANGED_ROWS* Packet = reinterpret_cast<PACKET_WORKLOG_CHANGED_ROWS*>(&cmr.data[0]);
+					if (Packet->latest_timestamp > workmark_timestamp_) {
+						// Reply holds every row changed after our timestamp.
+						workmark_timestamp_ = Packet->latest_timestamp;
+					}
+					if (Packet->latest_timestamp>0 && workarea_.HandleChangedRowsPacket(Packet, cmr.data.size())) {
+						map_area_->update();
+						++workarea_packets_;
+						char    xbuf[256];
+						workarea_packets_lbl_->setText(xsprintf(xbuf, sizeof(xbuf), "%d", workarea_packets_));
+					}
+				}
+			}
+            break;
         case PACKET_WORKLOG_ROWS::CMRTYPE:
 			if (modembox_disabled_) {
 				TRACE_PRINT("Info", ("Got worklog rows, forced to ignore."));
@@ -1369,6 +1405,10 @@ MainWindow::dataParse(
 				TRACE_PRINT("Info", ("Got worklog rows"));
 				if (cmr.data.size()>=sizeof(PACKET_WORKLOG_ROWS)) {
 					const PACKET_WORKLOG_ROWS* Packet = reinterpret_cast<PACKET_WORKLOG_ROWS*>(&cmr.data[0]);
+					if (!workmark_delta_mode_ && Packet->latest_timestamp > workmark_sweep_timestamp_) {
+						// Delta queries start from the rows of the sweep.
+						workmark_sweep_timestamp_ = Packet->latest_timestamp;
+					}
 					if (Packet->latest_timestamp>0 && workarea_.HandleRowsPacket(Packet, cmr.data.size())) {
 						map_area_->update();
 						++workarea_packets_;
@@ -1711,6 +1751,9 @@ MainWindow::onSerialPoll(FXObject*,FXSelector,void*)
                 PACKET_BUILD_INFO build;
                 build.build_number = BUILD_NUMBER;
                 WritePacket(&build, sizeof(BUILD_NUMBER), PACKET_BUILD_INFO::CMRTYPE);
+                // Marks set while disconnected were never broadcast to us.
+                workmark_update_index_ = 0;
+                workmark_delta_mode_ = false;
                 break;
             }
         }
@@ -1769,6 +1812,13 @@ MainWindow::onTimer1Hz(FXObject*, FXSelector, void*)
                 e.what());
         }
         SetTitle();
+    } else if (pointfile_downloader_.IsWindowed()) {
+        // Server streams the chunks as fast as the link takes them
+        PACKET_POINTSFILE_WINDOW_REQUEST req;
+        int size;
+        while (pointfile_downloader_.GetWindowRequest(req, size)){
+            WritePacket(&req, size, PACKET_POINTSFILE_WINDOW_REQUEST::CMRTYPE);
+        }
     } else {
         PACKET_POINTSFILE_CHUNK_REQUEST req;
         // Get two chunks in a row
@@ -1784,15 +1834,33 @@ MainWindow::onTimer1Hz(FXObject*, FXSelector, void*)
         timer_10s_=10;
         // Update weather information age
         SetTitle();
-        const unsigned int  nrows = 30;
-        PACKET_WORKLOG_QUERY_BY_INDICES query;
-        query.start_row_index = workmark_update_index_;
-        query.nrows = nrows;
-        WritePacket(&query, sizeof(query), PACKET_WORKLOG_QUERY_BY_INDICES::CMRTYPE);
-
-        workmark_update_index_ += nrows;
-        if (workmark_update_index_ > workarea_.Marks.dim1()) {
+        if (workmark_delta_mode_) {
+            // Only rows changed since the last known timestamp, usually an empty reply.
+            PACKET_WORKLOG_QUERY_BY_TIMESTAMP query;
+            query.timestamp = workmark_timestamp_;
+            WritePacket(&query, sizeof(query), PACKET_WORKLOG_QUERY_BY_TIMESTAMP::CMRTYPE);
+        } else if (workmark_update_index_ > 0 && workmark_update_index_ >= workarea_.Marks.dim1()) {
+            // Full baseline requested a tick ago and its replies are in, switch to delta mode.
+            workmark_update_index_ = 0;
+            workmark_delta_mode_ = true;
+            workmark_sweep_countdown_ = COUNTDOWN_WORKMARK_SWEEP;
+            if (workmark_sweep_timestamp_ > workmark_timestamp_) {
+                workmark_timestamp_ = workmark_sweep_timestamp_;
+            }
+        } else if (workarea_.Marks.dim1() > 0) {
+            const unsigned int  nrows = 30;
+            PACKET_WORKLOG_QUERY_BY_INDICES query;
+            query.start_row_index = workmark_update_index_;
+            query.nrows = nrows;
+            WritePacket(&query, sizeof(query), PACKET_WORKLOG_QUERY_BY_INDICES::CMRTYPE);
+
+            workmark_update_index_ += nrows;
+        }
+        if (workmark_delta_mode_ && --workmark_sweep_countdown_ <= 0) {
+            // Broadcast marks and delta replies may be dropped by a congested server, sweep again.
+            workmark_sweep_countdown_ = COUNTDOWN_WORKMARK_SWEEP;
             workmark_update_index_ = 0;
+            workmark_delta_mode_ = false;
         }
         // See if we know all ships
         for (unsigned int i=0; i<ships_.size(); ++i) {
@@ -270,6 +270,16 @@ private:
     utils::Option<MatrixIndices>    workmark_indices_;
     /** Index into workarea_.MarkSources. */
     unsigned int                    workmark_update_index_;
+    /** Latest worklog timestamp of the replies to our PACKET_WORKLOG_QUERY_BY_TIMESTAMP,
+        seeded from workmark_sweep_timestamp_ when the sweep is done. */
+    uint32_t                        workmark_timestamp_;
+    /** Latest worklog timestamp of the rows received during the full sweep. Rows changed during
+        the sweep are broadcast to us, the next sweep recovers any lost on the way. */
+    uint32_t                        workmark_sweep_timestamp_;
+    /** Full sweep of the rows is done, query only rows changed after workmark_timestamp_. */
+    bool                            workmark_delta_mode_;
+    /** 10s timer ticks of delta mode until the next full sweep, recovers replies lost on the way. */
+    int                             workmark_sweep_countdown_;
     FXSwitcher*                     button_worklogmode_switcher_;
     WORKLOGMODE                     worklogmode_;
     double                          map_rotation_angle_;
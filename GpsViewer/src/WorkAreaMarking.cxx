@@ -287,6 +287,47 @@ WorkAreaMarking::SetWorkArea(
     return ok;
 }
 
+//=====================================================================================//
+bool
+WorkAreaMarking::SetMarks_(
+    const unsigned int          start_row,
+    const unsigned int          start_col,
+    const unsigned int          nmarks,
+    const uint8_t*              marks
+)
+{
+    const unsigned int  BITS_IN_MARK = 2;
+    const unsigned int  nrows = Marks.dim1();
+    const unsigned int  ncols = Marks.dim2();
+    bool                any_updates = false;
+    if (nrows>0 && ncols>0 && start_col<ncols) {
+        unsigned int        row_index = start_row;
+        unsigned int        col_index = start_col;
+        unsigned int        total_bit_index = 0;
+        for (unsigned int i=0; i<nmarks && row_index<nrows; ++i) {
+            const unsigned int  byte_index = total_bit_index / 8;
+            const unsigned int  bit_shift = (8 - BITS_IN_MARK) - (total_bit_index & 0x07);
+            const unsigned int  b = marks[byte_index];
+            const WORKMARK      wm = static_cast<WORKMARK>((b >> bit_shift) & ((1<<BITS_IN_MARK)-1));
+
+            if (Marks[row_index][col_index] != wm) {
+                Marks[row_index][col_index] = wm;
+                any_updates = true;
+            }
+            if (row_index < MarkSources.size()) {
+                MarkSources[row_index] = SOURCE_SERVER;
+            }
+
+            total_bit_index += BITS_IN_MARK;
+            if (++col_index >= ncols) {
+                col_index = 0;
+                ++row_index;
+            }
+        }
+    }
+    return any_updates;
+}
+
 //=====================================================================================//
 bool
 WorkAreaMarking::HandleRowsPacket(
@@ -294,35 +335,14 @@ WorkAreaMarking::HandleRowsPacket(
     const unsigned int          PacketSize
 )
 {
-    const unsigned int    BITS_IN_MARK = 2;
-    const unsigned int  nrows = Marks.dim1();
+    const unsigned int  BITS_IN_MARK = 2;
     const unsigned int  ncols = Marks.dim2();
     bool                any_updates = false;
-    if (nrows>0 && ncols>0) {
+    if (ncols>0) {
+        // Full rows only.
         const unsigned int  nbytes = PacketSize - sizeof(PACKET_WORKLOG_ROWS) + 1;
         const unsigned int  newrows = nbytes * 8 / BITS_IN_MARK / ncols;
-        unsigned int        total_bit_index = 0;
-        for (unsigned int i=0; i<newrows; ++i) {
-            const unsigned int  row_index = Packet->start_row + i;
-            if (row_index < nrows) {
-                for (unsigned int col_index=0; col_index<ncols; ++col_index) {
-                    const unsigned int    byte_index = total_bit_index / 8;
-                    const unsigned int    bit_shift = (8 - BITS_IN_MARK) - (total_bit_index & 0x07);
-                    const unsigned int    b = Packet->marks[byte_index];
-                    const WORKMARK      wm = static_cast<WORKMARK>((b >> bit_shift) & ((1<<BITS_IN_MARK)-1));
-
-                    if (Marks[row_index][col_index] != wm) {
-                        Marks[row_index][col_index] = wm;
-                        any_updates = true;
-                    }
-
-                    total_bit_index += BITS_IN_MARK;
-                }
-                if (row_index < MarkSources.size()) {
-                    MarkSources[row_index] = SOURCE_SERVER;
-                }
-            }
-       }
+        any_updates = SetMarks_(Packet->start_row, 0, newrows * ncols, Packet->marks);
     }
     if (any_updates) {
         Store_();
@@ -330,6 +350,23 @@ WorkAreaMarking::HandleRowsPacket(
     return any_updates;
 }
 
+//=====================================================================================//
+bool
+WorkAreaMarking::HandleChangedRowsPacket(
+    const PACKET_WORKLOG_CHANGED_ROWS*  Packet,
+    const unsigned int                  PacketSize
+)
+{
+    const unsigned int  BITS_IN_MARK = 2;
+    const unsigned int  nbytes = PacketSize - sizeof(PACKET_WORKLOG_CHANGED_ROWS) + 1;
+    const unsigned int  nmarks = mymin<unsigned int>(Packet->nmarks, nbytes * 8 / BITS_IN_MARK);
+    const bool          any_updates = SetMarks_(Packet->start_row, Packet->start_col, nmarks, Packet->marks);
+    if (any_updates) {
+        Store_();
+    }
+    return any_updates;
+}
+
 //=====================================================================================//
 void
 WorkAreaMarking::Store_()
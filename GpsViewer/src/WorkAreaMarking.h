@@ -56,7 +56,7 @@ public:
     TNT::Array2D<WORKMARK>  Marks;
 
     /** Mark sources. Default is \c SOURCE_LOCAL.
-    This field is updated by \c HandleRowsPacket.
+    This field is updated by \c HandleRowsPacket and \c HandleChangedRowsPacket.
     */
     std::vector<SOURCE>     MarkSources;
 
@@ -87,6 +87,15 @@ public:
         const unsigned int          PacketSize
     );
 
+    /** Handle changed rows sent by the server, possibly parts of rows.
+    Returns true if any of the marks changed.
+    */
+    bool
+    HandleChangedRowsPacket(
+        const PACKET_WORKLOG_CHANGED_ROWS*  Packet,
+        const unsigned int                  PacketSize
+    );
+
     /** Get row/column indices for the given point (geodetic coordinate system). */
     bool
     GetIndices(
@@ -108,6 +117,17 @@ private:
     void
     Store_();
 
+    /** Set \c nmarks marks from the packed \c marks, starting from the given row and column
+    and continuing row by row. Marks outside the grid are ignored. Returns true if any of the marks changed.
+    */
+    bool
+    SetMarks_(
+        const unsigned int          start_row,
+        const unsigned int          start_col,
+        const unsigned int          nmarks,
+        const uint8_t*              marks
+    );
+
     /** Unit vector on the axis direction. Valid only if Area is valid.
     */
     double                              vector_dx_;
@@ -2,10 +2,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#if defined(__AVR__)
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
 #include <avr/sleep.h>
+#endif
 #include "sysdefs.h"
 #include "cmrpcktctrl.h"
 
@@ -14,7 +14,7 @@ enum {
 	CMR_TYPE_DIGNET				= 0xbc07,
 };
 
-enum {
+typedef enum {
 
 	CMRDECODE_OK,
 	CMRDECODE_ERROR,
@@ -0,0 +1,114 @@
+#include <math.h>                   // cos, sin
+
+#include <utils/util.h>             // ssprintf and friends.
+#include <utils/Transformations.h>  // gps_of_local.
+#include <utils/NMEA.h>
+#include <utils/math.h>             // deg2rad
+#include <DigNetMessages.h>
+
+#include "ModemBoxProtocol.h"
+
+using namespace utils;
+
+// Speed from knots to m/s
+static const double KN2MS = 1.0/1.852;
+
+const long  MODEMBOX_GPS_SEND_PERIOD = 10*1000;
+const long  MODEMBOX_GPS_MAX_AGE = 3 * 1000;
+const long  MODEMBOX_SUPPLY_SEND_PERIOD = 5 * 60 * 1000;
+
+/*--------------------------------------------------------------------*/
+std::string
+modembox_identification(
+    const std::string&  imei,
+    const std::string&  firmware_version,
+    const std::string&  firmware_date,
+    const std::string&  build_info
+)
+{
+    std::string msg;
+    msg += "client name=ModemBox";
+    msg += " Firmware_Version=" + firmware_version;
+    msg += " Firmware_Date=\"" + firmware_date + "\"";
+    msg += " IMEI=" + imei;
+    msg += " BuildInfo=" + build_info;
+    return msg;
+}
+
+/*--------------------------------------------------------------------*/
+std::string
+gpsviewer_identification(
+    const int           build_number,
+    const std::string&  build_date
+)
+{
+    return ssprintf("client name=ModemBox IMEI=12345 Firmware_Version=%d Firmware_Date=\"%s\"", build_number, build_date.c_str());
+}
+
+/*--------------------------------------------------------------------*/
+std::string
+startupinfo_query()
+{
+    std::string query(DIGNETMESSAGE_QUERY);
+    query.append(std::string(" ") + DIGNETMESSAGE_STARTUPINFO);
+    return query;
+}
+
+/*--------------------------------------------------------------------*/
+CMR
+modembox_supply_voltage(
+    const std::string&  voltage
+)
+{
+    return CMR(CMR::DIGNET, ssprintf("modembox supplyvoltage=%s", voltage.c_str()));
+}
+
+/*--------------------------------------------------------------------*/
+std::string
+modembox_gga_line(
+    const double        x,
+    const double        y,
+    const my_time&      time
+)
+{
+    GPGGA           gpgga;
+    gpgga.computer_time = time;
+    gpgga.gps_time = time;
+    gps_of_local(x, y, 0.0, gpgga.latitude, gpgga.longitude, gpgga.altitude);
+    gpgga.north = true;
+    gpgga.east = true;
+    gpgga.quality = GPSQUALITY_DIFFERENTIAL;
+    gpgga.nr_of_satellites = 10;
+    gpgga.pdop = 5.0;
+    return string_of_gga(gpgga, true, 8);
+}
+
+/*--------------------------------------------------------------------*/
+CMR
+modembox_serial_packet(
+    const unsigned int  gps_index,
+    const std::string&  line
+)
+{
+    std::vector<unsigned char>  data_block;
+    data_block.push_back(gps_index);
+    for (unsigned int i=0; i<line.size(); ++i) {
+        data_block.push_back(line[i]);
+    }
+    return CMR(CMR::SERIAL, data_block);
+}
+
+/*--------------------------------------------------------------------*/
+void
+modembox_move(
+    double&             x,
+    double&             y,
+    const double        speed,
+    const double        heading,
+    const double        dt
+)
+{
+    const double    distance = KN2MS * speed * dt;
+    x = x + distance*cos(deg2rad(heading));
+    y = y + distance*sin(deg2rad(heading));
+}
@@ -0,0 +1,78 @@
+#ifndef ModemBoxProtocol_h_
+#define ModemBoxProtocol_h_
+
+#include <string>
+#include <utils/util.h>     // my_time
+#include <utils/CMR.h>
+
+/** \file What the ModemBox sends to GpsServer, without the GUI.
+
+Shared by ModemBoxSimulator and the headless load generator GpsServerLoad.
+*/
+
+/// GPS coordinate sending period, milliseconds.
+extern const long   MODEMBOX_GPS_SEND_PERIOD;
+/// GPS lines older than this are not sent, milliseconds.
+extern const long   MODEMBOX_GPS_MAX_AGE;
+/// Supply voltage sending period, milliseconds.
+extern const long   MODEMBOX_SUPPLY_SEND_PERIOD;
+
+/*--------------------------------------------------------------------*/
+/** Identification of a ModemBox, the first DigNet message after connecting. */
+std::string
+modembox_identification(
+    const std::string&  imei,
+    const std::string&  firmware_version,
+    const std::string&  firmware_date,
+    const std::string&  build_info
+);
+
+/*--------------------------------------------------------------------*/
+/** Identification of a plain GpsViewer: ModemBox with IMEI 12345. */
+std::string
+gpsviewer_identification(
+    const int           build_number,
+    const std::string&  build_date
+);
+
+/*--------------------------------------------------------------------*/
+/** Query for the startup information, sent by GpsViewer after identification. */
+std::string
+startupinfo_query();
+
+/*--------------------------------------------------------------------*/
+/** Supply voltage report, DigNet message. */
+utils::CMR
+modembox_supply_voltage(
+    const std::string&  voltage
+);
+
+/*--------------------------------------------------------------------*/
+/** GPGGA line, without CR LF, of a GPS at local coordinates \c x, \c y. */
+std::string
+modembox_gga_line(
+    const double            x,
+    const double            y,
+    const utils::my_time&   time
+);
+
+/*--------------------------------------------------------------------*/
+/** SERIAL packet carrying GPS data: GPS index followed by \c line as is. */
+utils::CMR
+modembox_serial_packet(
+    const unsigned int  gps_index,
+    const std::string&  line
+);
+
+/*--------------------------------------------------------------------*/
+/** Move point \c x, \c y for \c dt seconds at \c speed knots, \c heading degrees. */
+void
+modembox_move(
+    double&             x,
+    double&             y,
+    const double        speed,
+    const double        heading,
+    const double        dt
+);
+
+#endif /* ModemBoxProtocol_h_ */
@@ -11,6 +11,7 @@
 
 #include "globals.h"
 #include "ModemBoxSimulator.h"
+#include "ModemBoxProtocol.h"
 #include "Joystick.h"
 
 static const char*  CONFIG_FILENAME = "ModemBoxSimulator.ini";
@@ -20,9 +21,6 @@ using namespace fxutils;
 
 // 1 distance slider unit = 10cm.
 static const double SLIDER2METERS   = 0.1;
-
-// Speed from knots to m/s
-static const double KN2MS = 1.0/1.852;
 /* ------------------------------------------------------------- */
 enum {
 	TIMEOUT_POLL_100HZ = 10,
@@ -93,10 +91,12 @@ init_packets(   std::map<int, PacketInfo>& packets)
     add_packet(packets, false,  PACKET_WORKLOG_SETMARK::CMRTYPE,            "Worklog set mark");
     add_packet(packets, false,  PACKET_WORKLOG_QUERY_BY_INDICES::CMRTYPE,   "Worklog query by indices");
     add_packet(packets, false,  PACKET_WORKLOG_QUERY_BY_TIMESTAMP::CMRTYPE, "Worklog query by timestamp");
+    add_packet(packets, false,  PACKET_WORKLOG_CHANGED_ROWS::CMRTYPE,       "Worklog changed rows");
     add_packet(packets, false,  PACKET_SHIP_INFO::CMRTYPE,                  "Ship info");
     add_packet(packets, false,  PACKET_BUILD_INFO::CMRTYPE,                 "Build info");
     add_packet(packets, false,  PACKET_POINTSFILE_INFO::CMRTYPE,            "Pointfile info");
     add_packet(packets, false,  PACKET_POINTSFILE_CHUNK_REQUEST::CMRTYPE,   "Pointfile chunk request");
+    add_packet(packets, false,  PACKET_POINTSFILE_WINDOW_REQUEST::CMRTYPE,  "Pointfile window request");
     add_packet(packets, false,  PACKET_POINTSFILE_CHUNK::CMRTYPE,           "Pointfile chunk");
     add_packet(packets, false,  PACKET_WEATHER_INFORMATION::CMRTYPE,        "Weather information");
 }
@@ -662,12 +662,11 @@ ModemBoxSimulator::onTimerPoll10HZ(FXObject*, FXSelector, void*)
                     // Connected.
                     statsServer_->tfStatus->setText("Connected.");
                     received_ping_time = System::currentTimeMillis();
-                    std::string msg;
-                        msg += "client name=ModemBox";
-                        msg += " Firmware_Version=" + string_of_fx(tfFirmwareVersion_);
-                        msg += " Firmware_Date=\"" + string_of_fx(tfFirmwareDate_) + "\"";
-                        msg += " IMEI=" + string_of_fx(tfIMEI_);
-                        msg += " BuildInfo=" + string_of_fx(tfFirmwareBuildInfo_);
+                    const std::string msg(modembox_identification(
+                        string_of_fx(tfIMEI_),
+                        string_of_fx(tfFirmwareVersion_),
+                        string_of_fx(tfFirmwareDate_),
+                        string_of_fx(tfFirmwareBuildInfo_)));
                     CMR AuthPacket(CMR::DIGNET, msg);
                     WriteServer(AuthPacket);
                     ModemBox_ProcessConnect();
@@ -737,16 +736,12 @@ move_ship(
     const double    dt)
 {
     try {
-        const double    distance = KN2MS * slSpeed->getValue() * dt;
-        const double    heading = deg2rad(diHeading->getValue());
         double          x1 = double_of_textfield(gps1_x);
         double          y1 = double_of_textfield(gps1_y);
         double          x2 = double_of_textfield(gps2_x);
         double          y2 = double_of_textfield(gps2_y);
-        x1 = x1 + distance*cos(heading);
-        y1 = y1 + distance*sin(heading);
-        x2 = x2 + distance*cos(heading);
-        y2 = y2 + distance*sin(heading);
+        modembox_move(x1, y1, slSpeed->getValue(), diHeading->getValue(), dt);
+        modembox_move(x2, y2, slSpeed->getValue(), diHeading->getValue(), dt);
         fxprintf(gps1_x, "%4.2f", x1);
         fxprintf(gps1_y, "%4.2f", y1);
         fxprintf(gps2_x, "%4.2f", x2);
@@ -781,34 +776,16 @@ ModemBoxSimulator::onTimerPollGps(FXObject*, FXSelector, void*)
         try {
             const double    x = double_of_textfield(tfGps_[gpsIndex].first);
             const double    y = double_of_textfield(tfGps_[gpsIndex].second);
-            GPGGA           gpgga;
-
-            // gpgga.
-            gpgga.computer_time = gpsTime;
-            gpgga.gps_time = gpsTime;
-            gps_of_local(x, y, 0.0, gpgga.latitude, gpgga.longitude, gpgga.altitude);
-            gpgga.north = true;
-            gpgga.east = true;
-            gpgga.quality = GPSQUALITY_DIFFERENTIAL;
-            gpgga.nr_of_satellites = 10;
-            gpgga.pdop = 5.0;
 
             // gpgga_line.
-            std::string gpgga_line(string_of_gga(gpgga, true, 8));
+            std::string gpgga_line(modembox_gga_line(x, y, gpsTime));
             if (cbLogGpsSerial_->getCheck() != FALSE) {
                 lprintf("GPS", "%d : %s", gpsIndex, gpgga_line.c_str());
             }
             gpgga_line += "\r\n";
 
-            // CMR data block and output buffer.
-            std::vector<unsigned char>  data_block;
-            data_block.push_back(gpsIndex);
-            for (unsigned int i=0; i<gpgga_line.size(); ++i) {
-                data_block.push_back(gpgga_line[i]);
-            }
-
             // Send to bluetooth.
-            CMR Packet(CMR::SERIAL, data_block);
+            CMR Packet(modembox_serial_packet(gpsIndex, gpgga_line));
             WriteBluetooth(Packet);
 
             // Send to imaginary serial input.
@@ -1153,12 +1130,6 @@ ModemBoxSimulator::WriteServer(
 }
 
     // ---------------- ModemBox functions 1:1 ------------------------
-/// GPS coordinate sending period, milliseconds.
-static long GPS_SEND_PERIOD = 10*1000;
-/// GPS coordinate max. age, milliseconds
-long GPS_MAX_AGE = 3 * 1000;
-/// Supply voltage sending period, milliseconds.
-long SUPPLY_SEND_PERIOD = 5 * 60 * 1000;
 
 /*--------------------------------------------------------------------*/
 /** Send supply voltage to the clients.
@@ -1168,7 +1139,7 @@ ModemBoxSimulator::SendSupplyVoltage()
 {
     const std::string s_voltage = string_of_fxstring(tfSupplyVoltage_->getText());
 
-    CMR packet(CMR::DIGNET, ssprintf("modembox supplyvoltage=%s", s_voltage.c_str()));
+    CMR packet(modembox_supply_voltage(s_voltage));
 
     SupplyVoltageTime = System::currentTimeMillis();
 
@@ -1200,7 +1171,7 @@ ModemBoxSimulator::ModemBox_ProcessIdle()
 {
     long now = System::currentTimeMillis();
 
-    if (SupplyVoltageTime < 0 || SupplyVoltageTime + SUPPLY_SEND_PERIOD < now)
+    if (SupplyVoltageTime < 0 || SupplyVoltageTime + MODEMBOX_SUPPLY_SEND_PERIOD < now)
     {
         SendSupplyVoltage();
     }
@@ -1275,21 +1246,16 @@ ModemBoxSimulator::ModemBox_ProcessSerial(
     }
 
     // Check if we need to send data.
-    if (GpsPositionTime < 0 || GpsPositionTime + GPS_SEND_PERIOD < now)
+    if (GpsPositionTime < 0 || GpsPositionTime + MODEMBOX_GPS_SEND_PERIOD < now)
     {
         GpsPositionTime = now;
         for (int gpsIndex = 0; gpsIndex<2; ++gpsIndex)
         {
             GpsLine& gline = GpsLines[gpsIndex];
-            if (gline.Line.size()>0 && gline.LineTime + GPS_MAX_AGE >= now)
+            if (gline.Line.size()>0 && gline.LineTime + MODEMBOX_GPS_MAX_AGE >= now)
             {
                 if (IsServerConnected()) {
-                    std::vector<unsigned char>  data_block;
-                    data_block.push_back(gpsIndex);
-                    for (unsigned int i=0; i<gline.Line.size(); ++i) {
-                        data_block.push_back(gline.Line[i]);
-                    }
-                    CMR gps_packet(CMR::SERIAL, data_block);
+                    CMR gps_packet(modembox_serial_packet(gpsIndex, gline.Line));
                     WriteServer(gps_packet);
                 }
             }
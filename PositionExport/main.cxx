@@ -0,0 +1,211 @@
+// vim: shiftwidth=4
+// vim: ts=4
+/**
+Exports ship positions stored by GpsServer ([PositionStore] section of GpsServer.ini) as CSV,
+or as SQL inserts into the ShipPosition table for the tools that still read it.
+
+    PositionExport -s 3 -from "2010-05-01 08:00" -to "2010-05-01 12:00" positions
+    PositionExport -sql -from 2010-05-01 positions | mysql DigNet
+
+Rows are ordered by day, ship and time.
+*/
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>        // std::sort
+
+#include <stdio.h>          // printf
+#include <stdlib.h>         // atoi
+#include <string.h>         // strcmp, memset
+#include <time.h>           // mktime, localtime_r
+#include <dirent.h>         // opendir
+
+#include "PositionStore.h"
+
+using namespace std;
+
+/*****************************************************************************/
+static int
+print_usage()
+{
+    printf("Usage:\n");
+    printf("\tPositionExport [options] directory\n");
+    printf("where options are:\n");
+    printf("\t-s ship\t\tExport only this ship ID, default all ships.\n");
+    printf("\t-from time\tExport positions at or after this local time, YYYY-MM-DD [HH:MM[:SS]].\n");
+    printf("\t-to time\tExport positions before this local time, YYYY-MM-DD [HH:MM[:SS]].\n");
+    printf("\t-csv\t\tComma-separated values with a header line, default.\n");
+    printf("\t-sql\t\tINSERT statements for the ShipPosition table.\n");
+    printf("directory is the Directory of [PositionStore] section of GpsServer.ini.\n");
+    return 1;
+}
+
+/*****************************************************************************/
+/** Parses local time "YYYY-MM-DD [HH:MM[:SS]]". Returns false on errors. */
+static bool
+parse_time(
+    const char*     s,
+    time_t&         t)
+{
+    struct tm   tm;
+    memset(&tm, 0, sizeof(tm));
+    const int   n = sscanf(s, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n != 3 && n != 5 && n != 6) {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    t = mktime(&tm);
+    return t != static_cast<time_t>(-1);
+}
+
+/*****************************************************************************/
+/** Returns UTC date of \c t as YYYY-MM-DD, the name of the day directory. */
+static string
+utc_day(
+    const time_t    t)
+{
+    struct tm   tm;
+    char        buffer[16];
+    gmtime_r(&t, &tm);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d", &tm);
+    return buffer;
+}
+
+/*****************************************************************************/
+/** Returns sorted names of the entries of \c directory ending in \c suffix. */
+static vector<string>
+list_directory(
+    const string&   directory,
+    const string&   suffix)
+{
+    vector<string>  r;
+    DIR*            dir = opendir(directory.c_str());
+    if (dir == 0) {
+        return r;
+    }
+    for (struct dirent* e = readdir(dir); e != 0; e = readdir(dir)) {
+        const string    name(e->d_name);
+        if (name[0] != '.' && name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            r.push_back(name);
+        }
+    }
+    closedir(dir);
+    sort(r.begin(), r.end());
+    return r;
+}
+
+/*****************************************************************************/
+/** Prints an optional column, NULL or empty if not valid. */
+static void
+print_optional(
+    const bool      valid,
+    const char*     format,
+    const double    value,
+    const bool      sql)
+{
+    printf(",");
+    if (valid) {
+        printf(format, value);
+    } else if (sql) {
+        printf("NULL");
+    }
+}
+
+/*****************************************************************************/
+int
+main(
+    int     argc,
+    char**  argv)
+{
+    string  directory;
+    int     ship_id = 0;
+    time_t  from = 0;
+    time_t  to = 0;
+    bool    sql = false;
+
+    for (int i=1; i<argc; ++i) {
+        const char* arg = argv[i];
+        if (arg[0] != '-') {
+            directory = arg;
+        } else if (strcmp(arg, "-csv") == 0) {
+            sql = false;
+        } else if (strcmp(arg, "-sql") == 0) {
+            sql = true;
+        } else if (i+1 < argc && strcmp(arg, "-s") == 0) {
+            ship_id = atoi(argv[++i]);
+        } else if (i+1 < argc && strcmp(arg, "-from") == 0) {
+            if (!parse_time(argv[++i], from)) {
+                return print_usage();
+            }
+        } else if (i+1 < argc && strcmp(arg, "-to") == 0) {
+            if (!parse_time(argv[++i], to)) {
+                return print_usage();
+            }
+        } else {
+            return print_usage();
+        }
+    }
+    if (directory == "") {
+        return print_usage();
+    }
+
+    // Day directories are named by UTC date, so names sort by time.
+    const string    first_day = from == 0 ? string() : utc_day(from);
+    const string    last_day = to == 0 ? string() : utc_day(to);
+    char            ship_file[32] = "";
+    if (ship_id != 0) {
+        snprintf(ship_file, sizeof(ship_file), "%d.pos", ship_id);
+    }
+
+    if (!sql) {
+        printf("Create_Time,ShipId,type,x,y,z,GpsStatus,heading,speed\n");
+    }
+    unsigned int    rows = 0;
+    const vector<string> days = list_directory(directory, "");
+    for (unsigned int d=0; d<days.size(); ++d) {
+        const string&   day = days[d];
+        if (day.size() != 10 || (first_day != "" && day < first_day) || (last_day != "" && day > last_day)) {
+            continue;
+        }
+        const vector<string> files = list_directory(directory + "/" + day, ".pos");
+        for (unsigned int f=0; f<files.size(); ++f) {
+            if (ship_id != 0 && files[f] != ship_file) {
+                continue;
+            }
+            try {
+                PositionSegmentReader   reader(directory + "/" + day + "/" + files[f]);
+                for (unsigned int i = from == 0 ? 0 : reader.find(from); i<reader.size(); ++i) {
+                    SHIP_POSITION_ROW   row;
+                    const double        t = reader.get(i, row);
+                    if (to != 0 && t >= to) {
+                        break;
+                    }
+                    if (sql) {
+                        printf("INSERT INTO ShipPosition (Create_Time, ShipId, type, x, y, z, GpsStatus, heading, speed) VALUES (FROM_UNIXTIME(%.3f),%d,'%c',%.2f,%.2f",
+                            t, row.ship_id, row.type, row.x, row.y);
+                    } else {
+                        struct tm       tm;
+                        const time_t    seconds = static_cast<time_t>(t);
+                        localtime_r(&seconds, &tm);
+                        printf("%04d-%02d-%02d %02d:%02d:%02d.%03d,%d,%c,%.2f,%.2f",
+                            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                            static_cast<int>((t - seconds) * 1000 + 0.5) % 1000, row.ship_id, row.type, row.x, row.y);
+                    }
+                    print_optional(row.has_z, "%.3f", row.z, sql);
+                    print_optional(row.has_gps_status, "%.0f", row.gps_status, sql);
+                    print_optional(row.has_heading, "%.2f", row.heading, sql);
+                    print_optional(row.has_speed, "%.2f", row.speed, sql);
+                    printf(sql ? ");\n" : "\n");
+                    ++rows;
+                }
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Skipping: %s\n", e.what());
+            }
+        }
+    }
+    fprintf(stderr, "%d positions exported\n", rows);
+    return 0;
+}
@@ -4,6 +4,10 @@ vim:	shiftwidth=4
 */
 
 #include <assert.h> // programmer's best friend.
+#include <string.h> // memchr, memcpy
+#if defined(__SSE2__) && !defined(CMR_BYTEWISE)
+#include <emmintrin.h>  // _mm_sad_epu8
+#endif
 #include "cmr.h"
 
 /****************************************************************************/
@@ -43,9 +47,11 @@ cmr_decode( CMR_RXPACKET*   Packet,
         case CMR_STX:
             Packet->CmrBuffer[0] = c;
             Packet->CmrLength = 1;
+            Packet->Checksum_ = 0;
             return CMRDECODE_OK;
         // Skip it.
         default:
+            Packet->CmrLength = 0;
             return CMRDECODE_ERROR;
         }
     } else {
@@ -59,7 +65,7 @@ cmr_decode( CMR_RXPACKET*   Packet,
         if (cmr_length<5) {
             // Header.
             Packet->Checksum_ += c;
-        } else if (length+7==cmr_length) {
+        } else if (length+5==cmr_length) {
             // Just received the checksum... really?
             if (Packet->Checksum_ != c) {
                 cmr_rxpacket_init(Packet, Packet->CmrBuffer);
@@ -202,3 +208,144 @@ cmr_encode_once(
     }
     return 0;
 }
+
+/****************************************************************************/
+uint8_t
+cmr_checksum(
+    const uint8_t*      data,
+    const unsigned int  size
+    )
+{
+    unsigned int    i = 0;
+    uint32_t        sum = 0;
+#if defined(CMR_BYTEWISE)
+    // pass
+#elif defined(__SSE2__)
+    {
+        // Sum of absolute differences against zero adds 8 bytes into each 64-bit half.
+        const __m128i   zero = _mm_setzero_si128();
+        __m128i         acc = zero;
+        for (; i + 16 <= size; i += 16) {
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(data + i)), zero));
+        }
+        sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+    }
+#else
+    // 8 bytes at a time, summed into four 16-bit lanes. Lanes are folded before they can overflow.
+    while (i + 8 <= size) {
+        uint64_t        acc = 0;
+        unsigned int    n;
+        for (n = 0; n < 128 && i + 8 <= size; ++n, i += 8) {
+            uint64_t    w;
+            memcpy(&w, data + i, sizeof(w));
+            acc += (w & 0x00FF00FF00FF00FFULL) + ((w >> 8) & 0x00FF00FF00FF00FFULL);
+        }
+        sum += (uint32_t)(acc & 0xFFFF) + (uint32_t)((acc >> 16) & 0xFFFF) + (uint32_t)((acc >> 32) & 0xFFFF) + (uint32_t)(acc >> 48);
+    }
+#endif
+    for (; i < size; ++i) {
+        sum += data[i];
+    }
+    return (uint8_t)sum;
+}
+
+/****************************************************************************/
+CMRDECODE
+cmr_decode_next(
+    CMR_RXPACKET*       Packet,
+    const uint8_t*      data,
+    const unsigned int  size,
+    unsigned int*       used,
+    const uint8_t**     data_block
+    )
+{
+    unsigned int    i = 0;
+
+    // Finish the packet started in the previous block.
+    while (i < size && Packet->CmrLength != 0 && !Packet->IsComplete_) {
+        if (cmr_decode(Packet, data[i++]) == CMRDECODE_COMPLETE) {
+            *used = i;
+            *data_block = Packet->DataBlock;
+            return CMRDECODE_COMPLETE;
+        }
+    }
+
+#if !defined(CMR_BYTEWISE)
+    // Whole packets in the block are checked and returned in place.
+    while (i < size) {
+        const uint8_t   c = data[i];
+        if (c == CMR_NULL) {
+            cmr_decode(Packet, c);
+            *used = i + 1;
+            *data_block = Packet->DataBlock;
+            return CMRDECODE_COMPLETE;
+        } else if (c == CMR_STX) {
+            unsigned int    length;
+            unsigned int    total;
+            if (size - i < 4) {
+                break;
+            }
+            length = data[i + 3];
+            total = length + 6;
+            if (size - i < total) {
+                break;
+            }
+            if (length <= CMR_MAX_DATABLOCK_LENGTH
+                    && data[i + total - 1] == CMR_ETX
+                    && cmr_checksum(&data[i + 1], length + 3) == data[i + length + 4]) {
+                Packet->Type = (((uint16_t)data[i + 1]) << 8) | data[i + 2];
+                Packet->Length = length;
+                Packet->CmrLength = total;
+                Packet->IsComplete_ = 1; // true
+                *used = i + total;
+                *data_block = &data[i + 4];
+                return CMRDECODE_COMPLETE;
+            }
+            // Broken, look for the next packet right after this STX.
+            ++i;
+        } else {
+            // Garbage, skip to the next STX or NULL.
+            const uint8_t*  stx = (const uint8_t*)memchr(&data[i], CMR_STX, size - i);
+            const unsigned int end = stx == 0 ? size : (unsigned int)(stx - data);
+            const uint8_t*  null = (const uint8_t*)memchr(&data[i], CMR_NULL, end - i);
+            i = null == 0 ? end : (unsigned int)(null - data);
+        }
+    }
+#endif
+
+    // Packet continuing in the next block.
+    while (i < size) {
+        if (cmr_decode(Packet, data[i++]) == CMRDECODE_COMPLETE) {
+            *used = i;
+            *data_block = Packet->DataBlock;
+            return CMRDECODE_COMPLETE;
+        }
+    }
+    *used = size;
+    *data_block = 0;
+    return CMRDECODE_OK;
+}
+
+/****************************************************************************/
+unsigned int
+cmr_decode_block(
+    CMR_RXPACKET*       Packet,
+    const uint8_t*      data,
+    const unsigned int  size,
+    CMR_PACKET_CALLBACK callback,
+    void*               context
+    )
+{
+    unsigned int    npackets = 0;
+    unsigned int    pos = 0;
+    while (pos < size) {
+        unsigned int    used;
+        const uint8_t*  data_block;
+        if (cmr_decode_next(Packet, &data[pos], size - pos, &used, &data_block) == CMRDECODE_COMPLETE) {
+            callback(context, Packet->Type, data_block, Packet->Length);
+            ++npackets;
+        }
+        pos += used;
+    }
+    return npackets;
+}
@@ -124,6 +124,64 @@ CMRDECODE
 cmr_decode( CMR_RXPACKET*   rxbuffer,
             const uint8_t   c);
 
+/*--------------------------------------------------------------------------*/
+/** 8-bit additive checksum of CMR type, length and data block.
+Computed 16 bytes at a time with SSE2, 8 bytes at a time otherwise; byte at a time
+if \c CMR_BYTEWISE is defined.
+*/
+uint8_t
+cmr_checksum(
+    const uint8_t*      data,
+    const unsigned int  size
+    );
+
+/*--------------------------------------------------------------------------*/
+/** Decode the CMR data stream up to the next complete packet.
+
+Packets lying entirely in \c data are found with \c memchr, verified and returned in
+place, without copying. Packets split between blocks are decoded by \c cmr_decode, byte
+at a time, and returned in \c Packet->DataBlock. With \c CMR_BYTEWISE defined, for small
+targets, everything goes through \c cmr_decode.
+
+\param      Packet      Receive buffer, initialized by \c cmr_rxpacket_init.
+\param[in]  data        Next block of the data stream.
+\param[in]  size        Length of \c data.
+\param[out] used        Number of bytes consumed, \c size unless a packet was completed.
+\param[out] data_block  Data block of the completed packet, valid until \c data is released or next call.
+\return CMRDECODE_COMPLETE iff packet complete, fields Type and Length of \c Packet are valid.
+        CMRDECODE_OK if \c data was used up.
+*/
+CMRDECODE
+cmr_decode_next(
+    CMR_RXPACKET*       Packet,
+    const uint8_t*      data,
+    const unsigned int  size,
+    unsigned int*       used,
+    const uint8_t**     data_block
+    );
+
+/// Receives packets from \c cmr_decode_block.
+typedef void (*CMR_PACKET_CALLBACK)(
+    void*               context,
+    const uint16_t      type,
+    const uint8_t*      data_block,
+    const uint8_t       length
+    );
+
+/*--------------------------------------------------------------------------*/
+/** Decode a block of the CMR data stream, calling \c callback for every complete packet.
+See \c cmr_decode_next.
+\return Number of packets decoded.
+*/
+unsigned int
+cmr_decode_block(
+    CMR_RXPACKET*       Packet,
+    const uint8_t*      data,
+    const unsigned int  size,
+    CMR_PACKET_CALLBACK callback,
+    void*               context
+    );
+
 /*--------------------------------------------------------------------------*/
 /** Initialize transmit packet.
 \param      Packet      Transmit packet.